@@ -1,39 +1,107 @@
 /**
  * @file main.c
- * @brief ESP32 Modbus Water Meter Reader (Zephyr)
- * @version 1.0
+ * @brief ESP32 Modbus Bus Soak & Benchmark Tool (Zephyr)
+ * @version 2.0
  * @date 2025-11-23
  * @author AMR ALI
  *
  * @details
- * This program reads data from an ultrasonic water meter using Modbus RTU
- * on ESP32 with Zephyr RTOS. The UART is switched between console mode and
- * Modbus mode to send a read command and receive meter measurements.
+ * Qualifies Modbus RTU cabling and BOVE meters before deployment. Polls one
+ * or more slaves back-to-back at the highest rate the bus allows, for hours,
+ * and keeps per-slave RTT histograms and error counts. A compact summary is
+ * printed periodically and when the soak ends.
  *
  * Main Features:
- * - Build and send Modbus read command (0x03)
+ * - Back-to-back Read Holding Registers (0x03) round-robin over SLAVE_IDS
+ * - End of frame on expected length or Modbus t3.5 silence, not fixed waits
+ * - RTT histogram per slave (min/avg/p50/p95/p99/max)
+ * - Error classes: timeout, incomplete, CRC, header, exception, line errors
  * - CRC16 Modbus calculation
- * - UART switching (Console <-> Modbus)
- * - Read flow, totals, pressure, temperature, and status
- * - Basic error handling (CRC, timeout, incomplete frame)
+ * - UART switching (Console <-> Modbus) only around summaries
  *
  * UART Settings for Modbus:
  *   2400 baud, 8E1, no flow control
  *
+ * The console shares the UART, so nothing is printed while the bus is in
+ * Modbus mode; output would go onto the bus at 2400 baud. Summaries pause
+ * polling for the few milliseconds it takes to print them.
+ *
+ * RTT is measured from the last request byte handed to the UART to the last
+ * response byte received, so it includes both frames' wire time (about
+ * 410 ms for a full 38-register read at 2400 baud).
  */
 
 #include <zephyr/kernel.h>
 #include <zephyr/device.h>
 #include <zephyr/drivers/uart.h>
 #include <zephyr/sys/printk.h>
+#include <zephyr/sys/util.h>
 
 #define UART_DEVICE_NODE DT_NODELABEL(uart0)
 
-static const struct device *uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
+/* ============================================================================
+ * CONFIGURATION
+ * ============================================================================ */
+
+/* Slaves polled round-robin */
+static const uint8_t SLAVE_IDS[] = { 1 };
+
+/* Soak length; 0 runs until reset */
+#define SOAK_DURATION_MIN 0
+#define SUMMARY_INTERVAL_SEC 60
+#define HISTOGRAM_EVERY_SUMMARIES 10    /* Full histogram every 10 summaries */
+
+/* Timing (2400 baud, 11 bits per character) */
+#define CHAR_TIME_US 4584
+#define FRAME_GAP_US (4 * CHAR_TIME_US)    /* t3.5, rounded up */
+#define RESPONSE_TIMEOUT_MS 1000            /* First byte must arrive by then */
+
+/* Request: 38 registers starting at register 1 */
+#define REGISTER_COUNT 38
+#define RESPONSE_LEN (3 + REGISTER_COUNT * 2 + 2)
+#define EXCEPTION_LEN 5
+
+/* RTT histogram: 10 ms buckets up to 1.5 s, last bucket is overflow */
+#define RTT_BUCKET_MS 10
+#define RTT_BUCKETS 150
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
 
+enum poll_result {
+    POLL_OK,
+    POLL_TIMEOUT,       /* Nothing received */
+    POLL_INCOMPLETE,    /* Frame shorter than expected */
+    POLL_CRC,
+    POLL_HEADER,        /* Wrong slave ID, function code or byte count */
+    POLL_EXCEPTION,     /* Valid Modbus exception response */
+    POLL_RESULT_COUNT,
+};
 
-struct uart_config original_cfg;
+static const char *const result_names[POLL_RESULT_COUNT] = {
+    "ok", "timeout", "short", "crc", "header", "exception",
+};
 
+struct slave_stats {
+    uint32_t results[POLL_RESULT_COUNT];
+    uint32_t line_errors;           /* Parity/framing/overrun from the UART */
+    uint32_t window_polls;          /* Since the last summary */
+    uint32_t window_errors;
+    uint32_t rtt_min_us;
+    uint32_t rtt_max_us;
+    uint64_t rtt_sum_us;
+    uint32_t rtt_hist[RTT_BUCKETS + 1];
+    bool identified;
+};
+
+static const struct device *uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
+static struct uart_config original_cfg;
+static struct slave_stats stats[ARRAY_SIZE(SLAVE_IDS)];
+
+/* ============================================================================
+ * MODBUS FUNCTIONS
+ * ============================================================================ */
 
 uint16_t modbus_crc16(const uint8_t *data, uint16_t length)
 {
@@ -55,8 +123,8 @@ void build_read_cmd(uint8_t *buf, uint8_t id)
     buf[2] = 0x00;
     buf[3] = 0x01;
     buf[4] = 0x00;
-    buf[5] = 0x26;
-    
+    buf[5] = REGISTER_COUNT;
+
     uint16_t crc = modbus_crc16(buf, 6);
     buf[6] = crc & 0xFF;
     buf[7] = (crc >> 8) & 0xFF;
@@ -87,150 +155,298 @@ void switch_to_modbus(void)
 void switch_to_console(void)
 {
     uart_configure(uart_dev, &original_cfg);
-    k_msleep(10); 
+    k_msleep(10);
 }
 
-int main(void)
+static uint32_t elapsed_us(uint32_t since_cycles)
+{
+    return k_cyc_to_us_floor32(k_cycle_get_32() - since_cycles);
+}
+
+/**
+ * @brief Discard bytes until the line has been quiet for t3.5
+ *
+ * Keeps a late or runaway reply from being parsed as the next response.
+ */
+static void drain_bus(void)
+{
+    uint32_t quiet_since = k_cycle_get_32();
+    uint8_t c;
+
+    while (elapsed_us(quiet_since) < FRAME_GAP_US) {
+        if (uart_poll_in(uart_dev, &c) == 0) {
+            quiet_since = k_cycle_get_32();
+        }
+    }
+}
+
+/**
+ * @brief One read transaction; the UART must already be in Modbus mode
+ *
+ * @param rtt_us Set to the round-trip time when anything was received
+ */
+static enum poll_result poll_slave(uint8_t id, uint8_t *frame, uint32_t *rtt_us)
 {
     uint8_t tx_buf[8];
-    uint8_t rx_buf[256];
-    
+    int rx_len = 0;
+
+    build_read_cmd(tx_buf, id);
+    for (int i = 0; i < 8; i++) {
+        uart_poll_out(uart_dev, tx_buf[i]);
+    }
+
+    /* Poll without sleeping: a tick would be longer than t3.5 */
+    uint32_t sent_at = k_cycle_get_32();
+    uint32_t last_byte = sent_at;
+
+    while (rx_len < RESPONSE_LEN) {
+        uint8_t c;
+
+        if (uart_poll_in(uart_dev, &c) == 0) {
+            frame[rx_len++] = c;
+            last_byte = k_cycle_get_32();
+
+            /* Exception responses are short; stop as soon as one is complete */
+            if (rx_len == EXCEPTION_LEN && (frame[1] & 0x80)) {
+                break;
+            }
+            continue;
+        }
+
+        if (rx_len == 0) {
+            if (elapsed_us(sent_at) > RESPONSE_TIMEOUT_MS * 1000U) {
+                return POLL_TIMEOUT;
+            }
+        } else if (elapsed_us(last_byte) > FRAME_GAP_US) {
+            break;
+        }
+    }
+
+    *rtt_us = k_cyc_to_us_floor32(last_byte - sent_at);
+
+    if (rx_len < EXCEPTION_LEN) {
+        return POLL_INCOMPLETE;
+    }
+
+    uint16_t recv_crc = frame[rx_len - 2] | (frame[rx_len - 1] << 8);
+    if (recv_crc != modbus_crc16(frame, rx_len - 2)) {
+        return (rx_len < RESPONSE_LEN && !(frame[1] & 0x80)) ? POLL_INCOMPLETE : POLL_CRC;
+    }
+    if (frame[0] != id) {
+        return POLL_HEADER;
+    }
+    if (frame[1] == (0x03 | 0x80)) {
+        return POLL_EXCEPTION;
+    }
+    if (frame[1] != 0x03 || frame[2] != REGISTER_COUNT * 2 || rx_len != RESPONSE_LEN) {
+        return POLL_HEADER;
+    }
+    return POLL_OK;
+}
+
+/* ============================================================================
+ * STATISTICS
+ * ============================================================================ */
+
+static void record(struct slave_stats *s, enum poll_result res, uint32_t rtt_us, int line_err)
+{
+    s->results[res]++;
+    s->window_polls++;
+    if (res != POLL_OK) {
+        s->window_errors++;
+    }
+    if (line_err) {
+        s->line_errors++;
+    }
+    if (res == POLL_TIMEOUT) {
+        return;
+    }
+
+    uint32_t bucket = MIN(rtt_us / (RTT_BUCKET_MS * 1000U), RTT_BUCKETS);
+
+    s->rtt_hist[bucket]++;
+    s->rtt_min_us = MIN(s->rtt_min_us, rtt_us);
+    s->rtt_max_us = MAX(s->rtt_max_us, rtt_us);
+    s->rtt_sum_us += rtt_us;
+}
+
+static uint32_t rtt_samples(const struct slave_stats *s)
+{
+    return s->results[POLL_OK] + s->results[POLL_INCOMPLETE] + s->results[POLL_CRC] +
+           s->results[POLL_HEADER] + s->results[POLL_EXCEPTION];
+}
+
+/**
+ * @brief RTT in ms below which @p permille of the samples fall (bucket edge,
+ *        or the maximum when it falls past the last bucket)
+ */
+static uint32_t rtt_percentile_ms(const struct slave_stats *s, uint32_t permille)
+{
+    uint32_t n = rtt_samples(s);
+    uint64_t target = ((uint64_t)n * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i <= RTT_BUCKETS; i++) {
+        seen += s->rtt_hist[i];
+        if (seen >= target && seen > 0) {
+            /* The overflow bucket has no upper edge; the maximum bounds it */
+            if (i == RTT_BUCKETS) {
+                return s->rtt_max_us / 1000U;
+            }
+            return MIN((i + 1) * RTT_BUCKET_MS, s->rtt_max_us / 1000U);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Decode the identity registers once per slave, for the log
+ */
+static void print_identity(uint8_t id, const uint8_t *frame)
+{
+    const uint8_t *d = &frame[3];
+    uint32_t serial = ((uint32_t)d[64] << 24) | ((uint32_t)d[65] << 16) |
+                      ((uint32_t)d[66] << 8) | d[67];
+    uint32_t forward_raw = read_u32(d, 12);
+
+    printk("  slave %u: serial %08X, modbus id %u, forward %u.%03u m3\n",
+           id, serial, d[69], forward_raw / 1000, forward_raw % 1000);
+}
+
+static void print_summary(uint32_t elapsed_s, uint32_t total_polls, bool with_histogram)
+{
+    printk("[%02u:%02u:%02u] %u polls, %u.%01u polls/s\n",
+           elapsed_s / 3600, (elapsed_s / 60) % 60, elapsed_s % 60, total_polls,
+           elapsed_s ? total_polls / elapsed_s : 0,
+           elapsed_s ? (total_polls * 10U / elapsed_s) % 10 : 0);
+
+    for (size_t i = 0; i < ARRAY_SIZE(SLAVE_IDS); i++) {
+        struct slave_stats *s = &stats[i];
+        uint32_t polls = 0;
+
+        for (int r = 0; r < POLL_RESULT_COUNT; r++) {
+            polls += s->results[r];
+        }
+        uint32_t ok_bp = polls ? (uint32_t)((uint64_t)s->results[POLL_OK] * 10000U / polls) : 0;
+
+        printk("  id %u: %u/%u ok %u.%02u%% | win %u err/%u |",
+               SLAVE_IDS[i], s->results[POLL_OK], polls, ok_bp / 100, ok_bp % 100,
+               s->window_errors, s->window_polls);
+        for (int r = POLL_TIMEOUT; r < POLL_RESULT_COUNT; r++) {
+            printk(" %s %u", result_names[r], s->results[r]);
+        }
+        printk(" line %u\n", s->line_errors);
+
+        uint32_t n = rtt_samples(s);
+        if (n > 0) {
+            printk("        rtt ms min %u avg %u p50 %u p95 %u p99 %u max %u\n",
+                   s->rtt_min_us / 1000U, (uint32_t)(s->rtt_sum_us / n / 1000U),
+                   rtt_percentile_ms(s, 500), rtt_percentile_ms(s, 950),
+                   rtt_percentile_ms(s, 990), s->rtt_max_us / 1000U);
+        }
+
+        if (with_histogram && n > 0) {
+            /* Non-empty buckets only, as <upper edge ms>:<count> */
+            printk("        hist");
+            for (uint32_t b = 0; b <= RTT_BUCKETS; b++) {
+                if (s->rtt_hist[b] == 0) {
+                    continue;
+                }
+                if (b == RTT_BUCKETS) {
+                    printk(" inf:%u", s->rtt_hist[b]);
+                } else {
+                    printk(" %u:%u", (b + 1) * RTT_BUCKET_MS, s->rtt_hist[b]);
+                }
+            }
+            printk("\n");
+        }
+
+        s->window_polls = 0;
+        s->window_errors = 0;
+    }
+}
+
+/* ============================================================================
+ * MAIN APPLICATION
+ * ============================================================================ */
+
+int main(void)
+{
+    uint8_t frame[RESPONSE_LEN];
+
     printk("\n\n");
     printk("========================================\n");
-    printk("    BOVE METER MODBUS READER\n");
+    printk("    BOVE MODBUS BUS SOAK TEST\n");
     printk("========================================\n");
-    
+
     if (!device_is_ready(uart_dev)) {
         printk("ERROR: UART not ready!\n");
         return -1;
     }
-    
+
     uart_config_get(uart_dev, &original_cfg);
     printk("Console: %d baud\n", original_cfg.baudrate);
-    printk("Starting Modbus polling...\n\n");
-    
+    printk("Slaves: %u, summary every %u s, duration %s\n",
+           (unsigned int)ARRAY_SIZE(SLAVE_IDS), SUMMARY_INTERVAL_SEC,
+           SOAK_DURATION_MIN ? STRINGIFY(SOAK_DURATION_MIN) " min" : "unlimited");
+    printk("Starting back-to-back polling...\n\n");
+
+    for (size_t i = 0; i < ARRAY_SIZE(stats); i++) {
+        stats[i].rtt_min_us = UINT32_MAX;
+    }
+
     k_msleep(2000);
-    
-    int request_num = 0;
-    
-    while (1) {
-        request_num++;
-        
-        switch_to_modbus();
-        
-        build_read_cmd(tx_buf, 1);
-        
-        for (int i = 0; i < 8; i++) {
-            uart_poll_out(uart_dev, tx_buf[i]);
-        }
-        
-        k_msleep(100);
-        
-        int rx_len = 0;
-        uint32_t start = k_uptime_get_32();
-        uint32_t last_byte = start;
-        
-        while ((k_uptime_get_32() - start) < 2000) {
-            uint8_t c;
-            if (uart_poll_in(uart_dev, &c) == 0) {
-                rx_buf[rx_len++] = c;
-                last_byte = k_uptime_get_32();
-                if (rx_len >= sizeof(rx_buf)) break;
-            }
-            
-            if (rx_len > 3 && (k_uptime_get_32() - last_byte) > 150) {
-                break;
+
+    int64_t soak_start = k_uptime_get();
+    int64_t next_summary = soak_start + SUMMARY_INTERVAL_SEC * 1000LL;
+    uint32_t total_polls = 0;
+    uint32_t summaries = 0;
+    bool finished = false;
+
+    switch_to_modbus();
+    drain_bus();
+
+    while (!finished) {
+        for (size_t i = 0; i < ARRAY_SIZE(SLAVE_IDS); i++) {
+            uint32_t rtt_us = 0;
+            enum poll_result res = poll_slave(SLAVE_IDS[i], frame, &rtt_us);
+            int line_err = uart_err_check(uart_dev);
+
+            record(&stats[i], res, rtt_us, line_err > 0);
+            total_polls++;
+
+            if (res == POLL_OK && !stats[i].identified) {
+                stats[i].identified = true;
+                switch_to_console();
+                print_identity(SLAVE_IDS[i], frame);
+                switch_to_modbus();
             }
-            
-            k_msleep(5);
+
+            /* Inter-frame silence before the next request */
+            drain_bus();
         }
-        
-        switch_to_console();
-        
-        printk("[%d] Request #%d - ", (int)k_uptime_get(), request_num);
-        
-        if (rx_len > 70) {
-            uint16_t recv_crc = rx_buf[rx_len-2] | (rx_buf[rx_len-1] << 8);
-            uint16_t calc_crc = modbus_crc16(rx_buf, rx_len - 2);
-            
-            if (recv_crc == calc_crc && rx_buf[0] == 1 && rx_buf[1] == 0x03) {
-                const uint8_t *d = &rx_buf[3];
-                
-                /* Register 1-2: Instantaneous Flow (x100) */
-                uint32_t flow_raw = read_u32(d, 0);
-                uint32_t flow_int = flow_raw / 100;
-                uint32_t flow_dec = flow_raw % 100;
-                
-                /* Register 7-8: Forward Total (x1000) */
-                uint32_t forward_raw = read_u32(d, 12);
-                uint32_t forward_int = forward_raw / 1000;
-                uint32_t forward_dec = forward_raw % 1000;
-                
-                /* Register 10-11: Reverse Total (x1000) */
-                uint32_t reverse_raw = read_u32(d, 18);
-                uint32_t reverse_int = reverse_raw / 1000;
-                uint32_t reverse_dec = reverse_raw % 1000;
-                
-                /* Register 19: Pressure (x1000) */
-                uint16_t pressure_raw = (d[36] << 8) | d[37];
-                uint32_t pressure_int = pressure_raw / 1000;
-                uint32_t pressure_dec = pressure_raw % 1000;
-                
-                /* Register 20: Status */
-                uint16_t status = (d[38] << 8) | d[39];
-                
-                /* Register 30: Temperature (x100) */
-                uint16_t temp_raw = (d[58] << 8) | d[59];
-                uint32_t temp_int = temp_raw / 100;
-                uint32_t temp_dec = temp_raw % 100;
-                
-                /* Register 33-34: Serial Number (BCD) */
-                uint32_t serial = ((uint32_t)d[64] << 24) | ((uint32_t)d[65] << 16) | 
-                                  ((uint32_t)d[66] << 8) | d[67];
-                
-                /* Register 35: Modbus ID */
-                uint8_t modbus_id = d[69];
-                
-                /* Register 37: Baud Rate Code */
-                uint16_t baud_code = (d[72] << 8) | d[73];
-                
-                printk("OK\n");
-                printk("========================================\n");
-                printk("  Flow Rate   : %u.%02u L/h\n", flow_int, flow_dec);
-                printk("  Forward Flow: %u.%03u m3\n", forward_int, forward_dec);
-                printk("  Reverse Flow: %u.%03u m3\n", reverse_int, reverse_dec);
-                printk("  Pressure    : %u.%03u MPa\n", pressure_int, pressure_dec);
-                printk("  Temperature : %u.%02u C\n", temp_int, temp_dec);
-                printk("  Status      : 0x%04X ", status);
-                if (status == 0) {
-                    printk("(Normal)\n");
-                } else {
-                    if (status & 0x0004) printk("(Empty!) ");
-                    if (status & 0x0020) printk("(Low Batt!) ");
-                    printk("\n");
-                }
-                printk("  Serial No   : %08X\n", serial);
-                printk("  Modbus ID   : %u\n", modbus_id);
-                printk("  Baud Code   : %u ", baud_code);
-                switch(baud_code) {
-                    case 0: printk("(9600)\n"); break;
-                    case 1: printk("(2400)\n"); break;
-                    case 2: printk("(4800)\n"); break;
-                    case 3: printk("(1200)\n"); break;
-                    default: printk("(Unknown)\n");
-                }
-                printk("========================================\n\n");
-            } else {
-                printk("CRC Error\n\n");
-            }
-        } else if (rx_len > 0) {
-            printk("Incomplete (%d bytes)\n\n", rx_len);
-        } else {
-            printk("No response\n\n");
+
+        int64_t now = k_uptime_get();
+
+        if (SOAK_DURATION_MIN > 0 &&
+            now - soak_start >= SOAK_DURATION_MIN * 60 * 1000LL) {
+            finished = true;
+        }
+
+        if (now >= next_summary || finished) {
+            summaries++;
+            next_summary += SUMMARY_INTERVAL_SEC * 1000LL;
+
+            switch_to_console();
+            print_summary((uint32_t)((now - soak_start) / 1000), total_polls,
+                          finished || (summaries % HISTOGRAM_EVERY_SUMMARIES) == 0);
+            switch_to_modbus();
+            drain_bus();
         }
-        
-        k_msleep(3000);
     }
-    
+
+    switch_to_console();
+    printk("Soak test finished\n");
+
     return 0;
 }
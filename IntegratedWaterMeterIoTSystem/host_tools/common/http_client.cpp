@@ -0,0 +1,55 @@
+/**
+ * @file http_client.cpp
+ * @brief Minimal blocking HTTP/1.1 POST client
+ */
+
+#include "http_client.hpp"
+
+#include <cstdio>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace wm::http {
+
+bool post(const endpoint &server, const std::string &path, const std::string &content_type,
+          const std::string &body, int timeout_ms, response &out)
+{
+    int fd = tcp_connect(server, timeout_ms);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string request = "POST " + path + " HTTP/1.1\r\n"
+                          "Host: " + server.host + "\r\n"
+                          "Content-Type: " + content_type + "\r\n"
+                          "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                          "Connection: close\r\n\r\n";
+    std::string reply;
+    char buf[1024];
+    ssize_t n;
+
+    if (!send_all(fd, request.data(), request.size()) ||
+        !send_all(fd, body.data(), body.size())) {
+        close(fd);
+        return false;
+    }
+    while ((n = recv(fd, buf, sizeof(buf), 0)) > 0) {
+        reply.append(buf, static_cast<size_t>(n));
+    }
+    close(fd);
+
+    int major, minor;
+
+    if (std::sscanf(reply.c_str(), "HTTP/%d.%d %d", &major, &minor, &out.status) != 3) {
+        return false;
+    }
+
+    size_t head_end = reply.find("\r\n\r\n");
+
+    out.body = (head_end == std::string::npos) ? std::string() : reply.substr(head_end + 4);
+    return true;
+}
+
+} // namespace wm::http
@@ -0,0 +1,36 @@
+/**
+ * @file http_client.hpp
+ * @brief Minimal blocking HTTP/1.1 POST client
+ *
+ * @details
+ * One request per connection ("Connection: close"), no TLS, no chunked
+ * request bodies. Enough for the ThingsBoard device HTTP API on a local
+ * network or behind a TLS-terminating proxy.
+ */
+
+#ifndef WM_HTTP_CLIENT_HPP_
+#define WM_HTTP_CLIENT_HPP_
+
+#include <string>
+
+#include "net.hpp"
+
+namespace wm::http {
+
+struct response {
+    int status = 0;
+    std::string body;
+};
+
+/**
+ * @brief POST @p body to @p path
+ *
+ * @return true if a response was received (any status), false on a network
+ *         error or a malformed status line
+ */
+bool post(const endpoint &server, const std::string &path, const std::string &content_type,
+          const std::string &body, int timeout_ms, response &out);
+
+} // namespace wm::http
+
+#endif /* WM_HTTP_CLIENT_HPP_ */
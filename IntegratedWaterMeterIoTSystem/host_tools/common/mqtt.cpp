@@ -0,0 +1,432 @@
+/**
+ * @file mqtt.cpp
+ * @brief Minimal MQTT 3.1.1 packet codec and blocking client
+ */
+
+#include "mqtt.hpp"
+
+#include <poll.h>
+#include <unistd.h>
+
+namespace wm::mqtt {
+
+/* ============================================================================
+ * FIELD HELPERS
+ * ============================================================================ */
+
+static void put_u16(std::vector<uint8_t> &out, uint16_t v)
+{
+    out.push_back(static_cast<uint8_t>(v >> 8));
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+static void put_string(std::vector<uint8_t> &out, const std::string &s)
+{
+    put_u16(out, static_cast<uint16_t>(s.size()));
+    out.insert(out.end(), s.begin(), s.end());
+}
+
+/* Cursor over a packet body; every get fails once the body runs out */
+struct reader {
+    const std::vector<uint8_t> &buf;
+    size_t pos = 0;
+
+    bool get_u8(uint8_t &v)
+    {
+        if (pos + 1 > buf.size()) {
+            return false;
+        }
+        v = buf[pos++];
+        return true;
+    }
+
+    bool get_u16(uint16_t &v)
+    {
+        if (pos + 2 > buf.size()) {
+            return false;
+        }
+        v = static_cast<uint16_t>((buf[pos] << 8) | buf[pos + 1]);
+        pos += 2;
+        return true;
+    }
+
+    bool get_string(std::string &s)
+    {
+        uint16_t len;
+
+        if (!get_u16(len) || pos + len > buf.size()) {
+            return false;
+        }
+        s.assign(reinterpret_cast<const char *>(&buf[pos]), len);
+        pos += len;
+        return true;
+    }
+
+    size_t remaining() const { return buf.size() - pos; }
+};
+
+/** @brief Fixed header in front of a body */
+static std::vector<uint8_t> frame(uint8_t header, const std::vector<uint8_t> &body)
+{
+    std::vector<uint8_t> out;
+    size_t len = body.size();
+
+    out.reserve(body.size() + 5);
+    out.push_back(header);
+    do {
+        uint8_t b = len & 0x7F;
+
+        len >>= 7;
+        out.push_back(len > 0 ? (b | 0x80) : b);
+    } while (len > 0);
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+}
+
+/* ============================================================================
+ * PACKET CODEC
+ * ============================================================================ */
+
+bool read_packet(int fd, packet &out)
+{
+    uint8_t b;
+    size_t len = 0;
+
+    if (!recv_all(fd, &out.header, 1)) {
+        return false;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (!recv_all(fd, &b, 1)) {
+            return false;
+        }
+        len |= static_cast<size_t>(b & 0x7F) << (7 * i);
+        if ((b & 0x80) == 0) {
+            break;
+        }
+        if (i == 3) {
+            return false;
+        }
+    }
+    if (len > MAX_PACKET_BODY) {
+        return false;
+    }
+    out.body.resize(len);
+    return len == 0 || recv_all(fd, out.body.data(), len);
+}
+
+bool write_packet(int fd, const std::vector<uint8_t> &frame_bytes)
+{
+    return send_all(fd, frame_bytes.data(), frame_bytes.size());
+}
+
+std::vector<uint8_t> encode_connect(const connect_msg &msg)
+{
+    std::vector<uint8_t> body;
+    uint8_t flags = msg.clean_session ? 0x02 : 0x00;
+
+    if (!msg.username.empty()) {
+        flags |= 0x80;
+    }
+    if (!msg.password.empty()) {
+        flags |= 0x40;
+    }
+
+    put_string(body, "MQTT");
+    body.push_back(4);   /* Protocol level 3.1.1 */
+    body.push_back(flags);
+    put_u16(body, msg.keepalive_sec);
+    put_string(body, msg.client_id);
+    if (!msg.username.empty()) {
+        put_string(body, msg.username);
+    }
+    if (!msg.password.empty()) {
+        put_string(body, msg.password);
+    }
+    return frame(CONNECT << 4, body);
+}
+
+std::vector<uint8_t> encode_connack(uint8_t return_code)
+{
+    return frame(CONNACK << 4, {0x00, return_code});
+}
+
+std::vector<uint8_t> encode_publish(const std::string &topic, const uint8_t *payload,
+                                    size_t len, uint8_t qos, uint16_t packet_id,
+                                    bool retain)
+{
+    std::vector<uint8_t> body;
+    uint8_t header = static_cast<uint8_t>((PUBLISH << 4) | (qos << 1) | (retain ? 1 : 0));
+
+    body.reserve(topic.size() + len + 4);
+    put_string(body, topic);
+    if (qos > 0) {
+        put_u16(body, packet_id);
+    }
+    body.insert(body.end(), payload, payload + len);
+    return frame(header, body);
+}
+
+std::vector<uint8_t> encode_puback(uint16_t packet_id)
+{
+    std::vector<uint8_t> body;
+
+    put_u16(body, packet_id);
+    return frame(PUBACK << 4, body);
+}
+
+std::vector<uint8_t> encode_subscribe(uint16_t packet_id, const std::string &filter,
+                                      uint8_t qos)
+{
+    std::vector<uint8_t> body;
+
+    put_u16(body, packet_id);
+    put_string(body, filter);
+    body.push_back(qos);
+    return frame((SUBSCRIBE << 4) | 0x02, body);
+}
+
+std::vector<uint8_t> encode_suback(uint16_t packet_id, const std::vector<uint8_t> &codes)
+{
+    std::vector<uint8_t> body;
+
+    put_u16(body, packet_id);
+    body.insert(body.end(), codes.begin(), codes.end());
+    return frame(SUBACK << 4, body);
+}
+
+std::vector<uint8_t> encode_empty(packet_type type)
+{
+    return frame(static_cast<uint8_t>(type << 4), {});
+}
+
+bool parse_connect(const packet &pkt, connect_msg &out)
+{
+    reader r{pkt.body};
+    std::string protocol;
+    uint8_t level, flags;
+
+    if (pkt.type() != CONNECT || !r.get_string(protocol) || protocol != "MQTT" ||
+        !r.get_u8(level) || level != 4 || !r.get_u8(flags) ||
+        !r.get_u16(out.keepalive_sec) || !r.get_string(out.client_id)) {
+        return false;
+    }
+    out.clean_session = (flags & 0x02) != 0;
+
+    if (flags & 0x04) {
+        /* Will topic and message: accepted, never delivered */
+        std::string will;
+
+        if (!r.get_string(will) || !r.get_string(will)) {
+            return false;
+        }
+    }
+    if ((flags & 0x80) && !r.get_string(out.username)) {
+        return false;
+    }
+    if ((flags & 0x40) && !r.get_string(out.password)) {
+        return false;
+    }
+    return true;
+}
+
+bool parse_publish(const packet &pkt, publish_msg &out)
+{
+    reader r{pkt.body};
+
+    out.qos = (pkt.flags() >> 1) & 0x03;
+    out.retain = (pkt.flags() & 0x01) != 0;
+    out.packet_id = 0;
+    if (pkt.type() != PUBLISH || out.qos > 1 || !r.get_string(out.topic)) {
+        return false;
+    }
+    if (out.qos > 0 && !r.get_u16(out.packet_id)) {
+        return false;
+    }
+    out.payload.assign(pkt.body.begin() + static_cast<long>(r.pos), pkt.body.end());
+    return true;
+}
+
+bool parse_subscribe(const packet &pkt, uint16_t &packet_id,
+                     std::vector<std::pair<std::string, uint8_t>> &filters)
+{
+    reader r{pkt.body};
+
+    filters.clear();
+    if (pkt.type() != SUBSCRIBE || !r.get_u16(packet_id)) {
+        return false;
+    }
+    while (r.remaining() > 0) {
+        std::string filter;
+        uint8_t qos;
+
+        if (!r.get_string(filter) || !r.get_u8(qos)) {
+            return false;
+        }
+        filters.emplace_back(filter, qos);
+    }
+    return !filters.empty();
+}
+
+bool parse_packet_id(const packet &pkt, uint16_t &packet_id)
+{
+    reader r{pkt.body};
+
+    return r.get_u16(packet_id);
+}
+
+bool topic_matches(const std::string &filter, const std::string &topic)
+{
+    size_t f = 0, t = 0;
+
+    while (f < filter.size()) {
+        if (filter[f] == '#') {
+            return true;
+        }
+
+        size_t f_end = filter.find('/', f);
+        size_t t_end = topic.find('/', t);
+
+        if (f_end == std::string::npos) {
+            f_end = filter.size();
+        }
+        if (t > topic.size()) {
+            return false;
+        }
+        if (t_end == std::string::npos) {
+            t_end = topic.size();
+        }
+        if (filter.compare(f, f_end - f, "+") != 0 &&
+            filter.compare(f, f_end - f, topic, t, t_end - t) != 0) {
+            return false;
+        }
+        f = f_end + 1;
+        t = t_end + 1;
+    }
+    return t > topic.size();
+}
+
+/* ============================================================================
+ * CLIENT
+ * ============================================================================ */
+
+client::~client()
+{
+    disconnect();
+}
+
+uint16_t client::next_packet_id()
+{
+    uint16_t id = next_id_++;
+
+    if (next_id_ == 0) {
+        next_id_ = 1;
+    }
+    return id;
+}
+
+int client::connect(const endpoint &broker, const connect_msg &msg, int timeout_ms)
+{
+    packet ack;
+
+    disconnect();
+    fd_ = tcp_connect(broker, timeout_ms);
+    if (fd_ < 0) {
+        return -1;
+    }
+    keepalive_sec_ = msg.keepalive_sec;
+
+    if (!write_packet(fd_, encode_connect(msg)) || !read_packet(fd_, ack) ||
+        ack.type() != CONNACK || ack.body.size() != 2) {
+        disconnect();
+        return -1;
+    }
+    if (ack.body[1] != 0) {
+        disconnect();
+        return ack.body[1];
+    }
+    return 0;
+}
+
+bool client::subscribe(const std::string &filter, uint8_t qos)
+{
+    uint16_t id = next_packet_id();
+    packet pkt;
+    uint16_t ack_id;
+
+    if (fd_ < 0 || !write_packet(fd_, encode_subscribe(id, filter, qos))) {
+        return false;
+    }
+    /* Anything arriving ahead of the SUBACK (retained messages) is skipped */
+    while (read_packet(fd_, pkt)) {
+        if (pkt.type() == SUBACK && parse_packet_id(pkt, ack_id) && ack_id == id) {
+            return pkt.body.size() >= 3 && pkt.body[2] != 0x80;
+        }
+    }
+    disconnect();
+    return false;
+}
+
+bool client::publish(const std::string &topic, const uint8_t *payload, size_t len,
+                     uint8_t qos)
+{
+    if (fd_ < 0) {
+        return false;
+    }
+    if (!write_packet(fd_, encode_publish(topic, payload, len, qos,
+                                          qos > 0 ? next_packet_id() : 0))) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void client::run(const message_handler &on_message, const std::atomic<bool> &keep_running)
+{
+    int ping_ms = (keepalive_sec_ > 0) ? keepalive_sec_ * 500 : 30000;
+    int64_t last_tx = now_ms();
+    packet pkt;
+    publish_msg msg;
+
+    while (fd_ >= 0 && keep_running) {
+        pollfd pfd{fd_, POLLIN, 0};
+        int rc = poll(&pfd, 1, 500);
+
+        if (now_ms() - last_tx >= ping_ms) {
+            if (!write_packet(fd_, encode_empty(PINGREQ))) {
+                break;
+            }
+            last_tx = now_ms();
+        }
+        if (rc <= 0) {
+            continue;
+        }
+        if (!read_packet(fd_, pkt)) {
+            break;
+        }
+        if (pkt.type() != PUBLISH) {
+            continue;   /* PINGRESP, PUBACK for our own publishes */
+        }
+        if (!parse_publish(pkt, msg)) {
+            break;
+        }
+        on_message(msg);
+        if (msg.qos == 1) {
+            if (!write_packet(fd_, encode_puback(msg.packet_id))) {
+                break;
+            }
+            last_tx = now_ms();
+        }
+    }
+    disconnect();
+}
+
+void client::disconnect()
+{
+    if (fd_ >= 0) {
+        write_packet(fd_, encode_empty(DISCONNECT));
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+} // namespace wm::mqtt
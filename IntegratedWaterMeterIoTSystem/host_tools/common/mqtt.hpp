@@ -0,0 +1,145 @@
+/**
+ * @file mqtt.hpp
+ * @brief Minimal MQTT 3.1.1 packet codec and blocking client
+ *
+ * @details
+ * Covers what the host tools need from a broker: CONNECT with a username
+ * (ThingsBoard takes the access token there), SUBSCRIBE, QoS 0/1 PUBLISH in
+ * both directions with PUBACK, and keep-alive pings. No QoS 2, no will, no
+ * session resumption.
+ */
+
+#ifndef WM_MQTT_HPP_
+#define WM_MQTT_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "net.hpp"
+
+namespace wm::mqtt {
+
+enum packet_type : uint8_t {
+    CONNECT = 1,
+    CONNACK = 2,
+    PUBLISH = 3,
+    PUBACK = 4,
+    SUBSCRIBE = 8,
+    SUBACK = 9,
+    UNSUBSCRIBE = 10,
+    UNSUBACK = 11,
+    PINGREQ = 12,
+    PINGRESP = 13,
+    DISCONNECT = 14,
+};
+
+/* Remaining length is capped well below the protocol's 256 MB */
+constexpr size_t MAX_PACKET_BODY = 1U << 20;
+
+struct packet {
+    uint8_t header = 0;          /* Type in the high nibble, flags below */
+    std::vector<uint8_t> body;
+
+    packet_type type() const { return static_cast<packet_type>(header >> 4); }
+    uint8_t flags() const { return header & 0x0F; }
+};
+
+struct publish_msg {
+    std::string topic;
+    uint8_t qos = 0;
+    bool retain = false;
+    uint16_t packet_id = 0;
+    std::vector<uint8_t> payload;
+};
+
+struct connect_msg {
+    std::string client_id;
+    std::string username;
+    std::string password;
+    uint16_t keepalive_sec = 0;
+    bool clean_session = true;
+};
+
+/* ============================================================================
+ * PACKET CODEC
+ * ============================================================================ */
+
+/** @brief Read one packet; false on EOF, timeout or an oversized packet */
+bool read_packet(int fd, packet &out);
+
+bool write_packet(int fd, const std::vector<uint8_t> &frame);
+
+std::vector<uint8_t> encode_connect(const connect_msg &msg);
+std::vector<uint8_t> encode_connack(uint8_t return_code);
+std::vector<uint8_t> encode_publish(const std::string &topic, const uint8_t *payload,
+                                    size_t len, uint8_t qos, uint16_t packet_id,
+                                    bool retain = false);
+std::vector<uint8_t> encode_puback(uint16_t packet_id);
+std::vector<uint8_t> encode_subscribe(uint16_t packet_id, const std::string &filter,
+                                      uint8_t qos);
+std::vector<uint8_t> encode_suback(uint16_t packet_id, const std::vector<uint8_t> &codes);
+std::vector<uint8_t> encode_empty(packet_type type);   /* PINGREQ, PINGRESP, DISCONNECT */
+
+bool parse_connect(const packet &pkt, connect_msg &out);
+bool parse_publish(const packet &pkt, publish_msg &out);
+
+/** @brief SUBSCRIBE: packet id and (filter, requested QoS) pairs */
+bool parse_subscribe(const packet &pkt, uint16_t &packet_id,
+                     std::vector<std::pair<std::string, uint8_t>> &filters);
+
+/** @brief Packet id of a PUBACK, SUBACK or UNSUBACK */
+bool parse_packet_id(const packet &pkt, uint16_t &packet_id);
+
+/** @brief MQTT topic filter match with '+' and '#' */
+bool topic_matches(const std::string &filter, const std::string &topic);
+
+/* ============================================================================
+ * CLIENT
+ * ============================================================================ */
+
+class client {
+public:
+    using message_handler = std::function<void(const publish_msg &)>;
+
+    client() = default;
+    ~client();
+    client(const client &) = delete;
+    client &operator=(const client &) = delete;
+
+    /**
+     * @brief Connect and wait for CONNACK
+     *
+     * @return 0 on success, the CONNACK return code if refused, -1 on a
+     *         network error
+     */
+    int connect(const endpoint &broker, const connect_msg &msg, int timeout_ms);
+
+    bool subscribe(const std::string &filter, uint8_t qos);
+    bool publish(const std::string &topic, const uint8_t *payload, size_t len, uint8_t qos);
+
+    /**
+     * @brief Receive until the connection drops or @p keep_running turns false
+     *
+     * Incoming QoS 1 messages are acknowledged after @p on_message returns.
+     * Pings are sent at half the keep-alive interval.
+     */
+    void run(const message_handler &on_message, const std::atomic<bool> &keep_running);
+
+    void disconnect();
+    bool connected() const { return fd_ >= 0; }
+
+private:
+    int fd_ = -1;
+    uint16_t keepalive_sec_ = 0;
+    uint16_t next_id_ = 1;
+
+    uint16_t next_packet_id();
+};
+
+} // namespace wm::mqtt
+
+#endif /* WM_MQTT_HPP_ */
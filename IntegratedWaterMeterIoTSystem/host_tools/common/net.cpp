@@ -0,0 +1,207 @@
+/**
+ * @file net.cpp
+ * @brief Blocking TCP helpers for the host tools (POSIX sockets)
+ */
+
+#include "net.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace wm {
+
+bool parse_endpoint(const std::string &text, uint16_t default_port, endpoint &out)
+{
+    size_t colon = text.rfind(':');
+
+    out.host = text.substr(0, colon);
+    out.port = default_port;
+    if (colon == std::string::npos) {
+        return !out.host.empty();
+    }
+
+    char *end = nullptr;
+    long port = std::strtol(text.c_str() + colon + 1, &end, 10);
+
+    if (*end != '\0' || port < 1 || port > 65535) {
+        return false;
+    }
+    out.port = static_cast<uint16_t>(port);
+    return !out.host.empty();
+}
+
+std::string to_string(const endpoint &ep)
+{
+    return ep.host + ":" + std::to_string(ep.port);
+}
+
+static void set_timeouts(int fd, int timeout_ms)
+{
+    timeval tv{};
+
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/**
+ * @brief Connect with a timeout: non-blocking connect, then poll
+ */
+static int connect_one(const addrinfo *ai, int timeout_ms)
+{
+    int fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+        if (errno != EINPROGRESS) {
+            close(fd);
+            return -1;
+        }
+
+        pollfd pfd{fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+
+        if (poll(&pfd, 1, timeout_ms) != 1 ||
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0 || err != 0) {
+            close(fd);
+            errno = (err != 0) ? err : ETIMEDOUT;
+            return -1;
+        }
+    }
+    fcntl(fd, F_SETFL, flags);
+
+    int one = 1;
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    set_timeouts(fd, timeout_ms);
+    return fd;
+}
+
+int tcp_connect(const endpoint &ep, int timeout_ms)
+{
+    addrinfo hints{};
+    addrinfo *result = nullptr;
+    std::string port = std::to_string(ep.port);
+
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(ep.host.c_str(), port.c_str(), &hints, &result) != 0) {
+        errno = EHOSTUNREACH;
+        return -1;
+    }
+
+    int fd = -1;
+
+    for (addrinfo *ai = result; ai != nullptr && fd < 0; ai = ai->ai_next) {
+        fd = connect_one(ai, timeout_ms);
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+int tcp_listen(uint16_t port, int backlog)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    sockaddr_in addr{};
+
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(fd, backlog) != 0) {
+        int err = errno;
+
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+
+uint16_t local_port(int fd)
+{
+    sockaddr_in addr{};
+    socklen_t len = sizeof(addr);
+
+    if (getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &len) != 0) {
+        return 0;
+    }
+    return ntohs(addr.sin_port);
+}
+
+bool send_all(int fd, const void *data, size_t len)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+    while (len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool recv_all(int fd, void *data, size_t len)
+{
+    uint8_t *p = static_cast<uint8_t *>(data);
+
+    while (len > 0) {
+        ssize_t n = recv(fd, p, len, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        len -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+int64_t now_ms()
+{
+    using namespace std::chrono;
+
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+int64_t unix_ms()
+{
+    using namespace std::chrono;
+
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+} // namespace wm
@@ -0,0 +1,61 @@
+/**
+ * @file net.hpp
+ * @brief Blocking TCP helpers for the host tools (POSIX sockets)
+ */
+
+#ifndef WM_NET_HPP_
+#define WM_NET_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace wm {
+
+struct endpoint {
+    std::string host;
+    uint16_t port = 0;
+};
+
+/**
+ * @brief Parse "host" or "host:port"
+ *
+ * @return false if the port is not a number in 1..65535
+ */
+bool parse_endpoint(const std::string &text, uint16_t default_port, endpoint &out);
+
+/** @brief "host:port", for logs */
+std::string to_string(const endpoint &ep);
+
+/**
+ * @brief Resolve and connect, with send/receive timeouts set on the socket
+ *
+ * @return Socket descriptor, or -1 with errno set
+ */
+int tcp_connect(const endpoint &ep, int timeout_ms);
+
+/**
+ * @brief Listening socket on all interfaces (port 0 picks a free one)
+ *
+ * @return Socket descriptor, or -1 with errno set
+ */
+int tcp_listen(uint16_t port, int backlog = 16);
+
+/** @brief Port a socket is bound to */
+uint16_t local_port(int fd);
+
+/** @brief Send everything, retrying on short writes and EINTR */
+bool send_all(int fd, const void *data, size_t len);
+
+/** @brief Receive exactly @p len bytes; false on EOF, error or timeout */
+bool recv_all(int fd, void *data, size_t len);
+
+/** @brief Monotonic milliseconds, for latency figures */
+int64_t now_ms();
+
+/** @brief Wall-clock Unix milliseconds */
+int64_t unix_ms();
+
+} // namespace wm
+
+#endif /* WM_NET_HPP_ */
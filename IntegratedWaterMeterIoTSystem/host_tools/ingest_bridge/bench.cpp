@@ -0,0 +1,251 @@
+/**
+ * @file bench.cpp
+ * @brief Decode throughput of the ingest bridge, per kernel and thread count
+ *
+ * @details
+ * Builds synthetic meter traces (30 s cadence, idle periods broken by draw
+ * events, integrating totals, noisy pressure and temperature), encodes them
+ * with batch_encode() and decodes every batch on the work-stealing pool.
+ * Each configuration is checked against the firmware's reference decoder
+ * and reported as samples per second in total and per worker thread.
+ *
+ *   ingest_bench [--batches N] [--samples N] [--threads N] [--rounds N]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "column_decode.hpp"
+#include "forwarder.hpp"
+#include "work_stealing_pool.hpp"
+
+using namespace wm;
+
+#define BATCHES_PER_TASK 64
+
+struct encoded_batch {
+    std::vector<uint8_t> bytes;
+    size_t samples;
+};
+
+/** @brief One meter's trace, continued across calls */
+struct meter_trace {
+    std::mt19937 rng;
+    int64_t ts_ms = 1760000000000LL;
+    uint32_t flow = 0;              /* L/h x 100 */
+    uint32_t target = 0;
+    int draw_left = 0;
+    double forward = 12345.0;       /* m3 x 1000 */
+    uint32_t reverse = 17;
+    double temperature = 1850.0;    /* degC x 100 */
+
+    explicit meter_trace(uint32_t seed) : rng(seed) {}
+
+    batch_sample next()
+    {
+        std::uniform_int_distribution<int> jitter(-200, 200);
+        std::uniform_int_distribution<int> noise(-3, 3);
+        std::uniform_int_distribution<int> pct(0, 99);
+        batch_sample s{};
+
+        ts_ms += 30000 + jitter(rng);
+        if (draw_left == 0 && pct(rng) < 5) {
+            draw_left = 1 + pct(rng) / 10;
+            target = 50000 + static_cast<uint32_t>(pct(rng)) * 1500;
+        }
+        if (draw_left > 0) {
+            draw_left--;
+            flow = target + static_cast<uint32_t>(noise(rng) * 100);
+        } else {
+            flow = 0;
+        }
+        forward += flow / 100.0 * 30.0 / 3600.0;
+        temperature += noise(rng) * 0.2;
+
+        s.ts_ms = ts_ms;
+        s.values[BOVE_FLOW_RATE] = flow;
+        s.values[BOVE_FORWARD_TOTAL] = static_cast<uint32_t>(forward);
+        s.values[BOVE_REVERSE_TOTAL] = reverse;
+        s.values[BOVE_PRESSURE] = static_cast<uint32_t>(300 + noise(rng));
+        s.values[BOVE_TEMPERATURE] = static_cast<uint32_t>(temperature);
+        s.values[BOVE_STATUS] = (pct(rng) == 0) ? BOVE_STATUS_EMPTY : 0;
+        return s;
+    }
+};
+
+static uint64_t checksum(const batch_sample *s, size_t n)
+{
+    uint64_t sum = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        sum += static_cast<uint64_t>(s[i].ts_ms);
+        for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+            sum = sum * 31 + s[i].values[f];
+        }
+    }
+    return sum;
+}
+
+/**
+ * @brief Decode everything once on @p pool
+ *
+ * @return Seconds taken; @p sum is the checksum of all decoded samples
+ */
+static double run_once(work_stealing_pool &pool, decode_kernel kernel,
+                       const std::vector<encoded_batch> &batches, uint64_t &sum,
+                       std::atomic<uint64_t> &errors)
+{
+    std::atomic<uint64_t> total{0};
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t first = 0; first < batches.size(); first += BATCHES_PER_TASK) {
+        pool.submit([&, first] {
+            std::vector<batch_sample> out;
+            uint64_t local = 0;
+            size_t last = std::min(first + BATCHES_PER_TASK, batches.size());
+
+            out.reserve(BATCH_MAX_SAMPLES);
+            for (size_t b = first; b < last; b++) {
+                out.clear();
+                if (decode_batch(kernel, batches[b].bytes.data(), batches[b].bytes.size(),
+                                 out) < 0) {
+                    errors++;
+                    continue;
+                }
+                local += checksum(out.data(), out.size());
+            }
+            total += local;
+        });
+    }
+    pool.wait_idle();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    sum = total;
+    return elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+    size_t batch_count = 20000;
+    size_t per_batch = 32;
+    unsigned max_threads = std::max(1U, std::thread::hardware_concurrency());
+    int rounds = 3;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--batches") == 0) {
+            batch_count = static_cast<size_t>(std::max(1, std::atoi(argv[i + 1])));
+        } else if (std::strcmp(argv[i], "--samples") == 0) {
+            per_batch = static_cast<size_t>(std::clamp(std::atoi(argv[i + 1]), 1,
+                                                       BATCH_MAX_SAMPLES));
+        } else if (std::strcmp(argv[i], "--threads") == 0) {
+            max_threads = static_cast<unsigned>(std::max(1, std::atoi(argv[i + 1])));
+        } else if (std::strcmp(argv[i], "--rounds") == 0) {
+            rounds = std::max(1, std::atoi(argv[i + 1]));
+        } else {
+            std::fprintf(stderr, "usage: %s [--batches N] [--samples N] [--threads N] "
+                                 "[--rounds N]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    /* Traces of 100 meters, each batch from one meter */
+    std::vector<meter_trace> meters;
+    std::vector<encoded_batch> batches(batch_count);
+    std::vector<batch_sample> samples(per_batch);
+    std::vector<batch_sample> check(BATCH_MAX_SAMPLES);
+    uint64_t expected = 0;
+    size_t encoded_bytes = 0, json_bytes = 0;
+
+    for (uint32_t m = 0; m < 100; m++) {
+        meters.emplace_back(m + 1);
+    }
+    for (size_t b = 0; b < batch_count; b++) {
+        meter_trace &meter = meters[b % meters.size()];
+
+        for (batch_sample &s : samples) {
+            s = meter.next();
+        }
+        batches[b].bytes.resize(BATCH_HEADER_MIN + 10 + BATCH_COLUMNS * 2 +
+                                per_batch * BATCH_COLUMNS * BATCH_VARINT_MAX);
+
+        int len = batch_encode(samples.data(), per_batch, batches[b].bytes.data(),
+                               batches[b].bytes.size());
+
+        if (len < 0) {
+            std::fprintf(stderr, "encode failed: %d\n", len);
+            return 1;
+        }
+        batches[b].bytes.resize(static_cast<size_t>(len));
+        batches[b].samples = per_batch;
+        encoded_bytes += static_cast<size_t>(len);
+        json_bytes += forwarder::to_json(samples.data(), per_batch).size();
+
+        /* Reference: the firmware's scalar decoder must round-trip exactly */
+        int n = batch_decode(batches[b].bytes.data(), batches[b].bytes.size(), check.data(),
+                             check.size());
+
+        if (n != static_cast<int>(per_batch) ||
+            std::memcmp(check.data(), samples.data(), per_batch * sizeof(batch_sample)) != 0) {
+            std::fprintf(stderr, "reference round trip failed at batch %zu\n", b);
+            return 1;
+        }
+        expected += checksum(samples.data(), per_batch);
+    }
+
+    size_t total_samples = batch_count * per_batch;
+
+    std::printf("%zu batches x %zu samples, %.2f bytes/sample encoded "
+                "(%.1f bytes/sample as telemetry JSON)\n",
+                batch_count, per_batch, double(encoded_bytes) / total_samples,
+                double(json_bytes) / total_samples);
+    std::printf("hardware threads: %u, SSE2 path: %s\n\n",
+                std::thread::hardware_concurrency(), simd_available() ? "yes" : "no");
+    std::printf("%-7s %7s %14s %16s %8s\n", "kernel", "threads", "samples/s",
+                "samples/s/thread", "steals");
+
+    for (decode_kernel kernel : {decode_kernel::scalar, decode_kernel::simd}) {
+        for (unsigned t = 1; t <= max_threads; t = (t < max_threads && t * 2 > max_threads)
+                                                      ? max_threads
+                                                      : t * 2) {
+            work_stealing_pool pool(t);
+            std::atomic<uint64_t> errors{0};
+            double best = 0;
+            uint64_t sum = 0;
+
+            for (int r = 0; r < rounds; r++) {
+                double secs = run_once(pool, kernel, batches, sum, errors);
+
+                if (errors != 0 || sum != expected) {
+                    std::fprintf(stderr, "%s kernel: decode mismatch (%llu errors)\n",
+                                 kernel_name(kernel), (unsigned long long)errors.load());
+                    return 1;
+                }
+                best = (r == 0) ? secs : std::min(best, secs);
+            }
+
+            uint64_t stolen = 0;
+
+            for (const auto &w : pool.stats()) {
+                stolen += w.stolen;
+            }
+
+            double rate = total_samples / best;
+
+            std::printf("%-7s %7u %14.0f %16.0f %8llu\n", kernel_name(kernel), t, rate,
+                        rate / t, (unsigned long long)stolen);
+            if (t == max_threads) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file column_decode.cpp
+ * @brief Batch column decoding for the ingest bridge
+ */
+
+#include "column_decode.hpp"
+
+#include <cerrno>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace wm {
+
+const char *kernel_name(decode_kernel kernel)
+{
+    return kernel == decode_kernel::simd ? "simd" : "scalar";
+}
+
+bool simd_available()
+{
+#if defined(__SSE2__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * @brief One varint of at most BATCH_VARINT_MAX bytes
+ *
+ * @return Bytes consumed, 0 if truncated, too long or above 32 bits
+ */
+static inline size_t get_varint(const uint8_t *in, size_t len, uint32_t &v)
+{
+    uint64_t acc = 0;
+
+    for (size_t i = 0; i < len && i < BATCH_VARINT_MAX; i++) {
+        acc |= static_cast<uint64_t>(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            if (acc > UINT32_MAX) {
+                return 0;
+            }
+            v = static_cast<uint32_t>(acc);
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static bool decode_scalar(const uint8_t *in, size_t len, uint32_t *out, size_t n)
+{
+    uint32_t acc = 0;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v;
+        size_t used = get_varint(&in[pos], len - pos, v);
+
+        if (used == 0) {
+            return false;
+        }
+        pos += used;
+        acc += static_cast<uint32_t>(batch_unzigzag(v));
+        out[i] = acc;
+    }
+    return pos == len;
+}
+
+#if defined(__SSE2__)
+
+/** @brief Un-zigzag four lanes: (v >> 1) ^ -(v & 1) */
+static inline __m128i unzigzag4(__m128i v)
+{
+    __m128i sign = _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(v, _mm_set1_epi32(1)));
+
+    return _mm_xor_si128(_mm_srli_epi32(v, 1), sign);
+}
+
+/** @brief Inclusive prefix sum of four lanes plus @p carry (broadcast) */
+static inline __m128i prefix4(__m128i v, __m128i carry)
+{
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+    v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+    return _mm_add_epi32(v, carry);
+}
+
+static bool decode_sse2(const uint8_t *in, size_t len, uint32_t *out, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    uint32_t acc = 0;
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (i < n) {
+        if (n - i >= 16 && len - pos >= 16) {
+            __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(&in[pos]));
+
+            if (_mm_movemask_epi8(bytes) == 0) {
+                __m128i lo = _mm_unpacklo_epi8(bytes, zero);
+                __m128i hi = _mm_unpackhi_epi8(bytes, zero);
+                __m128i carry = _mm_set1_epi32(static_cast<int>(acc));
+                __m128i v;
+
+                v = prefix4(unzigzag4(_mm_unpacklo_epi16(lo, zero)), carry);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i]), v);
+                carry = _mm_shuffle_epi32(v, 0xFF);
+                v = prefix4(unzigzag4(_mm_unpackhi_epi16(lo, zero)), carry);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i + 4]), v);
+                carry = _mm_shuffle_epi32(v, 0xFF);
+                v = prefix4(unzigzag4(_mm_unpacklo_epi16(hi, zero)), carry);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i + 8]), v);
+                carry = _mm_shuffle_epi32(v, 0xFF);
+                v = prefix4(unzigzag4(_mm_unpackhi_epi16(hi, zero)), carry);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(&out[i + 12]), v);
+
+                acc = out[i + 15];
+                i += 16;
+                pos += 16;
+                continue;
+            }
+        }
+
+        uint32_t v;
+        size_t used = get_varint(&in[pos], len - pos, v);
+
+        if (used == 0) {
+            return false;
+        }
+        pos += used;
+        acc += static_cast<uint32_t>(batch_unzigzag(v));
+        out[i++] = acc;
+    }
+    return pos == len;
+}
+
+#endif /* __SSE2__ */
+
+bool decode_column(decode_kernel kernel, const uint8_t *in, size_t len, uint32_t *out,
+                   size_t n)
+{
+#if defined(__SSE2__)
+    if (kernel == decode_kernel::simd) {
+        return decode_sse2(in, len, out, n);
+    }
+#endif
+    (void)kernel;
+    return decode_scalar(in, len, out, n);
+}
+
+int decode_batch(decode_kernel kernel, const uint8_t *buf, size_t len,
+                 std::vector<batch_sample> &out)
+{
+    batch_view view;
+    uint32_t values[BATCH_MAX_SAMPLES];
+    int rc = batch_parse(buf, len, &view);
+
+    if (rc != 0) {
+        return rc;
+    }
+
+    size_t first = out.size();
+
+    out.resize(first + view.count);
+    for (int c = 0; c < BATCH_COLUMNS; c++) {
+        if (!decode_column(kernel, view.column[c], view.column_len[c], values, view.count)) {
+            out.resize(first);
+            return -EINVAL;
+        }
+        for (size_t i = 0; i < view.count; i++) {
+            if (c == 0) {
+                out[first + i].ts_ms = view.base_ts_ms + values[i];
+            } else {
+                out[first + i].values[c - 1] = values[i];
+            }
+        }
+    }
+    return view.count;
+}
+
+} // namespace wm
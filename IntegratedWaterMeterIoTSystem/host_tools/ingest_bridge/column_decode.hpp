@@ -0,0 +1,57 @@
+/**
+ * @file column_decode.hpp
+ * @brief Batch column decoding for the ingest bridge
+ *
+ * @details
+ * A column is a run of zigzag-mapped deltas written as varints (see
+ * batch_codec.h). Two kernels decode it:
+ *
+ * - scalar: byte-at-a-time varint reads and a running sum, the same
+ *   algorithm as batch_decode_column() in the firmware tree.
+ * - simd:   when the next 16 bytes are all single-byte varints (no
+ *           continuation bit, checked with one movemask) they are widened,
+ *           un-zigzagged and prefix-summed in SSE2 registers, 16 values per
+ *           step; anything else falls back to one scalar varint. Meter data
+ *           is mostly steady, so most bytes take the wide path.
+ *
+ * Without SSE2 the simd kernel is the scalar one. Both produce identical
+ * output and reject the same malformed input.
+ */
+
+#ifndef WM_COLUMN_DECODE_HPP_
+#define WM_COLUMN_DECODE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "batch_codec.h"
+
+namespace wm {
+
+enum class decode_kernel { scalar, simd };
+
+const char *kernel_name(decode_kernel kernel);
+
+/** @brief True if the simd kernel has a vector path in this build */
+bool simd_available();
+
+/**
+ * @brief Decode one column into @p n absolute values
+ *
+ * @return false unless the column holds exactly @p n well-formed varints
+ */
+bool decode_column(decode_kernel kernel, const uint8_t *in, size_t len, uint32_t *out,
+                   size_t n);
+
+/**
+ * @brief Decode a whole batch, appending to @p out
+ *
+ * @return Samples appended, or a negative errno from batch_parse() / -EINVAL
+ */
+int decode_batch(decode_kernel kernel, const uint8_t *buf, size_t len,
+                 std::vector<batch_sample> &out);
+
+} // namespace wm
+
+#endif /* WM_COLUMN_DECODE_HPP_ */
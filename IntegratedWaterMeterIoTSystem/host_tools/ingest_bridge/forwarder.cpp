@@ -0,0 +1,196 @@
+/**
+ * @file forwarder.cpp
+ * @brief Bulk forwarding of decoded samples to the ThingsBoard HTTP API
+ */
+
+#include "forwarder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+
+#include "http_client.hpp"
+
+namespace wm {
+
+#define BACKOFF_MIN_MS 500
+#define BACKOFF_MAX_MS 30000
+
+static const char *const field_keys[BOVE_FIELD_COUNT] = {
+#define FIELD_KEY(id, key, offset, width) key,
+    BOVE_FIELDS(FIELD_KEY)
+#undef FIELD_KEY
+};
+
+forwarder::forwarder(const forwarder_config &config) : config_(config)
+{
+    for (unsigned i = 0; i < std::max(1U, config_.senders); i++) {
+        senders_.emplace_back(&forwarder::sender_loop, this);
+    }
+}
+
+forwarder::~forwarder()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    changed_.notify_all();
+    for (std::thread &t : senders_) {
+        t.join();
+    }
+}
+
+void forwarder::enqueue(const std::string &token, const batch_sample *samples, size_t n)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    device &dev = devices_[token];
+
+    if (dev.pending.empty()) {
+        dev.oldest_ms = now_ms();
+    }
+    dev.pending.insert(dev.pending.end(), samples, samples + n);
+    counters_.queued_records += n;
+
+    while (dev.pending.size() > config_.max_queued) {
+        dev.pending.pop_front();
+        counters_.dropped_records++;
+        counters_.queued_records--;
+    }
+    if (dev.pending.size() >= config_.max_records) {
+        changed_.notify_one();
+    }
+}
+
+forwarder::counters forwarder::stats() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    return counters_;
+}
+
+std::string forwarder::to_json(const batch_sample *samples, size_t n)
+{
+    std::string out;
+    char num[32];
+
+    out.reserve(n * 200);
+    out += '[';
+    for (size_t i = 0; i < n; i++) {
+        const batch_sample &s = samples[i];
+        uint32_t status = s.values[BOVE_STATUS];
+
+        if (i > 0) {
+            out += ',';
+        }
+        std::snprintf(num, sizeof(num), "%" PRId64, s.ts_ms);
+        out += "{\"ts\":";
+        out += num;
+        out += ",\"values\":{";
+        for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+            std::snprintf(num, sizeof(num), "%" PRIu32, s.values[f]);
+            out += '"';
+            out += field_keys[f];
+            out += "\":";
+            out += num;
+            out += ',';
+        }
+        /* Derived flags, as the firmware reports them */
+        out += (status & BOVE_STATUS_EMPTY) ? "\"leak\":1,\"empty\":1," : "\"leak\":0,\"empty\":0,";
+        out += (status & BOVE_STATUS_LOW_BATTERY) ? "\"lowBattery\":1}}" : "\"lowBattery\":0}}";
+    }
+    out += ']';
+    return out;
+}
+
+bool forwarder::take_due(int64_t now, std::string &token, std::vector<batch_sample> &out,
+                         int64_t &next_due)
+{
+    next_due = now + 1000;
+
+    for (auto &[name, dev] : devices_) {
+        if (dev.in_flight || dev.pending.empty()) {
+            continue;
+        }
+
+        int64_t due = std::max(dev.retry_at_ms, dev.pending.size() >= config_.max_records
+                                                    ? now
+                                                    : dev.oldest_ms + config_.flush_ms);
+
+        if (due > now && !stopping_) {
+            next_due = std::min(next_due, due);
+            continue;
+        }
+
+        size_t n = std::min(dev.pending.size(), config_.max_records);
+
+        out.assign(dev.pending.begin(), dev.pending.begin() + static_cast<long>(n));
+        dev.pending.erase(dev.pending.begin(), dev.pending.begin() + static_cast<long>(n));
+        dev.oldest_ms = now;
+        dev.in_flight = true;
+        token = name;
+        return true;
+    }
+    return false;
+}
+
+void forwarder::sender_loop()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    std::string token;
+    std::vector<batch_sample> batch;
+    int64_t next_due;
+
+    for (;;) {
+        if (!take_due(now_ms(), token, batch, next_due)) {
+            if (stopping_) {
+                return;
+            }
+            changed_.wait_for(guard, std::chrono::milliseconds(next_due - now_ms()));
+            continue;
+        }
+
+        guard.unlock();
+
+        std::string body = to_json(batch.data(), batch.size());
+        http::response rsp;
+        bool ok = http::post(config_.thingsboard, "/api/v1/" + token + "/telemetry",
+                             "application/json", body, config_.timeout_ms, rsp) &&
+                  rsp.status >= 200 && rsp.status < 300;
+
+        if (!ok) {
+            std::fprintf(stderr, "forward %zu records for %s failed (HTTP %d)\n",
+                         batch.size(), token.c_str(), rsp.status);
+        }
+
+        guard.lock();
+
+        device &dev = devices_[token];
+
+        dev.in_flight = false;
+        if (ok) {
+            counters_.posts++;
+            counters_.posted_records += batch.size();
+            counters_.queued_records -= batch.size();
+            dev.backoff_ms = 0;
+        } else if (stopping_) {
+            counters_.failed_posts++;
+            counters_.dropped_records += batch.size();
+            counters_.queued_records -= batch.size();
+        } else {
+            counters_.failed_posts++;
+            dev.pending.insert(dev.pending.begin(), batch.begin(), batch.end());
+            while (dev.pending.size() > config_.max_queued) {
+                dev.pending.pop_front();
+                counters_.dropped_records++;
+                counters_.queued_records--;
+            }
+            dev.backoff_ms = std::clamp(dev.backoff_ms * 2, BACKOFF_MIN_MS, BACKOFF_MAX_MS);
+            dev.retry_at_ms = now_ms() + dev.backoff_ms;
+        }
+        changed_.notify_all();
+    }
+}
+
+} // namespace wm
@@ -0,0 +1,95 @@
+/**
+ * @file forwarder.hpp
+ * @brief Bulk forwarding of decoded samples to the ThingsBoard HTTP API
+ *
+ * @details
+ * Samples are queued per device token. A device is flushed once it has
+ * max_records samples or its oldest sample has waited flush_ms, as one POST
+ * of a JSON array to /api/v1/<token>/telemetry, the same record format the
+ * firmware's history backfill uses. Several sender threads work in
+ * parallel, never two on the same device, so each device's records arrive
+ * in order.
+ *
+ * A failed POST puts the records back and retries that device with
+ * exponential backoff. Each device queue is bounded; on overflow the oldest
+ * samples are dropped and counted.
+ */
+
+#ifndef WM_FORWARDER_HPP_
+#define WM_FORWARDER_HPP_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "batch_codec.h"
+#include "net.hpp"
+
+namespace wm {
+
+struct forwarder_config {
+    endpoint thingsboard;
+    size_t max_records = 500;            /* Per POST */
+    int flush_ms = 1000;
+    size_t max_queued = 20000;           /* Per device */
+    unsigned senders = 2;
+    int timeout_ms = 5000;
+};
+
+class forwarder {
+public:
+    struct counters {
+        uint64_t posts;
+        uint64_t posted_records;
+        uint64_t failed_posts;
+        uint64_t dropped_records;
+        uint64_t queued_records;
+    };
+
+    explicit forwarder(const forwarder_config &config);
+
+    /** @brief Flushes what is queued (one attempt per device), then joins */
+    ~forwarder();
+
+    forwarder(const forwarder &) = delete;
+    forwarder &operator=(const forwarder &) = delete;
+
+    /** @brief Queue samples of one device; thread-safe */
+    void enqueue(const std::string &token, const batch_sample *samples, size_t n);
+
+    counters stats() const;
+
+    /** @brief ThingsBoard telemetry array for @p n samples */
+    static std::string to_json(const batch_sample *samples, size_t n);
+
+private:
+    struct device {
+        std::deque<batch_sample> pending;
+        int64_t oldest_ms = 0;         /* Monotonic time the oldest was queued */
+        int64_t retry_at_ms = 0;
+        int backoff_ms = 0;
+        bool in_flight = false;
+    };
+
+    forwarder_config config_;
+    mutable std::mutex lock_;
+    std::condition_variable changed_;
+    std::unordered_map<std::string, device> devices_;
+    std::vector<std::thread> senders_;
+    counters counters_{};
+    bool stopping_ = false;
+
+    /** @brief Under lock_: a device due for a POST, and its records */
+    bool take_due(int64_t now, std::string &token, std::vector<batch_sample> &out,
+                  int64_t &next_due);
+    void sender_loop();
+};
+
+} // namespace wm
+
+#endif /* WM_FORWARDER_HPP_ */
@@ -0,0 +1,277 @@
+/**
+ * @file main.cpp
+ * @brief Ingest bridge: meter batches from a local broker to ThingsBoard
+ *
+ * @details
+ * Subscribes to watermeter/<token>/raw on a local MQTT broker, decodes each
+ * batch of raw meter responses (raw_frame.h) by the register map on a
+ * work-stealing pool and forwards the samples to ThingsBoard over its
+ * device HTTP API in bulk. The device access token is taken from the topic.
+ *
+ * Compact column batches (batch_codec.h) are decoded from a second filter
+ * given with --topic, e.g. watermeter/+/batch. No firmware publishes them
+ * yet, so nothing is subscribed for them by default.
+ *
+ *   ingest_bridge --broker localhost:1883 --thingsboard tb.local:8080
+ *                 [--raw-topic watermeter/+/raw] [--topic watermeter/+/batch]
+ *                 [--threads N] [--senders N]
+ *                 [--flush-ms 1000] [--max-records 500] [--stats-sec 10]
+ *                 [--kernel simd|scalar]
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "column_decode.hpp"
+#include "forwarder.hpp"
+#include "mqtt.hpp"
+#include "raw_frame.h"
+#include "work_stealing_pool.hpp"
+
+using namespace wm;
+
+#define RECONNECT_MIN_MS 1000
+#define RECONNECT_MAX_MS 30000
+
+static std::atomic<bool> running{true};
+
+static std::atomic<uint64_t> batches_rx{0};
+static std::atomic<uint64_t> raw_batches_rx{0};
+static std::atomic<uint64_t> samples_rx{0};
+static std::atomic<uint64_t> decode_errors{0};
+static std::atomic<uint64_t> bad_topics{0};
+
+struct options {
+    endpoint broker{"localhost", 1883};
+    endpoint thingsboard{"localhost", 8080};
+    std::string topic;                          /* Column batches, off when empty */
+    std::string raw_topic = "watermeter/+/raw";
+    std::string client_id = "watermeter-ingest-bridge";
+    unsigned threads = std::max(1U, std::thread::hardware_concurrency());
+    unsigned senders = 2;
+    int flush_ms = 1000;
+    size_t max_records = 500;
+    int stats_sec = 10;
+    decode_kernel kernel = decode_kernel::simd;
+};
+
+static void usage(const char *prog)
+{
+    std::fprintf(stderr,
+                 "usage: %s [--broker host[:port]] [--thingsboard host[:port]]\n"
+                 "          [--topic filter] [--raw-topic filter] [--client-id id]\n"
+                 "          [--threads N] [--senders N]\n"
+                 "          [--flush-ms ms] [--max-records N] [--stats-sec s]\n"
+                 "          [--kernel simd|scalar]\n",
+                 prog);
+}
+
+static bool parse_args(int argc, char **argv, options &opt)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const char *val = argv[++i];
+
+        if (arg == "--broker") {
+            if (!parse_endpoint(val, 1883, opt.broker)) {
+                return false;
+            }
+        } else if (arg == "--thingsboard") {
+            if (!parse_endpoint(val, 8080, opt.thingsboard)) {
+                return false;
+            }
+        } else if (arg == "--topic") {
+            opt.topic = val;
+        } else if (arg == "--raw-topic") {
+            opt.raw_topic = val;
+        } else if (arg == "--client-id") {
+            opt.client_id = val;
+        } else if (arg == "--threads") {
+            opt.threads = static_cast<unsigned>(std::max(1, std::atoi(val)));
+        } else if (arg == "--senders") {
+            opt.senders = static_cast<unsigned>(std::max(1, std::atoi(val)));
+        } else if (arg == "--flush-ms") {
+            opt.flush_ms = std::max(1, std::atoi(val));
+        } else if (arg == "--max-records") {
+            opt.max_records = static_cast<size_t>(std::max(1, std::atoi(val)));
+        } else if (arg == "--stats-sec") {
+            opt.stats_sec = std::max(1, std::atoi(val));
+        } else if (arg == "--kernel") {
+            opt.kernel = (std::strcmp(val, "scalar") == 0) ? decode_kernel::scalar
+                                                           : decode_kernel::simd;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Device token: the topic level the filter's first '+' matched
+ */
+static bool token_from_topic(const std::string &filter, const std::string &topic,
+                             std::string &token)
+{
+    size_t f = 0, t = 0;
+
+    while (f < filter.size() && t <= topic.size()) {
+        size_t f_end = filter.find('/', f);
+        size_t t_end = topic.find('/', t);
+
+        f_end = (f_end == std::string::npos) ? filter.size() : f_end;
+        t_end = (t_end == std::string::npos) ? topic.size() : t_end;
+        if (filter.compare(f, f_end - f, "+") == 0) {
+            token = topic.substr(t, t_end - t);
+            return !token.empty();
+        }
+        f = f_end + 1;
+        t = t_end + 1;
+    }
+    return false;
+}
+
+static void on_signal(int)
+{
+    running = false;
+}
+
+static void print_stats(const work_stealing_pool &pool, const forwarder &fwd)
+{
+    forwarder::counters c = fwd.stats();
+    uint64_t stolen = 0;
+
+    for (const auto &w : pool.stats()) {
+        stolen += w.stolen;
+    }
+    std::printf("batches %llu raw %llu samples %llu decode_err %llu bad_topic %llu | "
+                "posts %llu records %llu failed %llu dropped %llu queued %llu | "
+                "steals %llu\n",
+                (unsigned long long)batches_rx, (unsigned long long)raw_batches_rx,
+                (unsigned long long)samples_rx,
+                (unsigned long long)decode_errors, (unsigned long long)bad_topics,
+                (unsigned long long)c.posts, (unsigned long long)c.posted_records,
+                (unsigned long long)c.failed_posts, (unsigned long long)c.dropped_records,
+                (unsigned long long)c.queued_records, (unsigned long long)stolen);
+    std::fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+
+    if (!parse_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    forwarder_config fcfg;
+
+    fcfg.thingsboard = opt.thingsboard;
+    fcfg.max_records = opt.max_records;
+    fcfg.flush_ms = opt.flush_ms;
+    fcfg.senders = opt.senders;
+
+    forwarder fwd(fcfg);
+    work_stealing_pool pool(opt.threads);
+
+    std::printf("ingest bridge: %s -> %s, %u decode threads (%s kernel%s), %u senders\n",
+                to_string(opt.broker).c_str(), to_string(opt.thingsboard).c_str(),
+                pool.size(), kernel_name(opt.kernel),
+                simd_available() ? "" : ", no SSE2 in this build", opt.senders);
+
+    std::thread stats([&] {
+        int64_t next = now_ms() + opt.stats_sec * 1000LL;
+
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(200));
+            if (now_ms() >= next) {
+                print_stats(pool, fwd);
+                next += opt.stats_sec * 1000LL;
+            }
+        }
+    });
+
+    auto on_message = [&](const mqtt::publish_msg &msg) {
+        bool raw = mqtt::topic_matches(opt.raw_topic, msg.topic);
+        std::string token;
+
+        if ((!raw && opt.topic.empty()) ||
+            !token_from_topic(raw ? opt.raw_topic : opt.topic, msg.topic, token)) {
+            bad_topics++;
+            return;
+        }
+        (raw ? raw_batches_rx : batches_rx)++;
+        pool.submit([&, raw, token, payload = msg.payload] {
+            std::vector<batch_sample> samples;
+            int rc;
+
+            if (raw) {
+                /* One sample per frame, read by the firmware's register map */
+                samples.resize(RAW_MAX_FRAMES);
+                rc = raw_batch_decode(payload.data(), payload.size(), samples.data(),
+                                      samples.size());
+                samples.resize(rc > 0 ? rc : 0);
+            } else {
+                rc = decode_batch(opt.kernel, payload.data(), payload.size(), samples);
+            }
+            if (rc < 0) {
+                decode_errors++;
+                return;
+            }
+            samples_rx += samples.size();
+            fwd.enqueue(token, samples.data(), samples.size());
+        });
+    };
+
+    mqtt::connect_msg cmsg;
+    int backoff_ms = RECONNECT_MIN_MS;
+
+    cmsg.client_id = opt.client_id;
+    cmsg.keepalive_sec = 60;
+
+    while (running) {
+        mqtt::client broker;
+        int rc = broker.connect(opt.broker, cmsg, 5000);
+
+        if (rc == 0 && broker.subscribe(opt.raw_topic, 1) &&
+            (opt.topic.empty() || broker.subscribe(opt.topic, 1))) {
+            std::printf("subscribed to %s%s%s on %s\n", opt.raw_topic.c_str(),
+                        opt.topic.empty() ? "" : " and ", opt.topic.c_str(),
+                        to_string(opt.broker).c_str());
+            backoff_ms = RECONNECT_MIN_MS;
+            broker.run(on_message, running);
+            if (running) {
+                std::fprintf(stderr, "broker connection lost\n");
+            }
+            continue;
+        }
+
+        std::fprintf(stderr, "broker %s: %s, retry in %d ms\n", to_string(opt.broker).c_str(),
+                     rc > 0 ? "connection refused" : std::strerror(errno), backoff_ms);
+        for (int waited = 0; waited < backoff_ms && running; waited += 100) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        backoff_ms = std::min(backoff_ms * 2, RECONNECT_MAX_MS);
+    }
+
+    stats.join();
+    pool.wait_idle();
+    print_stats(pool, fwd);
+    return 0;
+}
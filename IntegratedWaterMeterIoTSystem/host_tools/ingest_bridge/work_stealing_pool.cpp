@@ -0,0 +1,133 @@
+/**
+ * @file work_stealing_pool.cpp
+ * @brief Fixed-size thread pool with per-worker deques and work stealing
+ */
+
+#include "work_stealing_pool.hpp"
+
+namespace wm {
+
+/* Index of the worker running on this thread, for submits from a task */
+static thread_local const work_stealing_pool *tls_pool = nullptr;
+static thread_local unsigned tls_index = 0;
+
+work_stealing_pool::work_stealing_pool(unsigned threads)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers_.push_back(std::make_unique<worker>());
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        threads_.emplace_back(&work_stealing_pool::run, this, i);
+    }
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+    wait_idle();
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread &t : threads_) {
+        t.join();
+    }
+}
+
+void work_stealing_pool::submit(task t)
+{
+    unsigned target = (tls_pool == this) ? tls_index : next_++ % size();
+    worker &w = *workers_[target];
+
+    unfinished_++;
+    {
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.tasks.push_back(std::move(t));
+    }
+    queued_++;
+
+    /* Taking the lock orders this wake-up after a sleeper's predicate check */
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock_);
+    }
+    wake_.notify_one();
+}
+
+void work_stealing_pool::wait_idle()
+{
+    std::unique_lock<std::mutex> guard(sleep_lock_);
+
+    idle_.wait(guard, [this] { return unfinished_ == 0; });
+}
+
+std::vector<work_stealing_pool::worker_stats> work_stealing_pool::stats() const
+{
+    std::vector<worker_stats> out;
+
+    for (const auto &w : workers_) {
+        out.push_back({w->executed.load(), w->stolen.load()});
+    }
+    return out;
+}
+
+bool work_stealing_pool::take(unsigned self, task &out)
+{
+    worker &own = *workers_[self];
+
+    {
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.tasks.empty()) {
+            out = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    for (unsigned i = 1; i < size(); i++) {
+        worker &victim = *workers_[(self + i) % size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+
+        if (!victim.tasks.empty()) {
+            out = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            own.stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+void work_stealing_pool::run(unsigned self)
+{
+    worker &own = *workers_[self];
+    task t;
+
+    tls_pool = this;
+    tls_index = self;
+
+    for (;;) {
+        if (take(self, t)) {
+            queued_--;
+            t();
+            t = nullptr;
+            own.executed++;
+            if (--unfinished_ == 0) {
+                std::lock_guard<std::mutex> guard(sleep_lock_);
+                idle_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleep_lock_);
+
+        wake_.wait(guard, [this] { return stopping_ || queued_ > 0; });
+        if (stopping_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+} // namespace wm
@@ -0,0 +1,83 @@
+/**
+ * @file work_stealing_pool.hpp
+ * @brief Fixed-size thread pool with per-worker deques and work stealing
+ *
+ * @details
+ * Each worker owns a deque. Tasks submitted from outside the pool are spread
+ * round-robin over the deques; tasks submitted from inside a task go to the
+ * submitting worker's own deque. A worker takes from the back of its own
+ * deque (most recent first, still warm in its cache) and, when that is empty,
+ * steals from the front of the others. Idle workers sleep on a condition
+ * variable, so an idle bridge costs no CPU.
+ *
+ * The deques are mutex-protected rather than lock-free: a decode task runs
+ * for microseconds, so the lock is uncontended almost always and the code
+ * stays short.
+ */
+
+#ifndef WM_WORK_STEALING_POOL_HPP_
+#define WM_WORK_STEALING_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wm {
+
+class work_stealing_pool {
+public:
+    using task = std::function<void()>;
+
+    struct worker_stats {
+        uint64_t executed;
+        uint64_t stolen;     /* Of those, taken from another worker's deque */
+    };
+
+    explicit work_stealing_pool(unsigned threads);
+
+    /** @brief Runs the remaining tasks, then joins the workers */
+    ~work_stealing_pool();
+
+    work_stealing_pool(const work_stealing_pool &) = delete;
+    work_stealing_pool &operator=(const work_stealing_pool &) = delete;
+
+    void submit(task t);
+
+    /** @brief Block until every submitted task has finished */
+    void wait_idle();
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+    std::vector<worker_stats> stats() const;
+
+private:
+    struct worker {
+        std::mutex lock;
+        std::deque<task> tasks;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+    };
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex sleep_lock_;
+    std::condition_variable wake_;       /* Work queued or stopping */
+    std::condition_variable idle_;       /* unfinished_ reached zero */
+    std::atomic<size_t> queued_{0};      /* In a deque */
+    std::atomic<size_t> unfinished_{0};  /* Queued or running */
+    std::atomic<unsigned> next_{0};
+    bool stopping_ = false;              /* Under sleep_lock_ */
+
+    bool take(unsigned self, task &out);
+    void run(unsigned self);
+};
+
+} // namespace wm
+
+#endif /* WM_WORK_STEALING_POOL_HPP_ */
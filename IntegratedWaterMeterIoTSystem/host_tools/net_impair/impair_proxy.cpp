@@ -0,0 +1,459 @@
+/**
+ * @file impair_proxy.cpp
+ * @brief TCP proxy that impairs the link between a device and its broker
+ */
+
+#include "impair_proxy.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace wm {
+
+#define UPSTREAM_TIMEOUT_MS 5000
+
+/* ============================================================================
+ * LINK MODEL
+ * ============================================================================ */
+
+link_model::link_model(const impair_config &config, int kbps, uint32_t seed)
+    : config_(config), kbps_(kbps), rng_(seed)
+{
+}
+
+int64_t link_model::arrival(size_t bytes, int64_t now_ms)
+{
+    int64_t sent = std::max(now_ms, free_ms_);
+    int64_t stall = 0;
+    int rto = config_.rto_ms;
+
+    free_ms_ = sent + ((kbps_ > 0) ? static_cast<int64_t>(bytes) * 8 / kbps_ : 0);
+    segments_++;
+    while (config_.loss_permille > 0 &&
+           std::uniform_int_distribution<int>(0, 999)(rng_) < config_.loss_permille) {
+        retransmits_++;
+        stall += rto;
+        rto = std::min(rto * 2, config_.rto_max_ms);
+    }
+
+    int jitter = (config_.jitter_ms > 0) ?
+                 std::uniform_int_distribution<int>(0, config_.jitter_ms)(rng_) : 0;
+
+    /* One stream: a stalled segment holds back the ones behind it */
+    last_ms_ = std::max(last_ms_, free_ms_ + config_.delay_ms + jitter + stall);
+    return last_ms_;
+}
+
+/* ============================================================================
+ * LIFECYCLE
+ * ============================================================================ */
+
+impair_proxy::impair_proxy(const impair_config &config, const std::vector<route> &routes,
+                           std::FILE *log)
+    : config_(config), log_(log), start_ms_(now_ms()), routes_(routes.size())
+{
+    for (size_t i = 0; i < routes.size(); i++) {
+        routes_[i].config = routes[i];
+    }
+}
+
+impair_proxy::~impair_proxy()
+{
+    stop();
+}
+
+void impair_proxy::stop()
+{
+    running_ = false;
+    outage_cv_.notify_all();
+    for (auto &r : routes_) {
+        if (r.acceptor.joinable()) {
+            r.acceptor.join();
+        }
+        if (r.listen_fd >= 0) {
+            close(r.listen_fd);
+            r.listen_fd = -1;
+        }
+    }
+
+    std::vector<std::shared_ptr<connection>> open_conns;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        for (auto &kv : conns_) {
+            open_conns.push_back(kv.second);
+        }
+    }
+    for (auto &c : open_conns) {
+        close_connection(c);
+    }
+    reap(true);
+}
+
+bool impair_proxy::start()
+{
+    for (auto &r : routes_) {
+        r.listen_fd = tcp_listen(r.config.listen_port);
+        if (r.listen_fd < 0) {
+            return false;
+        }
+    }
+    running_ = true;
+    for (size_t i = 0; i < routes_.size(); i++) {
+        routes_[i].acceptor = std::thread(&impair_proxy::accept_loop, this, i);
+    }
+    return true;
+}
+
+void impair_proxy::log_event(const std::string &fields)
+{
+    if (log_ == nullptr) {
+        return;
+    }
+
+    std::string line = "{\"rx\":" + std::to_string(unix_ms()) +
+                       ",\"mono\":" + std::to_string(now_ms() - start_ms_) + "," + fields +
+                       "}\n";
+
+    std::fputs(line.c_str(), log_);
+    std::fflush(log_);
+}
+
+/* ============================================================================
+ * OUTAGES
+ * ============================================================================ */
+
+void impair_proxy::outage_begin()
+{
+    std::vector<std::shared_ptr<connection>> victims;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        if (outage_) {
+            return;
+        }
+        outage_ = true;
+        outages_++;
+        log_event(std::string("\"event\":\"outage_start\",\"mode\":\"") +
+                  (config_.blackhole ? "blackhole" : "reset") + "\"");
+        if (!config_.blackhole) {
+            for (auto &kv : conns_) {
+                victims.push_back(kv.second);
+            }
+            reset_ += victims.size();
+        }
+    }
+    for (auto &c : victims) {
+        close_connection(c);
+    }
+}
+
+void impair_proxy::outage_end()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (!outage_) {
+        return;
+    }
+    outage_ = false;
+    for (auto &r : routes_) {
+        r.recover_from_ms = now_ms();
+    }
+    log_event("\"event\":\"outage_end\"");
+    outage_cv_.notify_all();
+}
+
+bool impair_proxy::wait_link_up()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+
+    outage_cv_.wait(guard, [this] { return !outage_ || !running_; });
+    return running_;
+}
+
+/* ============================================================================
+ * CONNECTIONS
+ * ============================================================================ */
+
+void impair_proxy::accept_loop(size_t idx)
+{
+    route_state &r = routes_[idx];
+
+    while (running_) {
+        pollfd pfd{r.listen_fd, POLLIN, 0};
+
+        reap(false);
+
+        /* Blackhole: connections wait in the backlog, unanswered */
+        if (config_.blackhole && outage_ && !wait_link_up()) {
+            break;
+        }
+        if (poll(&pfd, 1, 500) != 1) {
+            continue;
+        }
+
+        int fd = accept(r.listen_fd, nullptr, nullptr);
+
+        if (fd < 0) {
+            continue;
+        }
+        if (outage_ && !config_.blackhole) {
+            std::lock_guard<std::mutex> guard(lock_);
+
+            turned_away_++;
+            log_event("\"event\":\"turned_away\",\"route\":" +
+                      std::to_string(r.config.listen_port));
+            close(fd);
+            continue;
+        }
+        open(idx, fd);
+    }
+}
+
+void impair_proxy::open(size_t idx, int client_fd)
+{
+    route_state &r = routes_[idx];
+    int upstream_fd = tcp_connect(r.config.upstream, UPSTREAM_TIMEOUT_MS);
+
+    if (upstream_fd < 0) {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        log_event("\"event\":\"upstream_failed\",\"route\":" +
+                  std::to_string(r.config.listen_port));
+        close(client_fd);
+        return;
+    }
+
+    /* Blocking reads: idle sessions are the device's and broker's business */
+    timeval none{0, 0};
+    int one = 1;
+
+    setsockopt(upstream_fd, SOL_SOCKET, SO_RCVTIMEO, &none, sizeof(none));
+    setsockopt(upstream_fd, SOL_SOCKET, SO_SNDTIMEO, &none, sizeof(none));
+    setsockopt(upstream_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    auto c = std::make_shared<connection>();
+    std::lock_guard<std::mutex> guard(lock_);
+
+    c->id = next_conn_++;
+    c->route_idx = idx;
+    c->client_fd = client_fd;
+    c->upstream_fd = upstream_fd;
+    c->start_ms = now_ms();
+
+    /* Per connection and direction, independent of thread timing */
+    std::seed_seq up_seed{config_.seed, c->id, 0U}, down_seed{config_.seed, c->id, 1U};
+    uint32_t up_s, down_s;
+
+    up_seed.generate(&up_s, &up_s + 1);
+    down_seed.generate(&down_s, &down_s + 1);
+    c->up = std::make_unique<pipe>(link_model(config_, config_.up_kbps, up_s));
+    c->down = std::make_unique<pipe>(link_model(config_, config_.down_kbps, down_s));
+
+    accepted_++;
+    conns_[c->id] = c;
+    log_event("\"event\":\"accept\",\"route\":" + std::to_string(r.config.listen_port) +
+              ",\"conn\":" + std::to_string(c->id));
+
+    c->running = 4;
+    c->threads.emplace_back(&impair_proxy::reader, this, c, true);
+    c->threads.emplace_back(&impair_proxy::writer, this, c, true);
+    c->threads.emplace_back(&impair_proxy::reader, this, c, false);
+    c->threads.emplace_back(&impair_proxy::writer, this, c, false);
+}
+
+void impair_proxy::reader(std::shared_ptr<connection> c, bool up)
+{
+    pipe &p = up ? *c->up : *c->down;
+    int fd = up ? c->client_fd : c->upstream_fd;
+    uint8_t buf[SEGMENT_MAX];
+
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        std::lock_guard<std::mutex> guard(p.lock);
+
+        if (n <= 0) {
+            /* End of stream, in order behind the data */
+            p.queue.push_back(segment{now_ms(), p.model.arrival(0, now_ms()), {}});
+            p.cv.notify_one();
+            break;
+        }
+        p.queue.push_back(segment{now_ms(), p.model.arrival(n, now_ms()),
+                                  std::vector<uint8_t>(buf, buf + n)});
+        p.bytes += n;
+        p.cv.notify_one();
+    }
+    if (--c->running == 0) {
+        finish(c);
+    }
+}
+
+void impair_proxy::writer(std::shared_ptr<connection> c, bool up)
+{
+    pipe &p = up ? *c->up : *c->down;
+    int fd = up ? c->upstream_fd : c->client_fd;
+
+    for (;;) {
+        segment s;
+
+        {
+            std::unique_lock<std::mutex> guard(p.lock);
+
+            p.cv.wait(guard, [&] { return c->closing || !p.queue.empty(); });
+            if (c->closing) {
+                break;
+            }
+
+            int64_t wait = p.queue.front().due_ms - now_ms();
+
+            if (wait > 0) {
+                p.cv.wait_for(guard, std::chrono::milliseconds(wait));
+                continue;
+            }
+            s = std::move(p.queue.front());
+            p.queue.pop_front();
+        }
+
+        /* Blackhole: everything in flight waits for the link */
+        if (config_.blackhole && outage_ && !wait_link_up()) {
+            break;
+        }
+        if (s.data.empty()) {
+            shutdown(fd, SHUT_WR);
+            break;
+        }
+        if (!send_all(fd, s.data.data(), s.data.size())) {
+            close_connection(c);
+            break;
+        }
+
+        if (!up) {
+            std::lock_guard<std::mutex> guard(lock_);
+            route_state &r = routes_[c->route_idx];
+
+            /* Data held through the outage does not count, only replies to
+             * what the device sent once the link was back */
+            if (r.recover_from_ms != 0 && s.read_ms >= r.recover_from_ms) {
+                int64_t ms = now_ms() - r.recover_from_ms;
+
+                r.recovery_ms.push_back(ms);
+                r.recover_from_ms = 0;
+                log_event("\"event\":\"recovered\",\"route\":" +
+                          std::to_string(r.config.listen_port) + ",\"conn\":" +
+                          std::to_string(c->id) + ",\"recovery_ms\":" + std::to_string(ms));
+            }
+        }
+    }
+    if (--c->running == 0) {
+        finish(c);
+    }
+}
+
+void impair_proxy::close_connection(const std::shared_ptr<connection> &c)
+{
+    /* Under lock_, so finish() cannot close the descriptors in between */
+    std::lock_guard<std::mutex> conns_guard(lock_);
+
+    if (c->closing.exchange(true)) {
+        return;
+    }
+    shutdown(c->client_fd, SHUT_RDWR);
+    shutdown(c->upstream_fd, SHUT_RDWR);
+    for (pipe *p : {c->up.get(), c->down.get()}) {
+        std::lock_guard<std::mutex> guard(p->lock);
+
+        p->cv.notify_all();
+    }
+}
+
+/** @brief Last thread of a connection out: close it and add up its counts */
+void impair_proxy::finish(const std::shared_ptr<connection> &c)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    c->closing = true;
+    close(c->client_fd);
+    close(c->upstream_fd);
+
+    uint64_t rexmit = c->up->model.retransmits() + c->down->model.retransmits();
+
+    bytes_up_ += c->up->bytes;
+    bytes_down_ += c->down->bytes;
+    segments_ += c->up->model.segments() + c->down->model.segments();
+    retransmits_ += rexmit;
+    log_event("\"event\":\"close\",\"route\":" +
+              std::to_string(routes_[c->route_idx].config.listen_port) +
+              ",\"conn\":" + std::to_string(c->id) +
+              ",\"up_bytes\":" + std::to_string(c->up->bytes) +
+              ",\"down_bytes\":" + std::to_string(c->down->bytes) +
+              ",\"retransmits\":" + std::to_string(rexmit) +
+              ",\"duration_ms\":" + std::to_string(now_ms() - c->start_ms));
+}
+
+/** @brief Join connections whose threads have all finished (all when @p all) */
+void impair_proxy::reap(bool all)
+{
+    std::vector<std::shared_ptr<connection>> finished;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        for (auto it = conns_.begin(); it != conns_.end();) {
+            if (all || it->second->running == 0) {
+                finished.push_back(it->second);
+                it = conns_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto &c : finished) {
+        for (auto &t : c->threads) {
+            t.join();
+        }
+    }
+}
+
+/* ============================================================================
+ * SUMMARY
+ * ============================================================================ */
+
+void impair_proxy::print_summary(std::FILE *out) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    std::fprintf(out,
+                 "connections %" PRIu64 " (turned away %" PRIu64 ", reset %" PRIu64
+                 "), outages %" PRIu64 "\n"
+                 "bytes up %" PRIu64 " down %" PRIu64 ", segments %" PRIu64
+                 ", retransmits %" PRIu64 "\n",
+                 accepted_, turned_away_, reset_, outages_, bytes_up_, bytes_down_, segments_,
+                 retransmits_);
+
+    for (const auto &r : routes_) {
+        if (r.recovery_ms.empty()) {
+            continue;
+        }
+
+        std::vector<int64_t> ms = r.recovery_ms;
+
+        std::sort(ms.begin(), ms.end());
+        std::fprintf(out,
+                     "route %u recovery ms: n %zu min %" PRId64 " p50 %" PRId64
+                     " max %" PRId64 "\n",
+                     r.config.listen_port, ms.size(), ms.front(), ms[ms.size() / 2],
+                     ms.back());
+    }
+}
+
+} // namespace wm
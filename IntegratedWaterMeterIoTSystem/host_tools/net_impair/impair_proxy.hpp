@@ -0,0 +1,187 @@
+/**
+ * @file impair_proxy.hpp
+ * @brief TCP proxy that impairs the link between a device and its broker
+ *
+ * @details
+ * Each route listens on a port and forwards every connection to an upstream
+ * (normally tb_mock). Data is read in segments of up to SEGMENT_MAX bytes
+ * and each segment is delivered, in order, when the link model says it
+ * arrives:
+ *
+ *   sent    = max(read time, link free)          bandwidth cap, per direction
+ *   free    = sent + bytes × 8 / kbps
+ *   arrival = free + delay + U(0, jitter) + stall
+ *
+ * A lost segment is not dropped; as on TCP it arrives after one or more
+ * retransmission timeouts (the stall), starting at rto_ms and doubling,
+ * the same model as the native_sim network (sim_cloud.c). Every direction
+ * of every connection has its own generator seeded from the seed and the
+ * connection number, so a run replays the same impairments as long as the
+ * device opens its connections in the same order.
+ *
+ * Scheduled outages either reset every connection and turn new ones away
+ * at once (reset), or hold all data and new connections until the outage
+ * ends (blackhole), so the device only notices by its own timeouts. The
+ * recovery time of an outage is from its end to the delivery of the first
+ * bytes the upstream sent after it, on that route.
+ */
+
+#ifndef WM_IMPAIR_PROXY_HPP_
+#define WM_IMPAIR_PROXY_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "net.hpp"
+
+namespace wm {
+
+#define SEGMENT_MAX 1460
+
+struct impair_config {
+    int delay_ms = 0;               /* One way */
+    int jitter_ms = 0;
+    int loss_permille = 0;
+    int rto_ms = 1000;
+    int rto_max_ms = 60000;
+    int up_kbps = 0;                /* Device to broker, 0 = unlimited */
+    int down_kbps = 0;
+    bool blackhole = false;         /* Outage mode; reset otherwise */
+    uint32_t seed = 1;
+};
+
+struct route {
+    uint16_t listen_port;
+    endpoint upstream;
+};
+
+/** @brief Arrival times of the segments of one direction */
+class link_model {
+public:
+    link_model(const impair_config &config, int kbps, uint32_t seed);
+
+    /** @brief Arrival of @p bytes read at @p now_ms, never before the last one */
+    int64_t arrival(size_t bytes, int64_t now_ms);
+
+    uint64_t segments() const { return segments_; }
+    uint64_t retransmits() const { return retransmits_; }
+
+private:
+    const impair_config &config_;
+    int kbps_;
+    std::mt19937 rng_;
+    int64_t free_ms_ = 0;
+    int64_t last_ms_ = 0;
+    uint64_t segments_ = 0;
+    uint64_t retransmits_ = 0;
+};
+
+class impair_proxy {
+public:
+    impair_proxy(const impair_config &config, const std::vector<route> &routes,
+                 std::FILE *log);
+    ~impair_proxy();
+
+    impair_proxy(const impair_proxy &) = delete;
+    impair_proxy &operator=(const impair_proxy &) = delete;
+
+    /** @brief Listen on every route; false with errno set on failure */
+    bool start();
+
+    /** @brief Close every connection and join the threads */
+    void stop();
+
+    void outage_begin();
+    void outage_end();
+    bool in_outage() const { return outage_; }
+
+    /** @brief Connections, bytes, retransmits and recovery times */
+    void print_summary(std::FILE *out) const;
+
+private:
+    struct segment {
+        int64_t read_ms;
+        int64_t due_ms;
+        std::vector<uint8_t> data;      /* Empty: end of stream */
+    };
+
+    /* One direction of a connection */
+    struct pipe {
+        explicit pipe(link_model m) : model(std::move(m)) {}
+
+        link_model model;
+        std::mutex lock;
+        std::condition_variable cv;
+        std::deque<segment> queue;
+        uint64_t bytes = 0;
+    };
+
+    struct connection {
+        unsigned id;
+        size_t route_idx;
+        int client_fd = -1;
+        int upstream_fd = -1;
+        int64_t start_ms;
+        std::unique_ptr<pipe> up;
+        std::unique_ptr<pipe> down;
+        std::atomic<bool> closing{false};
+        std::atomic<int> running{0};
+        std::vector<std::thread> threads;
+    };
+
+    struct route_state {
+        route config;
+        int listen_fd = -1;
+        std::thread acceptor;
+        int64_t recover_from_ms = 0;    /* End of the last outage, until recovered */
+        std::vector<int64_t> recovery_ms;
+    };
+
+    impair_config config_;
+    std::FILE *log_;
+    int64_t start_ms_;
+    std::vector<route_state> routes_;
+    std::atomic<bool> running_{false};
+    std::atomic<bool> outage_{false};
+
+    mutable std::mutex lock_;
+    std::condition_variable outage_cv_;
+    std::map<unsigned, std::shared_ptr<connection>> conns_;
+    unsigned next_conn_ = 1;
+    uint64_t accepted_ = 0;
+    uint64_t turned_away_ = 0;
+    uint64_t reset_ = 0;
+    uint64_t outages_ = 0;
+    uint64_t segments_ = 0;
+    uint64_t retransmits_ = 0;
+    uint64_t bytes_up_ = 0;
+    uint64_t bytes_down_ = 0;
+
+    void accept_loop(size_t idx);
+    void open(size_t idx, int client_fd);
+    void reader(std::shared_ptr<connection> c, bool up);
+    void writer(std::shared_ptr<connection> c, bool up);
+    void close_connection(const std::shared_ptr<connection> &c);
+    void finish(const std::shared_ptr<connection> &c);
+    void reap(bool all);
+
+    /** @brief Block while a blackhole outage lasts; false if shutting down */
+    bool wait_link_up();
+
+    /** @brief One JSON line of @p fields, stamped; called with lock_ held */
+    void log_event(const std::string &fields);
+};
+
+} // namespace wm
+
+#endif /* WM_IMPAIR_PROXY_HPP_ */
@@ -0,0 +1,240 @@
+/**
+ * @file main.cpp
+ * @brief net_impair: delay, loss, bandwidth caps and outages between a
+ *        device and its broker
+ *
+ * @details
+ * Sits in front of tb_mock (or any broker) so the firmware's own connect,
+ * retry and reconnect paths (cloud.c, main loop) can be measured under a
+ * bad link, repeatably. Point CONFIG_APP_TEST_BROKER_HOST and its ports at
+ * the proxy and the routes at the broker:
+ *
+ *   net_impair --route 1884=localhost:1883 --route 8081=localhost:8080
+ *              [--delay-ms 0] [--jitter-ms 0] [--loss-permille 0] [--rto-ms 1000]
+ *              [--up-kbps 0] [--down-kbps 0]
+ *              [--outage-every-sec 0] [--outage-for-sec 0]
+ *              [--outage-mode reset|blackhole] [--log events.jsonl] [--seed 1]
+ *
+ * Commands on stdin, one per line: "down" and "up" start and end an outage
+ * by hand (link flaps), "stats" prints the summary so far.
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "impair_proxy.hpp"
+#include "net.hpp"
+
+using namespace wm;
+
+static std::atomic<bool> running{true};
+
+struct options {
+    impair_config link;
+    std::vector<route> routes;
+    int outage_every_sec = 0;           /* 0: no scheduled outages */
+    int outage_for_sec = 0;
+    std::string log_path;
+};
+
+static void usage(const char *prog)
+{
+    std::fprintf(stderr,
+                 "usage: %s --route port=host:port [--route ...]\n"
+                 "          [--delay-ms ms] [--jitter-ms ms] [--loss-permille N] [--rto-ms ms]\n"
+                 "          [--up-kbps N] [--down-kbps N]\n"
+                 "          [--outage-every-sec s] [--outage-for-sec s]\n"
+                 "          [--outage-mode reset|blackhole] [--log path|-] [--seed N]\n",
+                 prog);
+}
+
+static bool parse_route(const std::string &text, route &out)
+{
+    size_t eq = text.find('=');
+
+    if (eq == std::string::npos) {
+        return false;
+    }
+
+    int port = std::atoi(text.substr(0, eq).c_str());
+
+    if (port < 1 || port > 65535 || !parse_endpoint(text.substr(eq + 1), 0, out.upstream) ||
+        out.upstream.port == 0) {
+        return false;
+    }
+    out.listen_port = static_cast<uint16_t>(port);
+    return true;
+}
+
+static bool parse_args(int argc, char **argv, options &opt)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const char *val = argv[++i];
+
+        if (arg == "--route") {
+            route r;
+
+            if (!parse_route(val, r)) {
+                return false;
+            }
+            opt.routes.push_back(r);
+        } else if (arg == "--delay-ms") {
+            opt.link.delay_ms = std::max(0, std::atoi(val));
+        } else if (arg == "--jitter-ms") {
+            opt.link.jitter_ms = std::max(0, std::atoi(val));
+        } else if (arg == "--loss-permille") {
+            opt.link.loss_permille = std::min(999, std::max(0, std::atoi(val)));
+        } else if (arg == "--rto-ms") {
+            opt.link.rto_ms = std::max(1, std::atoi(val));
+        } else if (arg == "--up-kbps") {
+            opt.link.up_kbps = std::max(0, std::atoi(val));
+        } else if (arg == "--down-kbps") {
+            opt.link.down_kbps = std::max(0, std::atoi(val));
+        } else if (arg == "--outage-every-sec") {
+            opt.outage_every_sec = std::max(0, std::atoi(val));
+        } else if (arg == "--outage-for-sec") {
+            opt.outage_for_sec = std::max(0, std::atoi(val));
+        } else if (arg == "--outage-mode") {
+            if (std::strcmp(val, "reset") != 0 && std::strcmp(val, "blackhole") != 0) {
+                return false;
+            }
+            opt.link.blackhole = std::strcmp(val, "blackhole") == 0;
+        } else if (arg == "--log") {
+            opt.log_path = val;
+        } else if (arg == "--seed") {
+            opt.link.seed = static_cast<uint32_t>(std::strtoul(val, nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return !opt.routes.empty();
+}
+
+static void on_signal(int)
+{
+    running = false;
+}
+
+static void run_command(const std::string &cmd, impair_proxy &proxy)
+{
+    if (cmd == "down") {
+        proxy.outage_begin();
+    } else if (cmd == "up") {
+        proxy.outage_end();
+    } else if (cmd == "stats") {
+        proxy.print_summary(stderr);
+    } else if (!cmd.empty()) {
+        std::fprintf(stderr, "commands: down | up | stats\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+
+    if (!parse_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    std::FILE *log = nullptr;
+
+    if (opt.log_path == "-") {
+        log = stdout;
+    } else if (!opt.log_path.empty()) {
+        log = std::fopen(opt.log_path.c_str(), "w");
+        if (log == nullptr) {
+            std::fprintf(stderr, "%s: %s\n", opt.log_path.c_str(), std::strerror(errno));
+            return 1;
+        }
+    }
+
+    int exit_code = 0;
+
+    {
+        impair_proxy proxy(opt.link, opt.routes, log);
+
+        if (!proxy.start()) {
+            std::fprintf(stderr, "listen: %s\n", std::strerror(errno));
+            exit_code = 1;
+        }
+
+        for (const auto &r : opt.routes) {
+            std::fprintf(stderr, "net_impair: %u -> %s\n", r.listen_port,
+                         to_string(r.upstream).c_str());
+        }
+        std::fprintf(stderr,
+                     "delay %d+%d ms, loss %d permille, up %d kbps, down %d kbps, outages %s\n",
+                     opt.link.delay_ms, opt.link.jitter_ms, opt.link.loss_permille,
+                     opt.link.up_kbps, opt.link.down_kbps,
+                     opt.link.blackhole ? "blackhole" : "reset");
+
+        /* Outages start one period in and last outage_for_sec */
+        int64_t period = opt.outage_every_sec * 1000LL;
+        int64_t next_down = period ? now_ms() + period : 0;
+        int64_t next_up = 0;
+        bool stdin_open = true;
+        std::string pending;
+
+        while (running && exit_code == 0) {
+            pollfd pfd{STDIN_FILENO, POLLIN, 0};
+
+            if (poll(&pfd, stdin_open ? 1 : 0, 100) == 1) {
+                char buf[256];
+                ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+
+                if (n <= 0) {
+                    stdin_open = false;
+                } else {
+                    pending.append(buf, n);
+                }
+
+                size_t eol;
+
+                while ((eol = pending.find('\n')) != std::string::npos) {
+                    run_command(pending.substr(0, eol), proxy);
+                    pending.erase(0, eol + 1);
+                }
+            }
+
+            int64_t now = now_ms();
+
+            if (next_down != 0 && now >= next_down) {
+                proxy.outage_begin();
+                next_up = now + opt.outage_for_sec * 1000LL;
+                next_down += period;
+            }
+            if (next_up != 0 && now >= next_up) {
+                proxy.outage_end();
+                next_up = 0;
+            }
+        }
+
+        proxy.outage_end();
+        proxy.stop();
+        proxy.print_summary(stderr);
+    }
+
+    if (log != nullptr && log != stdout) {
+        std::fclose(log);
+    }
+    return exit_code;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file arrival_log.cpp
+ * @brief Every message the mock receives or acknowledges, with timestamps
+ */
+
+#include "arrival_log.hpp"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+
+#include "net.hpp"
+
+namespace wm {
+
+std::string json_quote(const std::string &s)
+{
+    std::string out = "\"";
+
+    for (unsigned char c : s) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (c < 0x20) {
+                char esc[8];
+
+                std::snprintf(esc, sizeof(esc), "\\u%04x", c);
+                out += esc;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out + "\"";
+}
+
+/* Text is logged as a string, anything else as hex */
+static bool printable(const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] < 0x20 && p[i] != '\n' && p[i] != '\r' && p[i] != '\t') {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Every number after "ts": in a telemetry payload */
+static void sample_times(const uint8_t *p, size_t len, std::vector<int64_t> &out)
+{
+    static const char key[] = "\"ts\"";
+    const size_t key_len = sizeof(key) - 1;
+
+    for (size_t i = 0; i + key_len < len; i++) {
+        if (std::memcmp(&p[i], key, key_len) != 0) {
+            continue;
+        }
+
+        size_t j = i + key_len;
+
+        while (j < len && (p[j] == ' ' || p[j] == ':')) {
+            j++;
+        }
+
+        int64_t v = 0;
+        size_t digits = j;
+
+        while (j < len && p[j] >= '0' && p[j] <= '9') {
+            v = v * 10 + (p[j++] - '0');
+        }
+        if (j > digits) {
+            out.push_back(v);
+        }
+        i = j;
+    }
+}
+
+arrival_log::arrival_log(const std::string &path) : path_(path), start_ms_(now_ms())
+{
+    if (path_ == "-") {
+        file_ = stdout;
+    } else if (!path_.empty()) {
+        file_ = std::fopen(path_.c_str(), "w");
+    }
+}
+
+arrival_log::~arrival_log()
+{
+    if (file_ != nullptr && file_ != stdout) {
+        std::fclose(file_);
+    }
+}
+
+void arrival_log::record(const arrival &a)
+{
+    int64_t rx = unix_ms();
+    int64_t mono = now_ms() - start_ms_;
+    std::string line;
+
+    line.reserve(160 + 2 * a.len);
+    line += "{\"rx\":" + std::to_string(rx) + ",\"mono\":" + std::to_string(mono);
+    line += ",\"session\":" + std::to_string(a.session);
+    line += ",\"token\":" + json_quote(a.token) + ",\"kind\":" + json_quote(a.kind);
+    if (!a.topic.empty()) {
+        line += ",\"topic\":" + json_quote(a.topic);
+    }
+    if (a.qos >= 0) {
+        line += ",\"qos\":" + std::to_string(a.qos);
+    }
+    if (a.id >= 0) {
+        line += ",\"id\":" + std::to_string(a.id);
+    }
+    if (a.delay_ms >= 0) {
+        line += (a.kind == "rpc_reply") ? ",\"rtt_ms\":" : ",\"delay_ms\":";
+        line += std::to_string(a.delay_ms);
+    }
+    if (!a.reason.empty()) {
+        line += ",\"reason\":" + json_quote(a.reason);
+    }
+    if (a.payload != nullptr) {
+        line += ",\"bytes\":" + std::to_string(a.len);
+        if (printable(a.payload, a.len)) {
+            line += ",\"payload\":" +
+                    json_quote(std::string(reinterpret_cast<const char *>(a.payload), a.len));
+        } else {
+            static const char hex[] = "0123456789abcdef";
+
+            line += ",\"payload_hex\":\"";
+            for (size_t i = 0; i < a.len; i++) {
+                line += hex[a.payload[i] >> 4];
+                line += hex[a.payload[i] & 0x0F];
+            }
+            line += "\"";
+        }
+    }
+    line += "}\n";
+
+    std::vector<int64_t> ts;
+
+    if (a.payload != nullptr && a.topic.find("telemetry") != std::string::npos) {
+        sample_times(a.payload, a.len, ts);
+    }
+
+    std::lock_guard<std::mutex> guard(lock_);
+
+    kinds_[a.kind]++;
+    for (int64_t t : ts) {
+        lag_ms_.push_back(rx - t);
+    }
+    if (file_ != nullptr) {
+        std::fputs(line.c_str(), file_);
+        std::fflush(file_);
+    }
+}
+
+void arrival_log::print_summary(std::FILE *out) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    for (const auto &k : kinds_) {
+        std::fprintf(out, "%-12s %" PRIu64 "\n", k.first.c_str(), k.second);
+    }
+    if (lag_ms_.empty()) {
+        return;
+    }
+
+    std::vector<int64_t> lag = lag_ms_;
+
+    std::sort(lag.begin(), lag.end());
+    auto pct = [&](double p) {
+        return lag[std::min(lag.size() - 1, static_cast<size_t>(p * lag.size()))];
+    };
+    std::fprintf(out,
+                 "telemetry samples %zu, arrival lag ms: min %" PRId64 " p50 %" PRId64
+                 " p95 %" PRId64 " p99 %" PRId64 " max %" PRId64 "\n",
+                 lag.size(), lag.front(), pct(0.50), pct(0.95), pct(0.99), lag.back());
+}
+
+} // namespace wm
@@ -0,0 +1,79 @@
+/**
+ * @file arrival_log.hpp
+ * @brief Every message the mock receives or acknowledges, with timestamps
+ *
+ * @details
+ * One JSON object per line, written as it happens:
+ *
+ *   {"rx":1718000000123,"mono":5021,"session":3,"token":"...","kind":"publish",
+ *    "topic":"v1/devices/me/telemetry","qos":1,"id":17,"bytes":182,"payload":"..."}
+ *
+ * "rx" is the wall-clock arrival (Unix ms), comparable with the "ts" of
+ * timestamped telemetry when both clocks are synced; "mono" is monotonic
+ * ms since the mock started, for intervals. Kinds: connect, refused,
+ * subscribe, publish, puback (sent; "delay_ms" after the publish), withheld
+ * (PUBACK not sent), push (shared attributes), rpc_sent, rpc_reply
+ * ("rtt_ms"), http, disconnect, drop ("reason"). Binary payloads are
+ * written as "payload_hex".
+ *
+ * The log also keeps counts per kind and the arrival lag of every "ts" in
+ * telemetry (arrival minus sample time) for the summary at exit.
+ */
+
+#ifndef WM_ARRIVAL_LOG_HPP_
+#define WM_ARRIVAL_LOG_HPP_
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wm {
+
+struct arrival {
+    unsigned session = 0;       /* 0 for HTTP */
+    std::string token;
+    std::string kind;
+    std::string topic;          /* Or the HTTP path */
+    int qos = -1;               /* -1 = not applicable */
+    int id = -1;                /* Packet or RPC id, -1 = none */
+    int64_t delay_ms = -1;      /* puback: after the publish; rpc_reply: round trip */
+    std::string reason;
+    const uint8_t *payload = nullptr;
+    size_t len = 0;
+};
+
+class arrival_log {
+public:
+    /** @brief Write to @p path ("-" for stdout, empty for no file) */
+    explicit arrival_log(const std::string &path);
+    ~arrival_log();
+
+    arrival_log(const arrival_log &) = delete;
+    arrival_log &operator=(const arrival_log &) = delete;
+
+    bool ok() const { return path_.empty() || file_ != nullptr; }
+
+    /** @brief Log one event, stamped now; thread-safe */
+    void record(const arrival &a);
+
+    /** @brief Counts per kind and the telemetry arrival lag */
+    void print_summary(std::FILE *out) const;
+
+private:
+    std::string path_;
+    std::FILE *file_ = nullptr;
+    int64_t start_ms_;
+    mutable std::mutex lock_;
+    std::map<std::string, uint64_t> kinds_;
+    std::vector<int64_t> lag_ms_;
+};
+
+/** @brief @p s as a quoted JSON string */
+std::string json_quote(const std::string &s);
+
+} // namespace wm
+
+#endif /* WM_ARRIVAL_LOG_HPP_ */
@@ -0,0 +1,743 @@
+/**
+ * @file device_api.cpp
+ * @brief The ThingsBoard MQTT device API, as far as the firmware uses it
+ */
+
+#include "device_api.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net.hpp"
+
+namespace wm {
+
+#define CONNECT_TIMEOUT_MS 10000
+
+static const std::string attributes_topic = "v1/devices/me/attributes";
+static const std::string attr_request_prefix = "v1/devices/me/attributes/request/";
+static const std::string attr_response_prefix = "v1/devices/me/attributes/response/";
+static const std::string rpc_request_prefix = "v1/devices/me/rpc/request/";
+static const std::string rpc_response_prefix = "v1/devices/me/rpc/response/";
+
+/* ============================================================================
+ * JSON HELPERS
+ * ============================================================================ */
+
+using json_members = std::vector<std::pair<std::string, std::string>>;
+
+static size_t skip_ws(const std::string &t, size_t i)
+{
+    while (i < t.size() && std::strchr(" \t\r\n", t[i]) != nullptr) {
+        i++;
+    }
+    return i;
+}
+
+/* Past the string starting at the quote at @p i, or npos */
+static size_t skip_string(const std::string &t, size_t i)
+{
+    for (i++; i < t.size(); i++) {
+        if (t[i] == '\\') {
+            i++;
+        } else if (t[i] == '"') {
+            return i + 1;
+        }
+    }
+    return std::string::npos;
+}
+
+/**
+ * @brief Top-level members of a JSON object; values are kept as JSON text
+ *
+ * Not a validator: enough to merge and filter attribute objects.
+ */
+static bool parse_members(const std::string &t, json_members &out)
+{
+    size_t i = skip_ws(t, 0);
+
+    out.clear();
+    if (i >= t.size() || t[i] != '{') {
+        return false;
+    }
+    i = skip_ws(t, i + 1);
+    if (i < t.size() && t[i] == '}') {
+        return true;
+    }
+
+    while (i < t.size() && t[i] == '"') {
+        size_t key_end = skip_string(t, i);
+
+        if (key_end == std::string::npos) {
+            return false;
+        }
+
+        std::string key = t.substr(i + 1, key_end - i - 2);
+        size_t v = skip_ws(t, key_end);
+
+        if (v >= t.size() || t[v] != ':') {
+            return false;
+        }
+        v = skip_ws(t, v + 1);
+
+        size_t e = v;
+        int depth = 0;
+
+        while (e < t.size() && (depth > 0 || (t[e] != ',' && t[e] != '}'))) {
+            if (t[e] == '"') {
+                e = skip_string(t, e);
+                if (e == std::string::npos) {
+                    return false;
+                }
+                continue;
+            }
+            depth += (t[e] == '{' || t[e] == '[') ? 1 : (t[e] == '}' || t[e] == ']') ? -1 : 0;
+            e++;
+        }
+        if (e >= t.size() || e == v) {
+            return false;
+        }
+
+        size_t last = e;
+
+        while (last > v && std::strchr(" \t\r\n", t[last - 1]) != nullptr) {
+            last--;
+        }
+        out.emplace_back(key, t.substr(v, last - v));
+        if (t[e] == '}') {
+            return true;
+        }
+        i = skip_ws(t, e + 1);
+    }
+    return false;
+}
+
+/* A string member's value without quotes, empty if absent */
+static std::string string_member(const json_members &m, const std::string &key, bool *found)
+{
+    for (const auto &kv : m) {
+        if (kv.first == key) {
+            *found = true;
+            const std::string &v = kv.second;
+
+            return (v.size() >= 2 && v.front() == '"') ? v.substr(1, v.size() - 2) : v;
+        }
+    }
+    *found = false;
+    return "";
+}
+
+static std::set<std::string> split_keys(const std::string &list)
+{
+    std::set<std::string> keys;
+    size_t start = 0;
+
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string key = list.substr(start, comma - start);
+
+        if (!key.empty()) {
+            keys.insert(key);
+        }
+        if (comma == std::string::npos) {
+            break;
+        }
+        start = comma + 1;
+    }
+    return keys;
+}
+
+/* Members of @p attrs as an object; only @p keys if given */
+static std::string object_json(const std::map<std::string, std::string> &attrs,
+                               const std::set<std::string> *keys)
+{
+    std::string out = "{";
+
+    for (const auto &kv : attrs) {
+        if (keys != nullptr && keys->count(kv.first) == 0) {
+            continue;
+        }
+        if (out.size() > 1) {
+            out += ",";
+        }
+        out += json_quote(kv.first) + ":" + kv.second;
+    }
+    return out + "}";
+}
+
+/* ============================================================================
+ * LIFECYCLE
+ * ============================================================================ */
+
+device_api::device_api(const device_api_config &config, arrival_log &log)
+    : config_(config), log_(log), rng_(config.seed)
+{
+}
+
+device_api::~device_api()
+{
+    running_ = false;
+    if (acceptor_.joinable()) {
+        acceptor_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
+    drop_all("shutdown");
+    reap(true);
+}
+
+bool device_api::start()
+{
+    listen_fd_ = tcp_listen(config_.port);
+    if (listen_fd_ < 0) {
+        return false;
+    }
+    running_ = true;
+    acceptor_ = std::thread(&device_api::accept_loop, this);
+    return true;
+}
+
+void device_api::accept_loop()
+{
+    while (running_) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+
+        reap(false);
+        if (poll(&pfd, 1, 500) != 1) {
+            continue;
+        }
+
+        int fd = accept(listen_fd_, nullptr, nullptr);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        int one = 1;
+        auto s = std::make_shared<session>();
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        s->fd = fd;
+
+        std::lock_guard<std::mutex> guard(lock_);
+
+        s->id = next_session_++;
+        sessions_[s->id] = s;
+        s->writer = std::thread(&device_api::writer_loop, this, s);
+        s->reader = std::thread(&device_api::serve, this, s);
+    }
+}
+
+/** @brief Join finished connections (all of them when @p all) */
+void device_api::reap(bool all)
+{
+    std::vector<std::shared_ptr<session>> finished;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        for (auto it = sessions_.begin(); it != sessions_.end();) {
+            if (all || it->second->done) {
+                finished.push_back(it->second);
+                it = sessions_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    for (auto &s : finished) {
+        if (s->reader.joinable()) {
+            s->reader.join();
+        }
+    }
+}
+
+size_t device_api::connected() const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    return std::count_if(sessions_.begin(), sessions_.end(),
+                         [](const auto &kv) { return !kv.second->done; });
+}
+
+/* ============================================================================
+ * IMPAIRMENTS
+ * ============================================================================ */
+
+int device_api::roll_permille()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    return std::uniform_int_distribution<int>(0, 999)(rng_);
+}
+
+int64_t device_api::reply_delay_ms()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    int jitter = (config_.ack_jitter_ms > 0) ?
+                 std::uniform_int_distribution<int>(0, config_.ack_jitter_ms)(rng_) : 0;
+
+    return config_.ack_delay_ms + jitter;
+}
+
+bool device_api::token_allowed(const std::string &token) const
+{
+    return !token.empty() && (config_.tokens.empty() || config_.tokens.count(token) > 0);
+}
+
+void device_api::drop_all(const std::string &reason)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    for (auto &kv : sessions_) {
+        session &s = *kv.second;
+
+        if (s.done || s.dropped.exchange(true)) {
+            continue;
+        }
+        arrival a;
+
+        a.session = s.id;
+        a.token = s.token;
+        a.kind = "drop";
+        a.reason = reason;
+        log_.record(a);
+        shutdown(s.fd, SHUT_RDWR);
+    }
+}
+
+void device_api::refuse_for(int64_t ms)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    refuse_until_ms_ = now_ms() + ms;
+}
+
+/* ============================================================================
+ * OUTGOING
+ * ============================================================================ */
+
+void device_api::send(const std::shared_ptr<session> &s, std::vector<uint8_t> frame,
+                      int64_t delay_ms, int ack_id, int64_t publish_ms)
+{
+    std::lock_guard<std::mutex> guard(s->lock);
+
+    /* One TCP stream: nothing overtakes what is already queued */
+    int64_t due = std::max(now_ms() + delay_ms, s->last_due_ms);
+
+    s->last_due_ms = due;
+    s->queue.push_back(outgoing{due, std::move(frame), ack_id, publish_ms});
+    s->cv.notify_one();
+}
+
+void device_api::writer_loop(const std::shared_ptr<session> &s)
+{
+    std::unique_lock<std::mutex> guard(s->lock);
+
+    while (!s->closing) {
+        if (s->queue.empty()) {
+            s->cv.wait(guard);
+            continue;
+        }
+
+        int64_t wait = s->queue.front().due_ms - now_ms();
+
+        if (wait > 0) {
+            s->cv.wait_for(guard, std::chrono::milliseconds(wait));
+            continue;
+        }
+
+        outgoing o = std::move(s->queue.front());
+
+        s->queue.pop_front();
+        guard.unlock();
+
+        bool ok = mqtt::write_packet(s->fd, o.frame);
+
+        if (ok && o.ack_id >= 0) {
+            arrival a;
+
+            a.session = s->id;
+            a.token = s->token;
+            a.kind = "puback";
+            a.id = o.ack_id;
+            a.delay_ms = now_ms() - o.publish_ms;
+            log_.record(a);
+        }
+        guard.lock();
+        if (!ok) {
+            shutdown(s->fd, SHUT_RDWR);
+            break;
+        }
+    }
+}
+
+bool device_api::deliver(const std::shared_ptr<session> &s, const std::string &topic,
+                         const std::string &payload, int64_t delay_ms)
+{
+    uint16_t id;
+
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+        bool subscribed = std::any_of(s->filters.begin(), s->filters.end(),
+                                      [&](const std::string &f) {
+                                          return mqtt::topic_matches(f, topic);
+                                      });
+
+        if (!subscribed || s->closing) {
+            return false;
+        }
+        id = s->next_packet_id++;
+        if (s->next_packet_id == 0) {
+            s->next_packet_id = 1;
+        }
+    }
+
+    send(s, mqtt::encode_publish(topic, reinterpret_cast<const uint8_t *>(payload.data()),
+                                 payload.size(), 1, id),
+         delay_ms);
+    return true;
+}
+
+bool device_api::push_shared(const std::string &json)
+{
+    json_members members;
+
+    if (!parse_members(json, members)) {
+        return false;
+    }
+
+    std::vector<std::shared_ptr<session>> targets;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        for (const auto &kv : members) {
+            shared_[kv.first] = kv.second;
+        }
+        for (const auto &kv : sessions_) {
+            targets.push_back(kv.second);
+        }
+    }
+
+    for (auto &s : targets) {
+        if (deliver(s, attributes_topic, json, 0)) {
+            arrival a;
+
+            a.session = s->id;
+            a.token = s->token;
+            a.kind = "push";
+            a.topic = attributes_topic;
+            a.payload = reinterpret_cast<const uint8_t *>(json.data());
+            a.len = json.size();
+            log_.record(a);
+        }
+    }
+    return true;
+}
+
+int device_api::send_rpc(const std::string &method, const std::string &params_json)
+{
+    std::vector<std::shared_ptr<session>> targets;
+    int id;
+
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        id = next_rpc_++;
+        for (const auto &kv : sessions_) {
+            targets.push_back(kv.second);
+        }
+    }
+
+    std::string topic = rpc_request_prefix + std::to_string(id);
+    std::string payload = "{\"method\":" + json_quote(method) +
+                          ",\"params\":" + (params_json.empty() ? "{}" : params_json) + "}";
+
+    for (auto &s : targets) {
+        {
+            std::lock_guard<std::mutex> guard(s->lock);
+
+            s->rpc_sent_ms[id] = now_ms();
+        }
+        if (!deliver(s, topic, payload, 0)) {
+            std::lock_guard<std::mutex> guard(s->lock);
+
+            s->rpc_sent_ms.erase(id);
+            continue;
+        }
+
+        arrival a;
+
+        a.session = s->id;
+        a.token = s->token;
+        a.kind = "rpc_sent";
+        a.topic = topic;
+        a.id = id;
+        a.payload = reinterpret_cast<const uint8_t *>(payload.data());
+        a.len = payload.size();
+        log_.record(a);
+    }
+    return id;
+}
+
+/* ============================================================================
+ * INCOMING
+ * ============================================================================ */
+
+std::string device_api::attribute_response(const std::shared_ptr<session> &s,
+                                           const std::string &request)
+{
+    json_members req;
+    bool want_client = false, want_shared = false;
+    std::string client_keys, shared_keys;
+
+    if (parse_members(request, req)) {
+        client_keys = string_member(req, "clientKeys", &want_client);
+        shared_keys = string_member(req, "sharedKeys", &want_shared);
+    }
+    if (!want_client && !want_shared) {
+        want_client = want_shared = true;   /* No keys: everything */
+    }
+
+    std::set<std::string> ck = split_keys(client_keys), sk = split_keys(shared_keys);
+    std::string out = "{";
+
+    if (want_client) {
+        std::lock_guard<std::mutex> guard(s->lock);
+
+        out += "\"client\":" + object_json(s->client_attrs, client_keys.empty() ? nullptr : &ck);
+    }
+    if (want_shared) {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        out += std::string(want_client ? "," : "") + "\"shared\":" +
+               object_json(shared_, shared_keys.empty() ? nullptr : &sk);
+    }
+    return out + "}";
+}
+
+bool device_api::on_publish(const std::shared_ptr<session> &s, const mqtt::publish_msg &msg)
+{
+    int64_t rx_ms = now_ms();
+    std::string text(msg.payload.begin(), msg.payload.end());
+    arrival a;
+
+    a.session = s->id;
+    a.token = s->token;
+    a.kind = "publish";
+    a.topic = msg.topic;
+    a.qos = msg.qos;
+    a.id = (msg.qos > 0) ? msg.packet_id : -1;
+    a.payload = msg.payload.data();
+    a.len = msg.payload.size();
+    log_.record(a);
+
+    if (config_.drop_permille > 0 && roll_permille() < config_.drop_permille) {
+        arrival d;
+
+        d.session = s->id;
+        d.token = s->token;
+        d.kind = "drop";
+        d.reason = "publish";
+        s->dropped = true;
+        log_.record(d);
+        return false;
+    }
+
+    int64_t delay = reply_delay_ms();
+
+    if (msg.qos == 1) {
+        if (config_.ack_loss_permille > 0 && roll_permille() < config_.ack_loss_permille) {
+            arrival w;
+
+            w.session = s->id;
+            w.token = s->token;
+            w.kind = "withheld";
+            w.id = msg.packet_id;
+            log_.record(w);
+        } else {
+            send(s, mqtt::encode_puback(msg.packet_id), delay, msg.packet_id, rx_ms);
+        }
+    }
+
+    if (msg.topic == attributes_topic) {
+        json_members members;
+
+        if (parse_members(text, members)) {
+            std::lock_guard<std::mutex> guard(s->lock);
+
+            for (const auto &kv : members) {
+                s->client_attrs[kv.first] = kv.second;
+            }
+        }
+    } else if (msg.topic.compare(0, attr_request_prefix.size(), attr_request_prefix) == 0) {
+        std::string id = msg.topic.substr(attr_request_prefix.size());
+
+        deliver(s, attr_response_prefix + id, attribute_response(s, text), delay);
+    } else if (msg.topic.compare(0, rpc_response_prefix.size(), rpc_response_prefix) == 0) {
+        int id = std::atoi(msg.topic.c_str() + rpc_response_prefix.size());
+        arrival r;
+
+        r.session = s->id;
+        r.token = s->token;
+        r.kind = "rpc_reply";
+        r.id = id;
+        {
+            std::lock_guard<std::mutex> guard(s->lock);
+            auto it = s->rpc_sent_ms.find(id);
+
+            if (it != s->rpc_sent_ms.end()) {
+                r.delay_ms = rx_ms - it->second;
+                s->rpc_sent_ms.erase(it);
+            }
+        }
+        log_.record(r);
+    } else if (msg.topic.compare(0, rpc_request_prefix.size(), rpc_request_prefix) == 0) {
+        /* Client-side RPC */
+        std::string id = msg.topic.substr(rpc_request_prefix.size());
+        json_members req;
+        bool found = false;
+        std::string method;
+
+        if (parse_members(text, req)) {
+            method = string_member(req, "method", &found);
+        }
+
+        std::string reply = (method == "getCurrentTime") ?
+                            "{\"time\":" + std::to_string(unix_ms()) + "}" :
+                            "{\"error\":" + json_quote("unknown method " + method) + "}";
+
+        deliver(s, rpc_response_prefix + id, reply, delay);
+    }
+    return true;
+}
+
+void device_api::serve(const std::shared_ptr<session> &s)
+{
+    mqtt::packet pkt;
+    mqtt::connect_msg cmsg;
+    timeval tv{CONNECT_TIMEOUT_MS / 1000, 0};
+    std::string end_reason = "closed";
+    bool accepted = false;
+
+    setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if (mqtt::read_packet(s->fd, pkt) && pkt.type() == mqtt::CONNECT &&
+        mqtt::parse_connect(pkt, cmsg)) {
+        uint8_t code = 0;
+        arrival a;
+
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+
+            code = (now_ms() < refuse_until_ms_) ? 3 : 0;     /* Server unavailable */
+        }
+        if (code == 0 && !token_allowed(cmsg.username)) {
+            code = 5;                                           /* Not authorized */
+        }
+        s->token = cmsg.username;
+        a.session = s->id;
+        a.token = s->token;
+        a.kind = (code == 0) ? "connect" : "refused";
+        a.reason = (code == 3) ? "outage" : (code == 5) ? "token" : cmsg.client_id;
+        log_.record(a);
+
+        if (code != 0) {
+            mqtt::write_packet(s->fd, mqtt::encode_connack(code));
+        } else {
+            accepted = true;
+            send(s, mqtt::encode_connack(0), reply_delay_ms());
+
+            /* Keep-alive: the client has 1.5 intervals to send something */
+            int keepalive_ms = cmsg.keepalive_sec * 1500;
+
+            tv = timeval{keepalive_ms / 1000, (keepalive_ms % 1000) * 1000};
+            setsockopt(s->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        }
+    }
+
+    while (accepted && mqtt::read_packet(s->fd, pkt)) {
+        mqtt::publish_msg msg;
+        uint16_t id;
+
+        if (pkt.type() == mqtt::PUBLISH) {
+            if (!mqtt::parse_publish(pkt, msg) || !on_publish(s, msg)) {
+                break;
+            }
+        } else if (pkt.type() == mqtt::SUBSCRIBE) {
+            std::vector<std::pair<std::string, uint8_t>> filters;
+            std::vector<uint8_t> codes;
+            arrival a;
+
+            if (!mqtt::parse_subscribe(pkt, id, filters)) {
+                break;
+            }
+            {
+                std::lock_guard<std::mutex> guard(s->lock);
+
+                for (const auto &f : filters) {
+                    s->filters.insert(f.first);
+                    codes.push_back(std::min<uint8_t>(f.second, 1));
+                    a.topic += (a.topic.empty() ? "" : ",") + f.first;
+                }
+            }
+            a.session = s->id;
+            a.token = s->token;
+            a.kind = "subscribe";
+            a.id = id;
+            log_.record(a);
+            send(s, mqtt::encode_suback(id, codes), reply_delay_ms());
+        } else if (pkt.type() == mqtt::UNSUBSCRIBE) {
+            if (!mqtt::parse_packet_id(pkt, id)) {
+                break;
+            }
+            send(s, {0xB0, 0x02, static_cast<uint8_t>(id >> 8), static_cast<uint8_t>(id)},
+                 reply_delay_ms());
+        } else if (pkt.type() == mqtt::PINGREQ) {
+            send(s, mqtt::encode_empty(mqtt::PINGRESP), reply_delay_ms());
+        } else if (pkt.type() == mqtt::DISCONNECT) {
+            end_reason = "client";
+            break;
+        }
+        /* PUBACKs of our own publishes need nothing */
+    }
+
+    if (accepted && !s->dropped) {
+        arrival a;
+
+        a.session = s->id;
+        a.token = s->token;
+        a.kind = "disconnect";
+        a.reason = (errno == EAGAIN && end_reason == "closed") ? "keepalive" : end_reason;
+        log_.record(a);
+    }
+
+    shutdown(s->fd, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> guard(s->lock);
+
+        s->closing = true;
+        s->cv.notify_one();
+    }
+    s->writer.join();
+
+    /* drop_all() skips finished sessions, so their fd is never reused under it */
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        s->done = true;
+    }
+    close(s->fd);
+}
+
+} // namespace wm
@@ -0,0 +1,172 @@
+/**
+ * @file device_api.hpp
+ * @brief The ThingsBoard MQTT device API, as far as the firmware uses it
+ *
+ * @details
+ * Devices connect with their access token as the username. The mock
+ * handles:
+ *
+ * - v1/devices/me/telemetry, and any other topic: logged and acknowledged
+ * - v1/devices/me/attributes: client attributes of the device
+ * - v1/devices/me/attributes/request/<id>: answered on .../response/<id>
+ *   with {"client":{...},"shared":{...}}, filtered by "clientKeys" and
+ *   "sharedKeys" when given
+ * - shared attribute pushes to v1/devices/me/attributes (push_shared())
+ * - server-side RPC on v1/devices/me/rpc/request/<id> (send_rpc()); the
+ *   reply on .../rpc/response/<id> is logged with its round trip
+ * - client-side RPC on v1/devices/me/rpc/request/<id>: "getCurrentTime"
+ *   is answered with {"time":<Unix ms>}, other methods with an error
+ *
+ * Messages to a device go out only on topics it subscribed to, as with
+ * ThingsBoard. Shared attributes are one set for all devices.
+ *
+ * Impairments, all reproducible from the seed:
+ *
+ * - PUBACKs (and other replies) leave ack_delay_ms plus up to
+ *   ack_jitter_ms after the publish, in order, as on one TCP stream
+ * - ack_loss_permille of QoS 1 publishes get no PUBACK
+ * - drop_permille of publishes close the connection instead of an ack
+ * - drop_all() closes every connection; refuse_for() answers CONNECTs
+ *   with "server unavailable" for a while (scheduled outages)
+ *
+ * One reader and one writer thread per connection; meant for a handful of
+ * devices on a test bench.
+ */
+
+#ifndef WM_DEVICE_API_HPP_
+#define WM_DEVICE_API_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "arrival_log.hpp"
+#include "mqtt.hpp"
+
+namespace wm {
+
+struct device_api_config {
+    uint16_t port = 1883;
+    std::set<std::string> tokens;       /* Empty: any non-empty token */
+    int ack_delay_ms = 0;
+    int ack_jitter_ms = 0;
+    int ack_loss_permille = 0;
+    int drop_permille = 0;
+    uint32_t seed = 1;
+};
+
+class device_api {
+public:
+    device_api(const device_api_config &config, arrival_log &log);
+
+    /** @brief Closes every connection and joins the threads */
+    ~device_api();
+
+    device_api(const device_api &) = delete;
+    device_api &operator=(const device_api &) = delete;
+
+    /** @brief Listen and start accepting; false with errno set on failure */
+    bool start();
+
+    /**
+     * @brief Merge a JSON object into the shared attributes and push it to
+     *        the connected devices
+     *
+     * @return false if @p json is not an object
+     */
+    bool push_shared(const std::string &json);
+
+    /** @brief Server-side RPC to every connected device; returns its id */
+    int send_rpc(const std::string &method, const std::string &params_json);
+
+    /** @brief Close every connection now */
+    void drop_all(const std::string &reason);
+
+    /** @brief Refuse new connections for @p ms from now */
+    void refuse_for(int64_t ms);
+
+    size_t connected() const;
+
+    /** @brief Delay before a reply, by the configured delay and jitter */
+    int64_t reply_delay_ms();
+
+    /** @brief Whether @p token may connect */
+    bool token_allowed(const std::string &token) const;
+
+private:
+    struct outgoing {
+        int64_t due_ms;
+        std::vector<uint8_t> frame;
+        int ack_id;                     /* PUBACK being sent, else -1 */
+        int64_t publish_ms;
+    };
+
+    struct session {
+        unsigned id;
+        int fd;
+        std::string token;
+        std::set<std::string> filters;
+        std::map<std::string, std::string> client_attrs;
+        std::map<int, int64_t> rpc_sent_ms;
+        uint16_t next_packet_id = 1;
+
+        std::mutex lock;
+        std::condition_variable cv;
+        std::deque<outgoing> queue;
+        int64_t last_due_ms = 0;
+        bool closing = false;
+        std::atomic<bool> dropped{false};
+        std::atomic<bool> done{false};
+        std::thread reader;
+        std::thread writer;
+    };
+
+    device_api_config config_;
+    arrival_log &log_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread acceptor_;
+
+    mutable std::mutex lock_;
+    std::map<unsigned, std::shared_ptr<session>> sessions_;
+    std::map<std::string, std::string> shared_;
+    std::mt19937 rng_;
+    unsigned next_session_ = 1;
+    int next_rpc_ = 1;
+    int64_t refuse_until_ms_ = 0;
+
+    void accept_loop();
+    void serve(const std::shared_ptr<session> &s);
+    void writer_loop(const std::shared_ptr<session> &s);
+    void reap(bool all);
+
+    /** @brief Handle one PUBLISH; false to close the connection */
+    bool on_publish(const std::shared_ptr<session> &s, const mqtt::publish_msg &msg);
+
+    /** @brief Queue a frame after the replies already queued */
+    void send(const std::shared_ptr<session> &s, std::vector<uint8_t> frame, int64_t delay_ms,
+              int ack_id = -1, int64_t publish_ms = 0);
+
+    /** @brief PUBLISH to @p s if it subscribed to @p topic; false if not */
+    bool deliver(const std::shared_ptr<session> &s, const std::string &topic,
+                 const std::string &payload, int64_t delay_ms);
+
+    int roll_permille();
+
+    /** @brief Attribute request payload to response payload */
+    std::string attribute_response(const std::shared_ptr<session> &s,
+                                   const std::string &request);
+};
+
+} // namespace wm
+
+#endif /* WM_DEVICE_API_HPP_ */
@@ -0,0 +1,285 @@
+/**
+ * @file http_api.cpp
+ * @brief The ThingsBoard device HTTP API: telemetry and attribute POSTs
+ */
+
+#include "http_api.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "net.hpp"
+
+namespace wm {
+
+#define HTTP_TIMEOUT_SEC 10
+#define HTTP_MAX_BODY (1U << 20)
+
+/* ============================================================================
+ * REQUEST PARSING
+ * ============================================================================ */
+
+/* Buffered reads from the connection */
+class conn_reader {
+public:
+    explicit conn_reader(int fd) : fd_(fd) {}
+
+    /** @brief Next line without its CRLF; false on EOF or an overlong line */
+    bool line(std::string &out)
+    {
+        for (;;) {
+            size_t eol = buf_.find("\r\n", pos_);
+
+            if (eol != std::string::npos) {
+                out = buf_.substr(pos_, eol - pos_);
+                pos_ = eol + 2;
+                return true;
+            }
+            if (buf_.size() - pos_ > 8192 || !fill()) {
+                return false;
+            }
+        }
+    }
+
+    bool bytes(size_t n, std::string &out)
+    {
+        while (buf_.size() - pos_ < n) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        out += buf_.substr(pos_, n);
+        pos_ += n;
+        return true;
+    }
+
+private:
+    int fd_;
+    std::string buf_;
+    size_t pos_ = 0;
+
+    bool fill()
+    {
+        char chunk[4096];
+        ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+
+        if (n <= 0) {
+            return false;
+        }
+        buf_.erase(0, pos_);
+        pos_ = 0;
+        buf_.append(chunk, n);
+        return true;
+    }
+};
+
+struct http_request {
+    std::string method;
+    std::string path;
+    std::string body;
+};
+
+static std::string lower(std::string s)
+{
+    std::transform(s.begin(), s.end(), s.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return s;
+}
+
+static bool read_request(conn_reader &in, http_request &req)
+{
+    std::string line;
+    size_t content_length = 0;
+    bool chunked = false;
+
+    if (!in.line(line)) {
+        return false;
+    }
+
+    size_t sp1 = line.find(' ');
+    size_t sp2 = line.find(' ', sp1 + 1);
+
+    if (sp1 == std::string::npos || sp2 == std::string::npos) {
+        return false;
+    }
+    req.method = line.substr(0, sp1);
+    req.path = line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+    while (in.line(line) && !line.empty()) {
+        size_t colon = line.find(':');
+
+        if (colon == std::string::npos) {
+            continue;
+        }
+
+        size_t start = std::min(line.find_first_not_of(' ', colon + 1), line.size());
+        std::string name = lower(line.substr(0, colon));
+        std::string value = lower(line.substr(start));
+
+        if (name == "content-length") {
+            content_length = std::strtoul(value.c_str(), nullptr, 10);
+        } else if (name == "transfer-encoding") {
+            chunked = value.find("chunked") != std::string::npos;
+        }
+    }
+    if (!line.empty()) {
+        return false;
+    }
+
+    if (!chunked) {
+        return content_length <= HTTP_MAX_BODY && in.bytes(content_length, req.body);
+    }
+
+    for (;;) {
+        if (!in.line(line)) {
+            return false;
+        }
+
+        size_t size = std::strtoul(line.c_str(), nullptr, 16);
+
+        if (req.body.size() + size > HTTP_MAX_BODY) {
+            return false;
+        }
+        if (size == 0) {
+            /* Trailers, then the empty line */
+            while (in.line(line) && !line.empty()) {
+            }
+            return line.empty();
+        }
+        if (!in.bytes(size, req.body) || !in.line(line) || !line.empty()) {
+            return false;
+        }
+    }
+}
+
+/* ============================================================================
+ * SERVER
+ * ============================================================================ */
+
+http_api::http_api(uint16_t port, device_api &devices, arrival_log &log)
+    : port_(port), devices_(devices), log_(log)
+{
+}
+
+http_api::~http_api()
+{
+    running_ = false;
+    if (acceptor_.joinable()) {
+        acceptor_.join();
+    }
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
+    reap(true);
+}
+
+bool http_api::start()
+{
+    listen_fd_ = tcp_listen(port_);
+    if (listen_fd_ < 0) {
+        return false;
+    }
+    running_ = true;
+    acceptor_ = std::thread(&http_api::accept_loop, this);
+    return true;
+}
+
+void http_api::accept_loop()
+{
+    while (running_) {
+        pollfd pfd{listen_fd_, POLLIN, 0};
+
+        reap(false);
+        if (poll(&pfd, 1, 500) != 1) {
+            continue;
+        }
+
+        int fd = accept(listen_fd_, nullptr, nullptr);
+
+        if (fd < 0) {
+            continue;
+        }
+
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        std::lock_guard<std::mutex> guard(lock_);
+
+        requests_.push_back(request_thread{std::thread([this, fd, done] {
+                                               serve(fd);
+                                               *done = true;
+                                           }),
+                                           done});
+    }
+}
+
+void http_api::reap(bool all)
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    for (auto it = requests_.begin(); it != requests_.end();) {
+        if (all || *it->done) {
+            it->thread.join();
+            it = requests_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void http_api::serve(int fd)
+{
+    static const std::string prefix = "/api/v1/";
+    timeval tv{HTTP_TIMEOUT_SEC, 0};
+    conn_reader in(fd);
+    http_request req;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (!read_request(in, req)) {
+        close(fd);
+        return;
+    }
+
+    /* /api/v1/<token>/telemetry or /api/v1/<token>/attributes */
+    std::string token, resource;
+    int status = 404;
+
+    if (req.path.compare(0, prefix.size(), prefix) == 0) {
+        size_t slash = req.path.find('/', prefix.size());
+
+        if (slash != std::string::npos) {
+            token = req.path.substr(prefix.size(), slash - prefix.size());
+            resource = req.path.substr(slash + 1);
+        }
+    }
+    if (req.method == "POST" && (resource == "telemetry" || resource == "attributes")) {
+        status = devices_.token_allowed(token) ? 200 : 401;
+    }
+
+    arrival a;
+
+    a.token = token;
+    a.kind = "http";
+    a.topic = req.path;
+    a.reason = (status == 200) ? "" : std::to_string(status);
+    a.payload = reinterpret_cast<const uint8_t *>(req.body.data());
+    a.len = req.body.size();
+    log_.record(a);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(devices_.reply_delay_ms()));
+
+    const char *text = (status == 200) ? "OK" : (status == 401) ? "Unauthorized" : "Not Found";
+    std::string reply = "HTTP/1.1 " + std::to_string(status) + " " + text +
+                        "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+
+    send_all(fd, reply.data(), reply.size());
+    close(fd);
+}
+
+} // namespace wm
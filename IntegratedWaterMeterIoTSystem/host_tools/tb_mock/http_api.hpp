@@ -0,0 +1,63 @@
+/**
+ * @file http_api.hpp
+ * @brief The ThingsBoard device HTTP API: telemetry and attribute POSTs
+ *
+ * @details
+ * Accepts POST /api/v1/<token>/telemetry and /api/v1/<token>/attributes
+ * with a Content-Length or chunked body (the firmware's bulk upload is
+ * chunked) and answers 200 after the configured reply delay, 401 for a
+ * token that may not connect, 404 for anything else. Every request is
+ * logged with kind "http". Connections are not kept alive.
+ */
+
+#ifndef WM_HTTP_API_HPP_
+#define WM_HTTP_API_HPP_
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "arrival_log.hpp"
+#include "device_api.hpp"
+
+namespace wm {
+
+class http_api {
+public:
+    /** @brief Tokens and the reply delay come from @p devices */
+    http_api(uint16_t port, device_api &devices, arrival_log &log);
+    ~http_api();
+
+    http_api(const http_api &) = delete;
+    http_api &operator=(const http_api &) = delete;
+
+    /** @brief Listen and start accepting; false with errno set on failure */
+    bool start();
+
+private:
+    struct request_thread {
+        std::thread thread;
+        std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    uint16_t port_;
+    device_api &devices_;
+    arrival_log &log_;
+    int listen_fd_ = -1;
+    std::atomic<bool> running_{false};
+    std::thread acceptor_;
+    std::mutex lock_;
+    std::list<request_thread> requests_;
+
+    void accept_loop();
+    void serve(int fd);
+    void reap(bool all);
+};
+
+} // namespace wm
+
+#endif /* WM_HTTP_API_HPP_ */
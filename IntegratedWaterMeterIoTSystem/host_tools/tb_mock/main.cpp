@@ -0,0 +1,232 @@
+/**
+ * @file main.cpp
+ * @brief tb_mock: a local stand-in for ThingsBoard's device APIs
+ *
+ * @details
+ * Speaks the MQTT and HTTP device APIs the firmware uses, so network
+ * behaviour (batching, PUBACK flow control, reconnects, attribute and RPC
+ * handling) can be measured on a bench without a cloud account, with
+ * repeatable reply delays and connection drops. Every arrival is written
+ * to a JSONL log (arrival_log.hpp); a summary goes to stderr at exit.
+ *
+ *   tb_mock [--mqtt-port 1883] [--http-port 8080] [--token T]...
+ *           [--ack-delay-ms 0] [--ack-jitter-ms 0] [--ack-loss-permille 0]
+ *           [--drop-permille 0] [--drop-every-sec 0] [--drop-for-sec 0]
+ *           [--attributes file.json] [--log arrivals.jsonl] [--seed 1]
+ *
+ * Commands on stdin, one per line:
+ *
+ *   attr {"uploadInterval":30}      push shared attributes
+ *   rpc <method> [params json]      server-side RPC to every device
+ *   drop                            close every connection
+ *   stats                           print the summary so far
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include <poll.h>
+#include <unistd.h>
+
+#include "arrival_log.hpp"
+#include "device_api.hpp"
+#include "http_api.hpp"
+#include "net.hpp"
+
+using namespace wm;
+
+static std::atomic<bool> running{true};
+
+struct options {
+    device_api_config device;
+    uint16_t http_port = 8080;          /* 0: no HTTP API */
+    int drop_every_sec = 0;             /* 0: no scheduled outages */
+    int drop_for_sec = 0;
+    std::string attributes_file;
+    std::string log_path = "-";
+};
+
+static void usage(const char *prog)
+{
+    std::fprintf(stderr,
+                 "usage: %s [--mqtt-port N] [--http-port N] [--token T]...\n"
+                 "          [--ack-delay-ms ms] [--ack-jitter-ms ms] [--ack-loss-permille N]\n"
+                 "          [--drop-permille N] [--drop-every-sec s] [--drop-for-sec s]\n"
+                 "          [--attributes file] [--log path|-] [--seed N]\n",
+                 prog);
+}
+
+static bool parse_args(int argc, char **argv, options &opt)
+{
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) {
+            return false;
+        }
+
+        const char *val = argv[++i];
+
+        if (arg == "--mqtt-port") {
+            opt.device.port = static_cast<uint16_t>(std::atoi(val));
+        } else if (arg == "--http-port") {
+            opt.http_port = static_cast<uint16_t>(std::atoi(val));
+        } else if (arg == "--token") {
+            opt.device.tokens.insert(val);
+        } else if (arg == "--ack-delay-ms") {
+            opt.device.ack_delay_ms = std::max(0, std::atoi(val));
+        } else if (arg == "--ack-jitter-ms") {
+            opt.device.ack_jitter_ms = std::max(0, std::atoi(val));
+        } else if (arg == "--ack-loss-permille") {
+            opt.device.ack_loss_permille = std::max(0, std::atoi(val));
+        } else if (arg == "--drop-permille") {
+            opt.device.drop_permille = std::max(0, std::atoi(val));
+        } else if (arg == "--drop-every-sec") {
+            opt.drop_every_sec = std::max(0, std::atoi(val));
+        } else if (arg == "--drop-for-sec") {
+            opt.drop_for_sec = std::max(0, std::atoi(val));
+        } else if (arg == "--attributes") {
+            opt.attributes_file = val;
+        } else if (arg == "--log") {
+            opt.log_path = val;
+        } else if (arg == "--seed") {
+            opt.device.seed = static_cast<uint32_t>(std::strtoul(val, nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void on_signal(int)
+{
+    running = false;
+}
+
+static void run_command(const std::string &line, device_api &devices, const arrival_log &log)
+{
+    std::istringstream in(line);
+    std::string cmd;
+
+    in >> cmd;
+
+    std::string rest;
+
+    std::getline(in >> std::ws, rest);
+    if (cmd == "attr") {
+        if (!devices.push_shared(rest)) {
+            std::fprintf(stderr, "attr: not a JSON object\n");
+        }
+    } else if (cmd == "rpc") {
+        size_t sp = rest.find(' ');
+        std::string method = rest.substr(0, sp);
+        std::string params = (sp == std::string::npos) ? "" : rest.substr(sp + 1);
+
+        if (method.empty()) {
+            std::fprintf(stderr, "rpc: method required\n");
+        } else {
+            std::fprintf(stderr, "rpc %d sent\n", devices.send_rpc(method, params));
+        }
+    } else if (cmd == "drop") {
+        devices.drop_all("command");
+    } else if (cmd == "stats") {
+        std::fprintf(stderr, "connected %zu\n", devices.connected());
+        log.print_summary(stderr);
+    } else if (!cmd.empty()) {
+        std::fprintf(stderr, "commands: attr <json> | rpc <method> [params] | drop | stats\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    options opt;
+
+    if (!parse_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 2;
+    }
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    arrival_log log(opt.log_path);
+
+    if (!log.ok()) {
+        std::fprintf(stderr, "%s: %s\n", opt.log_path.c_str(), std::strerror(errno));
+        return 1;
+    }
+
+    device_api devices(opt.device, log);
+    std::unique_ptr<http_api> http;
+
+    if (!devices.start()) {
+        std::fprintf(stderr, "MQTT port %u: %s\n", opt.device.port, std::strerror(errno));
+        return 1;
+    }
+    if (opt.http_port != 0) {
+        http = std::make_unique<http_api>(opt.http_port, devices, log);
+        if (!http->start()) {
+            std::fprintf(stderr, "HTTP port %u: %s\n", opt.http_port, std::strerror(errno));
+            return 1;
+        }
+    }
+    if (!opt.attributes_file.empty()) {
+        std::ifstream f(opt.attributes_file);
+        std::stringstream text;
+
+        text << f.rdbuf();
+        if (!f || !devices.push_shared(text.str())) {
+            std::fprintf(stderr, "%s: not a JSON object\n", opt.attributes_file.c_str());
+            return 1;
+        }
+    }
+
+    std::fprintf(stderr, "tb_mock: MQTT on %u, HTTP on %u, ack delay %d+%d ms, %s tokens\n",
+                 opt.device.port, opt.http_port, opt.device.ack_delay_ms,
+                 opt.device.ack_jitter_ms, opt.device.tokens.empty() ? "any" : "listed");
+
+    int64_t next_drop = opt.drop_every_sec ? now_ms() + opt.drop_every_sec * 1000LL : 0;
+    bool stdin_open = true;
+    std::string pending;
+
+    while (running) {
+        pollfd pfd{STDIN_FILENO, POLLIN, 0};
+
+        if (poll(&pfd, stdin_open ? 1 : 0, 200) == 1) {
+            char buf[1024];
+            ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+
+            if (n <= 0) {
+                stdin_open = false;     /* Keep serving without commands */
+            } else {
+                pending.append(buf, n);
+            }
+
+            size_t eol;
+
+            while ((eol = pending.find('\n')) != std::string::npos) {
+                run_command(pending.substr(0, eol), devices, log);
+                pending.erase(0, eol + 1);
+            }
+        }
+
+        if (next_drop != 0 && now_ms() >= next_drop) {
+            devices.drop_all("scheduled");
+            devices.refuse_for(opt.drop_for_sec * 1000LL);
+            next_drop += opt.drop_every_sec * 1000LL;
+        }
+    }
+
+    http.reset();
+    std::fprintf(stderr, "connected %zu\n", devices.connected());
+    log.print_summary(stderr);
+    return 0;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file rollup_test.c
+ * @brief Host checks of the 15-minute and daily aggregates
+ *
+ * @details
+ * Buckets must carry the minimum, maximum and OR of their samples, and the
+ * volumes of the 15-minute buckets of a day must add up to the daily one
+ * and to the totalizer difference, across gaps and the local day boundary.
+ * A day rebuilt from stored buckets after a reboot must match the one kept
+ * in RAM. Retention must erase the oldest sectors of the ring in order,
+ * also once the ring has wrapped, and keep records after a clock step back.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rollup.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define DAY0 1699920000U            /* 2023-11-14 00:00 UTC */
+#define SAMPLE_SEC 300
+#define DAY_OFFSET_S 7200           /* UTC+2 */
+#define QUARTER_MAX 512
+
+static struct rollup r;
+static struct rollup_record quarters[QUARTER_MAX];
+static int quarter_count;
+static struct rollup_record days[8];
+static int day_count;
+
+static void reset(int32_t day_offset_s)
+{
+    rollup_init(&r, day_offset_s);
+    quarter_count = 0;
+    day_count = 0;
+}
+
+static void add(uint32_t ts_s, uint32_t flow, uint32_t forward, uint32_t reverse,
+                uint32_t pressure, uint32_t status)
+{
+    const uint32_t values[BOVE_FIELD_COUNT] = {
+        [BOVE_FLOW_RATE] = flow,
+        [BOVE_FORWARD_TOTAL] = forward,
+        [BOVE_REVERSE_TOTAL] = reverse,
+        [BOVE_PRESSURE] = pressure,
+        [BOVE_STATUS] = status,
+    };
+    struct rollup_closed out[2];
+    int n = rollup_add(&r, ts_s, values, out);
+
+    for (int i = 0; i < n; i++) {
+        if (out[i].tier == ROLLUP_QUARTER && quarter_count < QUARTER_MAX) {
+            quarters[quarter_count++] = out[i].rec;
+        } else if (out[i].tier == ROLLUP_DAILY && day_count < 8) {
+            days[day_count++] = out[i].rec;
+        }
+    }
+}
+
+static void test_quarter(void)
+{
+    reset(0);
+    add(DAY0 + 0, 100, 1000, 5, 310, 0);
+    add(DAY0 + 300, 900, 1004, 5, 290, BOVE_STATUS_EMPTY);
+    add(DAY0 + 600, 400, 1010, 6, 330, 0);
+    CHECK(quarter_count == 0);
+
+    /* The first sample of the next bucket closes this one */
+    add(DAY0 + 900, 0, 1010, 6, 300, BOVE_STATUS_LOW_BATTERY);
+    CHECK(quarter_count == 1);
+
+    const struct rollup_record *q = &quarters[0];
+
+    CHECK(q->start_s == DAY0);
+    CHECK(q->samples == 3);
+    CHECK(q->flow_max == 900);
+    CHECK(q->pressure_min == 290 && q->pressure_max == 330);
+    CHECK(q->status == BOVE_STATUS_EMPTY);
+    CHECK(q->forward_total == 1010 && q->forward_used == 10);
+    CHECK(q->reverse_total == 6 && q->reverse_used == 1);
+
+    /* A gap: its volume lands in the next bucket */
+    add(DAY0 + 3600, 0, 1050, 6, 300, 0);
+    CHECK(quarter_count == 2);
+    CHECK(quarters[1].start_s == DAY0 + 900 && quarters[1].forward_used == 0);
+    add(DAY0 + 4500, 0, 1050, 6, 300, 0);
+    CHECK(quarter_count == 3);
+    CHECK(quarters[2].start_s == DAY0 + 3600 && quarters[2].forward_used == 40);
+
+    /* A totalizer that goes back (meter swapped) counts nothing */
+    add(DAY0 + 5400, 0, 20, 0, 300, 0);
+    add(DAY0 + 6300, 0, 25, 0, 300, 0);
+    CHECK(quarter_count == 5);
+    CHECK(quarters[4].forward_used == 0 && quarters[4].reverse_used == 0);
+    add(DAY0 + 7200, 0, 25, 0, 300, 0);
+    CHECK(quarter_count == 6 && quarters[5].forward_used == 5);
+}
+
+/** @brief Pressure and flow of sample @p i, varying over the day */
+static uint32_t pressure_at(int i)
+{
+    return 250 + (uint32_t)(i * 37 % 101);
+}
+
+static uint32_t flow_at(int i)
+{
+    return (uint32_t)(i * 7919 % 50000);
+}
+
+static void test_days(void)
+{
+    const int count = 2 * 288 + 20;         /* Two days and a bit of 5 min samples */
+    uint32_t forward = 5000;
+
+    reset(DAY_OFFSET_S);
+    for (int i = 0; i < count; i++) {
+        forward += (uint32_t)(i % 13);
+        add(DAY0 + (uint32_t)i * SAMPLE_SEC, flow_at(i), forward, 0, pressure_at(i),
+            (i == 400) ? BOVE_STATUS_EMPTY : 0);
+    }
+
+    /* Days start at 22:00 UTC: one partial day, one full, one still open */
+    CHECK(day_count == 2);
+    CHECK(days[0].start_s == DAY0 - DAY_OFFSET_S);
+    CHECK(days[1].start_s == DAY0 - DAY_OFFSET_S + ROLLUP_DAY_SEC);
+    CHECK(days[1].samples == 288);
+    CHECK(days[1].status == BOVE_STATUS_EMPTY);
+    CHECK(r.day.start_s == DAY0 - DAY_OFFSET_S + 2 * ROLLUP_DAY_SEC);
+
+    /* Each day is the sum / min / max of its buckets */
+    uint32_t prev_total = 5000;
+
+    for (int d = 0; d < day_count; d++) {
+        uint32_t used = 0, flow_max = 0, samples = 0;
+        uint16_t p_min = UINT16_MAX, p_max = 0;
+        uint32_t last_total = 0;
+
+        for (int k = 0; k < quarter_count; k++) {
+            const struct rollup_record *q = &quarters[k];
+
+            if (q->start_s < days[d].start_s ||
+                q->start_s >= days[d].start_s + ROLLUP_DAY_SEC) {
+                continue;
+            }
+            used += q->forward_used;
+            flow_max = (q->flow_max > flow_max) ? q->flow_max : flow_max;
+            p_min = (q->pressure_min < p_min) ? q->pressure_min : p_min;
+            p_max = (q->pressure_max > p_max) ? q->pressure_max : p_max;
+            samples += q->samples;
+            last_total = q->forward_total;
+        }
+        CHECK(days[d].forward_used == used);
+        CHECK(days[d].forward_used == last_total - prev_total);
+        CHECK(days[d].forward_total == last_total);
+        CHECK(days[d].flow_max == flow_max);
+        CHECK(days[d].pressure_min == p_min && days[d].pressure_max == p_max);
+        CHECK(days[d].samples == samples);
+        prev_total = last_total;
+    }
+
+    /* The same extremes straight from the samples of the full day */
+    uint32_t first = (ROLLUP_DAY_SEC - DAY_OFFSET_S) / SAMPLE_SEC;
+    uint32_t flow_max = 0;
+    uint16_t p_min = UINT16_MAX, p_max = 0;
+
+    for (uint32_t i = first; i < first + 288; i++) {
+        flow_max = (flow_at((int)i) > flow_max) ? flow_at((int)i) : flow_max;
+        p_min = (pressure_at((int)i) < p_min) ? (uint16_t)pressure_at((int)i) : p_min;
+        p_max = (pressure_at((int)i) > p_max) ? (uint16_t)pressure_at((int)i) : p_max;
+    }
+    CHECK(days[1].flow_max == flow_max);
+    CHECK(days[1].pressure_min == p_min && days[1].pressure_max == p_max);
+}
+
+static void test_restore(void)
+{
+    struct rollup rebuilt;
+
+    /* test_days left two closed days and an open one */
+    rollup_init(&rebuilt, DAY_OFFSET_S);
+    for (int k = 0; k < quarter_count; k++) {
+        rollup_restore(&rebuilt, &quarters[k], days[day_count - 1].start_s);
+    }
+    CHECK(rebuilt.have_base);
+    CHECK(rebuilt.forward_base == r.forward_base);
+    CHECK(rebuilt.day.start_s == r.day.start_s);
+    CHECK(rebuilt.day.samples == r.day.samples);
+    CHECK(rebuilt.day.forward_used == r.day.forward_used);
+    CHECK(rebuilt.day.flow_max == r.day.flow_max);
+    CHECK(rebuilt.day.pressure_min == r.day.pressure_min);
+    CHECK(rebuilt.day.pressure_max == r.day.pressure_max);
+}
+
+#define SECTORS 6
+#define PER_SECTOR 3
+
+/**
+ * @brief Retention over a ring of sectors, as the archive applies it
+ *
+ * A sector is erased once the first record of the next one is past
+ * retention; the active sector is never erased.
+ */
+static void test_retention(void)
+{
+    const uint32_t retention_s = 10 * ROLLUP_DAY_SEC;
+    uint32_t first[SECTORS] = { 0 };
+    int oldest = 0, active = 0, fill = 0, erased = 0;
+    uint32_t now = DAY0;
+
+    CHECK(!rollup_past_retention(DAY0, DAY0 + retention_s - 1, retention_s));
+    CHECK(rollup_past_retention(DAY0, DAY0 + retention_s, retention_s));
+    CHECK(!rollup_past_retention(DAY0 + 10, DAY0, retention_s));
+    CHECK(!rollup_past_retention(UINT32_MAX, DAY0, retention_s));
+
+    /* One record a day for 40 days: the ring wraps several times */
+    for (int day = 0; day < 40; day++, now += ROLLUP_DAY_SEC) {
+        while (oldest != active) {
+            int next = (oldest + 1) % SECTORS;
+
+            if (first[next] == 0 || !rollup_past_retention(first[next], now, retention_s)) {
+                break;
+            }
+            first[oldest] = 0;
+            oldest = next;
+            erased++;
+        }
+
+        if (fill == PER_SECTOR) {
+            active = (active + 1) % SECTORS;
+            CHECK(active != oldest);        /* Retention frees it in time */
+            fill = 0;
+        }
+        if (fill == 0) {
+            first[active] = now;
+        }
+        fill++;
+
+        /* Whatever is stored spans less than retention plus one sector */
+        CHECK(now - first[oldest] < retention_s + PER_SECTOR * ROLLUP_DAY_SEC);
+    }
+    CHECK(erased >= 40 / PER_SECTOR - SECTORS);
+
+    /* The clock set back a year: nothing is erased */
+    int before = oldest;
+
+    now -= 365U * ROLLUP_DAY_SEC;
+    for (int next = (oldest + 1) % SECTORS; oldest != active; next = (oldest + 1) % SECTORS) {
+        if (first[next] == 0 || !rollup_past_retention(first[next], now, retention_s)) {
+            break;
+        }
+        oldest = next;
+    }
+    CHECK(oldest == before);
+}
+
+static void test_pick_tier(void)
+{
+    const uint32_t oldest[ROLLUP_TIER_COUNT] = {
+        [ROLLUP_RAW] = DAY0 - ROLLUP_DAY_SEC,
+        [ROLLUP_QUARTER] = DAY0 - 14 * ROLLUP_DAY_SEC,
+        [ROLLUP_DAILY] = DAY0 - 700 * ROLLUP_DAY_SEC,
+    };
+
+    CHECK(rollup_pick_tier(0, DAY0, oldest) == ROLLUP_RAW);
+    CHECK(rollup_pick_tier(0, DAY0 - 2 * ROLLUP_DAY_SEC, oldest) == ROLLUP_QUARTER);
+    CHECK(rollup_pick_tier(ROLLUP_QUARTER_SEC, DAY0, oldest) == ROLLUP_QUARTER);
+    CHECK(rollup_pick_tier(ROLLUP_DAY_SEC, DAY0, oldest) == ROLLUP_DAILY);
+    CHECK(rollup_pick_tier(0, 0, oldest) == ROLLUP_DAILY);
+}
+
+int main(void)
+{
+    test_quarter();
+    test_days();
+    test_restore();
+    test_retention();
+    test_pick_tier();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("rollup_test: ok\n");
+    return 0;
+}
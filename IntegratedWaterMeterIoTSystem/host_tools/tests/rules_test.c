@@ -0,0 +1,113 @@
+/**
+ * @file rules_test.c
+ * @brief Host checks of the alarm rule compiler against hostile rule text
+ *
+ * @details
+ * alarmRules comes from the cloud, so the compiler must reject what would
+ * exhaust its stack and the evaluator must stay defined on any operands.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rules.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+static struct rule_set set;
+
+static int compile(const char *text, char *err, size_t err_len)
+{
+    return rules_compile(text, &set, err, err_len);
+}
+
+/* "a: " + @p depth times @p open + "flow_rate" + closing parentheses */
+static void nested(char *text, size_t len, int depth, char open)
+{
+    size_t n = (size_t)snprintf(text, len, "a: ");
+
+    for (int i = 0; i < depth && n + 16 < len; i++) {
+        text[n++] = open;
+    }
+    for (const char *p = "flow_rate"; *p != '\0'; p++) {
+        text[n++] = *p;
+    }
+    for (int i = 0; open == '(' && i < depth && n + 1 < len; i++) {
+        text[n++] = ')';
+    }
+    text[n] = '\0';
+}
+
+static void test_nesting(void)
+{
+    static const char opens[] = { '(', '!', '-' };
+    char text[800];
+    char err[96];
+
+    for (size_t i = 0; i < sizeof(opens); i++) {
+        nested(text, sizeof(text), RULES_MAX_NESTING, opens[i]);
+        CHECK(compile(text, err, sizeof(err)) == 0);
+
+        nested(text, sizeof(text), RULES_MAX_NESTING + 1, opens[i]);
+        CHECK(compile(text, err, sizeof(err)) != 0);
+        CHECK(strstr(err, "nested too deep") != NULL);
+
+        /* As long as the attribute allows */
+        nested(text, 768, 760, opens[i]);
+        CHECK(compile(text, err, sizeof(err)) != 0);
+    }
+}
+
+static int compile_ok(const char *text)
+{
+    char err[96];
+
+    return compile(text, err, sizeof(err));
+}
+
+static void test_saturation(void)
+{
+    meter_data_t d = { 0 };
+
+    CHECK(compile_ok("a: (0 - 2147483647 - 1) / -1 == 2147483647") == 0);
+    CHECK(rules_exec(&set.rules[0], &d, 0) != 0);
+
+    CHECK(compile_ok("a: (0 - 2147483647 - 1) % -1 == 0") == 0);
+    CHECK(rules_exec(&set.rules[0], &d, 0) != 0);
+
+    CHECK(compile_ok("a: 2147483647 + 1 == 2147483647") == 0);
+    CHECK(rules_exec(&set.rules[0], &d, 0) != 0);
+
+    CHECK(compile_ok("a: 65536 * 65536 == 2147483647") == 0);
+    CHECK(rules_exec(&set.rules[0], &d, 0) != 0);
+
+    CHECK(compile_ok("a: -(0 - 2147483647 - 1) == 2147483647") == 0);
+    CHECK(rules_exec(&set.rules[0], &d, 0) != 0);
+
+    /* Hysteresis bias past the limit still compares correctly */
+    CHECK(compile_ok("a: flow_rate < 2147483647 hyst 10") == 0);
+    d.flow_rate = 100;
+    CHECK(rules_exec(&set.rules[0], &d, 10) != 0);
+}
+
+int main(void)
+{
+    test_nesting();
+    test_saturation();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("rules_test: ok\n");
+    return 0;
+}
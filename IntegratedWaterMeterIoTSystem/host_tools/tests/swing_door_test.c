@@ -0,0 +1,202 @@
+/**
+ * @file swing_door_test.c
+ * @brief Host checks of the swinging-door compressor
+ *
+ * @details
+ * Every sample fed in must be reproduced within its field's tolerance by
+ * interpolating between the archived points around it, the points must
+ * account for every sample, and a tolerance of 0 must keep a field exact.
+ * Segments close on a clock step back and after the longest gap.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "swing_door.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define SAMPLE_MS 30000
+#define MAX_GAP_MS (15U * 60U * 1000U)
+#define SAMPLE_COUNT 2000
+#define POINT_MAX (SAMPLE_COUNT + 1)
+
+static const uint32_t tol[BOVE_FIELD_COUNT] = {
+    [BOVE_FLOW_RATE] = 50,
+    [BOVE_FORWARD_TOTAL] = 2,
+    [BOVE_REVERSE_TOTAL] = 2,
+    [BOVE_PRESSURE] = 5,
+    [BOVE_TEMPERATURE] = 20,
+    [BOVE_STATUS] = 0,
+};
+
+static struct telemetry_record samples[SAMPLE_COUNT];
+static struct swing_door_point points[POINT_MAX];
+static struct swing_door sd;
+
+/* Deterministic noise, so a failure reproduces */
+static uint32_t rng_state = 12345;
+
+static int32_t noise(int32_t amplitude)
+{
+    rng_state = rng_state * 1103515245U + 12345U;
+    return (int32_t)((rng_state >> 16) % (2U * amplitude + 1U)) - amplitude;
+}
+
+/**
+ * @brief A day of meter readings: ramps, steps, noise and a status flag
+ */
+static void make_samples(void)
+{
+    uint32_t forward = 123456;
+    int32_t flow = 0;
+
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        struct telemetry_record *s = &samples[i];
+
+        /* Demand changes now and then, with meter noise on top */
+        if (i % 200 == 0) {
+            flow = (i / 200 % 3) * 40000;
+        }
+        int32_t f = flow + noise(30);
+
+        if (f < 0) {
+            f = 0;
+        }
+        forward += (uint32_t)f / 12000;
+
+        s->ts_ms = 1700000000000LL + (int64_t)i * SAMPLE_MS;
+        s->values[BOVE_FLOW_RATE] = (uint32_t)f;
+        s->values[BOVE_FORWARD_TOTAL] = forward;
+        s->values[BOVE_REVERSE_TOTAL] = 42;
+        s->values[BOVE_PRESSURE] = (uint32_t)(300 + (i % 500) / 10 + noise(3));
+        s->values[BOVE_TEMPERATURE] = (uint32_t)(1500 + noise(10));
+        s->values[BOVE_STATUS] = (i >= 700 && i < 760) ? BOVE_STATUS_EMPTY : 0;
+    }
+}
+
+/** @brief Compress @p n samples; returns the number of points */
+static int compress(const struct telemetry_record *in, int n)
+{
+    struct swing_door_point out[SWING_DOOR_OUT_MAX];
+    int count = 0;
+
+    swing_door_init(&sd, tol, MAX_GAP_MS);
+    for (int i = 0; i < n; i++) {
+        int got = swing_door_add(&sd, &in[i], out);
+
+        for (int k = 0; k < got && count < POINT_MAX; k++) {
+            points[count++] = out[k];
+        }
+    }
+    if (count < POINT_MAX && swing_door_flush(&sd, &points[count])) {
+        count++;
+    }
+    return count;
+}
+
+static void test_within_tolerance(void)
+{
+    make_samples();
+
+    int count = compress(samples, SAMPLE_COUNT);
+    uint32_t covered = 0;
+
+    CHECK(count > 1 && count < SAMPLE_COUNT / 4);
+    CHECK(sd.samples_in == SAMPLE_COUNT);
+    CHECK(sd.points_out == (uint32_t)count);
+    for (int p = 0; p < count; p++) {
+        covered += points[p].samples;
+    }
+    CHECK(covered == SAMPLE_COUNT);
+
+    /* Every sample lies within tolerance of the line between its points */
+    int p = 0;
+    uint32_t worst[BOVE_FIELD_COUNT] = { 0 };
+
+    for (int i = 0; i < SAMPLE_COUNT; i++) {
+        while (p < count && points[p].rec.ts_ms < samples[i].ts_ms) {
+            p++;
+        }
+        if (p == count) {
+            CHECK(p < count);
+            break;
+        }
+
+        const struct telemetry_record *a = &points[(p > 0) ? p - 1 : 0].rec;
+        const struct telemetry_record *b = &points[p].rec;
+
+        for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+            int64_t v = swing_door_value_at(a, b, (enum bove_field)f, samples[i].ts_ms);
+            uint32_t dev = (uint32_t)llabs(v - (int64_t)samples[i].values[f]);
+
+            if (dev > worst[f]) {
+                worst[f] = dev;
+            }
+        }
+    }
+    for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+        if (worst[f] > tol[f]) {
+            fprintf(stderr, "field %d off by %u, tolerance %u\n", f, worst[f], tol[f]);
+        }
+        CHECK(worst[f] <= tol[f]);
+    }
+}
+
+static void test_flat_and_gap(void)
+{
+    /* A flat signal leaves one point per longest segment */
+    for (int i = 0; i < 100; i++) {
+        samples[i] = (struct telemetry_record){ .ts_ms = (int64_t)i * SAMPLE_MS };
+        samples[i].values[BOVE_PRESSURE] = 300;
+    }
+
+    int count = compress(samples, 100);
+
+    CHECK(count >= (int)(99 * SAMPLE_MS / MAX_GAP_MS));
+    CHECK(count <= (int)(99 * SAMPLE_MS / MAX_GAP_MS) + 2);
+    for (int p = 1; p < count; p++) {
+        CHECK(points[p].rec.ts_ms - points[p - 1].rec.ts_ms <= MAX_GAP_MS);
+        CHECK(points[p].rec.values[BOVE_PRESSURE] == 300);
+    }
+}
+
+static void test_clock_back(void)
+{
+    struct swing_door_point out[SWING_DOOR_OUT_MAX];
+    struct telemetry_record r = { .ts_ms = 100000 };
+
+    swing_door_init(&sd, tol, MAX_GAP_MS);
+    CHECK(swing_door_add(&sd, &r, out) == 1);
+    r.ts_ms += SAMPLE_MS;
+    CHECK(swing_door_add(&sd, &r, out) == 0);
+
+    /* The held sample and the step back itself are both stored */
+    r.ts_ms -= 2 * SAMPLE_MS;
+    CHECK(swing_door_add(&sd, &r, out) == 2);
+    CHECK(out[0].rec.ts_ms == 100000 + SAMPLE_MS && out[0].samples == 1);
+    CHECK(out[1].rec.ts_ms == r.ts_ms && out[1].samples == 1);
+}
+
+int main(void)
+{
+    test_within_tolerance();
+    test_flat_and_gap();
+    test_clock_back();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("swing_door_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file telemetry_batch_test.c
+ * @brief Host checks of the AIMD batch controller
+ *
+ * @details
+ * Fast acknowledgements grow the batch by one sample and one period, slow
+ * ones hold it, losses halve it once per hold-off, and the smoothed PUBACK
+ * latency follows both directions without losing its first sample.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "telemetry_batch.h"
+
+static int failures;
+
+#define CHECK(cond)                                                         \
+    do {                                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+#define PERIOD_MS 30000
+#define MAX_FLUSH_MS 300000
+#define TARGET_MS 1500
+#define HOLDOFF_MS 10000
+
+static struct telemetry_batch b;
+
+static void reset(void)
+{
+    telemetry_batch_init(&b, PERIOD_MS, MAX_FLUSH_MS, TARGET_MS, HOLDOFF_MS);
+}
+
+static void test_grow(void)
+{
+    reset();
+    CHECK(b.size == 1 && b.flush_ms == 0);
+
+    CHECK(telemetry_batch_on_ack(&b, 200));
+    CHECK(b.size == 2 && b.flush_ms == PERIOD_MS);
+    CHECK(b.increases == 1);
+
+    /* Size stops at what fits one message, the interval at its limit */
+    for (int i = 0; i < 20; i++) {
+        telemetry_batch_on_ack(&b, 200);
+    }
+    CHECK(b.size == TELEMETRY_BATCH_MAX);
+    CHECK(b.flush_ms == MAX_FLUSH_MS);
+    CHECK(!telemetry_batch_on_ack(&b, 200));
+}
+
+static void test_hold(void)
+{
+    reset();
+    telemetry_batch_on_ack(&b, 200);
+
+    /* Slower than the target: acknowledged, but no growth */
+    CHECK(!telemetry_batch_on_ack(&b, TARGET_MS + 1));
+    CHECK(b.size == 2 && b.flush_ms == PERIOD_MS);
+    CHECK(telemetry_batch_on_ack(&b, TARGET_MS));
+}
+
+static void test_halve(void)
+{
+    reset();
+    for (int i = 0; i < 4; i++) {
+        telemetry_batch_on_ack(&b, 200);
+    }
+    CHECK(b.size == 5 && b.flush_ms == 4 * PERIOD_MS);
+
+    CHECK(telemetry_batch_on_loss(&b, 100000));
+    CHECK(b.size == 2 && b.flush_ms == 2 * PERIOD_MS);
+    CHECK(b.decreases == 1);
+
+    /* Losses of the same spell count once */
+    CHECK(!telemetry_batch_on_loss(&b, 100000 + HOLDOFF_MS - 1));
+    CHECK(b.size == 2);
+
+    CHECK(telemetry_batch_on_loss(&b, 100000 + HOLDOFF_MS));
+    CHECK(b.size == 1 && b.flush_ms == PERIOD_MS);
+
+    CHECK(telemetry_batch_on_loss(&b, 100000 + 2 * HOLDOFF_MS));
+    CHECK(b.size == 1 && b.flush_ms == PERIOD_MS / 2);
+
+    /* Single samples sent at once cannot shrink further */
+    reset();
+    CHECK(!telemetry_batch_on_loss(&b, 0));
+    CHECK(b.decreases == 0);
+}
+
+static void test_ack_average(void)
+{
+    reset();
+
+    /* The first sample is taken as is, even 0 */
+    telemetry_batch_on_ack(&b, 0);
+    CHECK(b.have_ack && b.ack_ms == 0);
+    telemetry_batch_on_ack(&b, 800);
+    CHECK(b.ack_ms == 100);
+
+    /* Falling latency moves the average down by 1/8 of the difference */
+    reset();
+    telemetry_batch_on_ack(&b, 800);
+    telemetry_batch_on_ack(&b, 0);
+    CHECK(b.ack_ms == 700);
+
+    /* Decayed towards 0, it is still an average, not a restart */
+    for (int i = 0; i < 200; i++) {
+        telemetry_batch_on_ack(&b, 0);
+    }
+    CHECK(b.ack_ms < 8);
+    telemetry_batch_on_ack(&b, 4000);
+    CHECK(b.ack_ms < 4000 / 8 + 8);
+
+    /* Latencies beyond INT32_MAX do not wrap */
+    reset();
+    telemetry_batch_on_ack(&b, 100);
+    telemetry_batch_on_ack(&b, UINT32_MAX);
+    CHECK(b.ack_ms > 100 && b.ack_ms < UINT32_MAX / 8 + 100);
+}
+
+int main(void)
+{
+    test_grow();
+    test_hold();
+    test_halve();
+    test_ack_average();
+
+    if (failures != 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("telemetry_batch_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,560 @@
+/**
+ * @file archive.c
+ * @brief Long-term meter history on the device: raw, 15-minute and daily tiers
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+#include <zephyr/fs/fcb.h>
+#include <stdlib.h>
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "archive.h"
+#include "history.h"
+#include "timebase.h"
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+#include "swing_door.h"
+#endif
+
+LOG_MODULE_REGISTER(archive, LOG_LEVEL_INF);
+
+#define ARCHIVE_AREA_ID FIXED_PARTITION_ID(storage_partition)
+#define ARCHIVE_MAGIC 0x57415230    /* "WAR0" + tier */
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_MAX_PARTITION_SECTORS 64     /* As history.c */
+
+#define SEC_PER_DAY 86400U
+
+/* FCB sector header (struct fcb_disk_area, private to the FCB) */
+#define FCB_SECTOR_HEADER_LEN 8
+
+/* Poll period of main.c, for the raw tier without compression */
+#define ARCHIVE_SAMPLE_SEC 30
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+struct tier {
+    struct fcb fcb;
+    uint16_t rec_len;
+    uint32_t retention_s;
+    uint32_t generation;        /* Bumped when a sector is erased */
+};
+
+static struct flash_sector sectors[ARCHIVE_MAX_PARTITION_SECTORS];
+static struct tier tiers[ROLLUP_TIER_COUNT];
+static struct archive_stats stats;
+static struct rollup rollup;
+static K_MUTEX_DEFINE(lock);
+static bool ready;
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+static struct swing_door raw_door;
+#endif
+
+static const uint8_t tier_sectors[ROLLUP_TIER_COUNT] = {
+    [ROLLUP_RAW] = CONFIG_APP_ARCHIVE_RAW_SECTORS,
+    [ROLLUP_QUARTER] = CONFIG_APP_ARCHIVE_QUARTER_SECTORS,
+    [ROLLUP_DAILY] = CONFIG_APP_ARCHIVE_DAILY_SECTORS,
+};
+
+static const uint32_t tier_retention_days[ROLLUP_TIER_COUNT] = {
+    [ROLLUP_RAW] = CONFIG_APP_ARCHIVE_RAW_DAYS,
+    [ROLLUP_QUARTER] = CONFIG_APP_ARCHIVE_QUARTER_DAYS,
+    [ROLLUP_DAILY] = CONFIG_APP_ARCHIVE_DAILY_DAYS,
+};
+
+/* Records written per day; compressed raw depends on the data (0 = unknown) */
+static const uint32_t tier_records_per_day[ROLLUP_TIER_COUNT] = {
+    [ROLLUP_RAW] = IS_ENABLED(CONFIG_APP_HISTORY_COMPRESS) ? 0 : SEC_PER_DAY / ARCHIVE_SAMPLE_SEC,
+    [ROLLUP_QUARTER] = ROLLUP_DAY_SEC / ROLLUP_QUARTER_SEC,
+    [ROLLUP_DAILY] = 1,
+};
+
+/* ============================================================================
+ * RECORDS
+ * ============================================================================ */
+
+/** @brief Raw records are history records, aggregates rollup records */
+static int read_row(const struct tier *t, const struct fcb_entry *loc,
+                    struct rollup_record *row, const struct rollup_record *prev)
+{
+    if (t == &tiers[ROLLUP_RAW]) {
+        struct history_record rec;
+
+        if (flash_area_read(t->fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), &rec, sizeof(rec)) != 0) {
+            return -EIO;
+        }
+
+        const uint32_t values[BOVE_FIELD_COUNT] = {
+            [BOVE_FLOW_RATE] = rec.flow_rate,
+            [BOVE_FORWARD_TOTAL] = rec.forward_total,
+            [BOVE_REVERSE_TOTAL] = rec.reverse_total,
+            [BOVE_PRESSURE] = rec.pressure,
+            [BOVE_TEMPERATURE] = rec.temperature,
+            [BOVE_STATUS] = rec.status,
+        };
+
+        rollup_from_sample(row, (uint32_t)(rec.ts_ms / 1000), values, prev);
+        row->samples = (rec.samples > 0) ? rec.samples : 1;
+        return 0;
+    }
+
+    return (flash_area_read(t->fcb.fap, FCB_ENTRY_FA_DATA_OFF(*loc), row,
+                            sizeof(*row)) != 0) ? -EIO : 0;
+}
+
+/** @brief Start time of the first record of @p sector (NULL: the oldest), 0 if none */
+static uint32_t first_start(struct tier *t, struct flash_sector *sector)
+{
+    struct fcb_entry loc = { .fe_sector = sector, .fe_elem_off = 0 };
+    struct rollup_record row;
+
+    if (fcb_getnext(&t->fcb, &loc) != 0 || (sector != NULL && loc.fe_sector != sector) ||
+        loc.fe_data_len != t->rec_len || read_row(t, &loc, &row, NULL) != 0) {
+        return 0;
+    }
+    return row.start_s;
+}
+
+static int count_all(struct fcb_entry_ctx *ctx, void *arg)
+{
+    ARG_UNUSED(ctx);
+
+    (*(uint32_t *)arg)++;
+    return 0;
+}
+
+/**
+ * @brief Erase the oldest sector of a tier
+ *
+ * @return Records that were in it
+ */
+static uint32_t rotate(struct tier *t, enum rollup_tier id)
+{
+    uint32_t n = 0;
+
+    fcb_walk(&t->fcb, t->fcb.f_oldest, count_all, &n);
+    fcb_rotate(&t->fcb);
+    t->generation++;
+    stats.records[id] -= MIN(n, stats.records[id]);
+    stats.oldest_s[id] = first_start(t, NULL);
+    return n;
+}
+
+/**
+ * @brief Erase sectors whose records are all past retention
+ *
+ * A sector is past retention once the first record of the next one is.
+ */
+static void expire(enum rollup_tier id, uint32_t now_s)
+{
+    struct tier *t = &tiers[id];
+
+    while (t->fcb.f_oldest != t->fcb.f_active.fe_sector) {
+        struct flash_sector *next = t->fcb.f_oldest + 1;
+
+        if (next == &t->fcb.f_sectors[t->fcb.f_sector_cnt]) {
+            next = &t->fcb.f_sectors[0];
+        }
+
+        uint32_t start = first_start(t, next);
+
+        if (start == 0 || !rollup_past_retention(start, now_s, t->retention_s)) {
+            break;
+        }
+        stats.expired[id] += rotate(t, id);
+    }
+}
+
+static int append(enum rollup_tier id, const void *data)
+{
+    struct tier *t = &tiers[id];
+    struct fcb_entry loc;
+    int rc;
+
+    rc = fcb_append(&t->fcb, t->rec_len, &loc);
+    if (rc == -ENOSPC) {
+        uint32_t lost = rotate(t, id);
+
+        stats.dropped[id] += lost;
+        LOG_WRN("Archive %s full, %u oldest record(s) dropped", rollup_tier_name(id), lost);
+        rc = fcb_append(&t->fcb, t->rec_len, &loc);
+    }
+    if (rc == 0) {
+        rc = flash_area_write(t->fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), data, t->rec_len);
+    }
+    if (rc == 0) {
+        rc = fcb_append_finish(&t->fcb, &loc);
+    }
+    if (rc != 0) {
+        LOG_ERR("Archive %s write failed: %d", rollup_tier_name(id), rc);
+        return -EIO;
+    }
+
+    stats.records[id]++;
+    stats.written[id]++;
+    if (stats.oldest_s[id] == 0) {
+        stats.oldest_s[id] = first_start(t, NULL);
+    }
+    return 0;
+}
+
+static int append_raw(const struct telemetry_record *r, uint16_t samples)
+{
+    struct history_record rec = {
+        .ts_ms = r->ts_ms,
+        .flow_rate = r->values[BOVE_FLOW_RATE],
+        .forward_total = r->values[BOVE_FORWARD_TOTAL],
+        .reverse_total = r->values[BOVE_REVERSE_TOTAL],
+        .pressure = r->values[BOVE_PRESSURE],
+        .temperature = r->values[BOVE_TEMPERATURE],
+        .status = r->values[BOVE_STATUS],
+        .samples = samples,
+    };
+
+    return append(ROLLUP_RAW, &rec);
+}
+
+/* ============================================================================
+ * INITIALISATION
+ * ============================================================================ */
+
+static int mount(enum rollup_tier id, struct flash_sector *first)
+{
+    struct tier *t = &tiers[id];
+    int rc;
+
+    t->fcb.f_magic = ARCHIVE_MAGIC + id;
+    t->fcb.f_version = ARCHIVE_VERSION;
+    t->fcb.f_sectors = first;
+    t->fcb.f_sector_cnt = tier_sectors[id];
+    t->fcb.f_scratch_cnt = 0;
+    t->rec_len = (id == ROLLUP_RAW) ? sizeof(struct history_record)
+                                    : sizeof(struct rollup_record);
+    t->retention_s = tier_retention_days[id] * SEC_PER_DAY;
+
+    rc = fcb_init(ARCHIVE_AREA_ID, &t->fcb);
+    if (rc != 0) {
+        const struct flash_area *fa;
+        const struct flash_sector *last = &first[tier_sectors[id] - 1];
+
+        /* Another layout or corrupted: start this tier over */
+        LOG_WRN("Archive %s invalid (%d), erasing", rollup_tier_name(id), rc);
+        rc = flash_area_open(ARCHIVE_AREA_ID, &fa);
+        if (rc == 0) {
+            rc = flash_area_erase(fa, first->fs_off,
+                                  last->fs_off + last->fs_size - first->fs_off);
+            flash_area_close(fa);
+        }
+        if (rc == 0) {
+            rc = fcb_init(ARCHIVE_AREA_ID, &t->fcb);
+        }
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    fcb_walk(&t->fcb, NULL, count_all, &stats.records[id]);
+    stats.oldest_s[id] = first_start(t, NULL);
+    return 0;
+}
+
+/**
+ * @brief Records a mounted tier is sure to hold: all its sectors but the
+ *        one erased to make room when it is full
+ */
+static uint32_t capacity(enum rollup_tier id, const struct flash_sector *first)
+{
+    const struct tier *t = &tiers[id];
+    uint32_t align = MAX(t->fcb.f_align, 1U);
+    /* Length byte, record, CRC8 */
+    uint32_t entry = ROUND_UP(1, align) + ROUND_UP(t->rec_len, align) + ROUND_UP(1, align);
+
+    return (first->fs_size - FCB_SECTOR_HEADER_LEN) / entry * (tier_sectors[id] - 1U);
+}
+
+/** @brief Warn if a tier fills up before its records reach retention */
+static void check_capacity(enum rollup_tier id, const struct flash_sector *first)
+{
+    uint32_t per_day = tier_records_per_day[id];
+    uint32_t records = capacity(id, first);
+
+    if (per_day == 0) {
+        LOG_INF("Archive %s: %u record(s) before the oldest are dropped",
+                rollup_tier_name(id), records);
+    } else if (records / per_day < tier_retention_days[id]) {
+        LOG_WRN("Archive %s holds %u of %u retention days; give it more sectors",
+                rollup_tier_name(id), records / per_day, tier_retention_days[id]);
+    }
+}
+
+/**
+ * @brief Rebuild the open day and the totals the next bucket counts from
+ */
+static void restore(void)
+{
+    struct tier *q = &tiers[ROLLUP_QUARTER];
+    struct fcb_entry loc = {0};
+    struct rollup_record row;
+    uint32_t last_day = 0;
+    uint32_t restored = 0;
+
+    if (fcb_offset_last_n(&tiers[ROLLUP_DAILY].fcb, 1, &loc) == 0 &&
+        read_row(&tiers[ROLLUP_DAILY], &loc, &row, NULL) == 0) {
+        last_day = row.start_s;
+    }
+
+    /* Once at boot: the whole 15-minute tier */
+    loc = (struct fcb_entry){0};
+    while (fcb_getnext(&q->fcb, &loc) == 0) {
+        if (loc.fe_data_len == q->rec_len && read_row(q, &loc, &row, NULL) == 0) {
+            rollup_restore(&rollup, &row, last_day);
+            restored++;
+        }
+    }
+    if (rollup.day.samples > 0) {
+        LOG_INF("Archive: open day rebuilt from %u sample(s) (%u bucket(s) read)",
+                rollup.day.samples, restored);
+    }
+}
+
+int archive_init(void)
+{
+    uint32_t sector_cnt = ARRAY_SIZE(sectors);
+    int rc;
+
+    rc = flash_area_get_sectors(ARCHIVE_AREA_ID, &sector_cnt, sectors);
+    if (rc != 0) {
+        LOG_ERR("Storage partition layout unusable: %d", rc);
+        return rc;
+    }
+    if (archive_sectors(sector_cnt) == 0) {
+        LOG_ERR("Storage partition too small for the archive (%u sectors, %u needed)",
+                sector_cnt, ARCHIVE_SECTORS + ARCHIVE_HISTORY_MIN_SECTORS);
+        return -ENOSPC;
+    }
+
+    /* The tiers take the end of the partition; history.c the rest */
+    struct flash_sector *next = &sectors[sector_cnt - ARCHIVE_SECTORS];
+
+    for (int id = 0; id < ROLLUP_TIER_COUNT; id++) {
+        rc = mount(id, next);
+        if (rc != 0) {
+            LOG_ERR("Archive %s unavailable: %d", rollup_tier_name(id), rc);
+            return rc;
+        }
+        check_capacity(id, next);
+        next += tier_sectors[id];
+    }
+
+    rollup_init(&rollup, CONFIG_APP_ARCHIVE_DAY_OFFSET_MIN * 60);
+    restore();
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    static const uint32_t tol[BOVE_FIELD_COUNT] = {
+        [BOVE_FLOW_RATE] = CONFIG_APP_HISTORY_TOL_FLOW,
+        [BOVE_FORWARD_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_REVERSE_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_PRESSURE] = CONFIG_APP_HISTORY_TOL_PRESSURE,
+        [BOVE_TEMPERATURE] = CONFIG_APP_HISTORY_TOL_TEMPERATURE,
+    };
+
+    swing_door_init(&raw_door, tol, CONFIG_APP_HISTORY_MAX_GAP_SEC * 1000U);
+#endif
+
+    ready = true;
+    LOG_INF("Archive: raw %u, 15min %u, daily %u record(s)",
+            stats.records[ROLLUP_RAW], stats.records[ROLLUP_QUARTER],
+            stats.records[ROLLUP_DAILY]);
+    return 0;
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+int archive_add(const struct telemetry_record *rec)
+{
+    struct rollup_closed closed[2];
+    uint32_t now_s = (uint32_t)(rec->ts_ms / 1000);
+    int rc = 0;
+
+    if (!ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&lock, K_FOREVER);
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    struct swing_door_point pts[SWING_DOOR_OUT_MAX];
+    int n = swing_door_add(&raw_door, rec, pts);
+
+    for (int i = 0; i < n && rc == 0; i++) {
+        rc = append_raw(&pts[i].rec, pts[i].samples);
+    }
+#else
+    int n = 1;
+
+    rc = append_raw(rec, 1);
+#endif
+    if (n > 0) {
+        expire(ROLLUP_RAW, now_s);
+    }
+
+    int closed_cnt = rollup_add(&rollup, now_s, rec->values, closed);
+
+    for (int i = 0; i < closed_cnt; i++) {
+        int err = append(closed[i].tier, &closed[i].rec);
+
+        rc = rc ? rc : err;
+        expire(closed[i].tier, now_s);
+    }
+
+    k_mutex_unlock(&lock);
+    return rc;
+}
+
+int archive_query(uint32_t from_s, uint32_t to_s, uint32_t resolution_s,
+                  archive_row_cb cb, void *arg, enum rollup_tier *tier)
+{
+    struct fcb_entry loc = {0};
+    struct rollup_record row, prev;
+    bool have_prev = false;
+    int rows = 0;
+
+    if (!ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&lock, K_FOREVER);
+    enum rollup_tier id = rollup_pick_tier(resolution_s, from_s, stats.oldest_s);
+    struct tier *t = &tiers[id];
+    uint32_t generation = t->generation;
+    k_mutex_unlock(&lock);
+
+    *tier = id;
+
+    /* One record per lock: the main loop keeps archiving meanwhile */
+    for (;;) {
+        int rc;
+
+        k_mutex_lock(&lock, K_FOREVER);
+        if (t->generation != generation) {
+            rc = -ESTALE;
+        } else {
+            do {
+                rc = fcb_getnext(&t->fcb, &loc);
+            } while (rc == 0 && loc.fe_data_len != t->rec_len);
+            if (rc == 0) {
+                rc = read_row(t, &loc, &row, have_prev ? &prev : NULL);
+            } else {
+                rc = -ENOENT;
+            }
+        }
+        k_mutex_unlock(&lock);
+
+        if (rc == -ENOENT) {
+            break;
+        }
+        if (rc != 0) {
+            return rc;
+        }
+
+        prev = row;
+        have_prev = true;
+        if (row.start_s < from_s) {
+            continue;
+        }
+        if (row.start_s > to_s) {
+            break;
+        }
+        rows++;
+        if (!cb(&row, arg)) {
+            break;
+        }
+    }
+    return rows;
+}
+
+void archive_get_stats(struct archive_stats *out)
+{
+    k_mutex_lock(&lock, K_FOREVER);
+    *out = stats;
+    k_mutex_unlock(&lock);
+}
+
+/* ============================================================================
+ * SHELL
+ * ============================================================================ */
+
+#if defined(CONFIG_SHELL)
+static bool print_row(const struct rollup_record *row, void *arg)
+{
+    const struct shell *sh = arg;
+
+    shell_print(sh, "%10u %5u %10u %8u %8u %8u %5u %5u 0x%04x", row->start_s, row->samples,
+                row->forward_total, row->forward_used, row->reverse_used, row->flow_max,
+                row->pressure_min, row->pressure_max, row->status);
+    return true;
+}
+
+/** @brief Unix seconds; 0 or negative values count back from now */
+static uint32_t parse_time(const char *arg, uint32_t now_s)
+{
+    long v = strtol(arg, NULL, 10);
+
+    return (v <= 0) ? now_s - (uint32_t)(-v) : (uint32_t)v;
+}
+
+static int cmd_archive(const struct shell *sh, size_t argc, char **argv)
+{
+    struct archive_stats s;
+
+    if (argc == 1) {
+        archive_get_stats(&s);
+        shell_print(sh, "%-6s %8s %10s %6s %8s %8s %8s", "Tier", "records", "oldest",
+                    "days", "written", "expired", "dropped");
+        for (int id = 0; id < ROLLUP_TIER_COUNT; id++) {
+            shell_print(sh, "%-6s %8u %10u %6u %8u %8u %8u", rollup_tier_name(id),
+                        s.records[id], s.oldest_s[id], tier_retention_days[id],
+                        s.written[id], s.expired[id], s.dropped[id]);
+        }
+        return 0;
+    }
+
+    if (!timebase_synced()) {
+        shell_error(sh, "Time not synced yet");
+        return -EAGAIN;
+    }
+
+    uint32_t now_s = (uint32_t)(timebase_to_unix_ms(k_uptime_get()) / 1000);
+    uint32_t from_s = parse_time(argv[1], now_s);
+    uint32_t to_s = (argc > 2) ? parse_time(argv[2], now_s) : now_s;
+    uint32_t resolution_s = (argc > 3) ? strtoul(argv[3], NULL, 10) : 0;
+    enum rollup_tier tier;
+
+    shell_print(sh, "%10s %5s %10s %8s %8s %8s %5s %5s %6s", "start", "n", "fwdTotal",
+                "fwdUsed", "revUsed", "flowMax", "pMin", "pMax", "status");
+
+    int rows = archive_query(from_s, to_s, resolution_s, print_row, (void *)sh, &tier);
+
+    if (rows < 0) {
+        shell_error(sh, "Query failed: %d", rows);
+        return rows;
+    }
+    shell_print(sh, "%d row(s) from the %s tier", rows, rollup_tier_name(tier));
+    return 0;
+}
+
+SHELL_CMD_ARG_REGISTER(archive, NULL,
+                       "Stored history by tier; archive <from> [to] [resolution s] "
+                       "(Unix s, or <= 0 for seconds before now)",
+                       cmd_archive, 1, 3);
+#endif /* CONFIG_SHELL */
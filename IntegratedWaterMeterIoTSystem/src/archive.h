@@ -0,0 +1,95 @@
+/**
+ * @file archive.h
+ * @brief Long-term meter history on the device: raw, 15-minute and daily tiers
+ *
+ * @details
+ * Every sample (once the time is known) goes to three flash circular
+ * buffers at the end of the storage partition, independent of uploads:
+ *
+ * - raw: the samples, through the swinging-door compressor when history
+ *   compression is enabled (within the same tolerances)
+ * - 15min, daily: aggregates built incrementally by rollup.c
+ *
+ * Each tier keeps its records for a retention period; a sector whose
+ * records are all older is erased. When a tier fills up before that, its
+ * oldest sector is dropped. Finer tiers are meant to be kept shorter, so a
+ * query picks the coarsest tier that still meets the requested resolution
+ * and reaches back far enough.
+ *
+ * The open 15-minute bucket and the raw compressor segment are held in
+ * RAM. After a reboot the open day is rebuilt from the stored 15-minute
+ * buckets, and the volume since the last stored bucket lands in the next.
+ */
+
+#ifndef ARCHIVE_H_
+#define ARCHIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "rollup.h"
+#include "telemetry_batch.h"
+
+#define ARCHIVE_SECTORS (CONFIG_APP_ARCHIVE_RAW_SECTORS + \
+                         CONFIG_APP_ARCHIVE_QUARTER_SECTORS + \
+                         CONFIG_APP_ARCHIVE_DAILY_SECTORS)
+
+/* The offline history keeps at least this much of the partition */
+#define ARCHIVE_HISTORY_MIN_SECTORS 4
+
+/**
+ * @brief Sectors at the end of a partition of @p partition_sectors given to
+ *        the archive; 0 if it would leave the history too little
+ */
+static inline uint32_t archive_sectors(uint32_t partition_sectors)
+{
+    return (partition_sectors >= ARCHIVE_SECTORS + ARCHIVE_HISTORY_MIN_SECTORS) ?
+           ARCHIVE_SECTORS : 0;
+}
+
+struct archive_stats {
+    uint32_t records[ROLLUP_TIER_COUNT];    /* Stored now */
+    uint32_t written[ROLLUP_TIER_COUNT];    /* Since boot */
+    uint32_t expired[ROLLUP_TIER_COUNT];    /* Past retention, since boot */
+    uint32_t dropped[ROLLUP_TIER_COUNT];    /* Tier full, since boot */
+    uint32_t oldest_s[ROLLUP_TIER_COUNT];   /* 0 = empty */
+};
+
+/**
+ * @brief Called for each row of a query
+ *
+ * @return false to stop the query
+ */
+typedef bool (*archive_row_cb)(const struct rollup_record *row, void *arg);
+
+/**
+ * @brief Mount the tiers and rebuild the open day
+ *
+ * @return 0, -ENOSPC if the partition is too small, negative errno from
+ *         the flash or FCB layer
+ */
+int archive_init(void);
+
+/**
+ * @brief Archive one sample (Unix time in @p rec)
+ *
+ * @return 0, -ENODEV if not initialised, -EIO on flash errors
+ */
+int archive_add(const struct telemetry_record *rec);
+
+/**
+ * @brief Rows with a start time in [@p from_s, @p to_s], oldest first
+ *
+ * Raw rows count their volume from the previous raw row.
+ *
+ * @param resolution_s Coarsest acceptable spacing of the rows
+ * @param tier Set to the tier that was read
+ * @return Number of rows, -ENODEV if not initialised, -ESTALE if the tier
+ *         rotated under the query, -EIO on flash errors
+ */
+int archive_query(uint32_t from_s, uint32_t to_s, uint32_t resolution_s,
+                  archive_row_cb cb, void *arg, enum rollup_tier *tier);
+
+void archive_get_stats(struct archive_stats *out);
+
+#endif /* ARCHIVE_H_ */
@@ -0,0 +1,78 @@
+/**
+ * @file attr_parse.c
+ * @brief Minimal lookup of values in ThingsBoard attribute JSON payloads
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "attr_parse.h"
+
+/**
+ * @brief Find the first character of the value belonging to "key"
+ */
+static const char *find_value(const char *json, size_t len, const char *key)
+{
+    const char *end = json + len;
+    size_t key_len = strlen(key);
+    const char *p = json;
+
+    while (p + key_len + 2 <= end) {
+        const char *q = memchr(p, '"', end - p);
+
+        if (q == NULL || q + key_len + 2 > end) {
+            return NULL;
+        }
+        if (strncmp(q + 1, key, key_len) == 0 && q[key_len + 1] == '"') {
+            q += key_len + 2;
+            while (q < end && (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\n')) {
+                q++;
+            }
+            if (q < end && *q == ':') {
+                q++;
+                while (q < end && (*q == ' ' || *q == '\t' || *q == '\r' || *q == '\n')) {
+                    q++;
+                }
+                return (q < end) ? q : NULL;
+            }
+        }
+        p = q + 1;
+    }
+    return NULL;
+}
+
+int attr_get_string(const char *json, size_t len, const char *key,
+                    char *out, size_t out_len)
+{
+    const char *end = json + len;
+    const char *p = find_value(json, len, key);
+    size_t n = 0;
+
+    if (p == NULL || *p != '"') {
+        return -ENOENT;
+    }
+
+    for (p++; p < end && *p != '"'; p++) {
+        char c = *p;
+
+        if (c == '\\' && p + 1 < end) {
+            p++;
+            switch (*p) {
+            case 'n': c = '\n'; break;
+            case 't': c = '\t'; break;
+            case 'r': c = '\r'; break;
+            default:  c = *p; break;    /* \" \\ \/ */
+            }
+        }
+        if (n + 1 >= out_len) {
+            return -ENOMEM;
+        }
+        out[n++] = c;
+    }
+
+    if (p >= end) {
+        return -ENOENT;     /* Unterminated string */
+    }
+    out[n] = '\0';
+    return (int)n;
+}
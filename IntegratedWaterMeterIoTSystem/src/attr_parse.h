@@ -0,0 +1,25 @@
+/**
+ * @file attr_parse.h
+ * @brief Minimal lookup of values in ThingsBoard attribute JSON payloads
+ *
+ * @details
+ * Shared-attribute pushes ({"key":value}) and attribute request responses
+ * ({"shared":{"key":value}}) are small and flat enough that a key scan is
+ * sufficient; no general JSON parser is pulled in.
+ */
+
+#ifndef ATTR_PARSE_H_
+#define ATTR_PARSE_H_
+
+#include <stddef.h>
+
+/**
+ * @brief Copy the string value of @p key into @p out (unescaped, NUL-terminated)
+ *
+ * @return Length of the value, -ENOENT if absent or not a string,
+ *         -ENOMEM if it does not fit in @p out
+ */
+int attr_get_string(const char *json, size_t len, const char *key,
+                    char *out, size_t out_len);
+
+#endif /* ATTR_PARSE_H_ */
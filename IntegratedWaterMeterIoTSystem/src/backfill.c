@@ -0,0 +1,315 @@
+/**
+ * @file backfill.c
+ * @brief Upload of stored history in large chunked HTTP requests
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "backfill.h"
+#include "cloud.h"
+#include "history.h"
+#include "metrics.h"
+#include "telemetry_batch.h"
+
+#if defined(CONFIG_APP_SIM)
+#include "sim.h"
+#endif
+
+LOG_MODULE_REGISTER(backfill, LOG_LEVEL_INF);
+
+#define BACKFILL_STACK_SIZE 3072
+#define BACKFILL_PRIORITY 12        /* Below the main loop and metrics server */
+#define BACKFILL_IDLE_MS 5000
+#define BACKFILL_RETRY_MS 60000
+
+/* One HTTP chunk; a record is well under RECORD_JSON_MAX */
+#define CHUNK_SIZE 1024
+#define RECORD_JSON_MAX 224
+
+BUILD_ASSERT(CHUNK_SIZE <= CONFIG_APP_BACKFILL_BURST_BYTES,
+             "a chunk must fit in the token bucket");
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+struct token_bucket {
+    uint32_t tokens;            /* Bytes that may be sent now */
+    int64_t last_ms;
+};
+
+/* Progress of the current drain, from the first batch until the store is empty */
+struct drain_stats {
+    int64_t start_ms;           /* 0 = not draining */
+    uint32_t records;
+    uint32_t bytes;
+};
+
+struct batch {
+    char chunk[CHUNK_SIZE];
+    size_t len;
+    uint32_t records;
+    uint32_t samples;           /* Samples the records stand for */
+    uint32_t bytes;
+};
+
+K_THREAD_STACK_DEFINE(backfill_stack, BACKFILL_STACK_SIZE);
+static struct k_thread backfill_thread;
+static bool started;
+static volatile enum link_grade link_grade = LINK_UNKNOWN;
+
+/* ============================================================================
+ * RATE LIMITING
+ * ============================================================================ */
+
+/** @brief Upload rate for the current link grade */
+static uint32_t rate_bps(void)
+{
+    return (link_grade == LINK_GOOD) ?
+           CONFIG_APP_BACKFILL_RATE_BPS * CONFIG_APP_LINKQ_GOOD_BOOST :
+           CONFIG_APP_BACKFILL_RATE_BPS;
+}
+
+/**
+ * @brief Wait until @p bytes may be sent at the current rate
+ */
+static void bucket_take(struct token_bucket *tb, uint32_t bytes)
+{
+    for (;;) {
+        int64_t now = k_uptime_get();
+        uint32_t rate = rate_bps();
+        uint64_t refill = (uint64_t)(now - tb->last_ms) * rate / 1000U;
+
+        if (refill > 0) {
+            tb->tokens = MIN(tb->tokens + refill, CONFIG_APP_BACKFILL_BURST_BYTES);
+            tb->last_ms = now;
+        }
+        if (tb->tokens >= bytes) {
+            tb->tokens -= bytes;
+            return;
+        }
+        k_sleep(K_MSEC((bytes - tb->tokens) * 1000U / rate + 1));
+    }
+}
+
+/* ============================================================================
+ * UPLOAD
+ * ============================================================================ */
+
+/**
+ * @brief Format one record as a ThingsBoard timestamped telemetry object
+ */
+static int format_record(char *buf, size_t size, const struct history_record *rec)
+{
+    const struct telemetry_record r = {
+        .ts_ms = rec->ts_ms,
+        .values = {
+            [BOVE_FLOW_RATE] = rec->flow_rate,
+            [BOVE_FORWARD_TOTAL] = rec->forward_total,
+            [BOVE_REVERSE_TOTAL] = rec->reverse_total,
+            [BOVE_PRESSURE] = rec->pressure,
+            [BOVE_TEMPERATURE] = rec->temperature,
+            [BOVE_STATUS] = rec->status,
+        },
+    };
+
+    return telemetry_record_format(&r, buf, size);
+}
+
+static int flush_chunk(struct batch *b, struct token_bucket *tb)
+{
+    bucket_take(tb, b->len);
+
+    /* The link went bad meanwhile: give up the request, the records stay */
+    if (link_grade == LINK_POOR) {
+        return -EAGAIN;
+    }
+
+    int rc = cloud_bulk_write(b->chunk, b->len);
+    if (rc == 0) {
+        b->bytes += b->len;
+        b->len = 0;
+    }
+    return rc;
+}
+
+/**
+ * @brief Append a record to the request body, sending full chunks
+ */
+static int add_record(struct batch *b, struct token_bucket *tb,
+                      const struct history_record *rec)
+{
+    char json[RECORD_JSON_MAX];
+    int n = format_record(json, sizeof(json), rec);
+
+    if (n < 0 || (size_t)n >= sizeof(json)) {
+        return -EMSGSIZE;
+    }
+    /* Separator, and room for the closing bracket */
+    if (b->len + 1 + n + 1 > sizeof(b->chunk)) {
+        int rc = flush_chunk(b, tb);
+        if (rc) {
+            return rc;
+        }
+    }
+
+    b->chunk[b->len++] = (b->records == 0) ? '[' : ',';
+    memcpy(&b->chunk[b->len], json, n);
+    b->len += n;
+    b->records++;
+    b->samples += (rec->samples > 0) ? rec->samples : 1;
+    return 0;
+}
+
+/**
+ * @brief Send up to CONFIG_APP_BACKFILL_BATCH_RECORDS in one request
+ *
+ * The records are released from the store only once the server accepted
+ * the whole request.
+ *
+ * @return 0 on success, -ENOENT if the store is empty, negative errno
+ */
+static int upload_batch(struct batch *b, struct token_bucket *tb)
+{
+    struct history_cursor cur;
+    struct history_record rec;
+    int rc;
+
+    b->len = 0;
+    b->records = 0;
+    b->samples = 0;
+    b->bytes = 0;
+
+    history_cursor_start(&cur);
+    rc = history_read_next(&cur, &rec);
+    if (rc) {
+        return rc;
+    }
+
+    rc = cloud_bulk_begin();
+    if (rc) {
+        return rc;
+    }
+
+    do {
+        rc = add_record(b, tb, &rec);
+        if (rc || b->records >= CONFIG_APP_BACKFILL_BATCH_RECORDS) {
+            break;
+        }
+        rc = history_read_next(&cur, &rec);
+    } while (rc == 0);
+
+    if (rc != 0 && rc != -ENOENT) {
+        cloud_bulk_abort();
+        return rc;
+    }
+
+    b->chunk[b->len++] = ']';
+    rc = flush_chunk(b, tb);
+    if (rc == 0) {
+        rc = cloud_bulk_end();
+    }
+    if (rc != 0) {
+        cloud_bulk_abort();
+        return rc;
+    }
+
+    /* Stale: records were dropped meanwhile and some will go out twice */
+    if (history_consume(&cur) != 0) {
+        LOG_WRN("History rotated during upload, batch will partly repeat");
+    }
+    return 0;
+}
+
+static void report_drain(const struct drain_stats *d)
+{
+    uint32_t ms = MAX((uint32_t)(k_uptime_get() - d->start_ms), 1U);
+
+    LOG_INF("Backfill complete: %u record(s), %u bytes in %u.%03u s (%u B/s)",
+            d->records, d->bytes, ms / 1000, ms % 1000,
+            (uint32_t)((uint64_t)d->bytes * 1000U / ms));
+}
+
+static void backfill_main(void *p1, void *p2, void *p3)
+{
+    static struct batch b;
+    struct token_bucket tb = {
+        .tokens = CONFIG_APP_BACKFILL_BURST_BYTES,
+        .last_ms = k_uptime_get(),
+    };
+    struct drain_stats drain = {0};
+
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    while (1) {
+        metrics_history(history_pending(), history_dropped());
+
+        /* Live telemetry first: start only with the outbox empty */
+        if (!cloud_connected() || cloud_queued() > 0 || history_pending() == 0 ||
+            link_grade == LINK_POOR) {
+            if (drain.start_ms != 0 && history_pending() == 0) {
+                report_drain(&drain);
+                drain.start_ms = 0;
+            }
+            k_sleep(K_MSEC(BACKFILL_IDLE_MS));
+            continue;
+        }
+
+        if (drain.start_ms == 0) {
+            LOG_INF("Backfill: %u record(s) pending", history_pending());
+            drain = (struct drain_stats){ .start_ms = k_uptime_get() };
+        }
+
+        int64_t t0 = k_uptime_get();
+        int rc = upload_batch(&b, &tb);
+        uint32_t ms = (uint32_t)(k_uptime_get() - t0);
+
+        if (rc == -ENOENT) {
+            continue;       /* Backlog count resynced; loop sees it empty */
+        }
+        if (rc == -EAGAIN) {
+            LOG_INF("Backfill paused, poor link");
+            continue;
+        }
+        if (rc != 0) {
+            LOG_WRN("Backfill batch failed: %d, retrying in %d s", rc,
+                    BACKFILL_RETRY_MS / 1000);
+            metrics_backfill_failed();
+            k_sleep(K_MSEC(BACKFILL_RETRY_MS));
+            continue;
+        }
+
+        drain.records += b.records;
+        drain.bytes += b.bytes;
+        metrics_backfill_batch(b.records, b.bytes, ms);
+#if defined(CONFIG_APP_SIM)
+        sim_stat_backfilled(b.records, b.samples, b.bytes);
+#endif
+        LOG_DBG("Backfill batch: %u record(s), %u bytes in %u ms", b.records, b.bytes, ms);
+    }
+}
+
+int backfill_start(void)
+{
+    if (started) {
+        return 0;
+    }
+
+    k_thread_create(&backfill_thread, backfill_stack,
+                    K_THREAD_STACK_SIZEOF(backfill_stack),
+                    backfill_main, NULL, NULL, NULL,
+                    BACKFILL_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&backfill_thread, "backfill");
+    started = true;
+    return 0;
+}
+
+void backfill_set_link_grade(enum link_grade grade)
+{
+    link_grade = grade;
+}
@@ -0,0 +1,27 @@
+/**
+ * @file backfill.h
+ * @brief Upload of stored history in large chunked HTTP requests
+ *
+ * @details
+ * A low-priority thread drains the history store (history.c) once the
+ * device is back online. Records are streamed from flash into one HTTP
+ * request per batch (a JSON array of {"ts":..,"values":{..}} objects,
+ * chunked transfer encoding), so only one chunk buffer is held in RAM.
+ * A token bucket caps the upload rate and a batch only starts while the
+ * MQTT outbox is empty, so live telemetry keeps priority. The link grade
+ * (linkq.h) scales the rate: paused on a poor link, by
+ * CONFIG_APP_LINKQ_GOOD_BOOST on a good one.
+ */
+
+#ifndef BACKFILL_H_
+#define BACKFILL_H_
+
+#include "linkq.h"
+
+/** @brief Start the backfill thread (idempotent) */
+int backfill_start(void);
+
+/** @brief Current link grade; a request in progress stops on LINK_POOR */
+void backfill_set_link_grade(enum link_grade grade);
+
+#endif /* BACKFILL_H_ */
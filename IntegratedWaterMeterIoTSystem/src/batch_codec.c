@@ -0,0 +1,202 @@
+/**
+ * @file batch_codec.c
+ * @brief Compact binary sample batches, shared by the firmware and host tools
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "batch_codec.h"
+
+/* Varint bytes of a column length: at most 255 * 5 bytes */
+#define COLUMN_LEN_MAX 2
+
+/* ============================================================================
+ * VARINTS
+ * ============================================================================ */
+
+static size_t varint_put(uint8_t *out, uint64_t v)
+{
+    size_t n = 0;
+
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+/**
+ * @return Bytes consumed, 0 if truncated or longer than @p max_bytes
+ */
+static size_t varint_get(const uint8_t *in, size_t len, size_t max_bytes, uint64_t *v)
+{
+    uint64_t acc = 0;
+
+    for (size_t i = 0; i < len && i < max_bytes; i++) {
+        acc |= (uint64_t)(in[i] & 0x7F) << (7 * i);
+        if ((in[i] & 0x80) == 0) {
+            *v = acc;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint64_t zigzag64(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag64(uint64_t v)
+{
+    return (int64_t)((v >> 1) ^ (0U - (v & 1U)));
+}
+
+/* ============================================================================
+ * ENCODING
+ * ============================================================================ */
+
+static uint32_t column_value(const struct batch_sample *s, int col, int64_t base)
+{
+    return (col == 0) ? (uint32_t)(s->ts_ms - base) : s->values[col - 1];
+}
+
+int batch_encode(const struct batch_sample *samples, size_t n, uint8_t *out, size_t size)
+{
+    uint8_t hdr[4 + 10];
+    size_t pos;
+
+    if (n == 0 || n > BATCH_MAX_SAMPLES) {
+        return -EINVAL;
+    }
+
+    int64_t base = samples[0].ts_ms;
+
+    for (size_t i = 1; i < n; i++) {
+        int64_t off = samples[i].ts_ms - base;
+
+        if (off < 0 || off > (int64_t)UINT32_MAX) {
+            return -ERANGE;
+        }
+    }
+
+    hdr[0] = BATCH_MAGIC_0;
+    hdr[1] = BATCH_MAGIC_1;
+    hdr[2] = BATCH_VERSION;
+    hdr[3] = (uint8_t)n;
+    pos = 4 + varint_put(&hdr[4], zigzag64(base));
+    if (pos > size) {
+        return -EMSGSIZE;
+    }
+    memcpy(out, hdr, pos);
+
+    for (int c = 0; c < BATCH_COLUMNS; c++) {
+        /* Values go behind room for the length, which is then moved up */
+        size_t start = pos + COLUMN_LEN_MAX;
+        size_t len = 0;
+        uint32_t prev = 0;
+        uint8_t len_buf[COLUMN_LEN_MAX];
+
+        for (size_t i = 0; i < n; i++) {
+            uint32_t v = column_value(&samples[i], c, base);
+
+            if (start + len + BATCH_VARINT_MAX > size) {
+                return -EMSGSIZE;
+            }
+            len += varint_put(&out[start + len], batch_zigzag((int32_t)(v - prev)));
+            prev = v;
+        }
+
+        size_t len_len = varint_put(len_buf, len);
+
+        memmove(&out[pos + len_len], &out[start], len);
+        memcpy(&out[pos], len_buf, len_len);
+        pos += len_len + len;
+    }
+    return (int)pos;
+}
+
+/* ============================================================================
+ * DECODING
+ * ============================================================================ */
+
+int batch_parse(const uint8_t *buf, size_t len, struct batch_view *view)
+{
+    uint64_t v;
+    size_t pos, used;
+
+    if (len < BATCH_HEADER_MIN || buf[0] != BATCH_MAGIC_0 || buf[1] != BATCH_MAGIC_1 ||
+        buf[2] != BATCH_VERSION || buf[3] == 0) {
+        return -EINVAL;
+    }
+    view->count = buf[3];
+
+    used = varint_get(&buf[4], len - 4, 10, &v);
+    if (used == 0) {
+        return -EINVAL;
+    }
+    view->base_ts_ms = unzigzag64(v);
+    pos = 4 + used;
+
+    for (int c = 0; c < BATCH_COLUMNS; c++) {
+        used = varint_get(&buf[pos], len - pos, BATCH_VARINT_MAX, &v);
+        if (used == 0 || v > len - pos - used) {
+            return -EINVAL;
+        }
+        pos += used;
+        view->column[c] = &buf[pos];
+        view->column_len[c] = (size_t)v;
+        pos += (size_t)v;
+    }
+    return (pos == len) ? 0 : -EINVAL;
+}
+
+int batch_decode_column(const uint8_t *in, size_t len, uint32_t *out, size_t n)
+{
+    uint32_t acc = 0;
+    size_t pos = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t v;
+        size_t used = varint_get(&in[pos], len - pos, BATCH_VARINT_MAX, &v);
+
+        if (used == 0 || v > UINT32_MAX) {
+            return -EINVAL;
+        }
+        pos += used;
+        acc += (uint32_t)batch_unzigzag((uint32_t)v);
+        out[i] = acc;
+    }
+    return (pos == len) ? 0 : -EINVAL;
+}
+
+int batch_decode(const uint8_t *buf, size_t len, struct batch_sample *out, size_t max)
+{
+    struct batch_view view;
+    uint32_t values[BATCH_MAX_SAMPLES];
+    int rc = batch_parse(buf, len, &view);
+
+    if (rc != 0) {
+        return rc;
+    }
+    if (view.count > max) {
+        return -EMSGSIZE;
+    }
+
+    for (int c = 0; c < BATCH_COLUMNS; c++) {
+        rc = batch_decode_column(view.column[c], view.column_len[c], values, view.count);
+        if (rc != 0) {
+            return rc;
+        }
+        for (size_t i = 0; i < view.count; i++) {
+            if (c == 0) {
+                out[i].ts_ms = view.base_ts_ms + values[i];
+            } else {
+                out[i].values[c - 1] = values[i];
+            }
+        }
+    }
+    return view.count;
+}
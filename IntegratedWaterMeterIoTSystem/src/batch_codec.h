@@ -0,0 +1,100 @@
+/**
+ * @file batch_codec.h
+ * @brief Compact binary sample batches, shared by the firmware and host tools
+ *
+ * @details
+ * A batch carries up to BATCH_MAX_SAMPLES samples of one meter, stored by
+ * column so that each series compresses on its own:
+ *
+ *   'W' 'B' version count  base_ts(zigzag varint, Unix ms)
+ *   then BATCH_COLUMNS times:  length(varint)  values(length bytes)
+ *
+ * Column 0 is the sample time as an offset from base_ts, columns 1.. are the
+ * BOVE_FIELDS in register_map.h order. Each column holds the differences
+ * between consecutive values (the first from 0), wrapped to 32 bits, zigzag
+ * mapped and written as LEB128 varints. Flat or slowly ramping series thus
+ * cost one byte per value. The column lengths let a decoder check bounds
+ * and decode columns independently.
+ *
+ * Plain C, no Zephyr headers, so it compiles on the host as well.
+ */
+
+#ifndef BATCH_CODEC_H_
+#define BATCH_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "register_map.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BATCH_MAGIC_0 'W'
+#define BATCH_MAGIC_1 'B'
+#define BATCH_VERSION 1
+#define BATCH_HEADER_MIN 5
+#define BATCH_MAX_SAMPLES 255
+#define BATCH_COLUMNS (1 + BOVE_FIELD_COUNT)   /* Time, then the fields */
+#define BATCH_VARINT_MAX 5                     /* Bytes of a 32-bit varint */
+
+struct batch_sample {
+    int64_t ts_ms;                      /* Unix time */
+    uint32_t values[BOVE_FIELD_COUNT];  /* Indexed by enum bove_field */
+};
+
+/* Located columns of a received batch; nothing decoded yet */
+struct batch_view {
+    uint8_t count;
+    int64_t base_ts_ms;
+    const uint8_t *column[BATCH_COLUMNS];
+    size_t column_len[BATCH_COLUMNS];
+};
+
+static inline uint32_t batch_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t batch_unzigzag(uint32_t v)
+{
+    return (int32_t)((v >> 1) ^ (0U - (v & 1U)));
+}
+
+/**
+ * @brief Encode @p n samples; times must lie within 2^32 ms of the first
+ *
+ * @return Encoded length, -EINVAL for no or too many samples, -ERANGE for
+ *         a time span that does not fit, -EMSGSIZE if @p size is too small
+ */
+int batch_encode(const struct batch_sample *samples, size_t n, uint8_t *out, size_t size);
+
+/**
+ * @brief Check the header and locate the columns
+ *
+ * @return 0 on success, -EINVAL if the batch is malformed or truncated
+ */
+int batch_parse(const uint8_t *buf, size_t len, struct batch_view *view);
+
+/**
+ * @brief Decode one column into absolute values (reference implementation)
+ *
+ * @return 0 on success, -EINVAL if the column does not hold exactly @p n
+ *         values
+ */
+int batch_decode_column(const uint8_t *in, size_t len, uint32_t *out, size_t n);
+
+/**
+ * @brief Decode a whole batch
+ *
+ * @return Number of samples, -EINVAL if malformed, -EMSGSIZE if more than
+ *         @p max
+ */
+int batch_decode(const uint8_t *buf, size_t len, struct batch_sample *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BATCH_CODEC_H_ */
@@ -0,0 +1,130 @@
+/**
+ * @file broker_select.c
+ * @brief Health and latency scoring of an ordered list of broker endpoints
+ */
+
+#include <string.h>
+
+#include "broker_select.h"
+
+/* EWMA weight of a new sample: 1/4 */
+#define EWMA_SHIFT 2
+
+static void ewma_add(uint32_t *avg, uint32_t sample)
+{
+    *avg = *avg - (*avg >> EWMA_SHIFT) + (sample >> EWMA_SHIFT);
+}
+
+static bool in_backoff(const struct broker_health *h, int64_t now_ms)
+{
+    return h->failures > 0 && now_ms < h->retry_at_ms;
+}
+
+void broker_set_init(struct broker_set *set, uint8_t count)
+{
+    memset(set, 0, sizeof(*set));
+    set->count = (count > BROKER_MAX) ? BROKER_MAX : count;
+    set->active = BROKER_NONE;
+    for (uint8_t i = 0; i < set->count; i++) {
+        set->h[i].latency_ewma_ms = BROKER_LATENCY_UNKNOWN_MS;
+    }
+}
+
+uint32_t broker_score(const struct broker_set *set, uint8_t idx)
+{
+    const struct broker_health *h = &set->h[idx];
+
+    return idx * BROKER_RANK_WEIGHT_MS + h->latency_ewma_ms +
+           h->failures * BROKER_FAILURE_PENALTY_MS;
+}
+
+int broker_select(const struct broker_set *set, int64_t now_ms)
+{
+    int best = BROKER_NONE;
+    uint32_t best_score = UINT32_MAX;
+
+    for (uint8_t i = 0; i < set->count; i++) {
+        if (in_backoff(&set->h[i], now_ms)) {
+            continue;
+        }
+        uint32_t score = broker_score(set, i);
+        if (score < best_score) {
+            best = i;
+            best_score = score;
+        }
+    }
+    return best;
+}
+
+void broker_report_connect(struct broker_set *set, uint8_t idx, bool ok,
+                           uint32_t latency_ms, int64_t now_ms)
+{
+    struct broker_health *h = &set->h[idx];
+
+    if (ok) {
+        h->failures = 0;
+        ewma_add(&h->latency_ewma_ms, latency_ms);
+        return;
+    }
+
+    if (h->failures < UINT8_MAX) {
+        h->failures++;
+    }
+
+    /* 5 s, 10 s, 20 s ... capped */
+    uint32_t backoff = BROKER_BACKOFF_BASE_MS;
+    for (uint8_t i = 1; i < h->failures && backoff < BROKER_BACKOFF_MAX_MS; i++) {
+        backoff *= 2;
+    }
+    if (backoff > BROKER_BACKOFF_MAX_MS) {
+        backoff = BROKER_BACKOFF_MAX_MS;
+    }
+    h->retry_at_ms = now_ms + backoff;
+}
+
+void broker_report_rtt(struct broker_set *set, uint32_t rtt_ms)
+{
+    if (set->active != BROKER_NONE) {
+        ewma_add(&set->h[set->active].latency_ewma_ms, rtt_ms);
+    }
+}
+
+void broker_report_drop(struct broker_set *set, uint8_t idx, int64_t now_ms)
+{
+    /* A dropped session counts as a failure so a flapping endpoint backs off */
+    broker_report_connect(set, idx, false, 0, now_ms);
+    if (set->active == idx) {
+        set->active = BROKER_NONE;
+    }
+}
+
+void broker_set_active(struct broker_set *set, int idx, int64_t now_ms)
+{
+    set->active = idx;
+    set->next_probe_ms = now_ms + BROKER_PROBE_INTERVAL_MS;
+}
+
+int broker_probe_candidate(struct broker_set *set, int64_t now_ms)
+{
+    if (set->active == BROKER_NONE || set->active == 0 || now_ms < set->next_probe_ms) {
+        return BROKER_NONE;
+    }
+    set->next_probe_ms = now_ms + BROKER_PROBE_INTERVAL_MS;
+
+    /* Most preferred first */
+    for (int i = 0; i < set->active; i++) {
+        if (!in_backoff(&set->h[i], now_ms)) {
+            return i;
+        }
+    }
+    return BROKER_NONE;
+}
+
+bool broker_should_switch(const struct broker_set *set, uint8_t candidate)
+{
+    if (set->active == BROKER_NONE || set->h[candidate].failures > 0) {
+        return false;
+    }
+    return broker_score(set, candidate) + BROKER_SWITCH_MARGIN_MS <
+           broker_score(set, set->active);
+}
@@ -0,0 +1,89 @@
+/**
+ * @file broker_select.h
+ * @brief Health and latency scoring of an ordered list of broker endpoints
+ *
+ * @details
+ * Endpoints are listed in order of preference (e.g. cloud, regional edge,
+ * local ThingsBoard Edge). Each keeps an EWMA of its connect and
+ * round-trip latency and a count of consecutive failures, which puts it
+ * into exponential back-off. The score is
+ *
+ *   rank * BROKER_RANK_WEIGHT_MS + latency EWMA + failures * BROKER_FAILURE_PENALTY_MS
+ *
+ * and the lowest-scoring endpoint out of back-off is selected. While on a
+ * lower-preference endpoint, better-ranked ones are probed periodically and
+ * the session is moved back when a probe scores better by a margin.
+ *
+ * Pure C, no kernel calls: times are passed in.
+ */
+
+#ifndef BROKER_SELECT_H_
+#define BROKER_SELECT_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BROKER_MAX 4
+#define BROKER_NONE (-1)
+
+#define BROKER_RANK_WEIGHT_MS 500
+#define BROKER_FAILURE_PENALTY_MS 2000
+#define BROKER_BACKOFF_BASE_MS 5000
+#define BROKER_BACKOFF_MAX_MS 300000
+#define BROKER_PROBE_INTERVAL_MS 120000
+#define BROKER_SWITCH_MARGIN_MS 250
+
+/* Latency assumed before the first measurement */
+#define BROKER_LATENCY_UNKNOWN_MS 1000
+
+struct broker_health {
+    uint32_t latency_ewma_ms;
+    uint8_t failures;           /* Consecutive */
+    int64_t retry_at_ms;        /* Back-off end */
+};
+
+struct broker_set {
+    struct broker_health h[BROKER_MAX];
+    uint8_t count;
+    int8_t active;              /* Index of the connected endpoint or BROKER_NONE */
+    int64_t next_probe_ms;
+};
+
+/** @brief Reset @p set for @p count endpoints (clamped to BROKER_MAX) */
+void broker_set_init(struct broker_set *set, uint8_t count);
+
+/** @brief Score of endpoint @p idx, lower is better */
+uint32_t broker_score(const struct broker_set *set, uint8_t idx);
+
+/**
+ * @brief Best endpoint to connect to now
+ *
+ * @return Index, or BROKER_NONE if every endpoint is in back-off
+ */
+int broker_select(const struct broker_set *set, int64_t now_ms);
+
+/** @brief Result of a connect attempt or probe to @p idx */
+void broker_report_connect(struct broker_set *set, uint8_t idx, bool ok,
+                           uint32_t latency_ms, int64_t now_ms);
+
+/** @brief A round trip (e.g. PUBACK, PINGRESP) on the active endpoint */
+void broker_report_rtt(struct broker_set *set, uint32_t rtt_ms);
+
+/** @brief The session on @p idx was lost */
+void broker_report_drop(struct broker_set *set, uint8_t idx, int64_t now_ms);
+
+/** @brief A session was established on @p idx (or BROKER_NONE when offline) */
+void broker_set_active(struct broker_set *set, int idx, int64_t now_ms);
+
+/**
+ * @brief Better-ranked endpoint to probe now, if any
+ *
+ * @return Index, or BROKER_NONE if on the preferred endpoint, the probe
+ *         interval has not elapsed, or all better ones are in back-off
+ */
+int broker_probe_candidate(struct broker_set *set, int64_t now_ms);
+
+/** @brief True if a probed @p candidate now beats the active endpoint */
+bool broker_should_switch(const struct broker_set *set, uint8_t candidate);
+
+#endif /* BROKER_SELECT_H_ */
@@ -0,0 +1,1116 @@
+/**
+ * @file cloud.c
+ * @brief WiFi and ThingsBoard MQTT connectivity
+ *
+ * @details
+ * Owns the WiFi station, the broker endpoints and the MQTT client. The
+ * application only sees cloud.h, which lets the native_sim build swap this
+ * file for a simulated network (sim_cloud.c).
+ *
+ * Endpoints (CONFIG_APP_BROKER_n_*) are tried in order, weighted by their
+ * measured latency and failures (broker_select.c). While connected to a
+ * fallback, better-ranked endpoints are probed with a TCP connect and the
+ * session moves back when one scores better. Publishes go through the
+ * outbox (outbox.c), so nothing unacknowledged is lost on a switch.
+ *
+ * Bulk uploads (backfill.c) use the HTTP device API of the endpoint the
+ * MQTT session is on, on a socket of their own.
+ *
+ * With the raw uplink, raw frame batches go to the broker of the host
+ * ingest bridge on a second MQTT session with its own outbox; ThingsBoard
+ * has no such topic. That session is reconnected from mqtt_maintenance()
+ * and does not depend on the ThingsBoard one.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/net/mqtt.h>
+#include <zephyr/random/random.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/posix/poll.h>
+#include <zephyr/net/wifi_mgmt.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_event.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_ip.h>
+#include <zephyr/net/net_stats.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "broker_select.h"
+#include "cloud.h"
+#include "metrics.h"
+#include "outbox.h"
+
+LOG_MODULE_REGISTER(cloud, LOG_LEVEL_INF);
+
+/* ============================================================================
+ * CONFIGURATION
+ * ============================================================================ */
+
+/* WiFi Configuration */
+#define WIFI_SSID "!!Huawei"
+#define WIFI_PSK "karamr195"
+
+/* ThingsBoard Configuration */
+#define ACCESS_TOKEN "JqkpupDR1nmXD6nbZX2S"
+
+struct broker_endpoint {
+    const char *name;
+    const char *host;
+    uint16_t port;
+    uint16_t http_port;         /* Device HTTP API, used for bulk uploads */
+};
+
+/* In order of preference, at most BROKER_MAX; an empty host ends the list */
+static const struct broker_endpoint broker_endpoints[] = {
+#if defined(CONFIG_APP_TEST_BROKER)
+    /* host_tools/tb_mock on the bench */
+    { "test", CONFIG_APP_TEST_BROKER_HOST, CONFIG_APP_TEST_BROKER_MQTT_PORT,
+      CONFIG_APP_TEST_BROKER_HTTP_PORT },
+#else
+    { "primary",   CONFIG_APP_BROKER_1_HOST, CONFIG_APP_BROKER_1_PORT,
+      CONFIG_APP_BROKER_1_HTTP_PORT },
+    { "fallback1", CONFIG_APP_BROKER_2_HOST, CONFIG_APP_BROKER_2_PORT,
+      CONFIG_APP_BROKER_2_HTTP_PORT },
+    { "fallback2", CONFIG_APP_BROKER_3_HOST, CONFIG_APP_BROKER_3_PORT,
+      CONFIG_APP_BROKER_3_HTTP_PORT },
+#endif
+};
+
+BUILD_ASSERT(ARRAY_SIZE(broker_endpoints) <= BROKER_MAX, "too many broker endpoints");
+
+#define CONNACK_TIMEOUT_MS 5000
+#define BULK_TIMEOUT_MS 10000
+
+/* Buffer Sizes */
+#define RX_BUFFER_SIZE 1024
+#define TX_BUFFER_SIZE 1024
+#define RX_PAYLOAD_BUFFER 768
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+/* Bridge Session: receives CONNACK, PUBACK and PINGRESP only */
+#define RAW_TOPIC "watermeter/" ACCESS_TOKEN "/raw"
+#define RAW_RX_BUFFER_SIZE 64
+#define RAW_RETRY_MS 30000
+
+BUILD_ASSERT(sizeof(CONFIG_APP_RAW_BROKER_HOST) > 1,
+             "CONFIG_APP_RAW_BROKER_HOST must name the ingest bridge's broker");
+#endif
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+/* MQTT Client */
+static struct mqtt_client client;
+static uint8_t mqtt_rx_buffer[RX_BUFFER_SIZE];
+static uint8_t mqtt_tx_buffer[TX_BUFFER_SIZE];
+static cloud_rx_handler_t rx_handler;
+static cloud_session_handler_t session_handler;
+static cloud_delivery_handler_t delivery_handler;
+static int64_t ping_sent_ms;
+
+/* Broker Endpoints */
+static struct sockaddr_in broker_addrs[BROKER_MAX];
+static bool broker_resolved[BROKER_MAX];
+static struct broker_set brokers;
+static int last_broker = BROKER_NONE;   /* Endpoint of the previous session */
+
+/* Messages awaiting PUBACK */
+OUTBOX_DEFINE(outbox, OUTBOX_SIZE);
+
+/* Bulk upload socket, -1 when idle */
+static int bulk_sock = -1;
+
+/* Endpoint of the MQTT session as seen by the backfill thread */
+static K_MUTEX_DEFINE(session_lock);
+static int session_endpoint = BROKER_NONE;
+static struct sockaddr_in session_addr;
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+/* Session to the ingest bridge's broker, raw batches only */
+static struct mqtt_client raw_client;
+static uint8_t raw_rx_buffer[RAW_RX_BUFFER_SIZE];
+static uint8_t raw_tx_buffer[TX_BUFFER_SIZE];
+OUTBOX_DEFINE(raw_outbox, CONFIG_APP_RAW_OUTBOX_SIZE);
+static volatile bool raw_connected = false;
+static int64_t raw_retry_ms;            /* No reconnect before this uptime */
+#endif
+
+/* Network Management */
+static struct net_mgmt_event_callback wifi_cb;
+static struct net_mgmt_event_callback ipv4_cb;
+static K_SEM_DEFINE(wifi_connected, 0, 1);
+static K_SEM_DEFINE(ipv4_obtained, 0, 1);
+static volatile bool mqtt_connected = false;
+static volatile bool wifi_up = false;
+
+/**
+ * @brief Record the endpoint of the session for cloud_bulk_begin(), which
+ *        runs on the backfill thread; BROKER_NONE when there is none
+ */
+static void set_session_endpoint(int idx)
+{
+    k_mutex_lock(&session_lock, K_FOREVER);
+    session_endpoint = idx;
+    if (idx != BROKER_NONE) {
+        session_addr = broker_addrs[idx];
+    }
+    k_mutex_unlock(&session_lock);
+}
+
+/* ============================================================================
+ * WIFI FUNCTIONS
+ * ============================================================================ */
+
+static void wifi_event_handler(struct net_mgmt_event_callback *cb,
+                              uint64_t mgmt_event, struct net_if *iface)
+{
+    if (mgmt_event == NET_EVENT_WIFI_CONNECT_RESULT) {
+        int status = *((int *)cb->info);
+        if (status == 0) {
+            LOG_INF("WiFi connected");
+            wifi_up = true;
+            k_sem_give(&wifi_connected);
+        } else {
+            LOG_ERR("WiFi failed: %d", status);
+        }
+    } else if (mgmt_event == NET_EVENT_WIFI_DISCONNECT_RESULT) {
+        LOG_WRN("WiFi disconnected");
+        wifi_up = false;
+        mqtt_connected = false;
+        set_session_endpoint(BROKER_NONE);
+        metrics_mqtt_connection(false);
+        k_sem_reset(&wifi_connected);
+        k_sem_reset(&ipv4_obtained);
+    }
+}
+
+static void ipv4_event_handler(struct net_mgmt_event_callback *cb,
+                              uint64_t mgmt_event, struct net_if *iface)
+{
+    if (mgmt_event == NET_EVENT_IPV4_ADDR_ADD) {
+        LOG_INF("IPv4 address obtained");
+        k_sem_give(&ipv4_obtained);
+    }
+}
+
+int wifi_connect(void)
+{
+    struct net_if *iface;
+    struct wifi_connect_req_params params;
+    int retry = 0;
+    const int max_retries = 10;
+    
+    LOG_INF("Initializing WiFi connection...");
+
+    iface = net_if_get_first_wifi();
+    if (iface == NULL) {
+        LOG_ERR("No WiFi interface found");
+        return -ENODEV;
+    }
+
+    net_mgmt_init_event_callback(&wifi_cb, wifi_event_handler,
+                                NET_EVENT_WIFI_CONNECT_RESULT |
+                                NET_EVENT_WIFI_DISCONNECT_RESULT);
+    net_mgmt_add_event_callback(&wifi_cb);
+
+    net_mgmt_init_event_callback(&ipv4_cb, ipv4_event_handler,
+                                NET_EVENT_IPV4_ADDR_ADD);
+    net_mgmt_add_event_callback(&ipv4_cb);
+
+    memset(&params, 0, sizeof(params));
+    params.ssid = WIFI_SSID;
+    params.ssid_length = strlen(WIFI_SSID);
+    params.psk = WIFI_PSK;
+    params.psk_length = strlen(WIFI_PSK);
+    params.security = WIFI_SECURITY_TYPE_PSK;
+    params.channel = WIFI_CHANNEL_ANY;
+    params.band = WIFI_FREQ_BAND_2_4_GHZ;
+
+    /* Retry loop for WiFi connection */
+    while (retry < max_retries) {
+        LOG_INF("WiFi connection attempt %d/%d...", retry + 1, max_retries);
+        
+        /* Reset semaphores before retry */
+        k_sem_reset(&wifi_connected);
+        k_sem_reset(&ipv4_obtained);
+        
+        int ret = net_mgmt(NET_REQUEST_WIFI_CONNECT, iface, &params, sizeof(params));
+        if (ret) {
+            LOG_WRN("WiFi connection request failed: %d", ret);
+            retry++;
+            k_sleep(K_SECONDS(5));
+            continue;
+        }
+
+        /* Wait for WiFi connection */
+        if (k_sem_take(&wifi_connected, K_SECONDS(30)) != 0) {
+            LOG_WRN("WiFi connection timeout (attempt %d/%d)", retry + 1, max_retries);
+            retry++;
+            k_sleep(K_SECONDS(5));
+            continue;
+        }
+
+        /* Wait for IPv4 address */
+        if (k_sem_take(&ipv4_obtained, K_SECONDS(30)) != 0) {
+            LOG_WRN("IPv4 acquisition timeout (attempt %d/%d)", retry + 1, max_retries);
+            retry++;
+            k_sleep(K_SECONDS(5));
+            continue;
+        }
+
+        /* Success! */
+        LOG_INF("WiFi connected successfully on attempt %d", retry + 1);
+        return 0;
+    }
+
+    /* All retries failed */
+    LOG_ERR("WiFi connection failed after %d attempts", max_retries);
+    return -ETIMEDOUT;
+}
+
+int cloud_link_sample(struct link_sample *s)
+{
+    struct net_if *iface = net_if_get_first_wifi();
+    struct wifi_iface_status status = {0};
+
+    memset(s, 0, sizeof(*s));
+    if (iface == NULL) {
+        return -ENODEV;
+    }
+
+    if (wifi_up &&
+        net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, iface, &status, sizeof(status)) == 0 &&
+        status.state >= WIFI_STATE_ASSOCIATED) {
+        s->rssi_valid = true;
+        s->rssi_dbm = status.rssi;
+    }
+
+#if defined(CONFIG_NET_STATISTICS_USER_API)
+#if defined(CONFIG_NET_STATISTICS_WIFI)
+    struct net_stats_wifi wifi;
+
+    if (net_mgmt(NET_REQUEST_STATS_GET_WIFI, iface, &wifi, sizeof(wifi)) == 0) {
+        s->tx_valid = true;
+        s->tx_packets = wifi.pkts.tx;
+        s->tx_errors = wifi.errors.tx;
+    }
+#endif
+#if defined(CONFIG_NET_STATISTICS_TCP)
+    struct net_stats_tcp tcp;
+
+    if (net_mgmt(NET_REQUEST_STATS_GET_TCP, iface, &tcp, sizeof(tcp)) == 0) {
+        s->tcp_valid = true;
+        s->tcp_sent = tcp.sent;
+        s->tcp_rexmit = tcp.rexmit;
+    }
+#endif
+#endif /* CONFIG_NET_STATISTICS_USER_API */
+
+    return 0;
+}
+
+/* ============================================================================
+ * MQTT FUNCTIONS
+ * ============================================================================ */
+
+/**
+ * @brief Endpoints in use: those before the first one without a host
+ */
+static int endpoint_count(void)
+{
+    int n = 0;
+
+    while (n < ARRAY_SIZE(broker_endpoints) && broker_endpoints[n].host[0] != '\0') {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Resolve one endpoint (IP literals resolve without DNS)
+ */
+static int resolve_endpoint(int idx)
+{
+    const struct broker_endpoint *ep = &broker_endpoints[idx];
+    struct zsock_addrinfo hints;
+    struct zsock_addrinfo *result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int ret = zsock_getaddrinfo(ep->host, NULL, &hints, &result);
+    if (ret != 0 || result == NULL) {
+        LOG_WRN("DNS resolution failed for %s (%s)", ep->name, ep->host);
+        return -EINVAL;
+    }
+
+    memcpy(&broker_addrs[idx], result->ai_addr, sizeof(broker_addrs[idx]));
+    broker_addrs[idx].sin_family = AF_INET;
+    broker_addrs[idx].sin_port = htons(ep->port);
+    broker_resolved[idx] = true;
+
+    zsock_freeaddrinfo(result);
+    return 0;
+}
+
+int broker_init(void)
+{
+    int resolved = 0;
+
+    if (brokers.count == 0) {
+        broker_set_init(&brokers, endpoint_count());
+    }
+
+    for (int i = 0; i < endpoint_count(); i++) {
+        LOG_INF("Resolving broker %s: %s", broker_endpoints[i].name,
+                broker_endpoints[i].host);
+        if (resolve_endpoint(i) == 0) {
+            resolved++;
+        }
+    }
+
+    if (resolved == 0) {
+        LOG_ERR("No broker endpoint could be resolved");
+        return -EINVAL;
+    }
+    LOG_INF("%d of %d broker endpoints resolved", resolved,
+            endpoint_count());
+    return 0;
+}
+
+/**
+ * @brief Read an incoming PUBLISH, acknowledge it and pass it to the app
+ */
+static void handle_incoming_publish(struct mqtt_client *const c,
+                                    const struct mqtt_publish_param *p)
+{
+    static char payload[RX_PAYLOAD_BUFFER];
+    char topic[64];
+    size_t len = p->message.payload.len;
+    int ret;
+
+    snprintf(topic, sizeof(topic), "%.*s", (int)p->message.topic.topic.size,
+             (const char *)p->message.topic.topic.utf8);
+
+    if (len >= sizeof(payload)) {
+        LOG_WRN("Incoming payload too large (%u bytes), dropped", (unsigned int)len);
+        /* Drain so the stream stays in sync */
+        while (len > 0) {
+            ret = mqtt_read_publish_payload_blocking(c, payload,
+                                                     MIN(len, sizeof(payload)));
+            if (ret <= 0) {
+                return;
+            }
+            len -= ret;
+        }
+        len = 0;
+    } else {
+        ret = mqtt_readall_publish_payload(c, (uint8_t *)payload, len);
+        if (ret != 0) {
+            LOG_ERR("Failed to read incoming payload: %d", ret);
+            return;
+        }
+        payload[len] = '\0';
+    }
+
+    if (p->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE) {
+        struct mqtt_puback_param ack = { .message_id = p->message_id };
+
+        mqtt_publish_qos1_ack(c, &ack);
+    }
+
+    if (len > 0 && rx_handler != NULL) {
+        rx_handler(topic, payload, len);
+    }
+}
+
+static void mqtt_evt_handler(struct mqtt_client *const client,
+                            const struct mqtt_evt *evt)
+{
+    switch (evt->type) {
+    case MQTT_EVT_CONNACK:
+        if (evt->result != 0) {
+            LOG_ERR("MQTT connection refused: %d", evt->result);
+            mqtt_connected = false;
+        } else {
+            LOG_INF("MQTT connected");
+            mqtt_connected = true;
+            metrics_mqtt_connection(true);
+        }
+        break;
+    case MQTT_EVT_DISCONNECT:
+        LOG_WRN("MQTT disconnected");
+        if (mqtt_connected && brokers.active != BROKER_NONE) {
+            /* Losing WiFi is not the broker's fault */
+            if (wifi_up) {
+                broker_report_drop(&brokers, brokers.active, k_uptime_get());
+            } else {
+                broker_set_active(&brokers, BROKER_NONE, k_uptime_get());
+            }
+            metrics_broker_active(BROKER_NONE);
+        }
+        mqtt_connected = false;
+        set_session_endpoint(BROKER_NONE);
+        metrics_mqtt_connection(false);
+        break;
+    case MQTT_EVT_PUBACK: {
+        const struct outbox_msg *m;
+
+        LOG_DBG("PUBACK received, msg_id: %d", evt->param.puback.message_id);
+        m = outbox_ack(&outbox, evt->param.puback.message_id);
+        if (m != NULL) {
+            uint32_t rtt = (uint32_t)(k_uptime_get() - m->sent_ms);
+
+            broker_report_rtt(&brokers, rtt);
+            metrics_mqtt_acked();
+            metrics_outbox_depth(outbox_count(&outbox));
+            if (delivery_handler != NULL) {
+                delivery_handler(m->topic, CLOUD_ACKED, rtt);
+            }
+        }
+        break;
+    }
+    case MQTT_EVT_PINGRESP:
+        if (ping_sent_ms != 0) {
+            broker_report_rtt(&brokers, (uint32_t)(k_uptime_get() - ping_sent_ms));
+            ping_sent_ms = 0;
+        }
+        break;
+    case MQTT_EVT_PUBLISH:
+        handle_incoming_publish(client, &evt->param.publish);
+        break;
+    case MQTT_EVT_SUBACK:
+        LOG_DBG("SUBACK received, msg_id: %d", evt->param.suback.message_id);
+        break;
+    default:
+        break;
+    }
+}
+
+static void prepare_mqtt_client(int idx)
+{
+    static char client_id[32];
+    static struct mqtt_utf8 mqtt_user_name;
+
+    snprintf(client_id, sizeof(client_id), "esp32_meter_%08x", 
+             (unsigned int)sys_rand32_get());
+
+    mqtt_client_init(&client);
+
+    client.broker = (struct sockaddr *)&broker_addrs[idx];
+    client.evt_cb = mqtt_evt_handler;
+    client.client_id.utf8 = (uint8_t *)client_id;
+    client.client_id.size = strlen(client_id);
+    client.user_name = &mqtt_user_name;
+    mqtt_user_name.utf8 = (uint8_t *)ACCESS_TOKEN;
+    mqtt_user_name.size = strlen(ACCESS_TOKEN);
+    client.password = NULL;
+    client.protocol_version = MQTT_VERSION_3_1_1;
+    client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+    client.rx_buf = mqtt_rx_buffer;
+    client.rx_buf_size = sizeof(mqtt_rx_buffer);
+    client.tx_buf = mqtt_tx_buffer;
+    client.tx_buf_size = sizeof(mqtt_tx_buffer);
+    client.keepalive = 60;
+}
+
+/**
+ * @brief Wait for the CONNACK of a session being opened on @p c
+ *
+ * @param connected Set by the event handler of @p c on CONNACK
+ */
+static int await_connack(struct mqtt_client *c, const volatile bool *connected)
+{
+    struct zsock_pollfd fds[1];
+    int timeout = CONNACK_TIMEOUT_MS;
+
+    fds[0].fd = c->transport.tcp.sock;
+    fds[0].events = ZSOCK_POLLIN;
+
+    while (timeout > 0) {
+        int poll_ret = zsock_poll(fds, 1, 500);
+        if (poll_ret > 0 && (fds[0].revents & ZSOCK_POLLIN)) {
+            mqtt_input(c);
+        }
+
+        if (*connected) {
+            return 0;
+        }
+
+        k_sleep(K_MSEC(500));
+        timeout -= 500;
+    }
+
+    struct mqtt_disconnect_param disc = {0};
+    mqtt_disconnect(c, &disc);
+    return -ETIMEDOUT;
+}
+
+/**
+ * @brief Open an MQTT session to one endpoint and wait for CONNACK
+ */
+static int connect_endpoint(int idx)
+{
+    prepare_mqtt_client(idx);
+
+    int ret = mqtt_connect(&client);
+    if (ret != 0) {
+        LOG_ERR("mqtt_connect to %s failed: %d", broker_endpoints[idx].name, ret);
+        return ret;
+    }
+
+    return await_connack(&client, &mqtt_connected);
+}
+
+/**
+ * @brief Flush an outbox into its session, oldest first
+ *
+ * @param connected Session state of @p c
+ */
+static void flush_outbox(struct mqtt_client *c, struct outbox *ob,
+                         const volatile bool *connected)
+{
+    struct outbox_msg *m;
+
+    while (*connected && (m = outbox_next_unsent(ob)) != NULL) {
+        struct mqtt_publish_param pub = {0};
+
+        pub.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+        pub.message.topic.topic.utf8 = (uint8_t *)m->topic;
+        pub.message.topic.topic.size = strlen(m->topic);
+        pub.message.payload.data = (uint8_t *)m->payload;
+        pub.message.payload.len = m->len;
+        pub.message_id = outbox_mark_sent(ob, m, k_uptime_get());
+
+        int rc = mqtt_publish(c, &pub);
+        if (rc) {
+            LOG_WRN("Publish failed: %d, kept in outbox", rc);
+            m->message_id = 0;
+            metrics_mqtt_publish_failed();
+            break;
+        }
+        metrics_mqtt_published();
+    }
+}
+
+/**
+ * @brief Bookkeeping for a fresh session on @p idx
+ */
+static void session_started(int idx)
+{
+    broker_set_active(&brokers, idx, k_uptime_get());
+    set_session_endpoint(idx);
+    metrics_broker_active(idx);
+    LOG_INF("ThingsBoard connected via %s", broker_endpoints[idx].name);
+
+    /* Anything unacknowledged on the old session goes out again */
+    size_t resend = outbox_session_reset(&outbox);
+    if (resend > 0) {
+        LOG_INF("Re-sending %u queued message(s)", (unsigned int)resend);
+        if (delivery_handler != NULL) {
+            delivery_handler(NULL, CLOUD_SESSION_LOST, 0);
+        }
+    }
+
+    if (last_broker != BROKER_NONE && idx != last_broker) {
+        LOG_WRN("Broker switched: %s -> %s", broker_endpoints[last_broker].name,
+                broker_endpoints[idx].name);
+        metrics_broker_switch();
+    }
+    last_broker = idx;
+
+    if (session_handler != NULL) {
+        session_handler();
+    }
+    flush_outbox(&client, &outbox, &mqtt_connected);
+}
+
+int thingsboard_connect(void)
+{
+    const int max_attempts = 2 * endpoint_count();
+
+    LOG_INF("Connecting to ThingsBoard...");
+    if (brokers.count == 0) {
+        broker_set_init(&brokers, endpoint_count());
+    }
+
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+        int64_t now = k_uptime_get();
+        int idx = broker_select(&brokers, now);
+
+        if (idx == BROKER_NONE) {
+            LOG_WRN("All broker endpoints backing off");
+            break;
+        }
+
+        if (!broker_resolved[idx] && resolve_endpoint(idx) != 0) {
+            broker_report_connect(&brokers, idx, false, 0, now);
+            continue;
+        }
+
+        /* TCP handshake + CONNECT/CONNACK: two round trips */
+        if (connect_endpoint(idx) == 0) {
+            uint32_t rtt = (uint32_t)(k_uptime_get() - now) / 2;
+
+            broker_report_connect(&brokers, idx, true, rtt, k_uptime_get());
+            session_started(idx);
+            return 0;
+        }
+
+        broker_report_connect(&brokers, idx, false, 0, k_uptime_get());
+        LOG_WRN("Connection to %s failed (score now %u)", broker_endpoints[idx].name,
+                broker_score(&brokers, idx));
+    }
+
+    LOG_ERR("No broker endpoint available");
+    return -ECONNREFUSED;
+}
+
+bool cloud_connected(void)
+{
+    return mqtt_connected;
+}
+
+void cloud_set_rx_handler(cloud_rx_handler_t handler)
+{
+    rx_handler = handler;
+}
+
+void cloud_set_session_handler(cloud_session_handler_t handler)
+{
+    session_handler = handler;
+}
+
+void cloud_set_delivery_handler(cloud_delivery_handler_t handler)
+{
+    delivery_handler = handler;
+}
+
+int cloud_publish(const char *topic, const char *payload, size_t len)
+{
+    int rc = outbox_put(&outbox, topic, payload, len);
+
+    if (rc) {
+        metrics_mqtt_publish_failed();
+        return rc;
+    }
+    metrics_outbox_depth(outbox_count(&outbox));
+
+    flush_outbox(&client, &outbox, &mqtt_connected);
+    return 0;
+}
+
+size_t cloud_queued(void)
+{
+    return outbox_count(&outbox);
+}
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+int cloud_publish_raw(const char *payload, size_t len)
+{
+    int rc = outbox_put(&raw_outbox, RAW_TOPIC, payload, len);
+
+    if (rc) {
+        metrics_mqtt_publish_failed();
+        return rc;
+    }
+
+    flush_outbox(&raw_client, &raw_outbox, &raw_connected);
+    return 0;
+}
+#endif
+
+int cloud_subscribe(const char *const *topics, size_t count)
+{
+    struct mqtt_topic list_topics[CLOUD_MAX_SUBSCRIPTIONS];
+    struct mqtt_subscription_list list = {
+        .list = list_topics,
+        .list_count = count,
+        .message_id = (sys_rand32_get() % 0xFFFE) + 1,
+    };
+
+    if (count > ARRAY_SIZE(list_topics)) {
+        return -EINVAL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        list_topics[i].topic.utf8 = (uint8_t *)topics[i];
+        list_topics[i].topic.size = strlen(topics[i]);
+        list_topics[i].qos = MQTT_QOS_1_AT_LEAST_ONCE;
+    }
+
+    return mqtt_subscribe(&client, &list);
+}
+
+/**
+ * @brief Report messages whose PUBACK is overdue; they stay in the outbox
+ */
+static void check_ack_timeouts(void)
+{
+    int64_t now = k_uptime_get();
+    struct outbox_msg *m;
+
+    while ((m = outbox_overdue(&outbox, now, CONFIG_APP_MQTT_ACK_TIMEOUT_MS)) != NULL) {
+        LOG_WRN("No PUBACK for msg_id %u after %u ms", m->message_id,
+                (unsigned int)(now - m->sent_ms));
+        metrics_mqtt_ack_timeout();
+        if (delivery_handler != NULL) {
+            delivery_handler(m->topic, CLOUD_ACK_TIMEOUT, (uint32_t)(now - m->sent_ms));
+        }
+    }
+}
+
+/**
+ * @brief TCP connect to a better-ranked endpoint; move the session if it wins
+ */
+static void probe_failback(void)
+{
+    int64_t now = k_uptime_get();
+    int cand = broker_probe_candidate(&brokers, now);
+
+    if (cand == BROKER_NONE) {
+        return;
+    }
+    if (!broker_resolved[cand] && resolve_endpoint(cand) != 0) {
+        broker_report_connect(&brokers, cand, false, 0, now);
+        return;
+    }
+
+    int sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return;
+    }
+    int ret = zsock_connect(sock, (struct sockaddr *)&broker_addrs[cand],
+                            sizeof(broker_addrs[cand]));
+    uint32_t rtt = (uint32_t)(k_uptime_get() - now);
+    zsock_close(sock);
+
+    broker_report_connect(&brokers, cand, ret == 0, rtt, k_uptime_get());
+    LOG_INF("Probed %s: %s, score %u vs %u", broker_endpoints[cand].name,
+            ret == 0 ? "up" : "down", broker_score(&brokers, cand),
+            broker_score(&brokers, brokers.active));
+
+    if (ret != 0 || !broker_should_switch(&brokers, cand)) {
+        return;
+    }
+
+    /* Fail back: close this session cleanly; the outbox keeps unacked data.
+     * Cleared first so the DISCONNECT event does not count as a failure.
+     */
+    struct mqtt_disconnect_param disc = {0};
+
+    mqtt_connected = false;
+    broker_set_active(&brokers, BROKER_NONE, k_uptime_get());
+    set_session_endpoint(BROKER_NONE);
+    mqtt_disconnect(&client, &disc);
+    metrics_mqtt_connection(false);
+
+    now = k_uptime_get();
+    if (connect_endpoint(cand) == 0) {
+        broker_report_connect(&brokers, cand, true,
+                              (uint32_t)(k_uptime_get() - now) / 2, k_uptime_get());
+        session_started(cand);
+    } else {
+        broker_report_connect(&brokers, cand, false, 0, k_uptime_get());
+        thingsboard_connect();
+    }
+}
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+/* ============================================================================
+ * RAW FRAME SESSION
+ * ============================================================================ */
+
+static void raw_evt_handler(struct mqtt_client *const c, const struct mqtt_evt *evt)
+{
+    ARG_UNUSED(c);
+
+    switch (evt->type) {
+    case MQTT_EVT_CONNACK:
+        raw_connected = (evt->result == 0);
+        if (!raw_connected) {
+            LOG_ERR("Bridge broker refused the connection: %d", evt->result);
+        }
+        break;
+    case MQTT_EVT_DISCONNECT:
+        if (raw_connected) {
+            LOG_WRN("Bridge broker disconnected");
+        }
+        raw_connected = false;
+        break;
+    case MQTT_EVT_PUBACK:
+        if (outbox_ack(&raw_outbox, evt->param.puback.message_id) != NULL) {
+            metrics_mqtt_acked();
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Open the session to CONFIG_APP_RAW_BROKER_HOST and re-send what
+ *        the previous one left unacknowledged
+ */
+static int raw_connect(void)
+{
+    static char client_id[32];
+    static struct sockaddr_in addr;
+    struct zsock_addrinfo hints;
+    struct zsock_addrinfo *result;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int ret = zsock_getaddrinfo(CONFIG_APP_RAW_BROKER_HOST, NULL, &hints, &result);
+    if (ret != 0 || result == NULL) {
+        LOG_WRN("DNS resolution failed for bridge broker %s", CONFIG_APP_RAW_BROKER_HOST);
+        return -EINVAL;
+    }
+    memcpy(&addr, result->ai_addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CONFIG_APP_RAW_BROKER_PORT);
+    zsock_freeaddrinfo(result);
+
+    snprintf(client_id, sizeof(client_id), "esp32_raw_%08x",
+             (unsigned int)sys_rand32_get());
+
+    mqtt_client_init(&raw_client);
+
+    raw_client.broker = (struct sockaddr *)&addr;
+    raw_client.evt_cb = raw_evt_handler;
+    raw_client.client_id.utf8 = (uint8_t *)client_id;
+    raw_client.client_id.size = strlen(client_id);
+    raw_client.protocol_version = MQTT_VERSION_3_1_1;
+    raw_client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+    raw_client.rx_buf = raw_rx_buffer;
+    raw_client.rx_buf_size = sizeof(raw_rx_buffer);
+    raw_client.tx_buf = raw_tx_buffer;
+    raw_client.tx_buf_size = sizeof(raw_tx_buffer);
+    raw_client.keepalive = 60;
+
+    ret = mqtt_connect(&raw_client);
+    if (ret != 0) {
+        LOG_WRN("mqtt_connect to bridge broker failed: %d", ret);
+        return ret;
+    }
+    ret = await_connack(&raw_client, &raw_connected);
+    if (ret != 0) {
+        return ret;
+    }
+
+    LOG_INF("Bridge broker connected: %s:%d", CONFIG_APP_RAW_BROKER_HOST,
+            CONFIG_APP_RAW_BROKER_PORT);
+    size_t resend = outbox_session_reset(&raw_outbox);
+    if (resend > 0) {
+        LOG_INF("Re-sending %u raw batch(es)", (unsigned int)resend);
+    }
+    return 0;
+}
+
+/**
+ * @brief Keep the bridge session up and drain the raw outbox into it
+ */
+static void raw_maintenance(void)
+{
+    struct outbox_msg *m;
+
+    if (!raw_connected) {
+        if (!wifi_up || k_uptime_get() < raw_retry_ms) {
+            return;
+        }
+        if (raw_connect() != 0) {
+            raw_retry_ms = k_uptime_get() + RAW_RETRY_MS;
+            return;
+        }
+    }
+
+    mqtt_input(&raw_client);
+    mqtt_live(&raw_client);
+
+    while ((m = outbox_overdue(&raw_outbox, k_uptime_get(),
+                               CONFIG_APP_MQTT_ACK_TIMEOUT_MS)) != NULL) {
+        LOG_WRN("No PUBACK from bridge broker for msg_id %u", m->message_id);
+        metrics_mqtt_ack_timeout();
+    }
+    flush_outbox(&raw_client, &raw_outbox, &raw_connected);
+}
+#endif /* CONFIG_APP_RAW_UPLINK */
+
+void mqtt_maintenance(void)
+{
+#if defined(CONFIG_APP_RAW_UPLINK)
+    raw_maintenance();
+#endif
+
+    if (!mqtt_connected) {
+        return;
+    }
+
+    mqtt_input(&client);
+    if (mqtt_live(&client) == 0 && ping_sent_ms == 0) {
+        ping_sent_ms = k_uptime_get();
+    }
+
+    check_ack_timeouts();
+    flush_outbox(&client, &outbox, &mqtt_connected);
+    probe_failback();
+}
+
+/* ============================================================================
+ * BULK UPLOAD (HTTP)
+ * ============================================================================ */
+
+static int send_all(int sock, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t sent = zsock_send(sock, buf, len, 0);
+
+        if (sent < 0) {
+            return -errno;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int cloud_bulk_begin(void)
+{
+    struct zsock_timeval tv = {
+        .tv_sec = BULK_TIMEOUT_MS / 1000,
+    };
+    char header[192];
+    struct sockaddr_in addr;
+    int idx;
+
+    /* Same host as the MQTT session, already resolved. The MQTT thread may
+     * move the session meanwhile; this upload then finishes on the old one.
+     */
+    k_mutex_lock(&session_lock, K_FOREVER);
+    idx = session_endpoint;
+    addr = session_addr;
+    k_mutex_unlock(&session_lock);
+
+    if (idx == BROKER_NONE) {
+        return -ENOTCONN;
+    }
+    if (bulk_sock >= 0) {
+        return -EBUSY;
+    }
+
+    addr.sin_port = htons(broker_endpoints[idx].http_port);
+
+    int sock = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        return -errno;
+    }
+    zsock_setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    zsock_setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (zsock_connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        int err = -errno;
+
+        LOG_WRN("Bulk upload connect to %s failed: %d", broker_endpoints[idx].name, err);
+        zsock_close(sock);
+        return err;
+    }
+
+    int len = snprintf(header, sizeof(header),
+                       "POST /api/v1/" ACCESS_TOKEN "/telemetry HTTP/1.1\r\n"
+                       "Host: %s\r\n"
+                       "Content-Type: application/json\r\n"
+                       "Transfer-Encoding: chunked\r\n"
+                       "Connection: close\r\n"
+                       "\r\n",
+                       broker_endpoints[idx].host);
+
+    int rc = send_all(sock, header, len);
+    if (rc) {
+        zsock_close(sock);
+        return rc;
+    }
+
+    bulk_sock = sock;
+    return 0;
+}
+
+int cloud_bulk_write(const char *data, size_t len)
+{
+    char size_line[12];
+    int rc;
+
+    if (bulk_sock < 0) {
+        return -ENOTCONN;
+    }
+    if (len == 0) {
+        return 0;   /* A zero-size chunk would end the body */
+    }
+
+    int n = snprintf(size_line, sizeof(size_line), "%x\r\n", (unsigned int)len);
+
+    rc = send_all(bulk_sock, size_line, n);
+    if (rc == 0) {
+        rc = send_all(bulk_sock, data, len);
+    }
+    if (rc == 0) {
+        rc = send_all(bulk_sock, "\r\n", 2);
+    }
+    if (rc) {
+        cloud_bulk_abort();
+    }
+    return rc;
+}
+
+int cloud_bulk_end(void)
+{
+    char status[32];
+    size_t len = 0;
+    int rc;
+
+    if (bulk_sock < 0) {
+        return -ENOTCONN;
+    }
+
+    rc = send_all(bulk_sock, "0\r\n\r\n", 5);
+
+    /* Only the status line matters: "HTTP/1.1 200 OK" */
+    while (rc == 0 && len < sizeof(status) - 1 && memchr(status, '\n', len) == NULL) {
+        ssize_t n = zsock_recv(bulk_sock, &status[len], sizeof(status) - 1 - len, 0);
+
+        if (n < 0) {
+            rc = -errno;
+        } else if (n == 0) {
+            rc = -ECONNRESET;
+        } else {
+            len += n;
+        }
+    }
+    cloud_bulk_abort();
+
+    if (rc) {
+        return rc;
+    }
+
+    status[len] = '\0';
+    int code = (len > 12 && strncmp(status, "HTTP/1.", 7) == 0) ? atoi(&status[9]) : 0;
+
+    if (code >= 200 && code < 300) {
+        return 0;
+    }
+    LOG_WRN("Bulk upload rejected: HTTP %d", code);
+    return (code == 401) ? -EACCES : -EIO;
+}
+
+void cloud_bulk_abort(void)
+{
+    if (bulk_sock >= 0) {
+        zsock_close(bulk_sock);
+        bulk_sock = -1;
+    }
+}
@@ -0,0 +1,160 @@
+/**
+ * @file cloud.h
+ * @brief WiFi and ThingsBoard MQTT connectivity
+ */
+
+#ifndef CLOUD_H_
+#define CLOUD_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "linkq.h"
+
+/* ThingsBoard device API topics */
+#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
+#define ATTRIBUTES_TOPIC "v1/devices/me/attributes"
+#define ATTRIBUTES_REQUEST_TOPIC "v1/devices/me/attributes/request/1"
+#define ATTRIBUTES_RESPONSE_TOPIC "v1/devices/me/attributes/response/+"
+
+#define CLOUD_MAX_SUBSCRIPTIONS 4
+
+/**
+ * @brief Incoming PUBLISH (shared attributes, RPC) delivered to the app
+ */
+typedef void (*cloud_rx_handler_t)(const char *topic, const char *payload, size_t len);
+
+/**
+ * @brief Called on every new MQTT session, including a broker switch,
+ *        before queued messages are flushed (subscribe here)
+ */
+typedef void (*cloud_session_handler_t)(void);
+
+/** Delivery outcome of a queued message */
+enum cloud_delivery {
+    CLOUD_ACKED,            /* PUBACK received */
+    CLOUD_ACK_TIMEOUT,      /* No PUBACK within CONFIG_APP_MQTT_ACK_TIMEOUT_MS */
+    CLOUD_SESSION_LOST,     /* Session ended with messages unacknowledged */
+};
+
+/**
+ * @brief Delivery feedback for flow control
+ *
+ * @param topic Topic of the message, valid during the call only; NULL for
+ *        CLOUD_SESSION_LOST
+ * @param latency_ms Publish to PUBACK (CLOUD_ACKED) or to the timeout
+ */
+typedef void (*cloud_delivery_handler_t)(const char *topic, enum cloud_delivery result,
+                                         uint32_t latency_ms);
+
+/**
+ * @brief Connect to WiFi and wait for an IPv4 address (with retries)
+ *
+ * @return 0 on success, -ENODEV without WiFi interface, -ETIMEDOUT
+ */
+int wifi_connect(void);
+
+/**
+ * @brief Resolve the broker endpoint addresses
+ *
+ * @return 0 if at least one endpoint resolved, -EINVAL otherwise
+ */
+int broker_init(void);
+
+/**
+ * @brief Open the MQTT session on the best-scoring broker endpoint
+ *
+ * Failed endpoints back off and the next best is tried (5 s CONNACK
+ * timeout each).
+ *
+ * @return 0 on success, -ECONNREFUSED if no endpoint could be reached
+ */
+int thingsboard_connect(void);
+
+/**
+ * @brief Read RSSI and the TX/retransmission counters of the WiFi link
+ *
+ * Fields the driver or stack cannot provide are left invalid.
+ *
+ * @return 0 on success, -ENODEV without WiFi interface
+ */
+int cloud_link_sample(struct link_sample *s);
+
+/** @brief True while the MQTT session is up */
+bool cloud_connected(void);
+
+/** @brief Register the handler for incoming messages */
+void cloud_set_rx_handler(cloud_rx_handler_t handler);
+
+/** @brief Register the handler for new sessions */
+void cloud_set_session_handler(cloud_session_handler_t handler);
+
+/** @brief Register the handler for delivery feedback */
+void cloud_set_delivery_handler(cloud_delivery_handler_t handler);
+
+/**
+ * @brief Publish with QoS 1
+ *
+ * The message is queued until its PUBACK and re-sent on the next session
+ * if the current one is lost, so it may be accepted while offline.
+ *
+ * @return 0 if queued, -ENOBUFS if the queue is full, -EMSGSIZE if too long
+ */
+int cloud_publish(const char *topic, const char *payload, size_t len);
+
+/** @brief Messages in the outbox, unsent or awaiting PUBACK */
+size_t cloud_queued(void);
+
+/**
+ * @brief Publish a raw frame batch (raw_frame.h) with QoS 1 to
+ *        watermeter/<token>/raw on the broker of the host ingest bridge
+ *        (CONFIG_APP_RAW_BROKER_HOST), not on the ThingsBoard session
+ *
+ * Queued like cloud_publish(), in an outbox of its own, so it may be
+ * accepted while the bridge broker is unreachable.
+ *
+ * @return 0 if queued, -ENOBUFS if the queue is full, -EMSGSIZE if too long
+ */
+int cloud_publish_raw(const char *payload, size_t len);
+
+/**
+ * @brief Subscribe to up to CLOUD_MAX_SUBSCRIPTIONS topics with QoS 1
+ */
+int cloud_subscribe(const char *const *topics, size_t count);
+
+/**
+ * @brief Process incoming packets and keep the session alive
+ *
+ * Call it also while disconnected: with the raw uplink it reconnects the
+ * bridge session, independently of the ThingsBoard one.
+ */
+void mqtt_maintenance(void);
+
+/**
+ * @brief Open a bulk telemetry upload to the HTTP API of the active endpoint
+ *
+ * The request body (a JSON array of timestamped telemetry objects) is sent
+ * with chunked transfer encoding through cloud_bulk_write(). One upload at
+ * a time; not to be mixed with the MQTT calls from another thread except
+ * cloud_connected() and cloud_queued().
+ *
+ * @return 0 on success, -ENOTCONN without a session, -EBUSY if one is open,
+ *         negative errno from the socket layer
+ */
+int cloud_bulk_begin(void);
+
+/** @brief Send @p len bytes of the body as one chunk; closes on error */
+int cloud_bulk_write(const char *data, size_t len);
+
+/**
+ * @brief Finish the body and wait for the response
+ *
+ * @return 0 on a 2xx status, -EACCES if the token was refused, -EIO on any
+ *         other status, negative errno from the socket layer
+ */
+int cloud_bulk_end(void);
+
+/** @brief Drop the upload in progress, if any */
+void cloud_bulk_abort(void);
+
+#endif /* CLOUD_H_ */
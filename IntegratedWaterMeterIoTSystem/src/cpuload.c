@@ -0,0 +1,259 @@
+/**
+ * @file cpuload.c
+ * @brief CPU load per core and per thread from the kernel's runtime statistics
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(CONFIG_SHELL)
+#include <zephyr/shell/shell.h>
+#endif
+
+#include "cpuload.h"
+
+LOG_MODULE_REGISTER(cpuload, LOG_LEVEL_INF);
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+struct thread_slot {
+    const struct k_thread *tid;     /* NULL = free */
+    uint64_t last_cycles;
+    bool fresh;                     /* First sample: no window to compare with */
+    bool seen;                      /* Still alive at this sample */
+    struct cpuload_entry e;
+};
+
+struct cpu_slot {
+    uint64_t last_busy;
+    uint64_t last_all;
+    struct cpuload_entry e;
+};
+
+/* Window being closed, for the thread walk */
+struct sample_ctx {
+    uint64_t window_cycles;
+    uint32_t untracked;
+};
+
+#if defined(CONFIG_THREAD_RUNTIME_STATS)
+static struct thread_slot threads[CPULOAD_MAX_THREADS];
+#endif
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+static struct cpu_slot cpus[CPULOAD_MAX_CPUS];
+#endif
+static struct cpuload_report report;
+static int64_t last_ms;
+static bool primed;
+static K_MUTEX_DEFINE(lock);
+
+/* ============================================================================
+ * SAMPLING
+ * ============================================================================ */
+
+#if defined(CONFIG_THREAD_RUNTIME_STATS) || defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+static uint16_t permille(uint64_t part, uint64_t whole)
+{
+    if (whole == 0) {
+        return 0;
+    }
+    return (uint16_t)MIN(part * 1000U / whole, 1000U);
+}
+
+static void entry_update(struct cpuload_entry *e, uint16_t load)
+{
+    e->load_permille = load;
+    e->peak_permille = MAX(e->peak_permille, load);
+}
+#endif
+
+#if defined(CONFIG_THREAD_RUNTIME_STATS)
+static struct thread_slot *thread_slot_get(const struct k_thread *thread)
+{
+    struct thread_slot *free_slot = NULL;
+
+    for (int i = 0; i < CPULOAD_MAX_THREADS; i++) {
+        if (threads[i].tid == thread) {
+            return &threads[i];
+        }
+        if (threads[i].tid == NULL && free_slot == NULL) {
+            free_slot = &threads[i];
+        }
+    }
+    if (free_slot != NULL) {
+        memset(free_slot, 0, sizeof(*free_slot));
+        free_slot->tid = thread;
+        free_slot->fresh = true;
+    }
+    return free_slot;
+}
+
+/**
+ * @brief k_thread_foreach() callback: close the window of one thread
+ */
+static void sample_thread(const struct k_thread *thread, void *user_data)
+{
+    struct sample_ctx *ctx = user_data;
+    struct thread_slot *slot = thread_slot_get(thread);
+    k_thread_runtime_stats_t st;
+
+    if (slot == NULL) {
+        ctx->untracked++;
+        return;
+    }
+    if (k_thread_runtime_stats_get((k_tid_t)thread, &st) != 0) {
+        return;
+    }
+
+    if (!slot->fresh) {
+        entry_update(&slot->e, permille(st.execution_cycles - slot->last_cycles,
+                                        ctx->window_cycles));
+    }
+    slot->last_cycles = st.execution_cycles;
+    slot->fresh = false;
+    slot->seen = true;
+
+    const char *name = k_thread_name_get((k_tid_t)thread);
+
+    if (name != NULL && name[0] != '\0') {
+        strncpy(slot->e.name, name, sizeof(slot->e.name) - 1);
+    } else {
+        snprintf(slot->e.name, sizeof(slot->e.name), "%p", (void *)thread);
+    }
+}
+#endif /* CONFIG_THREAD_RUNTIME_STATS */
+
+void cpuload_sample(uint32_t loop_ms)
+{
+    int64_t now = k_uptime_get();
+    struct sample_ctx ctx = {
+        /* Fallback if the cores are not accounted: the window by the clock */
+        .window_cycles = (uint64_t)(now - last_ms) * sys_clock_hw_cycles_per_sec() / 1000U,
+    };
+
+    k_mutex_lock(&lock, K_FOREVER);
+
+    report.loop_ms = loop_ms;
+    report.loop_max_ms = MAX(report.loop_max_ms, loop_ms);
+
+#if defined(CONFIG_SCHED_THREAD_USAGE_ALL)
+    report.cpu_count = MIN(arch_num_cpus(), CPULOAD_MAX_CPUS);
+    for (int cpu = 0; cpu < report.cpu_count; cpu++) {
+        struct cpu_slot *c = &cpus[cpu];
+        k_thread_runtime_stats_t st;
+
+        if (k_thread_runtime_stats_cpu_get(cpu, &st) != 0) {
+            continue;
+        }
+
+        /* total_cycles excludes the idle thread, execution_cycles does not */
+        uint64_t all = st.execution_cycles - c->last_all;
+
+        if (primed) {
+            entry_update(&c->e, permille(st.total_cycles - c->last_busy, all));
+            ctx.window_cycles = all;
+        }
+        c->last_busy = st.total_cycles;
+        c->last_all = st.execution_cycles;
+        snprintf(c->e.name, sizeof(c->e.name), "%d", cpu);
+        report.cpus[cpu] = c->e;
+    }
+#endif
+
+#if defined(CONFIG_THREAD_RUNTIME_STATS)
+    for (int i = 0; i < CPULOAD_MAX_THREADS; i++) {
+        threads[i].seen = false;
+    }
+    k_thread_foreach(sample_thread, &ctx);
+
+    report.thread_count = 0;
+    for (int i = 0; i < CPULOAD_MAX_THREADS; i++) {
+        if (threads[i].tid == NULL) {
+            continue;
+        }
+        if (!threads[i].seen) {
+            threads[i].tid = NULL;      /* Exited; the slot is free again */
+            continue;
+        }
+        report.threads[report.thread_count++] = threads[i].e;
+    }
+    report.threads_untracked = ctx.untracked;
+#else
+    ARG_UNUSED(ctx);
+#endif
+
+    if (primed) {
+        report.window_ms = (uint32_t)(now - last_ms);
+    }
+    last_ms = now;
+    primed = true;
+
+    k_mutex_unlock(&lock);
+}
+
+void cpuload_get(struct cpuload_report *out)
+{
+    k_mutex_lock(&lock, K_FOREVER);
+    *out = report;
+    k_mutex_unlock(&lock);
+}
+
+uint16_t cpuload_peak_permille(const struct cpuload_report *r)
+{
+    uint16_t peak = 0;
+
+    for (int i = 0; i < r->cpu_count; i++) {
+        peak = MAX(peak, r->cpus[i].peak_permille);
+    }
+    return peak;
+}
+
+/* ============================================================================
+ * SHELL
+ * ============================================================================ */
+
+#if defined(CONFIG_SHELL)
+static int cmd_load(const struct shell *sh, size_t argc, char **argv)
+{
+    static struct cpuload_report r;
+
+    ARG_UNUSED(argc);
+    ARG_UNUSED(argv);
+
+    cpuload_get(&r);
+    if (r.window_ms == 0) {
+        shell_print(sh, "No complete window yet, try again after a loop cycle");
+        return 0;
+    }
+
+    shell_print(sh, "Window %u.%03u s, main loop %u ms (max %u ms)",
+                r.window_ms / 1000, r.window_ms % 1000, r.loop_ms, r.loop_max_ms);
+    shell_print(sh, "%-16s %7s %7s", "CPU", "load", "peak");
+    for (int i = 0; i < r.cpu_count; i++) {
+        shell_print(sh, "%-16s %3u.%u %% %3u.%u %%", r.cpus[i].name,
+                    r.cpus[i].load_permille / 10, r.cpus[i].load_permille % 10,
+                    r.cpus[i].peak_permille / 10, r.cpus[i].peak_permille % 10);
+    }
+    shell_print(sh, "%-16s %7s %7s", "Thread", "load", "peak");
+    for (int i = 0; i < r.thread_count; i++) {
+        shell_print(sh, "%-16s %3u.%u %% %3u.%u %%", r.threads[i].name,
+                    r.threads[i].load_permille / 10, r.threads[i].load_permille % 10,
+                    r.threads[i].peak_permille / 10, r.threads[i].peak_permille % 10);
+    }
+    if (r.threads_untracked > 0) {
+        shell_print(sh, "(%u thread(s) beyond the table not shown)", r.threads_untracked);
+    }
+    if (r.cpu_count > 0) {
+        uint16_t peak = cpuload_peak_permille(&r);
+
+        shell_print(sh, "Headroom at peak: %u.%u %%", (1000 - peak) / 10, (1000 - peak) % 10);
+    }
+    return 0;
+}
+
+SHELL_CMD_REGISTER(load, NULL, "CPU load per core and thread, with peaks", cmd_load);
+#endif /* CONFIG_SHELL */
@@ -0,0 +1,59 @@
+/**
+ * @file cpuload.h
+ * @brief CPU load per core and per thread from the kernel's runtime statistics
+ *
+ * @details
+ * The kernel counts the cycles every thread runs (CONFIG_THREAD_RUNTIME_STATS)
+ * at each context switch, so accounting costs nothing between samples. The
+ * main loop takes one sample per cycle; loads are the share of the window
+ * since the previous sample:
+ *
+ *   core    non-idle cycles / all cycles of that core
+ *   thread  cycles of the thread / all cycles of one core
+ *
+ * Peaks and the longest main loop iteration are kept since boot, so the
+ * headroom left before raising the poll rate or the meter count can be read
+ * off after a representative period (shell command "load", telemetry and
+ * /metrics).
+ */
+
+#ifndef CPULOAD_H_
+#define CPULOAD_H_
+
+#include <stdint.h>
+
+#define CPULOAD_MAX_CPUS 2
+#define CPULOAD_MAX_THREADS 24
+#define CPULOAD_NAME_LEN 16
+
+struct cpuload_entry {
+    char name[CPULOAD_NAME_LEN];
+    uint16_t load_permille;     /* Last window */
+    uint16_t peak_permille;     /* Highest window since boot */
+};
+
+struct cpuload_report {
+    uint32_t window_ms;         /* 0 = no complete window yet */
+    uint8_t cpu_count;
+    struct cpuload_entry cpus[CPULOAD_MAX_CPUS];
+    uint8_t thread_count;
+    struct cpuload_entry threads[CPULOAD_MAX_THREADS];
+    uint32_t threads_untracked; /* Beyond the table */
+    uint32_t loop_ms;           /* Busy time of the last main loop iteration */
+    uint32_t loop_max_ms;       /* Longest since boot */
+};
+
+/**
+ * @brief Close the current window; call once per main loop cycle
+ *
+ * @param loop_ms Busy time of the iteration that just ended
+ */
+void cpuload_sample(uint32_t loop_ms);
+
+/** @brief Copy of the latest figures */
+void cpuload_get(struct cpuload_report *out);
+
+/** @brief Peak load of the busiest core since boot, per mille */
+uint16_t cpuload_peak_permille(const struct cpuload_report *r);
+
+#endif /* CPULOAD_H_ */
@@ -0,0 +1,288 @@
+/**
+ * @file deadline.c
+ * @brief Latency budgets for the main loop stages, backed by the task watchdog
+ *
+ * @details
+ * Every stage has a task watchdog channel timed to its limit, and the loop
+ * has one for the time between stages; all are added once at init. Only
+ * the channel of what the main thread is doing is left to it: entering a
+ * stage or leaving it feeds the channel it moves to, and a timer keeps the
+ * idle channels fed. A channel cannot change its period once added, hence
+ * one per stage.
+ *
+ * Nothing is logged from the timer callbacks, which run in interrupt
+ * context: a stage past its budget is reported from the system workqueue,
+ * and a hang is recorded in RAM that survives the reset and logged on the
+ * next boot.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/reboot.h>
+
+#if defined(CONFIG_TASK_WDT)
+#include <zephyr/device.h>
+#include <zephyr/task_wdt/task_wdt.h>
+#endif
+
+#include "deadline.h"
+#include "metrics.h"
+
+LOG_MODULE_REGISTER(deadline, LOG_LEVEL_INF);
+
+/* read_meter_data(): 100 ms turnaround, 2 s receive window, UART switches */
+#define METER_READ_BUDGET_MS 2500
+
+#if defined(CONFIG_APP_DMA)
+/* The whole group is read back-to-back within the spread limit */
+#define METER_STAGE_BUDGET_MS (CONFIG_APP_DMA_MAX_SPREAD_MS + METER_READ_BUDGET_MS)
+#else
+#define METER_STAGE_BUDGET_MS METER_READ_BUDGET_MS
+#endif
+
+#define NO_STAGE STAGE_COUNT
+
+/* Channel of the time between stages, after those of the stages */
+#define LOOP_CHANNEL NO_STAGE
+#define CHANNEL_COUNT (STAGE_COUNT + 1)
+
+/* Idle channels are fed this often, well within the shortest limit */
+#define KEEPER_PERIOD_MS 2000
+
+#define HANG_MAGIC 0x48414e47U      /* "HANG" */
+
+struct stage_deadline {
+    const char *name;
+    uint32_t budget_ms;         /* Longer is an overrun */
+    uint32_t limit_ms;          /* Longer is a hang: watchdog reset */
+};
+
+/*
+ * Limits sit above the worst case the code allows itself: wifi_connect()
+ * makes up to 10 attempts of 30 s + 30 s + 5 s, thingsboard_connect() up to
+ * two per endpoint with a 5 s CONNACK wait, and a failback probe in the MQTT
+ * maintenance may resolve and connect to another endpoint.
+ */
+static const struct stage_deadline stages[STAGE_COUNT] = {
+    [STAGE_WIFI_CONNECT] = { "wifi_connect", 30000, 720000 },
+    [STAGE_BROKER_RESOLVE] = { "broker_resolve", 6000, 60000 },
+    [STAGE_MQTT_CONNECT] = { "mqtt_connect", 10000, 180000 },
+    [STAGE_LINK_SAMPLE] = { "link_sample", 200, 10000 },
+    [STAGE_METER_READ] = { "meter_read", METER_STAGE_BUDGET_MS, 4 * METER_STAGE_BUDGET_MS },
+    [STAGE_PUBLISH] = { "publish", 1000, 30000 },
+    [STAGE_MQTT_MAINTENANCE] = { "mqtt_maintenance", 5000, 60000 },
+};
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+static volatile enum stage active = NO_STAGE;
+static volatile enum stage late = NO_STAGE;    /* Past its budget, to report */
+static int64_t active_since;
+static uint32_t loop_limit;
+
+static void budget_expired(struct k_timer *timer);
+static K_TIMER_DEFINE(budget_timer, budget_expired, NULL);
+static void report_late(struct k_work *work);
+static K_WORK_DEFINE(late_work, report_late);
+
+#if defined(CONFIG_TASK_WDT)
+static int channels[CHANNEL_COUNT];
+static bool wdt_ready;
+
+static void keep_idle_fed(struct k_timer *timer);
+static K_TIMER_DEFINE(keeper_timer, keep_idle_fed, NULL);
+
+/* What hung, kept across the reset */
+static __noinit struct {
+    uint32_t magic;
+    uint32_t channel;
+} hang_record;
+#endif
+
+/* ============================================================================
+ * WATCHDOG
+ * ============================================================================ */
+
+static void budget_expired(struct k_timer *timer)
+{
+    ARG_UNUSED(timer);
+
+    late = active;
+    if (late != NO_STAGE) {
+        k_work_submit(&late_work);
+    }
+}
+
+static void report_late(struct k_work *work)
+{
+    enum stage s = late;
+
+    ARG_UNUSED(work);
+
+    if (s != NO_STAGE) {
+        LOG_WRN("Stage %s still running after %u ms", stages[s].name,
+                stages[s].budget_ms);
+    }
+}
+
+#if defined(CONFIG_TASK_WDT)
+/**
+ * @brief A channel expired: record which, then reset
+ *
+ * Runs from the task watchdog timer, so the record is logged on the next
+ * boot instead.
+ */
+static void channel_expired(int channel_id, void *user_data)
+{
+    ARG_UNUSED(channel_id);
+
+    hang_record.magic = HANG_MAGIC;
+    hang_record.channel = (uint32_t)(uintptr_t)user_data;
+    sys_reboot(SYS_REBOOT_COLD);
+}
+
+/**
+ * @brief Feed every channel except the one of the main thread's position
+ */
+static void keep_idle_fed(struct k_timer *timer)
+{
+    enum stage s = active;
+
+    ARG_UNUSED(timer);
+
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (i != s) {
+            task_wdt_feed(channels[i]);
+        }
+    }
+}
+
+/**
+ * @brief Give channel @p ch its full period as the main thread moves to it
+ */
+static void arm(int ch)
+{
+    if (wdt_ready) {
+        task_wdt_feed(channels[ch]);
+    }
+}
+
+static void report_hang(void)
+{
+    if (hang_record.magic != HANG_MAGIC) {
+        return;
+    }
+    if (hang_record.channel == LOOP_CHANNEL) {
+        LOG_ERR("Reset by watchdog: main loop stalled for %u ms outside any stage",
+                loop_limit);
+    } else if (hang_record.channel < STAGE_COUNT) {
+        LOG_ERR("Reset by watchdog: stage %s hung for %u ms",
+                stages[hang_record.channel].name, stages[hang_record.channel].limit_ms);
+    }
+    hang_record.magic = 0;
+}
+#else
+static void arm(int ch)
+{
+    ARG_UNUSED(ch);
+}
+#endif /* CONFIG_TASK_WDT */
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+int deadline_init(uint32_t loop_limit_ms)
+{
+    loop_limit = loop_limit_ms;
+
+#if defined(CONFIG_TASK_WDT)
+    const struct device *hw_wdt = NULL;
+    int rc;
+
+#if DT_NODE_HAS_STATUS(DT_ALIAS(watchdog0), okay)
+    /* Backs up the software channels if the kernel itself stops */
+    hw_wdt = DEVICE_DT_GET(DT_ALIAS(watchdog0));
+#endif
+
+    report_hang();
+
+    rc = task_wdt_init(hw_wdt);
+    if (rc != 0) {
+        LOG_ERR("Task watchdog init failed: %d", rc);
+        return rc;
+    }
+
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        uint32_t period = (i == LOOP_CHANNEL) ? loop_limit : stages[i].limit_ms;
+
+        channels[i] = task_wdt_add(period, channel_expired, (void *)(uintptr_t)i);
+        if (channels[i] < 0) {
+            rc = channels[i];
+            LOG_ERR("Task watchdog channel unavailable: %d (CONFIG_TASK_WDT_CHANNELS)", rc);
+            while (--i >= 0) {
+                task_wdt_delete(channels[i]);
+            }
+            return rc;
+        }
+    }
+    wdt_ready = true;
+    k_timer_start(&keeper_timer, K_MSEC(KEEPER_PERIOD_MS), K_MSEC(KEEPER_PERIOD_MS));
+
+    LOG_INF("Task watchdog armed (loop limit %u s%s)", loop_limit / 1000,
+            hw_wdt != NULL ? ", hardware fallback" : "");
+    return 0;
+#else
+    LOG_WRN("No task watchdog, stage budgets are only monitored");
+    return -ENOTSUP;
+#endif
+}
+
+void deadline_begin(enum stage stage)
+{
+    if (stage >= STAGE_COUNT) {
+        return;
+    }
+    if (active != NO_STAGE) {
+        LOG_WRN("Stage %s entered inside %s", stages[stage].name, stages[active].name);
+    }
+
+    active_since = k_uptime_get();
+    arm(stage);
+    active = stage;
+    k_timer_start(&budget_timer, K_MSEC(stages[stage].budget_ms), K_NO_WAIT);
+}
+
+void deadline_end(enum stage stage)
+{
+    if (stage >= STAGE_COUNT || stage != active) {
+        return;
+    }
+
+    uint32_t ms = (uint32_t)(k_uptime_get() - active_since);
+    bool overrun = ms > stages[stage].budget_ms;
+
+    k_timer_stop(&budget_timer);
+    arm(LOOP_CHANNEL);
+    active = NO_STAGE;
+
+    if (overrun) {
+        LOG_WRN("Stage %s overran: %u ms (budget %u ms)", stages[stage].name, ms,
+                stages[stage].budget_ms);
+    }
+    metrics_stage_record(stage, ms, overrun);
+}
+
+void deadline_loop_feed(void)
+{
+    if (active == NO_STAGE) {
+        arm(LOOP_CHANNEL);
+    }
+}
+
+const char *deadline_stage_name(enum stage stage)
+{
+    return (stage < STAGE_COUNT) ? stages[stage].name : "none";
+}
@@ -0,0 +1,59 @@
+/**
+ * @file deadline.h
+ * @brief Latency budgets for the main loop stages, backed by the task watchdog
+ *
+ * @details
+ * Every blocking step of the main loop runs as a stage with two limits:
+ *
+ *   budget  expected worst case; a stage that takes longer is an overrun,
+ *           logged with its duration and counted in the health metrics
+ *   limit   the stage is hung; the task watchdog resets the device
+ *
+ * A warning is also logged when a stage passes its budget while still
+ * running, so a stall shows up before the stage returns (or never does).
+ * Between stages the watchdog channel covers the whole loop with the limit
+ * given to deadline_init(), so a hang outside any stage resets as well.
+ *
+ * Stages are entered from the main thread only and do not nest.
+ * Without CONFIG_TASK_WDT only the budgets are monitored.
+ */
+
+#ifndef DEADLINE_H_
+#define DEADLINE_H_
+
+#include <stdint.h>
+
+enum stage {
+    STAGE_WIFI_CONNECT = 0,     /* wifi_connect(): association and DHCP */
+    STAGE_BROKER_RESOLVE,       /* broker_init(): DNS lookups */
+    STAGE_MQTT_CONNECT,         /* thingsboard_connect(): TCP + CONNACK */
+    STAGE_LINK_SAMPLE,          /* RSSI and network statistics */
+    STAGE_METER_READ,           /* Modbus read, or a whole DMA round */
+    STAGE_PUBLISH,              /* Alarm rules and telemetry publish */
+    STAGE_MQTT_MAINTENANCE,     /* mqtt_input(), keep-alive, outbox flush */
+    STAGE_COUNT
+};
+
+/**
+ * @brief Start the task watchdog channel of the main loop
+ *
+ * @param loop_limit_ms Longest time the loop may go between stages,
+ *                      the sleep between cycles included
+ *
+ * @return 0 on success, negative errno if the watchdog is unavailable
+ */
+int deadline_init(uint32_t loop_limit_ms);
+
+/** @brief Enter a stage: its budget timer and watchdog limit start */
+void deadline_begin(enum stage stage);
+
+/** @brief Leave the stage entered last; records an overrun if over budget */
+void deadline_end(enum stage stage);
+
+/** @brief Feed the loop channel; call once per cycle outside any stage */
+void deadline_loop_feed(void);
+
+/** @brief Short name of a stage, for logs and metrics */
+const char *deadline_stage_name(enum stage stage);
+
+#endif /* DEADLINE_H_ */
@@ -0,0 +1,199 @@
+/**
+ * @file dma.c
+ * @brief District metered area (DMA) water balance from time-aligned polls
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dma.h"
+#include "modbus.h"
+
+LOG_MODULE_REGISTER(dma, LOG_LEVEL_INF);
+
+/* Ignore interval deltas above this (meter replaced or counter reset) */
+#define MAX_PLAUSIBLE_DELTA_L 1000000U
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+/* Index 0 is the parent */
+static uint8_t group_ids[1 + DMA_MAX_CHILDREN];
+static size_t group_count;
+
+/* Totals at the last volume balance, in litres */
+static uint32_t baseline_l[1 + DMA_MAX_CHILDREN];
+static int64_t baseline_ms;
+static bool have_baseline;
+
+/* Loss alarm */
+static uint8_t rounds_over;
+static bool alarm_active;
+
+/* ============================================================================
+ * GROUP CONFIGURATION
+ * ============================================================================ */
+
+int dma_init(void)
+{
+    const char *p = CONFIG_APP_DMA_CHILD_IDS;
+
+    group_ids[0] = CONFIG_APP_DMA_PARENT_ID;
+    group_count = 1;
+
+    while (*p != '\0') {
+        char *end;
+        unsigned long id = strtoul(p, &end, 10);
+
+        if (end == p || id < 1 || id > 247 || id == CONFIG_APP_DMA_PARENT_ID) {
+            LOG_ERR("Bad child ID list \"%s\"", CONFIG_APP_DMA_CHILD_IDS);
+            return -EINVAL;
+        }
+        if (group_count == ARRAY_SIZE(group_ids)) {
+            LOG_ERR("More than %d child meters", DMA_MAX_CHILDREN);
+            return -EINVAL;
+        }
+        group_ids[group_count++] = id;
+
+        p = end;
+        while (*p == ',' || *p == ' ') {
+            p++;
+        }
+    }
+
+    LOG_INF("DMA group: parent %u, %u children", group_ids[0],
+            (unsigned int)(group_count - 1));
+    return 0;
+}
+
+size_t dma_meter_count(void)
+{
+    return group_count;
+}
+
+/* ============================================================================
+ * ROUND
+ * ============================================================================ */
+
+static uint32_t net_volume_l(const meter_data_t *d)
+{
+    return d->forward_total - d->reverse_total;
+}
+
+/**
+ * @brief Raise after N consecutive intervals over the threshold, clear with hysteresis
+ */
+static void update_alarm(struct dma_round *r)
+{
+    bool was_active = alarm_active;
+
+    /* Night-time inflows are too small for a meaningful ratio */
+    if (!r->has_interval || r->inflow_l < CONFIG_APP_DMA_MIN_INFLOW_L) {
+        r->alarm = alarm_active;
+        r->alarm_changed = false;
+        return;
+    }
+
+    if (r->loss_rate_bp >= CONFIG_APP_DMA_LOSS_ALARM_BP) {
+        if (rounds_over < UINT8_MAX) {
+            rounds_over++;
+        }
+        if (rounds_over >= CONFIG_APP_DMA_LOSS_ALARM_ROUNDS) {
+            alarm_active = true;
+        }
+    } else {
+        rounds_over = 0;
+        if (r->loss_rate_bp < CONFIG_APP_DMA_LOSS_ALARM_BP - CONFIG_APP_DMA_LOSS_HYST_BP) {
+            alarm_active = false;
+        }
+    }
+
+    r->alarm = alarm_active;
+    r->alarm_changed = (alarm_active != was_active);
+}
+
+int dma_run_round(struct dma_round *r)
+{
+    meter_data_t data[1 + DMA_MAX_CHILDREN];
+    int64_t first_ms = 0;
+    int64_t last_ms = 0;
+
+    /* Back-to-back; each reading is stamped at the middle of its transaction */
+    for (size_t i = 0; i < group_count; i++) {
+        int ret = -1;
+
+        for (int attempt = 0; attempt < 2 && ret != 0; attempt++) {
+            int64_t t0 = k_uptime_get();
+
+            ret = read_meter_data(group_ids[i], &data[i]);
+            last_ms = (t0 + k_uptime_get()) / 2;
+        }
+        if (ret != 0) {
+            LOG_WRN("DMA round aborted: meter %u not read", group_ids[i]);
+            return -EIO;
+        }
+        if (i == 0) {
+            first_ms = last_ms;
+        }
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->start_ms = first_ms;
+    r->end_ms = last_ms;
+    r->spread_ms = (uint32_t)(last_ms - first_ms);
+
+    if (r->spread_ms > CONFIG_APP_DMA_MAX_SPREAD_MS) {
+        LOG_WRN("DMA round discarded: spread %u ms", r->spread_ms);
+        return -ETIME;
+    }
+
+    r->parent_flow = data[0].flow_rate;
+    for (size_t i = 1; i < group_count; i++) {
+        r->children_flow += data[i].flow_rate;
+    }
+    r->flow_balance = (int32_t)(r->parent_flow - r->children_flow);
+
+    /* Volumes need a longer window than one round: litre resolution */
+    if (have_baseline &&
+        first_ms - baseline_ms < CONFIG_APP_DMA_BALANCE_INTERVAL_SEC * 1000LL) {
+        r->alarm = alarm_active;
+        return 0;
+    }
+
+    /* Interval volumes against the last balance */
+    bool plausible = have_baseline;
+    uint32_t deltas[1 + DMA_MAX_CHILDREN];
+
+    for (size_t i = 0; i < group_count; i++) {
+        deltas[i] = net_volume_l(&data[i]) - baseline_l[i];
+        if (deltas[i] > MAX_PLAUSIBLE_DELTA_L) {
+            plausible = false;
+        }
+    }
+
+    if (plausible) {
+        r->has_interval = true;
+        r->interval_ms = (uint32_t)(first_ms - baseline_ms);
+        r->inflow_l = deltas[0];
+        for (size_t i = 1; i < group_count; i++) {
+            r->consumed_l += deltas[i];
+        }
+        r->loss_l = (int32_t)(r->inflow_l - r->consumed_l);
+        r->loss_rate_bp = r->inflow_l ?
+                          (int32_t)((int64_t)r->loss_l * 10000 / r->inflow_l) : 0;
+    } else if (have_baseline) {
+        LOG_WRN("DMA totals jumped, restarting the balance");
+    }
+
+    for (size_t i = 0; i < group_count; i++) {
+        baseline_l[i] = net_volume_l(&data[i]);
+    }
+    baseline_ms = first_ms;
+    have_baseline = true;
+
+    update_alarm(r);
+    return 0;
+}
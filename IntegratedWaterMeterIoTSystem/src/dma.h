@@ -0,0 +1,75 @@
+/**
+ * @file dma.h
+ * @brief District metered area (DMA) water balance from time-aligned polls
+ *
+ * @details
+ * A DMA group is one parent (bulk inlet) meter and the child meters behind
+ * it. Each round reads the whole group back-to-back, so the readings describe
+ * (nearly) the same instant; the round's spread is the time between the
+ * first and last reading. Every round gives the instantaneous flow balance;
+ * once CONFIG_APP_DMA_BALANCE_INTERVAL_SEC has passed since the last volume
+ * balance (totals only resolve whole litres), the round also closes an
+ * interval:
+ *
+ *   inflow   = parent net volume delta
+ *   consumed = sum of the children's net volume deltas
+ *   loss     = inflow - consumed
+ *
+ * Net volume is forward_total - reverse_total in litres. The loss rate is
+ * loss / inflow. A loss alarm is raised after several consecutive intervals
+ * above the threshold and cleared with hysteresis.
+ */
+
+#ifndef DMA_H_
+#define DMA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DMA_MAX_CHILDREN 7
+
+struct dma_round {
+    int64_t start_ms;           /* Uptime at the first reading */
+    int64_t end_ms;             /* Uptime at the last reading */
+    uint32_t spread_ms;
+
+    /* Instantaneous flows, L/h × 100 */
+    uint32_t parent_flow;
+    uint32_t children_flow;
+    int32_t flow_balance;
+
+    /* Volumes since the previous balance (valid if has_interval) */
+    bool has_interval;
+    uint32_t interval_ms;
+    uint32_t inflow_l;
+    uint32_t consumed_l;
+    int32_t loss_l;
+    int32_t loss_rate_bp;       /* loss / inflow in 0.01 % (basis points) */
+
+    /* Loss alarm */
+    bool alarm;
+    bool alarm_changed;
+};
+
+/**
+ * @brief Parse the group configuration
+ *
+ * @return 0 on success, -EINVAL on a malformed child list
+ */
+int dma_init(void);
+
+/**
+ * @brief Read the group and compute the balance
+ *
+ * A meter that fails is retried once within the round.
+ *
+ * @return 0 on success, -EIO if a meter could not be read, -ETIME if the
+ *         spread exceeded CONFIG_APP_DMA_MAX_SPREAD_MS (round discarded)
+ */
+int dma_run_round(struct dma_round *round);
+
+/** @brief Meters in the group, parent included */
+size_t dma_meter_count(void);
+
+#endif /* DMA_H_ */
@@ -0,0 +1,251 @@
+/**
+ * @file history.c
+ * @brief Timestamped samples kept in flash until they are uploaded
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/storage/flash_map.h>
+
+#include "history.h"
+
+#if defined(CONFIG_APP_ARCHIVE)
+#include "archive.h"
+#endif
+
+LOG_MODULE_REGISTER(history, LOG_LEVEL_INF);
+
+#define HISTORY_AREA_ID FIXED_PARTITION_ID(storage_partition)
+#define HISTORY_MAGIC 0x57484953    /* "WHIS" */
+#define HISTORY_VERSION 1
+#define HISTORY_MAX_SECTORS 64
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+static struct fcb fcb;
+static struct flash_sector sectors[HISTORY_MAX_SECTORS];
+static K_MUTEX_DEFINE(lock);
+static bool ready;
+
+/* Last released record; fe_sector NULL = nothing released in the oldest sector */
+static struct fcb_entry released;
+static uint32_t pending;
+static uint32_t dropped;
+static uint32_t generation;
+
+/* ============================================================================
+ * HELPERS
+ * ============================================================================ */
+
+static int count_all(struct fcb_entry_ctx *ctx, void *arg)
+{
+    ARG_UNUSED(ctx);
+
+    (*(uint32_t *)arg)++;
+    return 0;
+}
+
+static int count_after_released(struct fcb_entry_ctx *ctx, void *arg)
+{
+    if (ctx->loc.fe_elem_off > released.fe_elem_off) {
+        (*(uint32_t *)arg)++;
+    }
+    return 0;
+}
+
+/**
+ * @brief Make room by erasing the oldest sector, unreleased records included
+ */
+static void drop_oldest(void)
+{
+    struct flash_sector *victim = fcb.f_oldest;
+    uint32_t lost = 0;
+
+    /* Everything before the released record's sector is already erased */
+    if (released.fe_sector == victim) {
+        fcb_walk(&fcb, victim, count_after_released, &lost);
+    } else {
+        fcb_walk(&fcb, victim, count_all, &lost);
+    }
+    released.fe_sector = NULL;
+
+    fcb_rotate(&fcb);
+    pending -= MIN(lost, pending);
+    dropped += lost;
+    generation++;
+    LOG_WRN("History full, %u oldest record(s) dropped", lost);
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+int history_init(void)
+{
+    uint32_t sector_cnt = ARRAY_SIZE(sectors);
+    int rc;
+
+    rc = flash_area_get_sectors(HISTORY_AREA_ID, &sector_cnt, sectors);
+    if (rc != 0) {
+        LOG_ERR("Storage partition layout unusable: %d", rc);
+        return rc;
+    }
+#if defined(CONFIG_APP_ARCHIVE)
+    /* The end of the partition holds the archive tiers */
+    sector_cnt -= archive_sectors(sector_cnt);
+#endif
+
+    fcb.f_magic = HISTORY_MAGIC;
+    fcb.f_version = HISTORY_VERSION;
+    fcb.f_sectors = sectors;
+    fcb.f_sector_cnt = sector_cnt;
+    fcb.f_scratch_cnt = 0;
+
+    rc = fcb_init(HISTORY_AREA_ID, &fcb);
+    if (rc != 0) {
+        const struct flash_area *fa;
+
+        /* Another layout or corrupted: start over */
+        LOG_WRN("History store invalid (%d), erasing", rc);
+        rc = flash_area_open(HISTORY_AREA_ID, &fa);
+        if (rc == 0) {
+            rc = flash_area_erase(fa, 0, sectors[sector_cnt - 1].fs_off +
+                                         sectors[sector_cnt - 1].fs_size);
+            flash_area_close(fa);
+        }
+        if (rc == 0) {
+            rc = fcb_init(HISTORY_AREA_ID, &fcb);
+        }
+        if (rc != 0) {
+            LOG_ERR("History store unavailable: %d", rc);
+            return rc;
+        }
+    }
+
+    fcb_walk(&fcb, NULL, count_all, &pending);
+    ready = true;
+    LOG_INF("History: %u sectors, %u record(s) pending", sector_cnt, pending);
+    return 0;
+}
+
+bool history_available(void)
+{
+    return ready;
+}
+
+int history_append(const struct history_record *rec)
+{
+    struct fcb_entry loc;
+    int rc;
+
+    if (!ready) {
+        return -ENODEV;
+    }
+
+    k_mutex_lock(&lock, K_FOREVER);
+
+    rc = fcb_append(&fcb, sizeof(*rec), &loc);
+    if (rc == -ENOSPC) {
+        drop_oldest();
+        rc = fcb_append(&fcb, sizeof(*rec), &loc);
+    }
+    if (rc == 0) {
+        rc = flash_area_write(fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), rec, sizeof(*rec));
+    }
+    if (rc == 0) {
+        rc = fcb_append_finish(&fcb, &loc);
+    }
+    if (rc == 0) {
+        pending++;
+    }
+
+    k_mutex_unlock(&lock);
+
+    if (rc != 0) {
+        LOG_ERR("History write failed: %d", rc);
+        return -EIO;
+    }
+    return 0;
+}
+
+void history_cursor_start(struct history_cursor *cur)
+{
+    k_mutex_lock(&lock, K_FOREVER);
+    cur->loc = released;
+    cur->count = 0;
+    cur->generation = generation;
+    k_mutex_unlock(&lock);
+}
+
+int history_read_next(struct history_cursor *cur, struct history_record *rec)
+{
+    struct fcb_entry loc = cur->loc;
+    int rc;
+
+    k_mutex_lock(&lock, K_FOREVER);
+
+    if (!ready || cur->generation != generation) {
+        k_mutex_unlock(&lock);
+        return -ESTALE;
+    }
+
+    /* Records of another size would come from a foreign writer; skip them */
+    do {
+        rc = fcb_getnext(&fcb, &loc);
+    } while (rc == 0 && loc.fe_data_len != sizeof(*rec));
+
+    /* The cursor only moves onto a record that was read */
+    if (rc != 0) {
+        /* Cursors start at the release point, so this is the exact backlog */
+        pending = cur->count;
+        rc = -ENOENT;
+    } else if (flash_area_read(fcb.fap, FCB_ENTRY_FA_DATA_OFF(loc), rec,
+                               sizeof(*rec)) != 0) {
+        rc = -EIO;
+    } else {
+        cur->loc = loc;
+        cur->count++;
+    }
+
+    k_mutex_unlock(&lock);
+    return rc;
+}
+
+int history_consume(const struct history_cursor *cur)
+{
+    k_mutex_lock(&lock, K_FOREVER);
+
+    if (cur->generation != generation) {
+        k_mutex_unlock(&lock);
+        return -ESTALE;
+    }
+
+    if (cur->loc.fe_sector != NULL) {
+        released = cur->loc;
+        pending -= MIN(cur->count, pending);
+
+        /* Erase sectors holding released records only; the one with the
+         * release point stays until the next rotation past it.
+         */
+        while (fcb.f_oldest != released.fe_sector) {
+            if (fcb_rotate(&fcb) != 0) {
+                break;
+            }
+        }
+    }
+
+    k_mutex_unlock(&lock);
+    return 0;
+}
+
+uint32_t history_pending(void)
+{
+    return pending;
+}
+
+uint32_t history_dropped(void)
+{
+    return dropped;
+}
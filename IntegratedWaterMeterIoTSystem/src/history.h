@@ -0,0 +1,85 @@
+/**
+ * @file history.h
+ * @brief Timestamped samples kept in flash until they are uploaded
+ *
+ * @details
+ * A flash circular buffer (FCB) on the storage partition (the part before
+ * the archive tiers, see archive.h) holds fixed-size
+ * records. Readers walk the store with a cursor and release everything up
+ * to it once the upload is acknowledged; fully released sectors are erased.
+ * When the store is full the oldest sector is dropped to make room, which
+ * invalidates cursors taken before (-ESTALE).
+ *
+ * The release point is kept in RAM only: after a reboot up to one sector of
+ * already uploaded records is sent again. ThingsBoard keys telemetry by
+ * timestamp, so the repeat is harmless.
+ */
+
+#ifndef HISTORY_H_
+#define HISTORY_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/fs/fcb.h>
+
+/* One stored sample, in the raw register units of meter_data_t */
+struct history_record {
+    int64_t ts_ms;              /* Unix time of the sample */
+    uint32_t flow_rate;
+    uint32_t forward_total;
+    uint32_t reverse_total;
+    uint16_t pressure;
+    uint16_t temperature;
+    uint16_t status;
+    uint16_t samples;           /* Samples it stands for (swing_door.h); 0 = 1 */
+};
+
+/* Position of a reader in the store */
+struct history_cursor {
+    struct fcb_entry loc;       /* Last record read; fe_sector NULL = none yet */
+    uint32_t count;             /* Records read through this cursor */
+    uint32_t generation;        /* Store generation it is valid for */
+};
+
+/**
+ * @brief Mount the store on the storage partition, erasing it if invalid
+ *
+ * @return 0 on success, negative errno from the flash or FCB layer
+ */
+int history_init(void);
+
+/** @brief True once the store is mounted */
+bool history_available(void);
+
+/**
+ * @brief Store a record; drops the oldest sector if the store is full
+ *
+ * @return 0 on success, -ENODEV if not initialised, -EIO on flash errors
+ */
+int history_append(const struct history_record *rec);
+
+/** @brief Position @p cur at the oldest record not yet released */
+void history_cursor_start(struct history_cursor *cur);
+
+/**
+ * @brief Read the record after @p cur and advance it
+ *
+ * @return 0 on success, -ENOENT at the end, -ESTALE if records under the
+ *         cursor were dropped, -EIO on flash errors
+ */
+int history_read_next(struct history_cursor *cur, struct history_record *rec);
+
+/**
+ * @brief Release every record up to and including @p cur
+ *
+ * @return 0 on success, -ESTALE if the cursor is no longer valid
+ */
+int history_consume(const struct history_cursor *cur);
+
+/** @brief Records stored and not yet released */
+uint32_t history_pending(void);
+
+/** @brief Records lost to a full store since boot */
+uint32_t history_dropped(void);
+
+#endif /* HISTORY_H_ */
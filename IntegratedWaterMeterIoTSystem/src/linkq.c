@@ -0,0 +1,127 @@
+/**
+ * @file linkq.c
+ * @brief WiFi link quality grading from RSSI and retransmission counters
+ */
+
+#include <string.h>
+
+#include "linkq.h"
+
+/* EWMA weight of a new sample: 1/4 */
+#define EWMA_SHIFT 2
+
+static int32_t ewma(int32_t avg, int32_t sample)
+{
+    return avg + (sample - avg) / (1 << EWMA_SHIFT);
+}
+
+/**
+ * @brief Error ratio over the interval, -1 if there was too little traffic
+ *        or the counters went backwards (interface reset)
+ */
+static int ratio_permille(uint32_t total_prev, uint32_t total, uint32_t err_prev,
+                          uint32_t err)
+{
+    if (total < total_prev || err < err_prev) {
+        return -1;
+    }
+
+    uint32_t d_total = total - total_prev;
+    uint32_t d_err = err - err_prev;
+
+    if (d_total < LINKQ_MIN_PACKETS) {
+        return -1;
+    }
+    if (d_err >= d_total) {
+        return 1000;
+    }
+    return (int)((uint64_t)d_err * 1000U / d_total);
+}
+
+static enum link_grade classify(const struct link_quality *lq)
+{
+    int rssi = linkq_rssi_dbm(lq);
+
+    if (rssi < CONFIG_APP_LINKQ_POOR_RSSI ||
+        lq->err_permille > CONFIG_APP_LINKQ_POOR_ERR_PERMILLE) {
+        return LINK_POOR;
+    }
+    if (rssi >= CONFIG_APP_LINKQ_GOOD_RSSI &&
+        lq->err_permille <= CONFIG_APP_LINKQ_POOR_ERR_PERMILLE / 4) {
+        return LINK_GOOD;
+    }
+    return LINK_FAIR;
+}
+
+void linkq_init(struct link_quality *lq)
+{
+    memset(lq, 0, sizeof(*lq));
+}
+
+bool linkq_update(struct link_quality *lq, const struct link_sample *s)
+{
+    int err = -1;
+
+    if (!s->rssi_valid) {
+        return false;   /* Not associated; the grade is kept for the reconnect */
+    }
+
+    if (lq->primed) {
+        if (s->tx_valid && lq->last.tx_valid) {
+            err = ratio_permille(lq->last.tx_packets, s->tx_packets,
+                                 lq->last.tx_errors, s->tx_errors);
+        }
+        if (s->tcp_valid && lq->last.tcp_valid) {
+            int tcp = ratio_permille(lq->last.tcp_sent, s->tcp_sent,
+                                     lq->last.tcp_rexmit, s->tcp_rexmit);
+            if (tcp > err) {
+                err = tcp;
+            }
+        }
+        lq->rssi_x16 = ewma(lq->rssi_x16, s->rssi_dbm * 16);
+        if (err >= 0) {
+            lq->err_permille = (uint16_t)ewma(lq->err_permille, err);
+        }
+    } else {
+        lq->rssi_x16 = s->rssi_dbm * 16;
+        lq->primed = true;
+    }
+    lq->last = *s;
+
+    enum link_grade g = classify(lq);
+
+    if (g == lq->grade) {
+        lq->candidate_count = 0;
+        return false;
+    }
+    if (g != lq->candidate) {
+        lq->candidate = g;
+        lq->candidate_count = 0;
+    }
+    /* The first grade is taken at once */
+    if (++lq->candidate_count < LINKQ_CONFIRM_SAMPLES && lq->grade != LINK_UNKNOWN) {
+        return false;
+    }
+    lq->grade = g;
+    lq->candidate_count = 0;
+    return true;
+}
+
+int linkq_rssi_dbm(const struct link_quality *lq)
+{
+    return lq->rssi_x16 / 16;
+}
+
+const char *linkq_grade_name(enum link_grade grade)
+{
+    switch (grade) {
+    case LINK_POOR:
+        return "poor";
+    case LINK_FAIR:
+        return "fair";
+    case LINK_GOOD:
+        return "good";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,79 @@
+/**
+ * @file linkq.h
+ * @brief WiFi link quality grading from RSSI and retransmission counters
+ *
+ * @details
+ * Fed once per cycle with the RSSI and the cumulative TX packet/error
+ * counters of the WiFi driver and the TCP segment/retransmission counters
+ * of the stack. The RSSI and the worse of the two error ratios (over the
+ * last cycle) are smoothed and mapped to a grade:
+ *
+ *   POOR  RSSI below CONFIG_APP_LINKQ_POOR_RSSI or errors above
+ *         CONFIG_APP_LINKQ_POOR_ERR_PERMILLE
+ *   GOOD  RSSI at or above CONFIG_APP_LINKQ_GOOD_RSSI and errors at most
+ *         a quarter of the poor threshold
+ *   FAIR  anything in between
+ *
+ * A new grade is taken only after LINKQ_CONFIRM_SAMPLES consecutive
+ * samples agree, so a single bad reading does not flip the schedule.
+ *
+ * Pure C, no kernel calls.
+ */
+
+#ifndef LINKQ_H_
+#define LINKQ_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LINKQ_CONFIRM_SAMPLES 2
+
+/* Fewer packets in a cycle say nothing about the error ratio */
+#define LINKQ_MIN_PACKETS 8
+
+enum link_grade {
+    LINK_UNKNOWN = 0,
+    LINK_POOR,
+    LINK_FAIR,
+    LINK_GOOD,
+};
+
+/* Driver and stack readings; counters are cumulative */
+struct link_sample {
+    bool rssi_valid;
+    int8_t rssi_dbm;
+    bool tx_valid;
+    uint32_t tx_packets;
+    uint32_t tx_errors;
+    bool tcp_valid;
+    uint32_t tcp_sent;
+    uint32_t tcp_rexmit;
+};
+
+struct link_quality {
+    int32_t rssi_x16;           /* EWMA in 1/16 dB */
+    uint16_t err_permille;      /* EWMA of the worse error ratio */
+    bool primed;
+    struct link_sample last;    /* Previous counters, for deltas */
+    enum link_grade grade;
+    enum link_grade candidate;
+    uint8_t candidate_count;
+};
+
+/** @brief Reset to LINK_UNKNOWN */
+void linkq_init(struct link_quality *lq);
+
+/**
+ * @brief Add one reading
+ *
+ * @return true if the grade changed
+ */
+bool linkq_update(struct link_quality *lq, const struct link_sample *s);
+
+/** @brief Smoothed RSSI in dBm (0 before the first reading) */
+int linkq_rssi_dbm(const struct link_quality *lq);
+
+/** @brief Short name of a grade, for logs and metrics */
+const char *linkq_grade_name(enum link_grade grade);
+
+#endif /* LINKQ_H_ */
@@ -19,6 +19,20 @@
  * - Device attributes reporting
  * - CRC16 validation
  * - Error handling and logging
+ * - OpenMetrics health endpoint (http://<device>:9100/metrics)
+ * - Edge alarm rules (shared attribute "alarmRules") evaluated per sample
+ * - Time-accelerated simulation on native_sim (prj_sim.conf)
+ * - District metered area balance from time-aligned group reads (APP_DMA)
+ * - Multi-broker failover with an outbox re-sent across sessions
+ * - Offline samples kept in flash and backfilled over HTTP (APP_HISTORY)
+ * - Upload scheduling by WiFi link quality (RSSI, TX errors, retransmissions)
+ * - Per-stage latency budgets; a hung stage resets through the task watchdog
+ * - CPU load per core and thread (shell "load", telemetry, /metrics)
+ * - Telemetry batches sized from PUBACK latency and losses (AIMD)
+ * - Swinging-door compression of stored history within per-field tolerances
+ * - Raw, 15-minute and daily archive tiers with retention (shell "archive")
+ * - Raw meter frames forwarded undecoded for host-side decoding (APP_RAW_UPLINK)
+ * - Pulse-output flow between polls; flow start/stop triggers a read (APP_PULSE)
  *
  * Architecture:
  *   BOVE Meter <--Modbus RTU--> ESP32 <--WiFi--> Router <--Internet--> ThingsBoard
@@ -29,494 +43,357 @@
  */
 
 #include <zephyr/kernel.h>
-#include <zephyr/device.h>
-#include <zephyr/drivers/uart.h>
-#include <zephyr/net/socket.h>
-#include <zephyr/net/mqtt.h>
-#include <zephyr/random/random.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/posix/poll.h>
-#include <zephyr/net/wifi_mgmt.h>
-#include <zephyr/net/net_mgmt.h>
-#include <zephyr/net/net_event.h>
-#include <zephyr/net/net_if.h>
-#include <zephyr/net/net_ip.h>
 #include <string.h>
 #include <stdio.h>
 
+#include "archive.h"
+#include "attr_parse.h"
+#include "backfill.h"
+#include "cloud.h"
+#include "cpuload.h"
+#include "deadline.h"
+#include "dma.h"
+#include "history.h"
+#include "linkq.h"
+#include "meter.h"
+#include "metrics.h"
+#include "modbus.h"
+#include "pulse.h"
+#include "raw_frame.h"
+#include "rules.h"
+#include "swing_door.h"
+#include "telemetry_batch.h"
+#include "timebase.h"
+
+#if defined(CONFIG_APP_SIM)
+#include "sim.h"
+#endif
+
 LOG_MODULE_REGISTER(water_meter, LOG_LEVEL_INF);
 
 /* ============================================================================
  * CONFIGURATION
  * ============================================================================ */
 
-/* WiFi Configuration */
-#define WIFI_SSID "!!Huawei"
-#define WIFI_PSK "karamr195"
-
-/* ThingsBoard Configuration */
-#define THINGSBOARD_HOST "thingsboard.cloud"
-#define THINGSBOARD_PORT 1883
-#define ACCESS_TOKEN "JqkpupDR1nmXD6nbZX2S"
-#define TELEMETRY_TOPIC "v1/devices/me/telemetry"
-#define ATTRIBUTES_TOPIC "v1/devices/me/attributes"
+/* Shared Attributes */
+#define RULES_ATTRIBUTE_KEY "alarmRules"
+#define RULES_TEXT_BUFFER 768
 
 /* Modbus Configuration */
-#define UART_DEVICE_NODE DT_NODELABEL(uart0)
 #define MODBUS_SLAVE_ID 1
 #define MODBUS_READ_INTERVAL_SEC 30
 
-/* Buffer Sizes */
-#define RX_BUFFER_SIZE 1024
-#define TX_BUFFER_SIZE 1024
-#define MODBUS_RX_BUFFER 256
+/* Longest gap between stages, the sleep between reads included */
+#define LOOP_WATCHDOG_LIMIT_MS ((MODBUS_READ_INTERVAL_SEC + 60) * 1000)
 
 /* ============================================================================
  * GLOBAL VARIABLES
  * ============================================================================ */
 
-/* UART Device */
-static const struct device *uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
-static struct uart_config original_cfg;
-
-/* MQTT Client */
-static struct mqtt_client client;
-static struct sockaddr_in broker_addr;
-static uint8_t mqtt_rx_buffer[RX_BUFFER_SIZE];
-static uint8_t mqtt_tx_buffer[TX_BUFFER_SIZE];
-
-/* Network Management */
-static struct net_mgmt_event_callback wifi_cb;
-static struct net_mgmt_event_callback ipv4_cb;
-static K_SEM_DEFINE(wifi_connected, 0, 1);
-static K_SEM_DEFINE(ipv4_obtained, 0, 1);
-static volatile bool mqtt_connected = false;
-
+#if !defined(CONFIG_APP_DMA)
 /* Meter Data */
-typedef struct {
-    uint32_t flow_rate;        // L/h × 100
-    uint32_t forward_total;    // m³ × 1000
-    uint32_t reverse_total;    // m³ × 1000
-    uint16_t pressure;         // MPa × 1000
-    uint16_t temperature;      // °C × 100
-    uint16_t status;           // Status flags
-    uint32_t serial_number;    // Serial number (BCD)
-    uint8_t modbus_id;         // Modbus address
-    uint16_t baud_code;        // Baud rate code
-    bool valid;                // Data validity flag
-} meter_data_t;
-
 static meter_data_t meter_data = {0};
+#endif
+
+/* WiFi Link Quality */
+static struct link_quality link;
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+/* Swinging-door Compressor in Front of the History Store */
+static struct swing_door history_door;
+#endif
+
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+/* Telemetry Batch and its AIMD Operating Point */
+static struct telemetry_batch batch;
+#endif
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+/* Raw Frame Batch and the CPU Time of Both Uplink Paths */
+static struct {
+    uint8_t buf[OUTBOX_PAYLOAD_LEN];
+    size_t len;
+    int64_t first_ms;           /* Uptime of the oldest frame */
+    uint32_t frames;            /* Since boot */
+    uint64_t cycles;            /* Spent on the raw path */
+    uint32_t probes;
+    uint64_t probe_cycles;      /* Spent on the decoded path, when probed */
+} raw;
+#endif
+
+#if !defined(CONFIG_APP_DMA)
+/* Edge Alarm Rules */
+static struct rule_set alarm_rules;
+static char rules_status[96];
+static bool rules_status_pending = false;
+#endif
 
 /* ============================================================================
- * MODBUS FUNCTIONS
+ * TELEMETRY FUNCTIONS
  * ============================================================================ */
 
-/**
- * @brief Calculate Modbus CRC16
- */
-uint16_t modbus_crc16(const uint8_t *data, uint16_t length)
+static int publish_json(const char *topic, const char *payload)
 {
-    uint16_t crc = 0xFFFF;
-    for (uint16_t i = 0; i < length; i++) {
-        crc ^= data[i];
-        for (uint8_t j = 0; j < 8; j++) {
-            crc = (crc & 0x0001) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
-        }
-    }
-    return crc;
+    return cloud_publish(topic, payload, strlen(payload));
 }
 
+#if !defined(CONFIG_APP_DMA)
 /**
- * @brief Build Modbus read command (Function Code 0x03)
+ * @brief Subscribe to shared attribute updates and request current values
  */
-void build_read_cmd(uint8_t *buf, uint8_t id)
+static void subscribe_shared_attributes(void)
 {
-    buf[0] = id;           // Slave address
-    buf[1] = 0x03;         // Function code (Read Holding Registers)
-    buf[2] = 0x00;         // Start address high
-    buf[3] = 0x01;         // Start address low (register 1)
-    buf[4] = 0x00;         // Quantity high
-    buf[5] = 0x26;         // Quantity low (38 registers)
-    
-    uint16_t crc = modbus_crc16(buf, 6);
-    buf[6] = crc & 0xFF;
-    buf[7] = (crc >> 8) & 0xFF;
+    static const char *const topics[] = {
+        ATTRIBUTES_TOPIC,
+        ATTRIBUTES_RESPONSE_TOPIC,
+    };
+
+    int rc = cloud_subscribe(topics, ARRAY_SIZE(topics));
+    if (rc) {
+        LOG_ERR("Attribute subscription failed: %d", rc);
+        return;
+    }
+
+    rc = publish_json(ATTRIBUTES_REQUEST_TOPIC,
+                      "{\"sharedKeys\":\"" RULES_ATTRIBUTE_KEY "\"}");
+    if (rc) {
+        LOG_ERR("Shared attribute request failed: %d", rc);
+    }
 }
+#endif
+
+#if !defined(CONFIG_APP_DMA)
+/* The balance publishes its own rounds; per-meter samples are not kept */
 
 /**
- * @brief Read 32-bit value from Modbus response (big-endian word order)
+ * @brief The current sample, stamped with the server-synced clock
  */
-uint32_t read_u32(const uint8_t *d, int offset)
+static void make_record(struct telemetry_record *rec)
 {
-    uint32_t low = (d[offset] << 8) | d[offset + 1];
-    uint32_t high = (d[offset + 2] << 8) | d[offset + 3];
-    return (high << 16) | low;
+    rec->ts_ms = timebase_to_unix_ms(k_uptime_get());
+    rec->values[BOVE_FLOW_RATE] = meter_data.flow_rate;
+    rec->values[BOVE_FORWARD_TOTAL] = meter_data.forward_total;
+    rec->values[BOVE_REVERSE_TOTAL] = meter_data.reverse_total;
+    rec->values[BOVE_PRESSURE] = meter_data.pressure;
+    rec->values[BOVE_TEMPERATURE] = meter_data.temperature;
+    rec->values[BOVE_STATUS] = meter_data.status;
 }
 
-/**
- * @brief Switch UART to Modbus mode (2400 baud, 8E1)
- */
-void switch_to_modbus(void)
+#if defined(CONFIG_APP_HISTORY)
+static int store_point(const struct telemetry_record *r, uint16_t samples)
 {
-    struct uart_config modbus_cfg = {
-        .baudrate = 2400,
-        .parity = UART_CFG_PARITY_EVEN,
-        .stop_bits = UART_CFG_STOP_BITS_1,
-        .data_bits = UART_CFG_DATA_BITS_8,
-        .flow_ctrl = UART_CFG_FLOW_CTRL_NONE,
+    struct history_record rec = {
+        .ts_ms = r->ts_ms,
+        .flow_rate = r->values[BOVE_FLOW_RATE],
+        .forward_total = r->values[BOVE_FORWARD_TOTAL],
+        .reverse_total = r->values[BOVE_REVERSE_TOTAL],
+        .pressure = r->values[BOVE_PRESSURE],
+        .temperature = r->values[BOVE_TEMPERATURE],
+        .status = r->values[BOVE_STATUS],
+        .samples = samples,
     };
-    uart_configure(uart_dev, &modbus_cfg);
-}
 
-/**
- * @brief Switch UART back to console mode
- */
-void switch_to_console(void)
-{
-    uart_configure(uart_dev, &original_cfg);
-    k_msleep(10);
+    int rc = history_append(&rec);
+#if defined(CONFIG_APP_SIM)
+    if (rc == 0) {
+        sim_stat_history_point(r, samples);
+    }
+#endif
+    return rc;
 }
 
 /**
- * @brief Read data from water meter via Modbus RTU
+ * @brief Keep the sample in flash; backfill.c uploads it once back online
+ *
+ * With compression the sample may only narrow the current segment; it is
+ * covered by the next point stored.
  */
-int read_meter_data(void)
+static int store_sample(const struct telemetry_record *r)
 {
-    uint8_t tx_buf[8];
-    uint8_t rx_buf[MODBUS_RX_BUFFER];
-    int rx_len = 0;
-    
-    /* Switch to Modbus mode */
-    switch_to_modbus();
-    
-    /* Build and send read command */
-    build_read_cmd(tx_buf, MODBUS_SLAVE_ID);
-    for (int i = 0; i < 8; i++) {
-        uart_poll_out(uart_dev, tx_buf[i]);
-    }
-    
-    /* Wait for response */
-    k_msleep(100);
-    
-    /* Receive response with timeout */
-    uint32_t start = k_uptime_get_32();
-    uint32_t last_byte = start;
-    
-    while ((k_uptime_get_32() - start) < 2000) {
-        uint8_t c;
-        if (uart_poll_in(uart_dev, &c) == 0) {
-            rx_buf[rx_len++] = c;
-            last_byte = k_uptime_get_32();
-            if (rx_len >= sizeof(rx_buf)) break;
-        }
-        
-        /* Break if no data for 150ms */
-        if (rx_len > 3 && (k_uptime_get_32() - last_byte) > 150) {
-            break;
-        }
-        
-        k_msleep(5);
-    }
-    
-    /* Switch back to console */
-    switch_to_console();
-    
-    /* Validate response */
-    if (rx_len < 70) {
-        LOG_WRN("Incomplete response (%d bytes)", rx_len);
-        meter_data.valid = false;
-        return -1;
-    }
-    
-    /* Verify CRC */
-    uint16_t recv_crc = rx_buf[rx_len-2] | (rx_buf[rx_len-1] << 8);
-    uint16_t calc_crc = modbus_crc16(rx_buf, rx_len - 2);
-    
-    if (recv_crc != calc_crc) {
-        LOG_ERR("CRC error (recv: 0x%04X, calc: 0x%04X)", recv_crc, calc_crc);
-        meter_data.valid = false;
-        return -1;
-    }
-    
-    /* Verify slave ID and function code */
-    if (rx_buf[0] != MODBUS_SLAVE_ID || rx_buf[1] != 0x03) {
-        LOG_ERR("Invalid response header");
-        meter_data.valid = false;
-        return -1;
+    int rc = 0;
+
+    if (!history_available()) {
+        return -ENODEV;
     }
-    
-    /* Parse meter data */
-    const uint8_t *d = &rx_buf[3];
-    
-    meter_data.flow_rate = read_u32(d, 0);           // Register 1-2
-    meter_data.forward_total = read_u32(d, 12);      // Register 7-8
-    meter_data.reverse_total = read_u32(d, 18);      // Register 10-11
-    meter_data.pressure = (d[36] << 8) | d[37];      // Register 19
-    meter_data.temperature = (d[58] << 8) | d[59];   // Register 30
-    meter_data.status = (d[38] << 8) | d[39];        // Register 20
-    meter_data.serial_number = ((uint32_t)d[64] << 24) | ((uint32_t)d[65] << 16) | 
-                               ((uint32_t)d[66] << 8) | d[67];  // Register 33-34
-    meter_data.modbus_id = d[69];                    // Register 35
-    meter_data.baud_code = (d[72] << 8) | d[73];     // Register 37
-    meter_data.valid = true;
-    
-    LOG_INF("Meter data read successfully");
-    return 0;
-}
 
-/* ============================================================================
- * WIFI FUNCTIONS
- * ============================================================================ */
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    struct swing_door_point pts[SWING_DOOR_OUT_MAX];
+    int n = swing_door_add(&history_door, r, pts);
 
-static void wifi_event_handler(struct net_mgmt_event_callback *cb,
-                              uint64_t mgmt_event, struct net_if *iface)
-{
-    if (mgmt_event == NET_EVENT_WIFI_CONNECT_RESULT) {
-        int status = *((int *)cb->info);
-        if (status == 0) {
-            LOG_INF("WiFi connected");
-            k_sem_give(&wifi_connected);
-        } else {
-            LOG_ERR("WiFi failed: %d", status);
-        }
-    } else if (mgmt_event == NET_EVENT_WIFI_DISCONNECT_RESULT) {
-        LOG_WRN("WiFi disconnected");
-        mqtt_connected = false;
-        k_sem_reset(&wifi_connected);
-        k_sem_reset(&ipv4_obtained);
+    for (int i = 0; i < n && rc == 0; i++) {
+        rc = store_point(&pts[i].rec, pts[i].samples);
     }
+    metrics_history_compression(history_door.samples_in, history_door.points_out);
+#else
+    rc = store_point(r, 1);
+#endif
+    if (rc == 0) {
+        LOG_INF("Sample stored for backfill (%u pending)", history_pending());
+#if defined(CONFIG_APP_SIM)
+        sim_stat_stored(r);
+#endif
+    }
+    return rc;
 }
 
-static void ipv4_event_handler(struct net_mgmt_event_callback *cb,
-                              uint64_t mgmt_event, struct net_if *iface)
+/**
+ * @brief End the compressed segment when samples go live again, so backfill
+ *        gets its last point
+ */
+static void close_history(void)
 {
-    if (mgmt_event == NET_EVENT_IPV4_ADDR_ADD) {
-        LOG_INF("IPv4 address obtained");
-        k_sem_give(&ipv4_obtained);
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    struct swing_door_point pt;
+
+    if (swing_door_flush(&history_door, &pt)) {
+        store_point(&pt.rec, pt.samples);
+        metrics_history_compression(history_door.samples_in, history_door.points_out);
     }
+#endif
 }
+#endif /* CONFIG_APP_HISTORY */
 
-static int wifi_connect(void)
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+/**
+ * @brief Move the batched samples to flash (offline, poor link, full outbox)
+ *
+ * After a partial failure the batch is kept whole; samples stored twice
+ * carry the same timestamp, which ThingsBoard keeps once.
+ *
+ * @return true if every sample was stored and the batch cleared
+ */
+static bool stash_batch(void)
 {
-    struct net_if *iface;
-    struct wifi_connect_req_params params;
-    int retry = 0;
-    const int max_retries = 10;
-    
-    LOG_INF("Initializing WiFi connection...");
+#if defined(CONFIG_APP_HISTORY)
+    uint8_t stored = 0;
 
-    iface = net_if_get_first_wifi();
-    if (iface == NULL) {
-        LOG_ERR("No WiFi interface found");
-        return -ENODEV;
+    while (stored < batch.count && store_sample(&batch.recs[stored]) == 0) {
+        stored++;
     }
-
-    net_mgmt_init_event_callback(&wifi_cb, wifi_event_handler,
-                                NET_EVENT_WIFI_CONNECT_RESULT |
-                                NET_EVENT_WIFI_DISCONNECT_RESULT);
-    net_mgmt_add_event_callback(&wifi_cb);
-
-    net_mgmt_init_event_callback(&ipv4_cb, ipv4_event_handler,
-                                NET_EVENT_IPV4_ADDR_ADD);
-    net_mgmt_add_event_callback(&ipv4_cb);
-
-    memset(&params, 0, sizeof(params));
-    params.ssid = WIFI_SSID;
-    params.ssid_length = strlen(WIFI_SSID);
-    params.psk = WIFI_PSK;
-    params.psk_length = strlen(WIFI_PSK);
-    params.security = WIFI_SECURITY_TYPE_PSK;
-    params.channel = WIFI_CHANNEL_ANY;
-    params.band = WIFI_FREQ_BAND_2_4_GHZ;
-
-    /* Retry loop for WiFi connection */
-    while (retry < max_retries) {
-        LOG_INF("WiFi connection attempt %d/%d...", retry + 1, max_retries);
-        
-        /* Reset semaphores before retry */
-        k_sem_reset(&wifi_connected);
-        k_sem_reset(&ipv4_obtained);
-        
-        int ret = net_mgmt(NET_REQUEST_WIFI_CONNECT, iface, &params, sizeof(params));
-        if (ret) {
-            LOG_WRN("WiFi connection request failed: %d", ret);
-            retry++;
-            k_sleep(K_SECONDS(5));
-            continue;
-        }
-
-        /* Wait for WiFi connection */
-        if (k_sem_take(&wifi_connected, K_SECONDS(30)) != 0) {
-            LOG_WRN("WiFi connection timeout (attempt %d/%d)", retry + 1, max_retries);
-            retry++;
-            k_sleep(K_SECONDS(5));
-            continue;
-        }
-
-        /* Wait for IPv4 address */
-        if (k_sem_take(&ipv4_obtained, K_SECONDS(30)) != 0) {
-            LOG_WRN("IPv4 acquisition timeout (attempt %d/%d)", retry + 1, max_retries);
-            retry++;
-            k_sleep(K_SECONDS(5));
-            continue;
-        }
-
-        /* Success! */
-        LOG_INF("WiFi connected successfully on attempt %d", retry + 1);
-        return 0;
+    if (stored == batch.count) {
+        telemetry_batch_clear(&batch);
+        return true;
     }
-
-    /* All retries failed */
-    LOG_ERR("WiFi connection failed after %d attempts", max_retries);
-    return -ETIMEDOUT;
+#endif
+    return false;
 }
 
-/* ============================================================================
- * MQTT FUNCTIONS
- * ============================================================================ */
-
-static int broker_init(void)
+/**
+ * @brief Publish the batch once it is full or its oldest sample is due
+ */
+static int flush_batch(void)
 {
-    struct zsock_addrinfo hints;
-    struct zsock_addrinfo *result;
-
-    LOG_INF("Resolving broker: %s", THINGSBOARD_HOST);
+    static char payload[OUTBOX_PAYLOAD_LEN + 1];
 
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-
-    int ret = zsock_getaddrinfo(THINGSBOARD_HOST, NULL, &hints, &result);
-    if (ret != 0 || result == NULL) {
-        LOG_ERR("DNS resolution failed");
-        return -EINVAL;
+    if (!telemetry_batch_due(&batch, k_uptime_get())) {
+        return 0;
     }
 
-    memcpy(&broker_addr, result->ai_addr, sizeof(broker_addr));
-    broker_addr.sin_family = AF_INET;
-    broker_addr.sin_port = htons(THINGSBOARD_PORT);
+    int len = telemetry_batch_format(&batch, payload, sizeof(payload));
+    if (len < 0) {
+        LOG_ERR("Telemetry batch does not fit a message, dropped");
+        telemetry_batch_clear(&batch);
+        return len;
+    }
 
-    zsock_freeaddrinfo(result);
-    LOG_INF("Broker resolved successfully");
-    return 0;
-}
+    uint8_t count = batch.count;
+    int rc = cloud_publish(TELEMETRY_TOPIC, payload, len);
 
-static void mqtt_evt_handler(struct mqtt_client *const client,
-                            const struct mqtt_evt *evt)
-{
-    switch (evt->type) {
-    case MQTT_EVT_CONNACK:
-        if (evt->result != 0) {
-            LOG_ERR("MQTT connection refused: %d", evt->result);
-            mqtt_connected = false;
-        } else {
-            LOG_INF("MQTT connected");
-            mqtt_connected = true;
-        }
-        break;
-    case MQTT_EVT_DISCONNECT:
-        LOG_WRN("MQTT disconnected");
-        mqtt_connected = false;
-        break;
-    case MQTT_EVT_PUBACK:
-        LOG_DBG("PUBACK received, msg_id: %d", evt->param.puback.message_id);
-        break;
-    default:
-        break;
+    if (rc == -ENOBUFS && stash_batch()) {
+        LOG_WRN("Outbox full, %u sample(s) stored for backfill", count);
+        return 0;
+    }
+    if (rc) {
+        LOG_ERR("MQTT publish failed: %d", rc);
+        return rc;
     }
-}
 
-static void prepare_mqtt_client(void)
-{
-    static char client_id[32];
-    static struct mqtt_utf8 mqtt_user_name;
-
-    snprintf(client_id, sizeof(client_id), "esp32_meter_%08x", 
-             (unsigned int)sys_rand32_get());
-
-    mqtt_client_init(&client);
-
-    client.broker = (struct sockaddr *)&broker_addr;
-    client.evt_cb = mqtt_evt_handler;
-    client.client_id.utf8 = (uint8_t *)client_id;
-    client.client_id.size = strlen(client_id);
-    client.user_name = &mqtt_user_name;
-    mqtt_user_name.utf8 = (uint8_t *)ACCESS_TOKEN;
-    mqtt_user_name.size = strlen(ACCESS_TOKEN);
-    client.password = NULL;
-    client.protocol_version = MQTT_VERSION_3_1_1;
-    client.transport.type = MQTT_TRANSPORT_NON_SECURE;
-    client.rx_buf = mqtt_rx_buffer;
-    client.rx_buf_size = sizeof(mqtt_rx_buffer);
-    client.tx_buf = mqtt_tx_buffer;
-    client.tx_buf_size = sizeof(mqtt_tx_buffer);
-    client.keepalive = 60;
+    LOG_INF("Telemetry batch of %u sample(s) published", batch.count);
+    telemetry_batch_clear(&batch);
+    return 0;
 }
 
-static int thingsboard_connect(void)
+/**
+ * @brief PUBACK feedback moves the operating point: additive increase on
+ *        fast acks, halved on timeouts and lost sessions
+ */
+static void on_cloud_delivery(const char *topic, enum cloud_delivery result,
+                              uint32_t latency_ms)
 {
-    int ret;
-    int retry = 0;
-
-    LOG_INF("Connecting to ThingsBoard...");
-    prepare_mqtt_client();
+    int change = 0;
 
-    while (retry < 5) {
-        ret = mqtt_connect(&client);
-        if (ret != 0) {
-            LOG_ERR("mqtt_connect failed: %d", ret);
-            goto cleanup;
-        }
-
-        struct zsock_pollfd fds[1];
-        int timeout = 5000;
-
-        fds[0].fd = client.transport.tcp.sock;
-        fds[0].events = ZSOCK_POLLIN;
-
-        while (timeout > 0) {
-            int poll_ret = zsock_poll(fds, 1, 500);
-            if (poll_ret > 0 && (fds[0].revents & ZSOCK_POLLIN)) {
-                mqtt_input(&client);
-            }
-
-            if (mqtt_connected) {
-                LOG_INF("ThingsBoard connected successfully");
-                return 0;
-            }
-
-            k_sleep(K_MSEC(500));
-            timeout -= 500;
+    if (result == CLOUD_ACKED) {
+        /* Other topics share the link but not the batch size */
+        if (strcmp(topic, TELEMETRY_TOPIC) != 0) {
+            return;
         }
-
-cleanup:
-        retry++;
-        if (client.transport.tcp.sock >= 0) {
-            struct mqtt_disconnect_param disc = {0};
-            mqtt_disconnect(&client, &disc);
-        }
-        LOG_WRN("Connection attempt %d failed, retrying...", retry);
-        k_sleep(K_SECONDS(2));
+        change = telemetry_batch_on_ack(&batch, latency_ms) ? 1 : 0;
+    } else {
+        change = telemetry_batch_on_loss(&batch, k_uptime_get()) ? -1 : 0;
     }
 
-    LOG_ERR("Failed to connect after 5 attempts");
-    return -ECONNREFUSED;
+    metrics_telemetry_batch(batch.size, batch.flush_ms, batch.ack_ms, change);
+    if (change == 0) {
+        return;
+    }
+    LOG_INF("Telemetry batch %s: %u sample(s), flush %u s (PUBACK %u ms)",
+            change > 0 ? "grown" : "shrunk", batch.size, batch.flush_ms / 1000,
+            batch.ack_ms);
+#if defined(CONFIG_APP_SIM)
+    sim_stat_batch(batch.size, batch.flush_ms, change > 0);
+#endif
 }
+#endif /* CONFIG_APP_TELEMETRY_BATCH */
 
 static int send_telemetry(void)
 {
     char payload[512];
-    
-    if (!mqtt_connected) {
-        LOG_WRN("MQTT not connected, skipping telemetry");
-        return -ENOTCONN;
-    }
+    struct telemetry_record rec;
     
     if (!meter_data.valid) {
         LOG_WRN("Meter data invalid, skipping telemetry");
         return -EINVAL;
     }
+    make_record(&rec);
+
+#if defined(CONFIG_APP_ARCHIVE)
+    /* Every sample, whichever way it is uploaded */
+    if (timebase_synced()) {
+        archive_add(&rec);
+    }
+#endif
+
+#if defined(CONFIG_APP_HISTORY)
+    /* Offline: history keeps the outbox free for alarms and attributes.
+     * Poor link: routine samples wait for a better one; alarms still go.
+     * Without a known time the sample could not be placed, so it queues.
+     */
+    bool poor = cloud_connected() && link.grade == LINK_POOR;
+
+    if ((!cloud_connected() || poor) && timebase_synced()) {
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+        stash_batch();
+#endif
+        if (store_sample(&rec) == 0) {
+            if (poor) {
+                metrics_telemetry_deferred();
+            }
+            return 0;
+        }
+    }
+    close_history();
+#endif
+
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+    /* Batched records carry their own timestamps */
+    if (timebase_synced()) {
+        if (telemetry_batch_add(&batch, &rec, k_uptime_get()) != 0) {
+            LOG_WRN("Telemetry batch full, oldest sample dropped");
+        }
+        return flush_batch();
+    }
+#endif
 
     /* Build JSON payload with meter data (integer values only) */
     snprintf(payload, sizeof(payload),
@@ -544,15 +421,12 @@ static int send_telemetry(void)
 
     LOG_INF("Telemetry: %s", payload);
 
-    struct mqtt_publish_param pub = {0};
-    pub.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
-    pub.message.topic.topic.utf8 = (uint8_t *)TELEMETRY_TOPIC;
-    pub.message.topic.topic.size = strlen(TELEMETRY_TOPIC);
-    pub.message.payload.data = (uint8_t *)payload;
-    pub.message.payload.len = strlen(payload);
-    pub.message_id = sys_rand32_get();
-
-    int rc = mqtt_publish(&client, &pub);
+    int rc = publish_json(TELEMETRY_TOPIC, payload);
+#if defined(CONFIG_APP_HISTORY)
+    if (rc == -ENOBUFS && timebase_synced()) {
+        rc = store_sample(&rec);
+    }
+#endif
     if (rc) {
         LOG_ERR("MQTT publish failed: %d", rc);
     } else {
@@ -564,10 +438,9 @@ static int send_telemetry(void)
 static int send_attributes(void)
 {
     char payload[256];
-    struct mqtt_publish_param pub = {0};
     const char *baud_str;
 
-    if (!mqtt_connected) return -ENOTCONN;
+    if (!cloud_connected()) return -ENOTCONN;
 
     /* Determine baud rate string */
     switch(meter_data.baud_code) {
@@ -593,24 +466,558 @@ static int send_attributes(void)
 
     LOG_INF("Attributes: %s", payload);
 
-    pub.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
-    pub.message.topic.topic.utf8 = (uint8_t *)ATTRIBUTES_TOPIC;
-    pub.message.topic.topic.size = strlen(ATTRIBUTES_TOPIC);
-    pub.message.payload.data = (uint8_t *)payload;
-    pub.message.payload.len = strlen(payload);
-    pub.message_id = sys_rand32_get();
+    return publish_json(ATTRIBUTES_TOPIC, payload);
+}
+#endif /* !CONFIG_APP_DMA */
+
+#if defined(CONFIG_APP_RAW_UPLINK)
+/* ============================================================================
+ * RAW UPLINK
+ * ============================================================================ */
+
+static void process_alarm_rules(void);
+
+/**
+ * @brief Mean CPU time per sample of the raw path and of the decoded path
+ *        (0 until probed)
+ */
+static void raw_uplink_ns(uint32_t *raw_ns, uint32_t *decoded_ns)
+{
+    *raw_ns = raw.frames ? (uint32_t)k_cyc_to_ns_floor64(raw.cycles / raw.frames) : 0;
+    *decoded_ns = raw.probes ?
+                  (uint32_t)k_cyc_to_ns_floor64(raw.probe_cycles / raw.probes) : 0;
+}
+
+static bool raw_due(void)
+{
+    return raw.len > 0 &&
+           k_uptime_get() - raw.first_ms >= CONFIG_APP_RAW_MAX_DELAY_SEC * 1000LL;
+}
+
+/**
+ * @brief Publish the raw batch to the bridge broker; offline it waits in
+ *        the raw outbox, with that full it is dropped
+ */
+static int flush_raw(void)
+{
+    uint8_t frames = raw_batch_count(raw.buf, raw.len);
+
+    if (frames == 0) {
+        return 0;
+    }
+
+    int rc = cloud_publish_raw((const char *)raw.buf, raw.len);
+
+    if (rc) {
+        LOG_ERR("Raw batch of %u frame(s) dropped: %d", frames, rc);
+    } else {
+        LOG_INF("Raw batch of %u frame(s) published", frames);
+    }
+    raw.len = 0;
+    return rc;
+}
+
+/**
+ * @brief Format the decoded sample as the decoded path does, without
+ *        publishing; its cycles are what the raw path saves
+ *
+ * The frame is decoded for the alarm rules on either path, so only the
+ * record and its JSON count. Logging is left out, so the saving is a lower
+ * bound.
+ */
+static uint32_t probe_decoded_path(void)
+{
+    static char json[256];
+    struct telemetry_record rec;
+    uint32_t t0 = k_cycle_get_32();
+
+    make_record(&rec);
+    telemetry_record_format(&rec, json, sizeof(json));
+    return k_cycle_get_32() - t0;
+}
+
+/**
+ * @brief Queue one validated response; the batch goes out when another
+ *        frame would not fit or its oldest frame is due
+ */
+static void add_raw_frame(const uint8_t *data)
+{
+    uint32_t t0 = k_cycle_get_32();
+    struct raw_frame frame = {
+        .ts_ms = timebase_to_unix_ms(k_uptime_get()),
+        .slave_id = MODBUS_SLAVE_ID,
+        .start_reg = BOVE_READ_START_REG,
+        .reg_count = BOVE_READ_REG_COUNT,
+        .data = data,
+    };
+    int len = raw_batch_append(raw.buf, raw.len, sizeof(raw.buf), &frame);
+
+    if (len < 0) {
+        /* The clock stepped back past the start of the batch */
+        flush_raw();
+        len = raw_batch_append(raw.buf, 0, sizeof(raw.buf), &frame);
+    }
+    if (raw.len == 0) {
+        raw.first_ms = k_uptime_get();
+    }
+    raw.len = len;
+    raw.frames++;
+    raw.cycles += k_cycle_get_32() - t0;
+
+    if (CONFIG_APP_RAW_PROBE_EVERY > 0 && raw.frames % CONFIG_APP_RAW_PROBE_EVERY == 0) {
+        raw.probe_cycles += probe_decoded_path();
+        raw.probes++;
+    }
+
+    uint32_t raw_ns, decoded_ns;
+
+    raw_uplink_ns(&raw_ns, &decoded_ns);
+    metrics_raw_uplink(raw.frames, raw_ns, decoded_ns);
+
+    if (raw.len + RAW_FRAME_LEN(BOVE_READ_REG_COUNT) > sizeof(raw.buf) || raw_due()) {
+        flush_raw();
+    }
+}
+
+/**
+ * @brief One meter read on the raw path
+ *
+ * The validated frame is still decoded on the device for the attributes and
+ * the alarm rules; only the telemetry leaves undecoded. Before the clock is
+ * synced a frame could not be placed in time, so it goes the decoded way.
+ */
+static void process_raw_read(void)
+{
+    static uint8_t data[BOVE_DATA_LEN];
+    static bool attrs_sent = false;
+
+    deadline_begin(STAGE_METER_READ);
+    int ret = modbus_read_frame(MODBUS_SLAVE_ID, data);
+    deadline_end(STAGE_METER_READ);
+
+    if (ret != 0) {
+        LOG_ERR("Failed to read meter data");
+        /* Frames already batched still go out on time */
+        if (raw_due()) {
+            flush_raw();
+        }
+        return;
+    }
+
+    meter_decode(data, &meter_data);
+
+    deadline_begin(STAGE_PUBLISH);
+    if (!attrs_sent && cloud_connected()) {
+        send_attributes();
+        attrs_sent = true;
+    }
+    process_alarm_rules();
+    if (timebase_synced()) {
+        add_raw_frame(data);
+    } else if (send_telemetry() != 0) {
+        LOG_WRN("Telemetry transmission failed, will retry on next cycle");
+    }
+    deadline_end(STAGE_PUBLISH);
+}
+#endif /* CONFIG_APP_RAW_UPLINK */
+
+/* ============================================================================
+ * LINK QUALITY
+ * ============================================================================ */
+
+/**
+ * @brief Sample the WiFi link and re-grade it for upload scheduling
+ */
+static void update_link_quality(void)
+{
+    struct link_sample sample;
+
+    deadline_begin(STAGE_LINK_SAMPLE);
+    int rc = cloud_link_sample(&sample);
+    deadline_end(STAGE_LINK_SAMPLE);
+    if (rc != 0) {
+        return;
+    }
 
-    return mqtt_publish(&client, &pub);
+    if (linkq_update(&link, &sample)) {
+        LOG_INF("Link quality %s (RSSI %d dBm, errors %u.%u %%)",
+                linkq_grade_name(link.grade), linkq_rssi_dbm(&link),
+                link.err_permille / 10, link.err_permille % 10);
+#if defined(CONFIG_APP_HISTORY)
+        backfill_set_link_grade(link.grade);
+#endif
+    }
+    metrics_link(linkq_rssi_dbm(&link), link.err_permille, link.grade);
 }
 
-static void mqtt_maintenance(void)
+/* ============================================================================
+ * CPU LOAD
+ * ============================================================================ */
+
+/**
+ * @brief Publish the load figures every CONFIG_APP_CPULOAD_REPORT_SEC
+ *
+ * Peaks are since boot: after a representative period they give the
+ * headroom left before raising the poll rate or the meter count.
+ */
+static void send_load_report(void)
 {
-    if (mqtt_connected) {
-        mqtt_input(&client);
-        mqtt_live(&client);
+    static struct cpuload_report r;
+    static int64_t last_report_ms;
+    char payload[320];
+    const struct cpuload_entry *top = NULL;
+    uint16_t busiest = 0;
+
+    if (CONFIG_APP_CPULOAD_REPORT_SEC == 0 || !cloud_connected()) {
+        return;
+    }
+    if (last_report_ms != 0 &&
+        k_uptime_get() - last_report_ms < CONFIG_APP_CPULOAD_REPORT_SEC * 1000LL) {
+        return;
+    }
+
+    cpuload_get(&r);
+    if (r.window_ms == 0) {
+        return;
+    }
+
+    for (int i = 0; i < r.cpu_count; i++) {
+        busiest = MAX(busiest, r.cpus[i].load_permille);
+    }
+    /* Busiest thread by peak, the idle threads aside */
+    for (int i = 0; i < r.thread_count; i++) {
+        if (strncmp(r.threads[i].name, "idle", 4) == 0) {
+            continue;
+        }
+        if (top == NULL || r.threads[i].peak_permille > top->peak_permille) {
+            top = &r.threads[i];
+        }
+    }
+
+    int len = snprintf(payload, sizeof(payload),
+                       "{"
+                       "\"cpuLoad\":%u,"
+                       "\"cpuLoadPeak\":%u,"
+                       "\"loopMs\":%u,"
+                       "\"loopMaxMs\":%u,"
+                       "\"topThread\":\"%s\","
+                       "\"topThreadPeak\":%u",
+                       busiest, cpuload_peak_permille(&r), r.loop_ms, r.loop_max_ms,
+                       top ? top->name : "", top ? top->peak_permille : 0);
+#if defined(CONFIG_APP_RAW_UPLINK)
+    uint32_t raw_ns, decoded_ns;
+
+    /* CPU time per sample the raw uplink saves over decoding on the device */
+    raw_uplink_ns(&raw_ns, &decoded_ns);
+    len += snprintf(&payload[len], sizeof(payload) - len,
+                    ",\"rawUplinkNs\":%u,\"decodedUplinkNs\":%u,\"uplinkSavedNs\":%u",
+                    raw_ns, decoded_ns, decoded_ns > raw_ns ? decoded_ns - raw_ns : 0);
+#endif
+    snprintf(&payload[len], sizeof(payload) - len, "}");
+
+    if (publish_json(TELEMETRY_TOPIC, payload) == 0) {
+        last_report_ms = k_uptime_get();
     }
 }
 
+#if !defined(CONFIG_APP_DMA)
+/* ============================================================================
+ * EDGE ALARM RULES
+ * ============================================================================ */
+
+struct alarm_payload {
+    char buf[256];
+    size_t len;
+};
+
+/* Transitions not yet published, e.g. clears of deleted rules */
+static struct alarm_payload pending_alarms = { .buf = "{", .len = 1 };
+
+static void alarm_transition(const struct rule *rule, bool active, void *user_data);
+
+/**
+ * @brief Compile the "alarmRules" attribute and swap it in if valid
+ */
+static void apply_alarm_rules(const char *payload, size_t len)
+{
+    static char text[RULES_TEXT_BUFFER];
+    static struct rule_set compiled;
+    char err[64];
+
+    int ret = attr_get_string(payload, len, RULES_ATTRIBUTE_KEY, text, sizeof(text));
+    if (ret < 0) {
+        return;     /* Some other attribute changed */
+    }
+
+    ret = rules_compile(text, &compiled, err, sizeof(err));
+    if (ret != 0) {
+        LOG_ERR("Alarm rules rejected: %s", err);
+        snprintf(rules_status, sizeof(rules_status), "error: %s", err);
+        /* Reported inside a JSON string */
+        for (char *c = rules_status; *c != '\0'; c++) {
+            if (*c == '"' || *c == '\\' || *c < ' ') {
+                *c = '\'';
+            }
+        }
+    } else {
+        rules_inherit_state(&compiled, &alarm_rules, alarm_transition, &pending_alarms);
+        alarm_rules = compiled;
+        LOG_INF("Loaded %u alarm rule(s)", alarm_rules.count);
+        snprintf(rules_status, sizeof(rules_status), "ok: %u rules", alarm_rules.count);
+    }
+    rules_status_pending = true;
+}
+
+static void alarm_transition(const struct rule *rule, bool active, void *user_data)
+{
+    struct alarm_payload *a = user_data;
+
+    LOG_WRN("Alarm %s %s", rule->name, active ? "RAISED" : "cleared");
+    metrics_alarm_transition();
+
+    if (a->len >= sizeof(a->buf)) {
+        return;
+    }
+    a->len += snprintf(&a->buf[a->len], sizeof(a->buf) - a->len, "%s\"alarm_%s\":%d",
+                       (a->len > 1) ? "," : "", rule->name, active ? 1 : 0);
+}
+
+/**
+ * @brief Evaluate the rules on the latest sample; publish only transitions
+ */
+static void process_alarm_rules(void)
+{
+    struct alarm_payload *alarms = &pending_alarms;
+
+    if (rules_status_pending && cloud_connected()) {
+        char status[128];
+
+        snprintf(status, sizeof(status), "{\"alarmRulesStatus\":\"%s\"}", rules_status);
+        if (publish_json(ATTRIBUTES_TOPIC, status) == 0) {
+            rules_status_pending = false;
+        }
+    }
+
+    if (alarm_rules.count > 0) {
+        uint32_t t0 = k_cycle_get_32();
+        rules_evaluate(&alarm_rules, &meter_data, k_uptime_get(), alarm_transition, alarms);
+        uint32_t cycles = k_cycle_get_32() - t0;
+
+        metrics_rules_record((uint32_t)k_cyc_to_ns_floor64(cycles), alarm_rules.count);
+    }
+
+    if (alarms->len <= 1) {
+        return;     /* No transitions */
+    }
+    if (alarms->len >= sizeof(alarms->buf) - 1) {
+        LOG_ERR("Alarm payload overflow, transitions dropped");
+        alarms->len = 1;
+        return;
+    }
+    alarms->buf[alarms->len] = '}';
+    alarms->buf[alarms->len + 1] = '\0';
+
+    if (!cloud_connected() || publish_json(TELEMETRY_TOPIC, alarms->buf) != 0) {
+        /* Keep them; they go out with the next sample */
+        LOG_WRN("Alarm transitions not published yet");
+        return;
+    }
+    LOG_INF("Alarms: %s", alarms->buf);
+    alarms->len = 1;
+}
+
+/**
+ * @brief Incoming shared attribute pushes and attribute request responses
+ */
+static void on_cloud_message(const char *topic, const char *payload, size_t len)
+{
+    ARG_UNUSED(topic);
+
+    apply_alarm_rules(payload, len);
+}
+#endif /* !CONFIG_APP_DMA */
+
+/**
+ * @brief New MQTT session (first connect, reconnect or broker switch)
+ */
+static void on_cloud_session(void)
+{
+#if !defined(CONFIG_APP_DMA)
+    /* The balance does not evaluate alarm rules */
+    subscribe_shared_attributes();
+#endif
+    timebase_sync();
+}
+
+#if defined(CONFIG_APP_DMA)
+/* ============================================================================
+ * DISTRICT METERED AREA BALANCE
+ * ============================================================================ */
+
+/* Alarm transition not yet published */
+static bool dma_alarm_pending = false;
+static bool dma_alarm = false;
+
+/**
+ * @brief Publish one balance round, with its real timestamp once time is synced
+ */
+static int send_dma_balance(const struct dma_round *round)
+{
+    char values[320];
+    char payload[384];
+    int len;
+
+    len = snprintf(values, sizeof(values),
+                   "\"dmaSpreadMs\":%u,"
+                   "\"dmaParentFlow\":%u,"
+                   "\"dmaChildrenFlow\":%u,"
+                   "\"dmaFlowBalance\":%d",
+                   round->spread_ms, round->parent_flow, round->children_flow,
+                   round->flow_balance);
+
+    if (round->has_interval) {
+        len += snprintf(&values[len], sizeof(values) - len,
+                        ",\"dmaIntervalSec\":%u,"
+                        "\"dmaInflow\":%u,"
+                        "\"dmaConsumption\":%u,"
+                        "\"dmaLoss\":%d,"
+                        "\"dmaLossRate\":%d",
+                        round->interval_ms / 1000U, round->inflow_l, round->consumed_l,
+                        round->loss_l, round->loss_rate_bp);
+    }
+    if (dma_alarm_pending) {
+        snprintf(&values[len], sizeof(values) - len, ",\"alarm_dmaLoss\":%d",
+                 dma_alarm ? 1 : 0);
+    }
+
+    if (timebase_synced()) {
+        snprintf(payload, sizeof(payload), "{\"ts\":%lld,\"values\":{%s}}",
+                 (long long)timebase_to_unix_ms(round->start_ms), values);
+    } else {
+        snprintf(payload, sizeof(payload), "{%s}", values);
+    }
+
+    LOG_INF("Balance: %s", payload);
+
+    int rc = publish_json(TELEMETRY_TOPIC, payload);
+    if (rc == 0) {
+        dma_alarm_pending = false;
+    }
+    return rc;
+}
+
+/**
+ * @brief Read the meter group and publish its balance
+ */
+static void process_dma_round(void)
+{
+    struct dma_round round;
+
+    deadline_begin(STAGE_METER_READ);
+    int rc = dma_run_round(&round);
+    deadline_end(STAGE_METER_READ);
+    if (rc != 0) {
+        return;     /* Logged by dma.c; the next cycle starts a new round */
+    }
+
+    LOG_INF("DMA round: spread %u ms, flow balance %d", round.spread_ms,
+            round.flow_balance);
+    if (round.has_interval) {
+        LOG_INF("DMA balance: in %u L, out %u L, loss %d L (%d bp)",
+                round.inflow_l, round.consumed_l, round.loss_l, round.loss_rate_bp);
+    }
+    if (round.alarm_changed) {
+        LOG_WRN("DMA loss alarm %s", round.alarm ? "RAISED" : "cleared");
+        metrics_alarm_transition();
+        dma_alarm = round.alarm;
+        dma_alarm_pending = true;
+    }
+
+    if (!cloud_connected()) {
+        LOG_INF("MQTT not connected - balance queued");
+    }
+    deadline_begin(STAGE_PUBLISH);
+    if (send_dma_balance(&round) != 0) {
+        LOG_WRN("Balance transmission failed");
+    }
+    deadline_end(STAGE_PUBLISH);
+}
+#endif /* CONFIG_APP_DMA */
+
+#if defined(CONFIG_APP_PULSE)
+/* ============================================================================
+ * PULSE INPUT
+ * ============================================================================ */
+
+static bool pulse_ready = false;
+static uint32_t pulse_events;   /* Flow events that ended the last wait */
+
+/**
+ * @brief Publish the pulse flow, the event behind this read and a closed check
+ */
+static int send_pulse_report(const struct pulse_state *ps, const struct pulse_check *check)
+{
+    char values[224];
+    char payload[288];
+    int len;
+
+    len = snprintf(values, sizeof(values), "\"pulseCount\":%u,\"pulseFlow\":%u",
+                   ps->count, ps->flow);
+    if (pulse_events != 0) {
+        len += snprintf(&values[len], sizeof(values) - len, ",\"pulseEvent\":\"%s\"",
+                        ps->flowing ? "start" : "stop");
+    }
+    if (check != NULL) {
+        snprintf(&values[len], sizeof(values) - len,
+                 ",\"pulseVolume\":%u,"
+                 "\"pulseMeterVolume\":%u,"
+                 "\"pulseDrift\":%d,"
+                 "\"pulseMismatch\":%d",
+                 check->pulse_l, check->meter_l, check->drift_bp, check->mismatch ? 1 : 0);
+    }
+
+    if (timebase_synced()) {
+        snprintf(payload, sizeof(payload), "{\"ts\":%lld,\"values\":{%s}}",
+                 (long long)timebase_to_unix_ms(k_uptime_get()), values);
+    } else {
+        snprintf(payload, sizeof(payload), "{%s}", values);
+    }
+
+    LOG_INF("Pulse: %s", payload);
+    return publish_json(TELEMETRY_TOPIC, payload);
+}
+
+/**
+ * @brief After a meter read: cross-check the totals, report flow events
+ */
+static void process_pulse(void)
+{
+    struct pulse_state ps;
+    struct pulse_check check;
+    struct pulse_stats st;
+
+    if (!pulse_ready) {
+        return;
+    }
+
+    pulse_get_state(&ps);
+    bool checked = pulse_check(meter_data.forward_total, &check);
+
+    pulse_get_stats(&st);
+    metrics_pulse(st.pulses, ps.flow, st.wakeups, st.checks, st.mismatches);
+
+    if (pulse_events != 0) {
+        LOG_INF("Flow %s: pulses %u.%02u L/h, meter %u.%02u L/h",
+                ps.flowing ? "started" : "stopped", ps.flow / 100, ps.flow % 100,
+                meter_data.flow_rate / 100, meter_data.flow_rate % 100);
+    }
+    if ((pulse_events != 0 || checked) && send_pulse_report(&ps, checked ? &check : NULL) != 0) {
+        LOG_WRN("Pulse report transmission failed");
+    }
+    pulse_events = 0;
+}
+#endif /* CONFIG_APP_PULSE */
+
 /* ============================================================================
  * MAIN APPLICATION
  * ============================================================================ */
@@ -628,18 +1035,63 @@ int main(void)
     
     k_sleep(K_SECONDS(2));
     
+    /* Stage budgets; the watchdog resets the device if one hangs */
+    deadline_init(LOOP_WATCHDOG_LIMIT_MS);
+    
     /* Initialize UART for Modbus */
-    if (!device_is_ready(uart_dev)) {
-        LOG_ERR("UART device not ready");
+    if (modbus_init() != 0) {
         return -1;
     }
     
-    uart_config_get(uart_dev, &original_cfg);
-    LOG_INF("Console UART: %d baud", original_cfg.baudrate);
+#if defined(CONFIG_APP_DMA)
+    if (dma_init() != 0) {
+        return -1;
+    }
+#endif
+    
+#if defined(CONFIG_APP_PULSE)
+    /* Without the input the meter is still polled as usual */
+    pulse_ready = (pulse_init() == 0);
+#endif
+    
+#if defined(CONFIG_APP_HISTORY)
+    /* Offline samples; without it they are limited to the outbox */
+    if (history_init() == 0) {
+        backfill_start();
+    }
+#if defined(CONFIG_APP_ARCHIVE)
+    archive_init();
+#endif
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    static const uint32_t history_tol[BOVE_FIELD_COUNT] = {
+        [BOVE_FLOW_RATE] = CONFIG_APP_HISTORY_TOL_FLOW,
+        [BOVE_FORWARD_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_REVERSE_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_PRESSURE] = CONFIG_APP_HISTORY_TOL_PRESSURE,
+        [BOVE_TEMPERATURE] = CONFIG_APP_HISTORY_TOL_TEMPERATURE,
+        [BOVE_STATUS] = 0,      /* Flags stay exact */
+    };
+    swing_door_init(&history_door, history_tol, CONFIG_APP_HISTORY_MAX_GAP_SEC * 1000U);
+#endif
+#endif
+    
+    linkq_init(&link);
+#if !defined(CONFIG_APP_DMA)
+    cloud_set_rx_handler(on_cloud_message);
+#endif
+    cloud_set_session_handler(on_cloud_session);
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+    telemetry_batch_init(&batch, MODBUS_READ_INTERVAL_SEC * 1000,
+                         CONFIG_APP_BATCH_MAX_DELAY_SEC * 1000,
+                         CONFIG_APP_BATCH_ACK_TARGET_MS, CONFIG_APP_MQTT_ACK_TIMEOUT_MS);
+    cloud_set_delivery_handler(on_cloud_delivery);
+#endif
     
     /* Connect to WiFi with retries */
     while (wifi_retry_count < max_wifi_retries) {
+        deadline_begin(STAGE_WIFI_CONNECT);
         ret = wifi_connect();
+        deadline_end(STAGE_WIFI_CONNECT);
         if (ret == 0) {
             break;  /* WiFi connected successfully */
         }
@@ -657,17 +1109,25 @@ int main(void)
         LOG_INF("Continuing without WiFi connection - Modbus only mode");
         /* Continue without WiFi - can still read Modbus data */
     } else {
+        if (IS_ENABLED(CONFIG_APP_METRICS_HTTP)) {
+            metrics_http_start();
+        }
+        
         k_sleep(K_SECONDS(1));
         
         /* Resolve broker address */
+        deadline_begin(STAGE_BROKER_RESOLVE);
         ret = broker_init();
+        deadline_end(STAGE_BROKER_RESOLVE);
         if (ret != 0) {
             LOG_ERR("Broker initialization failed");
         } else {
             k_sleep(K_SECONDS(1));
             
             /* Connect to ThingsBoard */
+            deadline_begin(STAGE_MQTT_CONNECT);
             ret = thingsboard_connect();
+            deadline_end(STAGE_MQTT_CONNECT);
             if (ret != 0) {
                 LOG_ERR("ThingsBoard connection failed");
             }
@@ -681,29 +1141,62 @@ int main(void)
     /* Main loop */
     int loop_count = 0;
     while (1) {
+        uint32_t loop_start = k_uptime_get_32();
+        
         loop_count++;
+        deadline_loop_feed();
+        
+#if defined(CONFIG_APP_SIM)
+        /* Simulated run length reached: print statistics and exit */
+        if (sim_finished()) {
+            sim_report();
+        }
+#endif
         
         /* Check WiFi connection status periodically */
         if (loop_count % 10 == 0) {  /* Every 10 iterations */
-            if (!mqtt_connected) {
+            if (!cloud_connected()) {
                 LOG_WRN("MQTT disconnected, attempting reconnection...");
                 
                 /* Try to reconnect WiFi if needed */
+                metrics_wifi_reconnect();
+                deadline_begin(STAGE_WIFI_CONNECT);
                 ret = wifi_connect();
+                deadline_end(STAGE_WIFI_CONNECT);
                 if (ret == 0) {
+                    if (IS_ENABLED(CONFIG_APP_METRICS_HTTP)) {
+                        metrics_http_start();
+                    }
                     k_sleep(K_SECONDS(1));
+                    deadline_begin(STAGE_BROKER_RESOLVE);
                     ret = broker_init();
+                    deadline_end(STAGE_BROKER_RESOLVE);
                     if (ret == 0) {
                         k_sleep(K_SECONDS(1));
+                        metrics_mqtt_reconnect();
+                        deadline_begin(STAGE_MQTT_CONNECT);
                         thingsboard_connect();
+                        deadline_end(STAGE_MQTT_CONNECT);
                     }
                 }
             }
         }
         
+        /* Grade the WiFi link before deciding what to send */
+        update_link_quality();
+        
+#if defined(CONFIG_APP_DMA)
+        /* Read the meter group back-to-back and publish the balance */
+        process_dma_round();
+#elif defined(CONFIG_APP_RAW_UPLINK)
+        /* Read the meter and forward the response undecoded */
+        process_raw_read();
+#else
         /* Read meter data via Modbus */
         LOG_INF("Reading meter data...");
-        ret = read_meter_data();
+        deadline_begin(STAGE_METER_READ);
+        ret = read_meter_data(MODBUS_SLAVE_ID, &meter_data);
+        deadline_end(STAGE_METER_READ);
         
         if (ret == 0 && meter_data.valid) {
             /* Print meter data to console */
@@ -725,33 +1218,65 @@ int main(void)
                     (meter_data.status & 0x0020) ? "(Low Battery!)" : "");
             LOG_INF("========================================");
             
+            deadline_begin(STAGE_PUBLISH);
+            
             /* Send attributes on first successful read */
             static bool attrs_sent = false;
-            if (!attrs_sent && mqtt_connected) {
+            if (!attrs_sent && cloud_connected()) {
                 send_attributes();
                 attrs_sent = true;
             }
             
-            /* Send telemetry to ThingsBoard if connected */
-            if (mqtt_connected) {
-                if (send_telemetry() != 0) {
-                    LOG_WRN("Telemetry transmission failed, will retry on next cycle");
-                }
-            } else {
-                LOG_INF("MQTT not connected - data logged locally only");
+            /* Evaluate edge alarm rules on this sample */
+            process_alarm_rules();
+            
+#if defined(CONFIG_APP_PULSE)
+            process_pulse();
+#endif
+            
+            /* Send telemetry to ThingsBoard; stored or queued while offline */
+            if (!cloud_connected()) {
+                LOG_INF("MQTT not connected - telemetry kept for later");
+            }
+            if (send_telemetry() != 0) {
+                LOG_WRN("Telemetry transmission failed, will retry on next cycle");
             }
+            
+            deadline_end(STAGE_PUBLISH);
         } else {
             LOG_ERR("Failed to read meter data");
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+            /* Samples already batched still go out on time */
+            if (cloud_connected()) {
+                flush_batch();
+            }
+#endif
         }
+#endif
         
-        /* MQTT maintenance */
-        if (mqtt_connected) {
-            mqtt_maintenance();
-        }
+        /* MQTT maintenance, also while disconnected: it keeps the bridge
+         * session of the raw uplink
+         */
+        deadline_begin(STAGE_MQTT_MAINTENANCE);
+        mqtt_maintenance();
+        deadline_end(STAGE_MQTT_MAINTENANCE);
+        
+        /* Loop health */
+        uint32_t busy_ms = k_uptime_get_32() - loop_start;
+        
+        metrics_loop_record(busy_ms);
+        metrics_sample_memory();
+        cpuload_sample(busy_ms);
+        send_load_report();
         
         /* Wait before next reading */
         LOG_INF("Waiting %d seconds...\n", MODBUS_READ_INTERVAL_SEC);
+#if defined(CONFIG_APP_PULSE)
+        /* Flow starting or stopping brings the next read forward */
+        pulse_events = pulse_wait(K_SECONDS(MODBUS_READ_INTERVAL_SEC));
+#else
         k_sleep(K_SECONDS(MODBUS_READ_INTERVAL_SEC));
+#endif
     }
     
     return 0;
@@ -0,0 +1,26 @@
+/**
+ * @file meter.h
+ * @brief BOVE meter sample shared by the acquisition and processing modules
+ */
+
+#ifndef METER_H_
+#define METER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Meter Data */
+typedef struct {
+    uint32_t flow_rate;        // L/h × 100
+    uint32_t forward_total;    // m³ × 1000
+    uint32_t reverse_total;    // m³ × 1000
+    uint16_t pressure;         // MPa × 1000
+    uint16_t temperature;      // °C × 100
+    uint16_t status;           // Status flags
+    uint32_t serial_number;    // Serial number (BCD)
+    uint8_t modbus_id;         // Modbus address
+    uint16_t baud_code;        // Baud rate code
+    bool valid;                // Data validity flag
+} meter_data_t;
+
+#endif /* METER_H_ */
@@ -0,0 +1,811 @@
+/**
+ * @file metrics.c
+ * @brief Device and bus health metrics (OpenMetrics / Prometheus text)
+ *
+ * @details
+ * All state lives in one static structure guarded by a spinlock. Writers
+ * only bump integers; the renderer takes a snapshot under the lock and
+ * formats outside of it, so scraping never blocks the Modbus loop.
+ *
+ * Families of features that are not built (history, batching, raw uplink,
+ * pulse input, alarm rules) are left out of the output rather than
+ * reported as zeros, so a scraper can tell disabled from idle.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/util.h>
+#include <zephyr/net/net_pkt.h>
+#include <zephyr/net/buf.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cpuload.h"
+#include "metrics.h"
+
+#define HIST_MAX_BUCKETS 8
+
+/* Upper bounds (ms) of the Modbus round-trip histogram; +Inf is implicit */
+static const uint32_t modbus_rtt_bounds[] = {250, 500, 750, 1000, 1500, 2000, 3000};
+
+/* Upper bounds (ms) of the main loop busy-time histogram */
+static const uint32_t loop_bounds[] = {250, 500, 1000, 2000, 5000, 10000, 30000};
+
+BUILD_ASSERT(ARRAY_SIZE(modbus_rtt_bounds) < HIST_MAX_BUCKETS);
+BUILD_ASSERT(ARRAY_SIZE(loop_bounds) < HIST_MAX_BUCKETS);
+
+static const char *const modbus_result_names[MODBUS_RESULT_COUNT] = {
+    [MODBUS_RESULT_OK] = "ok",
+    [MODBUS_RESULT_TIMEOUT] = "timeout",
+    [MODBUS_RESULT_INCOMPLETE] = "incomplete",
+    [MODBUS_RESULT_CRC] = "crc",
+    [MODBUS_RESULT_HEADER] = "header",
+};
+
+struct histogram {
+    uint32_t bucket[HIST_MAX_BUCKETS];  /* Non-cumulative, last = +Inf */
+    uint64_t sum_ms;
+    uint32_t count;
+};
+
+struct slave_metrics {
+    uint8_t id;                         /* 0 = unused slot */
+    uint32_t results[MODBUS_RESULT_COUNT];
+    struct histogram rtt;
+};
+
+struct mem_watermark {
+    uint32_t free;
+    uint32_t min_free;
+    uint32_t total;
+};
+
+struct metrics_state {
+    struct slave_metrics slaves[METRICS_MAX_SLAVES];
+    uint32_t slaves_dropped;
+
+    uint32_t mqtt_published;
+    uint32_t mqtt_acked;
+    uint32_t mqtt_publish_failed;
+    uint32_t mqtt_ack_timeouts;
+    uint32_t mqtt_inflight;
+    uint32_t mqtt_inflight_max;
+    uint32_t mqtt_reconnects;
+    uint32_t wifi_reconnects;
+    bool mqtt_connected;
+    uint32_t outbox_depth;
+    uint32_t outbox_depth_max;
+    int broker_active;
+    uint32_t broker_switches;
+
+    int link_rssi_dbm;
+    uint32_t link_err_permille;
+    int link_grade;
+    uint32_t telemetry_deferred;
+    uint8_t batch_size;
+    uint32_t batch_flush_ms;
+    uint32_t batch_ack_ms;
+    uint32_t batch_increases;
+    uint32_t batch_decreases;
+    uint32_t raw_frames;
+    uint32_t raw_ns;
+    uint32_t raw_decoded_ns;
+    uint32_t pulses;
+    uint32_t pulse_flow;
+    uint32_t pulse_reads;
+    uint32_t pulse_checks;
+    uint32_t pulse_mismatches;
+
+    uint32_t history_pending;
+    uint32_t history_dropped;
+    uint32_t history_samples;
+    uint32_t history_records;
+    uint32_t backfill_records;
+    uint64_t backfill_bytes;
+    uint32_t backfill_failures;
+    uint32_t backfill_bps;
+
+    struct histogram loop;
+    uint32_t loop_max_ms;
+    uint32_t loop_count;
+    uint32_t stage_overruns[STAGE_COUNT];
+    uint32_t stage_max_ms[STAGE_COUNT];
+
+    uint8_t rules_loaded;
+    uint32_t rules_eval_ns;
+    uint32_t rules_eval_max_ns;
+    uint32_t alarm_transitions;
+
+    uint32_t heap_free;
+    uint32_t heap_allocated;
+    uint32_t heap_max_allocated;
+    struct mem_watermark rx_pkt;
+    struct mem_watermark tx_pkt;
+    struct mem_watermark rx_buf;
+    struct mem_watermark tx_buf;
+};
+
+static struct metrics_state state = {
+    .broker_active = -1,
+    .batch_size = 1,
+    .rx_pkt.min_free = UINT32_MAX,
+    .tx_pkt.min_free = UINT32_MAX,
+    .rx_buf.min_free = UINT32_MAX,
+    .tx_buf.min_free = UINT32_MAX,
+};
+static struct k_spinlock lock;
+
+static void hist_add(struct histogram *h, const uint32_t *bounds, size_t n,
+                     uint32_t value_ms)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (value_ms <= bounds[i]) {
+            break;
+        }
+    }
+    h->bucket[i]++;
+    h->sum_ms += value_ms;
+    h->count++;
+}
+
+static struct slave_metrics *slave_get(uint8_t id)
+{
+    struct slave_metrics *free_slot = NULL;
+
+    for (int i = 0; i < METRICS_MAX_SLAVES; i++) {
+        if (state.slaves[i].id == id) {
+            return &state.slaves[i];
+        }
+        if (state.slaves[i].id == 0 && free_slot == NULL) {
+            free_slot = &state.slaves[i];
+        }
+    }
+    if (free_slot != NULL) {
+        free_slot->id = id;
+    }
+    return free_slot;
+}
+
+/* ============================================================================
+ * UPDATE API
+ * ============================================================================ */
+
+void metrics_modbus_record(uint8_t slave_id, enum modbus_result res,
+                           uint32_t latency_ms)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    struct slave_metrics *s = slave_get(slave_id);
+
+    if (s == NULL || res >= MODBUS_RESULT_COUNT) {
+        state.slaves_dropped++;
+    } else {
+        s->results[res]++;
+        if (res == MODBUS_RESULT_OK) {
+            hist_add(&s->rtt, modbus_rtt_bounds, ARRAY_SIZE(modbus_rtt_bounds),
+                     latency_ms);
+        }
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_published(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_published++;
+    state.mqtt_inflight++;
+    state.mqtt_inflight_max = MAX(state.mqtt_inflight_max, state.mqtt_inflight);
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_acked(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_acked++;
+    if (state.mqtt_inflight > 0) {
+        state.mqtt_inflight--;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_publish_failed(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_publish_failed++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_ack_timeout(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_ack_timeouts++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_connection(bool connected)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_connected = connected;
+    /* Unacknowledged messages are re-sent from the outbox and counted again */
+    state.mqtt_inflight = 0;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_outbox_depth(uint32_t depth)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.outbox_depth = depth;
+    state.outbox_depth_max = MAX(state.outbox_depth_max, depth);
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_broker_active(int index)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.broker_active = index;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_broker_switch(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.broker_switches++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_link(int rssi_dbm, uint32_t err_permille, int grade)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.link_rssi_dbm = rssi_dbm;
+    state.link_err_permille = err_permille;
+    state.link_grade = grade;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_telemetry_deferred(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.telemetry_deferred++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_telemetry_batch(uint8_t size, uint32_t flush_ms, uint32_t ack_ms, int change)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.batch_size = size;
+    state.batch_flush_ms = flush_ms;
+    state.batch_ack_ms = ack_ms;
+    if (change > 0) {
+        state.batch_increases++;
+    } else if (change < 0) {
+        state.batch_decreases++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_raw_uplink(uint32_t frames, uint32_t raw_ns, uint32_t decoded_ns)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.raw_frames = frames;
+    state.raw_ns = raw_ns;
+    state.raw_decoded_ns = decoded_ns;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_pulse(uint32_t pulses, uint32_t flow, uint32_t reads, uint32_t checks,
+                   uint32_t mismatches)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.pulses = pulses;
+    state.pulse_flow = flow;
+    state.pulse_reads = reads;
+    state.pulse_checks = checks;
+    state.pulse_mismatches = mismatches;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_history(uint32_t pending, uint32_t dropped)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.history_pending = pending;
+    state.history_dropped = dropped;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_history_compression(uint32_t samples, uint32_t records)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.history_samples = samples;
+    state.history_records = records;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_backfill_batch(uint32_t records, uint32_t bytes, uint32_t duration_ms)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.backfill_records += records;
+    state.backfill_bytes += bytes;
+    state.backfill_bps = (uint32_t)((uint64_t)bytes * 1000U / MAX(duration_ms, 1U));
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_backfill_failed(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.backfill_failures++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_wifi_reconnect(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.wifi_reconnects++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_mqtt_reconnect(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.mqtt_reconnects++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_loop_record(uint32_t duration_ms)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    hist_add(&state.loop, loop_bounds, ARRAY_SIZE(loop_bounds), duration_ms);
+    state.loop_max_ms = MAX(state.loop_max_ms, duration_ms);
+    state.loop_count++;
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_stage_record(enum stage stage, uint32_t duration_ms, bool overrun)
+{
+    if (stage >= STAGE_COUNT) {
+        return;
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (overrun) {
+        state.stage_overruns[stage]++;
+    }
+    state.stage_max_ms[stage] = MAX(state.stage_max_ms[stage], duration_ms);
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_rules_record(uint32_t eval_ns, uint8_t rule_count)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.rules_loaded = rule_count;
+    state.rules_eval_ns = eval_ns;
+    state.rules_eval_max_ns = MAX(state.rules_eval_max_ns, eval_ns);
+    k_spin_unlock(&lock, key);
+}
+
+void metrics_alarm_transition(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    state.alarm_transitions++;
+    k_spin_unlock(&lock, key);
+}
+
+#if defined(CONFIG_NETWORKING)
+static void watermark_update(struct mem_watermark *w, uint32_t free, uint32_t total)
+{
+    w->free = free;
+    w->total = total;
+    w->min_free = MIN(w->min_free, free);
+}
+#endif
+
+void metrics_sample_memory(void)
+{
+#if defined(CONFIG_NETWORKING)
+    struct k_mem_slab *rx_slab, *tx_slab;
+    struct net_buf_pool *rx_pool, *tx_pool;
+#endif
+    k_spinlock_key_t key;
+
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS) && (CONFIG_HEAP_MEM_POOL_SIZE > 0)
+    extern struct k_heap _system_heap;
+    struct sys_memory_stats heap_stats;
+
+    sys_heap_runtime_stats_get(&_system_heap.heap, &heap_stats);
+#endif
+
+#if defined(CONFIG_NETWORKING)
+    net_pkt_get_info(&rx_slab, &tx_slab, &rx_pool, &tx_pool);
+#endif
+
+    key = k_spin_lock(&lock);
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS) && (CONFIG_HEAP_MEM_POOL_SIZE > 0)
+    state.heap_free = heap_stats.free_bytes;
+    state.heap_allocated = heap_stats.allocated_bytes;
+    state.heap_max_allocated = heap_stats.max_allocated_bytes;
+#endif
+#if defined(CONFIG_NETWORKING)
+    watermark_update(&state.rx_pkt, k_mem_slab_num_free_get(rx_slab),
+                     rx_slab->info.num_blocks);
+    watermark_update(&state.tx_pkt, k_mem_slab_num_free_get(tx_slab),
+                     tx_slab->info.num_blocks);
+#if defined(CONFIG_NET_BUF_POOL_USAGE)
+    watermark_update(&state.rx_buf, atomic_get(&rx_pool->avail_count),
+                     rx_pool->buf_count);
+    watermark_update(&state.tx_buf, atomic_get(&tx_pool->avail_count),
+                     tx_pool->buf_count);
+#endif
+#endif /* CONFIG_NETWORKING */
+    k_spin_unlock(&lock, key);
+}
+
+/* ============================================================================
+ * RENDERING
+ * ============================================================================ */
+
+struct render_ctx {
+    metrics_emit_t emit;
+    void *ctx;
+    char line[160];
+    int err;
+};
+
+static void out(struct render_ctx *r, const char *fmt, ...)
+{
+    va_list ap;
+    int len;
+
+    if (r->err) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    len = vsnprintf(r->line, sizeof(r->line), fmt, ap);
+    va_end(ap);
+
+    if (len < 0) {
+        r->err = -EINVAL;
+        return;
+    }
+    r->err = r->emit(r->ctx, r->line, MIN((size_t)len, sizeof(r->line) - 1));
+}
+
+static void out_header(struct render_ctx *r, const char *name, const char *type,
+                       const char *help)
+{
+    out(r, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void out_hist(struct render_ctx *r, const char *name, const char *labels,
+                     const struct histogram *h, const uint32_t *bounds, size_t n)
+{
+    uint32_t cumulative = 0;
+    const char *sep = (labels[0] != '\0') ? "," : "";
+    const char *open = (labels[0] != '\0') ? "{" : "";
+    const char *close = (labels[0] != '\0') ? "}" : "";
+
+    for (size_t i = 0; i < n; i++) {
+        cumulative += h->bucket[i];
+        out(r, "%s_bucket{%s%sle=\"%u.%03u\"} %u\n", name, labels, sep,
+            bounds[i] / 1000, bounds[i] % 1000, cumulative);
+    }
+    cumulative += h->bucket[n];
+    out(r, "%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, sep, cumulative);
+    out(r, "%s_sum%s%s%s %llu.%03u\n", name, open, labels, close,
+        (unsigned long long)(h->sum_ms / 1000), (unsigned int)(h->sum_ms % 1000));
+    out(r, "%s_count%s%s%s %u\n", name, open, labels, close, h->count);
+}
+
+enum watermark_field { WM_FREE, WM_MIN_FREE, WM_SIZE };
+
+static void out_watermarks(struct render_ctx *r, const struct metrics_state *s,
+                           const char *name, enum watermark_field field)
+{
+    const struct {
+        const char *pool;
+        const struct mem_watermark *w;
+    } pools[] = {
+        { "rx_pkt", &s->rx_pkt }, { "tx_pkt", &s->tx_pkt },
+        { "rx_buf", &s->rx_buf }, { "tx_buf", &s->tx_buf },
+    };
+
+    for (size_t i = 0; i < ARRAY_SIZE(pools); i++) {
+        const struct mem_watermark *w = pools[i].w;
+        uint32_t v = (field == WM_FREE) ? w->free :
+                     (field == WM_MIN_FREE) ? w->min_free : w->total;
+
+        /* Pools without usage tracking are never sampled */
+        if (w->total == 0) {
+            continue;
+        }
+        out(r, "%s{pool=\"%s\"} %u\n", name, pools[i].pool, v);
+    }
+}
+
+static void out_load(struct render_ctx *r, const char *name, const char *label,
+                     const struct cpuload_entry *e, size_t n, bool peak)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint16_t v = peak ? e[i].peak_permille : e[i].load_permille;
+
+        out(r, "%s{%s=\"%s\"} %u.%03u\n", name, label, e[i].name, v / 1000, v % 1000);
+    }
+}
+
+int metrics_render(metrics_emit_t emit, void *ctx)
+{
+    static struct metrics_state snap;
+    static struct cpuload_report load;
+    static K_MUTEX_DEFINE(snap_lock);
+    struct render_ctx r = { .emit = emit, .ctx = ctx };
+    char labels[24];
+    k_spinlock_key_t key;
+
+    metrics_sample_memory();
+
+    /* One scrape at a time; the snapshot is too large for the stack */
+    k_mutex_lock(&snap_lock, K_FOREVER);
+
+    key = k_spin_lock(&lock);
+    snap = state;
+    k_spin_unlock(&lock, key);
+    cpuload_get(&load);
+
+    out_header(&r, "watermeter_uptime_seconds", "gauge", "Time since boot");
+    out(&r, "watermeter_uptime_seconds %lld\n", k_uptime_get() / 1000);
+
+    out_header(&r, "watermeter_modbus_requests_total", "counter",
+               "Modbus transactions by slave and outcome");
+    for (int i = 0; i < METRICS_MAX_SLAVES; i++) {
+        const struct slave_metrics *s = &snap.slaves[i];
+
+        if (s->id == 0) {
+            continue;
+        }
+        for (int res = 0; res < MODBUS_RESULT_COUNT; res++) {
+            out(&r, "watermeter_modbus_requests_total{slave=\"%u\",result=\"%s\"} %u\n",
+                s->id, modbus_result_names[res], s->results[res]);
+        }
+    }
+    out_header(&r, "watermeter_modbus_untracked_total", "counter",
+               "Modbus transactions from slaves beyond the tracking table");
+    out(&r, "watermeter_modbus_untracked_total %u\n", snap.slaves_dropped);
+
+    out_header(&r, "watermeter_modbus_rtt_seconds", "histogram",
+               "Round-trip time of successful Modbus reads");
+    for (int i = 0; i < METRICS_MAX_SLAVES; i++) {
+        const struct slave_metrics *s = &snap.slaves[i];
+
+        if (s->id == 0) {
+            continue;
+        }
+        snprintf(labels, sizeof(labels), "slave=\"%u\"", s->id);
+        out_hist(&r, "watermeter_modbus_rtt_seconds", labels, &s->rtt,
+                 modbus_rtt_bounds, ARRAY_SIZE(modbus_rtt_bounds));
+    }
+
+    out_header(&r, "watermeter_mqtt_connected", "gauge", "MQTT session state");
+    out(&r, "watermeter_mqtt_connected %d\n", snap.mqtt_connected ? 1 : 0);
+    out_header(&r, "watermeter_mqtt_published_total", "counter", "QoS 1 publishes sent");
+    out(&r, "watermeter_mqtt_published_total %u\n", snap.mqtt_published);
+    out_header(&r, "watermeter_mqtt_acked_total", "counter", "PUBACKs received");
+    out(&r, "watermeter_mqtt_acked_total %u\n", snap.mqtt_acked);
+    out_header(&r, "watermeter_mqtt_publish_errors_total", "counter",
+               "mqtt_publish() failures");
+    out(&r, "watermeter_mqtt_publish_errors_total %u\n", snap.mqtt_publish_failed);
+    out_header(&r, "watermeter_mqtt_ack_timeouts_total", "counter",
+               "Messages without PUBACK within the timeout");
+    out(&r, "watermeter_mqtt_ack_timeouts_total %u\n", snap.mqtt_ack_timeouts);
+    out_header(&r, "watermeter_mqtt_queue_depth", "gauge",
+               "Messages awaiting acknowledgement, by queue");
+    out(&r, "watermeter_mqtt_queue_depth{queue=\"inflight\"} %u\n", snap.mqtt_inflight);
+    out(&r, "watermeter_mqtt_queue_depth{queue=\"outbox\"} %u\n", snap.outbox_depth);
+    out_header(&r, "watermeter_mqtt_queue_depth_max", "gauge",
+               "High-water mark of queue depth since boot");
+    out(&r, "watermeter_mqtt_queue_depth_max{queue=\"inflight\"} %u\n",
+        snap.mqtt_inflight_max);
+    out(&r, "watermeter_mqtt_queue_depth_max{queue=\"outbox\"} %u\n",
+        snap.outbox_depth_max);
+
+    out_header(&r, "watermeter_broker_active", "gauge",
+               "Index of the broker endpoint in use, -1 when offline");
+    out(&r, "watermeter_broker_active %d\n", snap.broker_active);
+    out_header(&r, "watermeter_broker_switches_total", "counter",
+               "Sessions moved to a different broker endpoint");
+    out(&r, "watermeter_broker_switches_total %u\n", snap.broker_switches);
+
+    out_header(&r, "watermeter_wifi_rssi_dbm", "gauge", "Smoothed WiFi RSSI");
+    out(&r, "watermeter_wifi_rssi_dbm %d\n", snap.link_rssi_dbm);
+    out_header(&r, "watermeter_wifi_tx_error_ratio", "gauge",
+               "Smoothed TX error / TCP retransmission ratio, whichever is worse");
+    out(&r, "watermeter_wifi_tx_error_ratio %u.%03u\n",
+        snap.link_err_permille / 1000, snap.link_err_permille % 1000);
+    out_header(&r, "watermeter_link_grade", "gauge",
+               "Link quality used for upload scheduling (0 unknown, 1 poor, 2 fair, 3 good)");
+    out(&r, "watermeter_link_grade %d\n", snap.link_grade);
+#if defined(CONFIG_APP_HISTORY)
+    out_header(&r, "watermeter_telemetry_deferred_total", "counter",
+               "Samples stored for backfill instead of sent on a poor link");
+    out(&r, "watermeter_telemetry_deferred_total %u\n", snap.telemetry_deferred);
+#endif
+#if defined(CONFIG_APP_TELEMETRY_BATCH)
+    out_header(&r, "watermeter_telemetry_batch_size", "gauge",
+               "Samples per telemetry publish (AIMD operating point)");
+    out(&r, "watermeter_telemetry_batch_size %u\n", snap.batch_size);
+    out_header(&r, "watermeter_telemetry_flush_seconds", "gauge",
+               "Longest a sample waits for its batch (AIMD operating point)");
+    out(&r, "watermeter_telemetry_flush_seconds %u.%03u\n",
+        snap.batch_flush_ms / 1000, snap.batch_flush_ms % 1000);
+    out_header(&r, "watermeter_telemetry_ack_seconds", "gauge",
+               "Smoothed publish-to-PUBACK latency of telemetry batches");
+    out(&r, "watermeter_telemetry_ack_seconds %u.%03u\n",
+        snap.batch_ack_ms / 1000, snap.batch_ack_ms % 1000);
+    out_header(&r, "watermeter_telemetry_batch_adjustments_total", "counter",
+               "Changes of the batch operating point, by direction");
+    out(&r, "watermeter_telemetry_batch_adjustments_total{direction=\"increase\"} %u\n",
+        snap.batch_increases);
+    out(&r, "watermeter_telemetry_batch_adjustments_total{direction=\"decrease\"} %u\n",
+        snap.batch_decreases);
+#endif
+#if defined(CONFIG_APP_RAW_UPLINK)
+    out_header(&r, "watermeter_raw_frames_total", "counter",
+               "Meter responses forwarded undecoded (raw uplink)");
+    out(&r, "watermeter_raw_frames_total %u\n", snap.raw_frames);
+    out_header(&r, "watermeter_uplink_cpu_seconds", "gauge",
+               "Mean CPU time to prepare one sample for upload; decoded is probed");
+    out(&r, "watermeter_uplink_cpu_seconds{path=\"raw\"} %u.%09u\n",
+        snap.raw_ns / 1000000000U, snap.raw_ns % 1000000000U);
+    out(&r, "watermeter_uplink_cpu_seconds{path=\"decoded\"} %u.%09u\n",
+        snap.raw_decoded_ns / 1000000000U, snap.raw_decoded_ns % 1000000000U);
+#endif
+#if defined(CONFIG_APP_PULSE)
+    out_header(&r, "watermeter_pulses_total", "counter", "Pulses from the meter's pulse output");
+    out(&r, "watermeter_pulses_total %u\n", snap.pulses);
+    out_header(&r, "watermeter_pulse_flow_liters_per_hour", "gauge",
+               "Flow from pulse intervals at the last meter read");
+    out(&r, "watermeter_pulse_flow_liters_per_hour %u.%02u\n", snap.pulse_flow / 100,
+        snap.pulse_flow % 100);
+    out_header(&r, "watermeter_pulse_triggered_reads_total", "counter",
+               "Meter reads brought forward by flow starting or stopping");
+    out(&r, "watermeter_pulse_triggered_reads_total %u\n", snap.pulse_reads);
+    out_header(&r, "watermeter_pulse_checks_total", "counter",
+               "Pulse volume against forward total, per check window");
+    out(&r, "watermeter_pulse_checks_total{result=\"ok\"} %u\n",
+        snap.pulse_checks - snap.pulse_mismatches);
+    out(&r, "watermeter_pulse_checks_total{result=\"mismatch\"} %u\n", snap.pulse_mismatches);
+#endif
+
+#if defined(CONFIG_APP_HISTORY)
+    out_header(&r, "watermeter_history_pending_records", "gauge",
+               "Samples stored in flash awaiting backfill");
+    out(&r, "watermeter_history_pending_records %u\n", snap.history_pending);
+    out_header(&r, "watermeter_history_dropped_total", "counter",
+               "Stored samples overwritten before upload");
+    out(&r, "watermeter_history_dropped_total %u\n", snap.history_dropped);
+#endif
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    out_header(&r, "watermeter_history_compressed_samples_total", "counter",
+               "Samples fed to the swinging-door compressor");
+    out(&r, "watermeter_history_compressed_samples_total %u\n", snap.history_samples);
+    out_header(&r, "watermeter_history_compressed_records_total", "counter",
+               "Turning points stored for them");
+    out(&r, "watermeter_history_compressed_records_total %u\n", snap.history_records);
+#endif
+#if defined(CONFIG_APP_HISTORY)
+    out_header(&r, "watermeter_backfill_records_total", "counter",
+               "Stored samples uploaded");
+    out(&r, "watermeter_backfill_records_total %u\n", snap.backfill_records);
+    out_header(&r, "watermeter_backfill_bytes_total", "counter",
+               "Request body bytes of accepted backfill uploads");
+    out(&r, "watermeter_backfill_bytes_total %llu\n",
+        (unsigned long long)snap.backfill_bytes);
+    out_header(&r, "watermeter_backfill_failures_total", "counter",
+               "Backfill requests that failed");
+    out(&r, "watermeter_backfill_failures_total %u\n", snap.backfill_failures);
+    out_header(&r, "watermeter_backfill_throughput_bytes_per_second", "gauge",
+               "Throughput of the last backfill request, rate limit included");
+    out(&r, "watermeter_backfill_throughput_bytes_per_second %u\n", snap.backfill_bps);
+#endif
+
+    out_header(&r, "watermeter_reconnects_total", "counter",
+               "Reconnection cycles by link");
+    out(&r, "watermeter_reconnects_total{link=\"wifi\"} %u\n", snap.wifi_reconnects);
+    out(&r, "watermeter_reconnects_total{link=\"mqtt\"} %u\n", snap.mqtt_reconnects);
+
+    out_header(&r, "watermeter_loop_busy_seconds", "histogram",
+               "Busy time of one main loop iteration");
+    out_hist(&r, "watermeter_loop_busy_seconds", "", &snap.loop,
+             loop_bounds, ARRAY_SIZE(loop_bounds));
+    out_header(&r, "watermeter_loop_busy_max_seconds", "gauge",
+               "Longest main loop iteration since boot");
+    out(&r, "watermeter_loop_busy_max_seconds %u.%03u\n",
+        snap.loop_max_ms / 1000, snap.loop_max_ms % 1000);
+
+    out_header(&r, "watermeter_cpu_load_ratio", "gauge",
+               "Non-idle share of each core over the last loop cycle");
+    out_load(&r, "watermeter_cpu_load_ratio", "cpu", load.cpus, load.cpu_count, false);
+    out_header(&r, "watermeter_cpu_load_peak_ratio", "gauge",
+               "Highest cycle load of each core since boot");
+    out_load(&r, "watermeter_cpu_load_peak_ratio", "cpu", load.cpus, load.cpu_count, true);
+    out_header(&r, "watermeter_thread_cpu_ratio", "gauge",
+               "Share of one core used by each thread over the last loop cycle");
+    out_load(&r, "watermeter_thread_cpu_ratio", "thread", load.threads,
+             load.thread_count, false);
+    out_header(&r, "watermeter_thread_cpu_peak_ratio", "gauge",
+               "Highest cycle share of each thread since boot");
+    out_load(&r, "watermeter_thread_cpu_peak_ratio", "thread", load.threads,
+             load.thread_count, true);
+
+    out_header(&r, "watermeter_stage_overruns_total", "counter",
+               "Main loop stages that took longer than their latency budget");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        out(&r, "watermeter_stage_overruns_total{stage=\"%s\"} %u\n",
+            deadline_stage_name(i), snap.stage_overruns[i]);
+    }
+    out_header(&r, "watermeter_stage_max_seconds", "gauge",
+               "Longest run of each main loop stage since boot");
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        out(&r, "watermeter_stage_max_seconds{stage=\"%s\"} %u.%03u\n",
+            deadline_stage_name(i), snap.stage_max_ms[i] / 1000,
+            snap.stage_max_ms[i] % 1000);
+    }
+
+#if !defined(CONFIG_APP_DMA)
+    out_header(&r, "watermeter_rules_loaded", "gauge", "Compiled edge alarm rules");
+    out(&r, "watermeter_rules_loaded %u\n", snap.rules_loaded);
+    out_header(&r, "watermeter_rules_eval_seconds", "gauge",
+               "Time to evaluate all rules on the last sample");
+    out(&r, "watermeter_rules_eval_seconds %u.%09u\n",
+        snap.rules_eval_ns / 1000000000U, snap.rules_eval_ns % 1000000000U);
+    out_header(&r, "watermeter_rules_eval_max_seconds", "gauge",
+               "Longest rule evaluation since boot");
+    out(&r, "watermeter_rules_eval_max_seconds %u.%09u\n",
+        snap.rules_eval_max_ns / 1000000000U, snap.rules_eval_max_ns % 1000000000U);
+#endif
+    out_header(&r, "watermeter_alarm_transitions_total", "counter",
+               "Alarm raise/clear transitions published");
+    out(&r, "watermeter_alarm_transitions_total %u\n", snap.alarm_transitions);
+
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS) && (CONFIG_HEAP_MEM_POOL_SIZE > 0)
+    out_header(&r, "watermeter_heap_bytes", "gauge", "System heap usage");
+    out(&r, "watermeter_heap_bytes{state=\"free\"} %u\n", snap.heap_free);
+    out(&r, "watermeter_heap_bytes{state=\"allocated\"} %u\n", snap.heap_allocated);
+    out(&r, "watermeter_heap_bytes{state=\"max_allocated\"} %u\n",
+        snap.heap_max_allocated);
+#endif
+
+    out_header(&r, "watermeter_net_pool_free", "gauge", "Free network packets/buffers");
+    out_watermarks(&r, &snap, "watermeter_net_pool_free", WM_FREE);
+    out_header(&r, "watermeter_net_pool_min_free", "gauge",
+               "Low-water mark of free network packets/buffers");
+    out_watermarks(&r, &snap, "watermeter_net_pool_min_free", WM_MIN_FREE);
+    out_header(&r, "watermeter_net_pool_size", "gauge", "Network pool capacity");
+    out_watermarks(&r, &snap, "watermeter_net_pool_size", WM_SIZE);
+
+    k_mutex_unlock(&snap_lock);
+    return r.err;
+}
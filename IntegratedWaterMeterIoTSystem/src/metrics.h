@@ -0,0 +1,136 @@
+/**
+ * @file metrics.h
+ * @brief Device and bus health metrics (OpenMetrics / Prometheus text)
+ *
+ * @details
+ * Counters, gauges and histograms updated from the main loop and MQTT
+ * event handler, rendered on demand by the /metrics HTTP endpoint.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "deadline.h"
+
+/* Maximum number of Modbus slaves tracked individually */
+#define METRICS_MAX_SLAVES 8
+
+/** Outcome of one Modbus transaction */
+enum modbus_result {
+    MODBUS_RESULT_OK = 0,
+    MODBUS_RESULT_TIMEOUT,      /* No byte received */
+    MODBUS_RESULT_INCOMPLETE,   /* Short or overlong frame */
+    MODBUS_RESULT_CRC,          /* CRC mismatch */
+    MODBUS_RESULT_HEADER,       /* Wrong slave ID / function code */
+    MODBUS_RESULT_COUNT
+};
+
+/**
+ * @brief Sink for rendered text
+ *
+ * @return 0 on success, negative errno to abort rendering
+ */
+typedef int (*metrics_emit_t)(void *ctx, const char *buf, size_t len);
+
+/** @brief Record one Modbus transaction and its round-trip time */
+void metrics_modbus_record(uint8_t slave_id, enum modbus_result res,
+                           uint32_t latency_ms);
+
+/** @brief A QoS 1 publish has been handed to the MQTT client */
+void metrics_mqtt_published(void);
+
+/** @brief A PUBACK has been received */
+void metrics_mqtt_acked(void);
+
+/** @brief mqtt_publish() returned an error */
+void metrics_mqtt_publish_failed(void);
+
+/** @brief No PUBACK within CONFIG_APP_MQTT_ACK_TIMEOUT_MS */
+void metrics_mqtt_ack_timeout(void);
+
+/** @brief Connection state changed; drops outstanding in-flight count */
+void metrics_mqtt_connection(bool connected);
+
+/** @brief Messages waiting in the outbox (unsent or unacknowledged) */
+void metrics_outbox_depth(uint32_t depth);
+
+/** @brief Index of the broker endpoint in use, negative when offline */
+void metrics_broker_active(int index);
+
+/** @brief The session moved to a different broker endpoint */
+void metrics_broker_switch(void);
+
+/** @brief Smoothed RSSI, TX error ratio and grade (enum link_grade) of the link */
+void metrics_link(int rssi_dbm, uint32_t err_permille, int grade);
+
+/** @brief A sample was stored for backfill instead of sent on a poor link */
+void metrics_telemetry_deferred(void);
+
+/**
+ * @brief Telemetry batch operating point after an adjustment
+ *
+ * @param change +1 after an increase, -1 after a decrease, 0 if unchanged
+ */
+void metrics_telemetry_batch(uint8_t size, uint32_t flush_ms, uint32_t ack_ms, int change);
+
+/**
+ * @brief Raw uplink: frames forwarded and the mean CPU time per sample of
+ *        the raw path and of the decoded path it replaces (0 = not timed)
+ */
+void metrics_raw_uplink(uint32_t frames, uint32_t raw_ns, uint32_t decoded_ns);
+
+/**
+ * @brief Pulse input: pulses counted, flow from them (L/h × 100), reads
+ *        brought forward by flow events, and total cross-checks
+ */
+void metrics_pulse(uint32_t pulses, uint32_t flow, uint32_t reads, uint32_t checks,
+                   uint32_t mismatches);
+
+/** @brief Samples stored for backfill and samples lost to a full store */
+void metrics_history(uint32_t pending, uint32_t dropped);
+
+/** @brief Samples fed to the history compressor and records it stored */
+void metrics_history_compression(uint32_t samples, uint32_t records);
+
+/** @brief A backfill request was accepted by the server */
+void metrics_backfill_batch(uint32_t records, uint32_t bytes, uint32_t duration_ms);
+
+/** @brief A backfill request failed and will be retried */
+void metrics_backfill_failed(void);
+
+/** @brief A WiFi reconnection cycle was started */
+void metrics_wifi_reconnect(void);
+
+/** @brief An MQTT (re)connection attempt was started */
+void metrics_mqtt_reconnect(void);
+
+/** @brief Record the busy time of one main loop iteration */
+void metrics_loop_record(uint32_t duration_ms);
+
+/** @brief A main loop stage finished after @p duration_ms, over budget or not */
+void metrics_stage_record(enum stage stage, uint32_t duration_ms, bool overrun);
+
+/** @brief Record the time taken to evaluate all alarm rules on one sample */
+void metrics_rules_record(uint32_t eval_ns, uint8_t rule_count);
+
+/** @brief An alarm rule was raised or cleared */
+void metrics_alarm_transition(void);
+
+/** @brief Sample heap and net_buf usage and update low-water marks */
+void metrics_sample_memory(void);
+
+/**
+ * @brief Render all metrics in Prometheus text exposition format
+ *
+ * @return 0 on success, negative errno from @p emit otherwise
+ */
+int metrics_render(metrics_emit_t emit, void *ctx);
+
+/** @brief Start the /metrics HTTP server thread (idempotent) */
+int metrics_http_start(void);
+
+#endif /* METRICS_H_ */
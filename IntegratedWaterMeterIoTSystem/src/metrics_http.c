@@ -0,0 +1,168 @@
+/**
+ * @file metrics_http.c
+ * @brief Minimal HTTP/1.0 server exposing GET /metrics
+ *
+ * @details
+ * One connection at a time, no keep-alive. The response body is streamed
+ * straight from metrics_render() and delimited by closing the socket, so
+ * no response buffer is needed.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/net/socket.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+#include "metrics.h"
+
+LOG_MODULE_REGISTER(metrics_http, LOG_LEVEL_INF);
+
+#define METRICS_HTTP_STACK_SIZE 3072
+#define METRICS_HTTP_PRIORITY 10
+#define REQUEST_BUFFER_SIZE 256
+#define CLIENT_TIMEOUT_MS 2000
+
+static const char resp_ok[] =
+    "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+    "Connection: close\r\n"
+    "\r\n";
+
+static const char resp_not_found[] =
+    "HTTP/1.0 404 Not Found\r\n"
+    "Content-Type: text/plain\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "Try /metrics\n";
+
+K_THREAD_STACK_DEFINE(metrics_http_stack, METRICS_HTTP_STACK_SIZE);
+static struct k_thread metrics_http_thread;
+static bool started;
+
+static int send_all(int sock, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t sent = zsock_send(sock, buf, len, 0);
+
+        if (sent < 0) {
+            return -errno;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static int emit_to_socket(void *ctx, const char *buf, size_t len)
+{
+    return send_all(*(int *)ctx, buf, len);
+}
+
+/**
+ * @brief Read until the end of the request line; only the path matters
+ */
+static bool read_request_is_metrics(int sock)
+{
+    char req[REQUEST_BUFFER_SIZE];
+    size_t len = 0;
+
+    while (len < sizeof(req) - 1) {
+        ssize_t n = zsock_recv(sock, &req[len], sizeof(req) - 1 - len, 0);
+
+        if (n <= 0) {
+            return false;
+        }
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n") != NULL) {
+            break;
+        }
+    }
+
+    return strncmp(req, "GET /metrics ", strlen("GET /metrics ")) == 0 ||
+           strncmp(req, "GET /metrics?", strlen("GET /metrics?")) == 0;
+}
+
+static void handle_client(int client)
+{
+    struct zsock_timeval tv = {
+        .tv_sec = CLIENT_TIMEOUT_MS / 1000,
+        .tv_usec = (CLIENT_TIMEOUT_MS % 1000) * 1000,
+    };
+
+    zsock_setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    zsock_setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if (!read_request_is_metrics(client)) {
+        send_all(client, resp_not_found, sizeof(resp_not_found) - 1);
+        return;
+    }
+
+    if (send_all(client, resp_ok, sizeof(resp_ok) - 1) == 0) {
+        int ret = metrics_render(emit_to_socket, &client);
+
+        if (ret != 0) {
+            LOG_WRN("Scrape aborted: %d", ret);
+        }
+    }
+}
+
+static void metrics_http_main(void *p1, void *p2, void *p3)
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_APP_METRICS_HTTP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int opt = 1;
+    int server;
+
+    ARG_UNUSED(p1);
+    ARG_UNUSED(p2);
+    ARG_UNUSED(p3);
+
+    server = zsock_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (server < 0) {
+        LOG_ERR("socket() failed: %d", errno);
+        return;
+    }
+
+    zsock_setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    if (zsock_bind(server, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        zsock_listen(server, 1) < 0) {
+        LOG_ERR("Cannot listen on port %d: %d", CONFIG_APP_METRICS_HTTP_PORT, errno);
+        zsock_close(server);
+        return;
+    }
+
+    LOG_INF("Metrics endpoint on :%d/metrics", CONFIG_APP_METRICS_HTTP_PORT);
+
+    while (1) {
+        int client = zsock_accept(server, NULL, NULL);
+
+        if (client < 0) {
+            LOG_WRN("accept() failed: %d", errno);
+            k_sleep(K_SECONDS(1));
+            continue;
+        }
+
+        handle_client(client);
+        zsock_close(client);
+    }
+}
+
+int metrics_http_start(void)
+{
+    if (started) {
+        return 0;
+    }
+
+    k_thread_create(&metrics_http_thread, metrics_http_stack,
+                    K_THREAD_STACK_SIZEOF(metrics_http_stack),
+                    metrics_http_main, NULL, NULL, NULL,
+                    METRICS_HTTP_PRIORITY, 0, K_NO_WAIT);
+    k_thread_name_set(&metrics_http_thread, "metrics_http");
+    started = true;
+    return 0;
+}
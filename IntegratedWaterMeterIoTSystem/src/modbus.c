@@ -0,0 +1,206 @@
+/**
+ * @file modbus.c
+ * @brief Modbus RTU master for the BOVE meter (UART shared with console)
+ *
+ * @details
+ * The UART is switched to 2400 baud 8E1 for each transaction and restored
+ * to the console configuration afterwards.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/drivers/uart.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "modbus.h"
+#include "register_map.h"
+
+LOG_MODULE_REGISTER(modbus, LOG_LEVEL_INF);
+
+/* The simulator routes Modbus to an emulated UART instead of the console */
+#if DT_HAS_CHOSEN(app_modbus_uart)
+#define UART_DEVICE_NODE DT_CHOSEN(app_modbus_uart)
+#else
+#define UART_DEVICE_NODE DT_NODELABEL(uart0)
+#endif
+
+#define MODBUS_RX_BUFFER 256
+
+static const struct device *uart_dev = DEVICE_DT_GET(UART_DEVICE_NODE);
+static struct uart_config original_cfg;
+
+int modbus_init(void)
+{
+    if (!device_is_ready(uart_dev)) {
+        LOG_ERR("UART device not ready");
+        return -ENODEV;
+    }
+
+    uart_config_get(uart_dev, &original_cfg);
+    LOG_INF("Console UART: %d baud", original_cfg.baudrate);
+    return 0;
+}
+
+uint16_t modbus_crc16(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (uint8_t j = 0; j < 8; j++) {
+            crc = (crc & 0x0001) ? ((crc >> 1) ^ 0xA001) : (crc >> 1);
+        }
+    }
+    return crc;
+}
+
+void build_read_cmd(uint8_t *buf, uint8_t id)
+{
+    buf[0] = id;           // Slave address
+    buf[1] = BOVE_FC_READ_HOLDING;          // Function code (Read Holding Registers)
+    buf[2] = BOVE_READ_START_REG >> 8;      // Start address high
+    buf[3] = BOVE_READ_START_REG & 0xFF;    // Start address low (register 1)
+    buf[4] = BOVE_READ_REG_COUNT >> 8;      // Quantity high
+    buf[5] = BOVE_READ_REG_COUNT & 0xFF;    // Quantity low (38 registers)
+    
+    uint16_t crc = modbus_crc16(buf, 6);
+    buf[6] = crc & 0xFF;
+    buf[7] = (crc >> 8) & 0xFF;
+}
+
+uint32_t read_u32(const uint8_t *d, int offset)
+{
+    return bove_get_u32(d, offset);
+}
+
+/**
+ * @brief Switch UART to Modbus mode (2400 baud, 8E1)
+ */
+static void switch_to_modbus(void)
+{
+    struct uart_config modbus_cfg = {
+        .baudrate = 2400,
+        .parity = UART_CFG_PARITY_EVEN,
+        .stop_bits = UART_CFG_STOP_BITS_1,
+        .data_bits = UART_CFG_DATA_BITS_8,
+        .flow_ctrl = UART_CFG_FLOW_CTRL_NONE,
+    };
+    uart_configure(uart_dev, &modbus_cfg);
+}
+
+/**
+ * @brief Switch UART back to console mode
+ */
+static void switch_to_console(void)
+{
+    uart_configure(uart_dev, &original_cfg);
+    k_msleep(10);
+}
+
+int modbus_read_frame(uint8_t slave_id, uint8_t *data)
+{
+    uint8_t tx_buf[8];
+    uint8_t rx_buf[MODBUS_RX_BUFFER];
+    int rx_len = 0;
+    
+    /* Switch to Modbus mode */
+    switch_to_modbus();
+    
+    /* Build and send read command */
+    build_read_cmd(tx_buf, slave_id);
+    for (int i = 0; i < 8; i++) {
+        uart_poll_out(uart_dev, tx_buf[i]);
+    }
+    uint32_t sent_at = k_uptime_get_32();
+    
+    /* Wait for response */
+    k_msleep(100);
+    
+    /* Receive response with timeout */
+    uint32_t start = k_uptime_get_32();
+    uint32_t last_byte = start;
+    
+    while ((k_uptime_get_32() - start) < 2000) {
+        uint8_t c;
+        if (uart_poll_in(uart_dev, &c) == 0) {
+            rx_buf[rx_len++] = c;
+            last_byte = k_uptime_get_32();
+            if (rx_len >= sizeof(rx_buf)) break;
+        }
+        
+        /* Break if no data for 150ms */
+        if (rx_len > 3 && (k_uptime_get_32() - last_byte) > 150) {
+            break;
+        }
+        
+        k_msleep(5);
+    }
+    
+    /* Switch back to console */
+    switch_to_console();
+    
+    /* Validate response */
+    uint32_t rtt = last_byte - sent_at;
+
+    /* Only a whole response of the fixed length is decoded */
+    if (rx_len != BOVE_RESPONSE_LEN) {
+        LOG_WRN("Incomplete response (%d of %d bytes)", rx_len, BOVE_RESPONSE_LEN);
+        metrics_modbus_record(slave_id,
+                              rx_len == 0 ? MODBUS_RESULT_TIMEOUT : MODBUS_RESULT_INCOMPLETE,
+                              rtt);
+        return -1;
+    }
+    
+    /* Verify CRC */
+    uint16_t recv_crc = rx_buf[rx_len-2] | (rx_buf[rx_len-1] << 8);
+    uint16_t calc_crc = modbus_crc16(rx_buf, rx_len - 2);
+    
+    if (recv_crc != calc_crc) {
+        LOG_ERR("CRC error (recv: 0x%04X, calc: 0x%04X)", recv_crc, calc_crc);
+        metrics_modbus_record(slave_id, MODBUS_RESULT_CRC, rtt);
+        return -1;
+    }
+    
+    /* Verify slave ID, function code and byte count */
+    if (rx_buf[0] != slave_id || rx_buf[1] != BOVE_FC_READ_HOLDING ||
+        rx_buf[2] != BOVE_DATA_LEN) {
+        LOG_ERR("Invalid response header");
+        metrics_modbus_record(slave_id, MODBUS_RESULT_HEADER, rtt);
+        return -1;
+    }
+    
+    memcpy(data, &rx_buf[3], BOVE_DATA_LEN);
+    metrics_modbus_record(slave_id, MODBUS_RESULT_OK, rtt);
+    return 0;
+}
+
+void meter_decode(const uint8_t *d, meter_data_t *out)
+{
+    out->flow_rate = bove_field_get(d, BOVE_FLOW_RATE);
+    out->forward_total = bove_field_get(d, BOVE_FORWARD_TOTAL);
+    out->reverse_total = bove_field_get(d, BOVE_REVERSE_TOTAL);
+    out->pressure = bove_field_get(d, BOVE_PRESSURE);
+    out->temperature = bove_field_get(d, BOVE_TEMPERATURE);
+    out->status = bove_field_get(d, BOVE_STATUS);
+    out->serial_number = ((uint32_t)bove_get_u16(d, BOVE_OFF_SERIAL) << 16) |
+                         bove_get_u16(d, BOVE_OFF_SERIAL + 2);
+    out->modbus_id = d[BOVE_OFF_MODBUS_ID + 1];
+    out->baud_code = bove_get_u16(d, BOVE_OFF_BAUD_CODE);
+    out->valid = true;
+}
+
+int read_meter_data(uint8_t slave_id, meter_data_t *out)
+{
+    uint8_t data[BOVE_DATA_LEN];
+
+    if (modbus_read_frame(slave_id, data) != 0) {
+        out->valid = false;
+        return -1;
+    }
+
+    /* Parse meter data */
+    meter_decode(data, out);
+    LOG_INF("Meter data read successfully");
+    return 0;
+}
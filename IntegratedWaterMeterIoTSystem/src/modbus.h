@@ -0,0 +1,63 @@
+/**
+ * @file modbus.h
+ * @brief Modbus RTU master for the BOVE meter (UART shared with console)
+ */
+
+#ifndef MODBUS_H_
+#define MODBUS_H_
+
+#include <stdint.h>
+
+#include "meter.h"
+
+/**
+ * @brief Check the UART and save its console configuration
+ *
+ * @return 0 on success, -ENODEV if the UART is not ready
+ */
+int modbus_init(void);
+
+/**
+ * @brief Calculate Modbus CRC16
+ */
+uint16_t modbus_crc16(const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Build Modbus read command (Function Code 0x03)
+ */
+void build_read_cmd(uint8_t *buf, uint8_t id);
+
+/**
+ * @brief Read 32-bit value from Modbus response (big-endian word order)
+ */
+uint32_t read_u32(const uint8_t *d, int offset);
+
+/**
+ * @brief Read the telemetry registers of one meter, undecoded
+ *
+ * The response is checked (length, CRC, address, function code and byte
+ * count) and its register payload copied to @p data.
+ *
+ * @param slave_id Modbus address of the meter
+ * @param data     BOVE_DATA_LEN bytes, laid out as in register_map.h
+ *
+ * @return 0 on success, -1 on timeout, short frame, CRC or header error
+ */
+int modbus_read_frame(uint8_t slave_id, uint8_t *data);
+
+/**
+ * @brief Decode the register payload of a response (register_map.h)
+ */
+void meter_decode(const uint8_t *d, meter_data_t *out);
+
+/**
+ * @brief Read data from one water meter via Modbus RTU
+ *
+ * @param slave_id Modbus address of the meter
+ * @param out      Filled on success; out->valid reflects the result
+ *
+ * @return 0 on success, -1 on timeout, short frame, CRC or header error
+ */
+int read_meter_data(uint8_t slave_id, meter_data_t *out);
+
+#endif /* MODBUS_H_ */
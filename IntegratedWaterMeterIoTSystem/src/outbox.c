@@ -0,0 +1,118 @@
+/**
+ * @file outbox.c
+ * @brief QoS 1 messages kept until their PUBACK, across sessions
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "outbox.h"
+
+static struct outbox_msg *slot(struct outbox *ob, uint8_t i)
+{
+    return &ob->msgs[(ob->head + i) % ob->size];
+}
+
+int outbox_put(struct outbox *ob, const char *topic, const char *payload, size_t len)
+{
+    if (len > OUTBOX_PAYLOAD_LEN || strlen(topic) >= OUTBOX_TOPIC_LEN) {
+        return -EMSGSIZE;
+    }
+    if (ob->count == ob->size) {
+        return -ENOBUFS;
+    }
+
+    struct outbox_msg *m = slot(ob, ob->count);
+
+    m->message_id = 0;
+    m->acked = false;
+    m->overdue = false;
+    m->attempts = 0;
+    m->len = len;
+    m->sent_ms = 0;
+    strcpy(m->topic, topic);
+    memcpy(m->payload, payload, len);
+    ob->count++;
+    return 0;
+}
+
+struct outbox_msg *outbox_next_unsent(struct outbox *ob)
+{
+    for (uint8_t i = 0; i < ob->count; i++) {
+        struct outbox_msg *m = slot(ob, i);
+
+        if (m->message_id == 0 && !m->acked) {
+            return m;
+        }
+    }
+    return NULL;
+}
+
+uint16_t outbox_mark_sent(struct outbox *ob, struct outbox_msg *msg, int64_t now_ms)
+{
+    /* 1..65535, never 0; wraps long after any ID could still be queued */
+    ob->last_id = (ob->last_id == UINT16_MAX) ? 1 : ob->last_id + 1;
+    msg->message_id = ob->last_id;
+    msg->sent_ms = now_ms;
+    if (msg->attempts < UINT8_MAX) {
+        msg->attempts++;
+    }
+    return msg->message_id;
+}
+
+const struct outbox_msg *outbox_ack(struct outbox *ob, uint16_t message_id)
+{
+    const struct outbox_msg *found = NULL;
+
+    for (uint8_t i = 0; i < ob->count; i++) {
+        struct outbox_msg *m = slot(ob, i);
+
+        if (m->message_id == message_id && !m->acked) {
+            m->acked = true;
+            found = m;
+            break;
+        }
+    }
+
+    /* Acks normally arrive in order; free the head as far as possible */
+    while (ob->count > 0 && slot(ob, 0)->acked) {
+        ob->head = (ob->head + 1) % ob->size;
+        ob->count--;
+    }
+    return found;
+}
+
+struct outbox_msg *outbox_overdue(struct outbox *ob, int64_t now_ms, uint32_t timeout_ms)
+{
+    for (uint8_t i = 0; i < ob->count; i++) {
+        struct outbox_msg *m = slot(ob, i);
+
+        if (m->message_id != 0 && !m->acked && !m->overdue &&
+            now_ms - m->sent_ms >= timeout_ms) {
+            m->overdue = true;
+            return m;
+        }
+    }
+    return NULL;
+}
+
+size_t outbox_session_reset(struct outbox *ob)
+{
+    size_t resend = 0;
+
+    for (uint8_t i = 0; i < ob->count; i++) {
+        struct outbox_msg *m = slot(ob, i);
+
+        if (!m->acked) {
+            m->message_id = 0;
+            m->overdue = false;
+            resend++;
+        }
+    }
+    return resend;
+}
+
+size_t outbox_count(const struct outbox *ob)
+{
+    return ob->count;
+}
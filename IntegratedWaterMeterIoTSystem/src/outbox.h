@@ -0,0 +1,96 @@
+/**
+ * @file outbox.h
+ * @brief QoS 1 messages kept until their PUBACK, across sessions
+ *
+ * @details
+ * Every publish is copied into the outbox first. A message is sent when a
+ * session is up and stays queued until the broker acknowledges it; when the
+ * session is lost (or moved to another broker) all unacknowledged messages
+ * are marked unsent and go out again, in order, on the next session.
+ * Delivery is at-least-once: a message acknowledged just before the drop
+ * may be seen twice by the server.
+ *
+ * The slots are defined with the outbox (OUTBOX_DEFINE), so each session
+ * can have a queue of its own depth.
+ *
+ * Pure C, no kernel calls: times are passed in.
+ */
+
+#ifndef OUTBOX_H_
+#define OUTBOX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OUTBOX_SIZE 16              /* Slots of the telemetry outbox */
+#define OUTBOX_TOPIC_LEN 48
+#define OUTBOX_PAYLOAD_LEN 1024    /* A telemetry batch (telemetry_batch.h) */
+
+struct outbox_msg {
+    uint16_t message_id;        /* 0 = not sent on the current session */
+    bool acked;
+    bool overdue;               /* PUBACK timeout already reported */
+    uint8_t attempts;           /* Times handed to the client */
+    uint16_t len;
+    int64_t sent_ms;
+    char topic[OUTBOX_TOPIC_LEN];
+    char payload[OUTBOX_PAYLOAD_LEN];
+};
+
+struct outbox {
+    struct outbox_msg *msgs;
+    uint8_t size;               /* Slots in msgs */
+    uint8_t head;
+    uint8_t count;
+    uint16_t last_id;
+};
+
+/** @brief Define a static, empty outbox @p name with @p slots slots (1..255) */
+#define OUTBOX_DEFINE(name, slots)                                          \
+    static struct outbox_msg name##_msgs[(slots)];                          \
+    static struct outbox name = { .msgs = name##_msgs, .size = (slots) }
+
+/**
+ * @brief Queue a copy of a message
+ *
+ * @return 0 on success, -EMSGSIZE if it does not fit a slot,
+ *         -ENOBUFS if the outbox is full
+ */
+int outbox_put(struct outbox *ob, const char *topic, const char *payload, size_t len);
+
+/** @brief Oldest message not yet sent on this session, or NULL */
+struct outbox_msg *outbox_next_unsent(struct outbox *ob);
+
+/** @brief Assign a message ID to @p msg as it is handed to the client */
+uint16_t outbox_mark_sent(struct outbox *ob, struct outbox_msg *msg, int64_t now_ms);
+
+/**
+ * @brief Release the message acknowledged by @p message_id
+ *
+ * @return The message (its topic and send time stay readable until the next
+ *         outbox_put()), or NULL if the ID belonged to no queued message
+ */
+const struct outbox_msg *outbox_ack(struct outbox *ob, uint16_t message_id);
+
+/**
+ * @brief First message sent at least @p timeout_ms ago and still not
+ *        acknowledged; it is reported once per session
+ *
+ * The message stays queued: MQTT 3.1.1 re-sends only on a new session.
+ *
+ * @return The message, or NULL if none is overdue
+ */
+struct outbox_msg *outbox_overdue(struct outbox *ob, int64_t now_ms, uint32_t timeout_ms);
+
+/**
+ * @brief Session lost: everything unacknowledged is sent again next time
+ *
+ * @return Number of messages that will be re-sent
+ */
+size_t outbox_session_reset(struct outbox *ob);
+
+/** @brief Queued messages (sent or not) */
+size_t outbox_count(const struct outbox *ob);
+
+#endif /* OUTBOX_H_ */
@@ -0,0 +1,253 @@
+/**
+ * @file pulse.c
+ * @brief Pulse output of the meter: near-real-time flow without bus traffic
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/logging/log.h>
+#include <stdlib.h>
+
+#include "pulse.h"
+
+LOG_MODULE_REGISTER(pulse, LOG_LEVEL_INF);
+
+#define PULSE_NODE DT_PATH(zephyr_user)
+
+BUILD_ASSERT(DT_NODE_HAS_PROP(PULSE_NODE, pulse_gpios),
+             "CONFIG_APP_PULSE needs pulse-gpios on the zephyr,user node");
+
+#define RING_LEN (PULSE_AVG_INTERVALS + 1)
+#define STOP_MS (CONFIG_APP_PULSE_STOP_SEC * 1000LL)
+
+/* 0.01 L/h for one pulse per millisecond */
+#define FLOW_PER_PULSE_MS ((uint64_t)CONFIG_APP_PULSE_ML_PER_PULSE * 360000U)
+
+/* Ignore window deltas above this (meter replaced or counter reset) */
+#define MAX_PLAUSIBLE_DELTA_L 1000000U
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+static const struct gpio_dt_spec pulse_gpio = GPIO_DT_SPEC_GET(PULSE_NODE, pulse_gpios);
+static struct gpio_callback pulse_cb;
+
+/* Shared with the interrupt handler and the stop timer */
+static struct k_spinlock lock;
+static int64_t times[RING_LEN];     /* Pulses of the current burst, newest at head */
+static uint8_t head;
+static uint8_t filled;
+static bool flowing;
+static struct pulse_stats stats;
+
+static atomic_t events;
+static K_SEM_DEFINE(event_sem, 0, 1);
+
+/* Cross-check window, main thread only */
+static uint32_t base_count;
+static uint32_t base_total_l;
+static bool have_base;
+
+/* ============================================================================
+ * INTERRUPT SIDE
+ * ============================================================================ */
+
+static void raise_event(uint32_t event)
+{
+    atomic_or(&events, event);
+    k_sem_give(&event_sem);
+}
+
+static void on_stop(struct k_timer *timer)
+{
+    ARG_UNUSED(timer);
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    bool stopped = flowing;
+
+    if (stopped) {
+        flowing = false;
+        stats.stops++;
+    }
+    k_spin_unlock(&lock, key);
+
+    if (stopped) {
+        raise_event(PULSE_EVENT_STOP);
+    }
+}
+
+static K_TIMER_DEFINE(stop_timer, on_stop, NULL);
+
+static void on_pulse(const struct device *dev, struct gpio_callback *cb, uint32_t pins)
+{
+    ARG_UNUSED(dev);
+    ARG_UNUSED(cb);
+    ARG_UNUSED(pins);
+
+    int64_t now = k_uptime_get();
+    bool started = false;
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    /* Contact bounce of reed outputs */
+    if (filled > 0 && now - times[head] < CONFIG_APP_PULSE_DEBOUNCE_MS) {
+        stats.bounces++;
+        k_spin_unlock(&lock, key);
+        return;
+    }
+
+    /* A pulse after a quiet spell opens a new burst */
+    if (filled > 0 && now - times[head] > STOP_MS) {
+        filled = 0;
+    }
+    head = (head + 1) % RING_LEN;
+    times[head] = now;
+    if (filled < RING_LEN) {
+        filled++;
+    }
+    stats.pulses++;
+
+    if (!flowing && filled >= 2) {
+        flowing = true;
+        stats.starts++;
+        started = true;
+    }
+    k_spin_unlock(&lock, key);
+
+    k_timer_start(&stop_timer, K_MSEC(STOP_MS), K_NO_WAIT);
+    if (started) {
+        raise_event(PULSE_EVENT_START);
+    }
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+int pulse_init(void)
+{
+    int rc;
+
+    if (!gpio_is_ready_dt(&pulse_gpio)) {
+        LOG_ERR("Pulse input %s not ready", pulse_gpio.port->name);
+        return -ENODEV;
+    }
+
+    rc = gpio_pin_configure_dt(&pulse_gpio, GPIO_INPUT);
+    if (rc == 0) {
+        rc = gpio_pin_interrupt_configure_dt(&pulse_gpio, GPIO_INT_EDGE_TO_ACTIVE);
+    }
+    if (rc != 0) {
+        LOG_ERR("Pulse input configuration failed: %d", rc);
+        return rc;
+    }
+
+    gpio_init_callback(&pulse_cb, on_pulse, BIT(pulse_gpio.pin));
+    rc = gpio_add_callback_dt(&pulse_gpio, &pulse_cb);
+    if (rc != 0) {
+        return rc;
+    }
+
+    LOG_INF("Pulse input on %s pin %u, %u mL per pulse", pulse_gpio.port->name,
+            pulse_gpio.pin, CONFIG_APP_PULSE_ML_PER_PULSE);
+    return 0;
+}
+
+uint32_t pulse_wait(k_timeout_t timeout)
+{
+    k_timepoint_t end = sys_timepoint_calc(timeout);
+
+    for (;;) {
+        uint32_t ev = atomic_clear(&events);
+
+        if (ev != 0) {
+            k_spinlock_key_t key = k_spin_lock(&lock);
+
+            stats.wakeups++;
+            k_spin_unlock(&lock, key);
+            return ev;
+        }
+        if (k_sem_take(&event_sem, sys_timepoint_timeout(end)) != 0) {
+            return 0;
+        }
+    }
+}
+
+void pulse_get_state(struct pulse_state *out)
+{
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    out->count = stats.pulses;
+    out->last_ms = (filled > 0) ? times[head] : 0;
+    out->flowing = flowing;
+    out->flow = 0;
+
+    if (flowing && filled >= 2) {
+        uint32_t n = MIN(filled - 1, PULSE_AVG_INTERVALS);
+        int64_t span = times[head] - times[(head + RING_LEN - n) % RING_LEN];
+        int64_t since = now - times[head];
+        uint64_t flow = FLOW_PER_PULSE_MS * n / MAX(span, 1);
+
+        /* No pulse for longer than the mean interval: at most one per "since" */
+        if (since > 0) {
+            flow = MIN(flow, FLOW_PER_PULSE_MS / since);
+        }
+        out->flow = (uint32_t)MIN(flow, UINT32_MAX);
+    }
+    k_spin_unlock(&lock, key);
+}
+
+bool pulse_check(uint32_t forward_total_l, struct pulse_check *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    uint32_t count = stats.pulses;
+
+    k_spin_unlock(&lock, key);
+
+    if (!have_base || forward_total_l < base_total_l ||
+        forward_total_l - base_total_l > MAX_PLAUSIBLE_DELTA_L) {
+        base_count = count;
+        base_total_l = forward_total_l;
+        have_base = true;
+        return false;
+    }
+
+    uint32_t meter_l = forward_total_l - base_total_l;
+
+    if (meter_l < CONFIG_APP_PULSE_CHECK_LITRES) {
+        return false;
+    }
+
+    int64_t pulse_ml = (int64_t)(count - base_count) * CONFIG_APP_PULSE_ML_PER_PULSE;
+    int64_t meter_ml = (int64_t)meter_l * 1000;
+
+    out->meter_l = meter_l;
+    out->pulse_l = (uint32_t)((pulse_ml + 500) / 1000);
+    out->drift_bp = (int32_t)((pulse_ml - meter_ml) * 10000 / meter_ml);
+    out->mismatch = abs(out->drift_bp) > CONFIG_APP_PULSE_MAX_DRIFT_BP;
+
+    if (out->mismatch) {
+        LOG_WRN("Pulse volume %u L vs meter %u L (%d bp)", out->pulse_l, meter_l,
+                out->drift_bp);
+    }
+
+    key = k_spin_lock(&lock);
+    stats.checks++;
+    stats.mismatches += out->mismatch ? 1 : 0;
+    if (abs(out->drift_bp) > abs(stats.max_drift_bp)) {
+        stats.max_drift_bp = out->drift_bp;
+    }
+    k_spin_unlock(&lock, key);
+
+    base_count = count;
+    base_total_l = forward_total_l;
+    return true;
+}
+
+void pulse_get_stats(struct pulse_stats *out)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    *out = stats;
+    k_spin_unlock(&lock, key);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file pulse.h
+ * @brief Pulse output of the meter: near-real-time flow without bus traffic
+ *
+ * @details
+ * The meter's pulse output (one pulse per CONFIG_APP_PULSE_ML_PER_PULSE)
+ * is wired to the GPIO in the devicetree property pulse-gpios of the
+ * zephyr,user node. Each pulse is timestamped in the interrupt handler;
+ * the flow is the mean over the last PULSE_AVG_INTERVALS intervals, capped
+ * by one pulse volume over the time since the last pulse, so it falls while
+ * the next pulse is overdue:
+ *
+ *   flow = min(n × volume / (t_last - t_last-n), volume / (now - t_last))
+ *
+ * Flow starts with a second pulse within CONFIG_APP_PULSE_STOP_SEC of the
+ * first and stops when no pulse comes for that long; both wake
+ * pulse_wait() so the meter is read at once instead of at the next poll.
+ * The smallest flow seen is one pulse volume per CONFIG_APP_PULSE_STOP_SEC.
+ *
+ * pulse_check() compares the pulse volume with the meter's forward total
+ * over windows of CONFIG_APP_PULSE_CHECK_LITRES: a drift beyond
+ * CONFIG_APP_PULSE_MAX_DRIFT_BP points at missed pulses (wiring, bounce
+ * filtered too hard) or a wrong pulse volume.
+ */
+
+#ifndef PULSE_H_
+#define PULSE_H_
+
+#include <zephyr/kernel.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PULSE_AVG_INTERVALS 4
+
+/* pulse_wait() events */
+#define PULSE_EVENT_START BIT(0)
+#define PULSE_EVENT_STOP BIT(1)
+
+struct pulse_state {
+    uint32_t count;             /* Since boot */
+    int64_t last_ms;            /* Uptime of the last pulse, 0 = none yet */
+    uint32_t flow;              /* L/h × 100, as the meter's flow_rate */
+    bool flowing;
+};
+
+struct pulse_check {
+    uint32_t meter_l;           /* Forward total delta over the window */
+    uint32_t pulse_l;           /* Pulse volume over the window */
+    int32_t drift_bp;           /* (pulse - meter) / meter in 0.01 % */
+    bool mismatch;
+};
+
+struct pulse_stats {
+    uint32_t pulses;
+    uint32_t bounces;           /* Edges inside the debounce time */
+    uint32_t starts;
+    uint32_t stops;
+    uint32_t wakeups;           /* Waits cut short, i.e. reads brought forward */
+    uint32_t checks;
+    uint32_t mismatches;
+    int32_t max_drift_bp;       /* Largest |drift| of a check, signed */
+};
+
+/**
+ * @brief Configure the input and its interrupt
+ *
+ * @return 0 on success, -ENODEV if the GPIO is not ready, or the GPIO
+ *         driver's error
+ */
+int pulse_init(void);
+
+/**
+ * @brief Sleep up to @p timeout, returning early on a flow start or stop
+ *
+ * @return PULSE_EVENT_* bits that occurred, 0 on timeout
+ */
+uint32_t pulse_wait(k_timeout_t timeout);
+
+/** @brief Count, last pulse and flow now */
+void pulse_get_state(struct pulse_state *out);
+
+/**
+ * @brief Feed the meter's forward total read just now (litres)
+ *
+ * The first call, and any call after the total went backwards, starts a
+ * window. A window closes once the meter has counted
+ * CONFIG_APP_PULSE_CHECK_LITRES.
+ *
+ * @return true with @p out filled when a window closed
+ */
+bool pulse_check(uint32_t forward_total_l, struct pulse_check *out);
+
+void pulse_get_stats(struct pulse_stats *out);
+
+#endif /* PULSE_H_ */
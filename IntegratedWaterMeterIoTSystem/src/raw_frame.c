@@ -0,0 +1,160 @@
+/**
+ * @file raw_frame.c
+ * @brief Batches of raw meter responses, shared by the firmware and host tools
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "raw_frame.h"
+
+/* ============================================================================
+ * HELPERS
+ * ============================================================================ */
+
+static void put_le(uint8_t *out, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *in, int bytes)
+{
+    uint64_t v = 0;
+
+    for (int i = 0; i < bytes; i++) {
+        v |= (uint64_t)in[i] << (8 * i);
+    }
+    return v;
+}
+
+/* ============================================================================
+ * ENCODING
+ * ============================================================================ */
+
+int raw_batch_append(uint8_t *buf, size_t len, size_t size, const struct raw_frame *frame)
+{
+    size_t data_len = 2U * frame->reg_count;
+    size_t pos = (len == 0) ? RAW_HEADER_LEN : len;
+    int64_t base = (len == 0) ? frame->ts_ms : (int64_t)get_le(&buf[4], 8);
+    int64_t off = frame->ts_ms - base;
+
+    if (frame->reg_count == 0 || raw_batch_count(buf, len) == RAW_MAX_FRAMES) {
+        return -EINVAL;
+    }
+    if (off < 0 || off > (int64_t)UINT32_MAX) {
+        return -ERANGE;
+    }
+    if (pos + RAW_FRAME_HEADER_LEN + data_len > size) {
+        return -EMSGSIZE;
+    }
+
+    if (len == 0) {
+        buf[0] = RAW_MAGIC_0;
+        buf[1] = RAW_MAGIC_1;
+        buf[2] = RAW_VERSION;
+        buf[3] = 0;
+        put_le(&buf[4], (uint64_t)base, 8);
+    }
+
+    buf[pos] = frame->slave_id;
+    put_le(&buf[pos + 1], (uint64_t)off, 4);
+    put_le(&buf[pos + 5], frame->start_reg, 2);
+    buf[pos + 7] = frame->reg_count;
+    memcpy(&buf[pos + RAW_FRAME_HEADER_LEN], frame->data, data_len);
+    buf[3]++;
+
+    return (int)(pos + RAW_FRAME_HEADER_LEN + data_len);
+}
+
+/* ============================================================================
+ * DECODING
+ * ============================================================================ */
+
+int raw_batch_open(struct raw_reader *r, const uint8_t *buf, size_t len)
+{
+    if (len < RAW_HEADER_LEN || buf[0] != RAW_MAGIC_0 || buf[1] != RAW_MAGIC_1 ||
+        buf[2] != RAW_VERSION || buf[3] == 0) {
+        return -EINVAL;
+    }
+
+    *r = (struct raw_reader){
+        .buf = buf,
+        .len = len,
+        .pos = RAW_HEADER_LEN,
+        .count = buf[3],
+        .base_ts_ms = (int64_t)get_le(&buf[4], 8),
+    };
+    return 0;
+}
+
+int raw_batch_next(struct raw_reader *r, struct raw_frame *frame)
+{
+    const uint8_t *p = &r->buf[r->pos];
+
+    if (r->read == r->count) {
+        return (r->pos == r->len) ? 0 : -EINVAL;
+    }
+    if (r->len - r->pos < RAW_FRAME_HEADER_LEN) {
+        return -EINVAL;
+    }
+
+    size_t data_len = 2U * p[7];
+
+    if (p[7] == 0 || r->len - r->pos - RAW_FRAME_HEADER_LEN < data_len) {
+        return -EINVAL;
+    }
+
+    *frame = (struct raw_frame){
+        .ts_ms = r->base_ts_ms + (int64_t)get_le(&p[1], 4),
+        .slave_id = p[0],
+        .start_reg = (uint16_t)get_le(&p[5], 2),
+        .reg_count = p[7],
+        .data = &p[RAW_FRAME_HEADER_LEN],
+    };
+    r->pos += RAW_FRAME_HEADER_LEN + data_len;
+    r->read++;
+    return 1;
+}
+
+int raw_frame_sample(const struct raw_frame *frame, struct batch_sample *out)
+{
+    uint32_t end = (uint32_t)frame->start_reg + frame->reg_count;
+
+    if (frame->start_reg > BOVE_READ_START_REG ||
+        end < BOVE_READ_START_REG + BOVE_READ_REG_COUNT) {
+        return -ENOENT;
+    }
+
+    const uint8_t *d = &frame->data[2 * (BOVE_READ_START_REG - frame->start_reg)];
+
+    out->ts_ms = frame->ts_ms;
+    for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+        out->values[f] = bove_field_get(d, (enum bove_field)f);
+    }
+    return 0;
+}
+
+int raw_batch_decode(const uint8_t *buf, size_t len, struct batch_sample *out, size_t max)
+{
+    struct raw_reader r;
+    struct raw_frame frame;
+    int rc = raw_batch_open(&r, buf, len);
+    size_t n = 0;
+
+    if (rc != 0) {
+        return rc;
+    }
+    if (r.count > max) {
+        return -EMSGSIZE;
+    }
+
+    while ((rc = raw_batch_next(&r, &frame)) == 1) {
+        if (raw_frame_sample(&frame, &out[n]) != 0) {
+            return -EINVAL;
+        }
+        n++;
+    }
+    return (rc < 0) ? rc : (int)n;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file raw_frame.h
+ * @brief Batches of raw meter responses, shared by the firmware and host tools
+ *
+ * @details
+ * With the raw uplink the gateway forwards validated Modbus responses as
+ * they came off the bus and leaves the decoding to the host. A batch
+ * carries up to RAW_MAX_FRAMES of them:
+ *
+ *   'W' 'R' version count  base_ts(8 bytes, Unix ms)
+ *   then count times:
+ *   slave_id  ts_offset(4, ms after base_ts)  start_reg(2)  reg_count
+ *   data(2 x reg_count bytes)
+ *
+ * Multi-byte header fields are little-endian. The data is the register
+ * payload of the response exactly as received (after the byte count,
+ * before the CRC), so register_map.h reads it unchanged. Fields are fixed
+ * width: appending a frame is a few stores and a copy.
+ *
+ * Plain C, no Zephyr headers, so it compiles on the host as well.
+ */
+
+#ifndef RAW_FRAME_H_
+#define RAW_FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "batch_codec.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RAW_MAGIC_0 'W'
+#define RAW_MAGIC_1 'R'
+#define RAW_VERSION 1
+#define RAW_HEADER_LEN 12
+#define RAW_FRAME_HEADER_LEN 8
+#define RAW_MAX_FRAMES 255
+
+/* Bytes a frame of @p regs registers adds to a batch */
+#define RAW_FRAME_LEN(regs) (RAW_FRAME_HEADER_LEN + 2 * (regs))
+
+struct raw_frame {
+    int64_t ts_ms;              /* Unix time of the read */
+    uint8_t slave_id;
+    uint16_t start_reg;
+    uint8_t reg_count;
+    const uint8_t *data;        /* 2 x reg_count bytes */
+};
+
+/* Position in a received batch */
+struct raw_reader {
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+    uint8_t count;
+    uint8_t read;
+    int64_t base_ts_ms;
+};
+
+/**
+ * @brief Append one frame to the batch of @p len bytes in @p buf
+ *
+ * The first frame (@p len 0) writes the header and sets the base time.
+ * On error the batch is left as it was.
+ *
+ * @return New length, -EINVAL if the batch already holds RAW_MAX_FRAMES
+ *         or the frame has no registers, -ERANGE if the time is before
+ *         the base or 2^32 ms after it, -EMSGSIZE if @p size is too small
+ */
+int raw_batch_append(uint8_t *buf, size_t len, size_t size, const struct raw_frame *frame);
+
+/** @brief Frames in an encoded batch (0 for an empty buffer) */
+static inline uint8_t raw_batch_count(const uint8_t *buf, size_t len)
+{
+    return (len >= RAW_HEADER_LEN) ? buf[3] : 0;
+}
+
+/**
+ * @brief Check the header of a received batch
+ *
+ * @return 0 on success, -EINVAL if it is not a raw batch
+ */
+int raw_batch_open(struct raw_reader *r, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Next frame; @p frame->data points into the batch
+ *
+ * @return 1 for a frame, 0 at the end, -EINVAL if truncated or padded
+ */
+int raw_batch_next(struct raw_reader *r, struct raw_frame *frame);
+
+/**
+ * @brief Telemetry fields of a frame, by the register map
+ *
+ * @return 0 on success, -ENOENT if the frame does not cover the
+ *         BOVE_READ_REG_COUNT registers from BOVE_READ_START_REG
+ */
+int raw_frame_sample(const struct raw_frame *frame, struct batch_sample *out);
+
+/**
+ * @brief Decode a whole batch into samples
+ *
+ * @return Number of samples, -EINVAL if malformed or a frame lacks the
+ *         telemetry registers, -EMSGSIZE if more than @p max
+ */
+int raw_batch_decode(const uint8_t *buf, size_t len, struct batch_sample *out, size_t max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RAW_FRAME_H_ */
@@ -0,0 +1,85 @@
+/**
+ * @file register_map.h
+ * @brief BOVE meter register layout, shared by the firmware and host tools
+ *
+ * @details
+ * One read of holding registers 1..38 (function 0x03) returns every field.
+ * Offsets are bytes into the response data, i.e. after the slave ID,
+ * function code and byte count. 32-bit values span two registers, low word
+ * first, each word big-endian.
+ *
+ * BOVE_FIELDS lists the telemetry fields in a fixed order; the batch codec
+ * stores its columns in this order and the host tools name them by key.
+ *
+ * Plain C, no Zephyr headers, so it compiles on the host as well.
+ */
+
+#ifndef REGISTER_MAP_H_
+#define REGISTER_MAP_H_
+
+#include <stdint.h>
+
+#define BOVE_FC_READ_HOLDING 0x03
+#define BOVE_READ_START_REG 1
+#define BOVE_READ_REG_COUNT 38
+#define BOVE_DATA_LEN (2 * BOVE_READ_REG_COUNT)
+#define BOVE_RESPONSE_LEN (3 + BOVE_DATA_LEN + 2)  /* Header, data, CRC */
+
+/* Telemetry fields */
+#define BOVE_OFF_FLOW_RATE 0        /* Reg 1-2, L/h x 100 */
+#define BOVE_OFF_FORWARD_TOTAL 12   /* Reg 7-8, m3 x 1000 */
+#define BOVE_OFF_REVERSE_TOTAL 18   /* Reg 10-11, m3 x 1000 */
+#define BOVE_OFF_PRESSURE 36        /* Reg 19, MPa x 1000 */
+#define BOVE_OFF_STATUS 38          /* Reg 20, flags below */
+#define BOVE_OFF_TEMPERATURE 58     /* Reg 30, degC x 100 */
+
+/* X(id, telemetry key, byte offset, width in bytes) */
+#define BOVE_FIELDS(X)                                                  \
+    X(FLOW_RATE, "flowRate", BOVE_OFF_FLOW_RATE, 4)                     \
+    X(FORWARD_TOTAL, "forwardTotal", BOVE_OFF_FORWARD_TOTAL, 4)         \
+    X(REVERSE_TOTAL, "reverseTotal", BOVE_OFF_REVERSE_TOTAL, 4)         \
+    X(PRESSURE, "pressure", BOVE_OFF_PRESSURE, 2)                       \
+    X(TEMPERATURE, "temperature", BOVE_OFF_TEMPERATURE, 2)              \
+    X(STATUS, "status", BOVE_OFF_STATUS, 2)
+
+#define BOVE_FIELD_ENUM(id, key, offset, width) BOVE_##id,
+enum bove_field {
+    BOVE_FIELDS(BOVE_FIELD_ENUM)
+    BOVE_FIELD_COUNT
+};
+#undef BOVE_FIELD_ENUM
+
+/* Identification, read once for the device attributes */
+#define BOVE_OFF_SERIAL 64          /* Reg 33-34, BCD, high word first */
+#define BOVE_OFF_MODBUS_ID 68       /* Reg 35; the address is the low byte */
+#define BOVE_OFF_BAUD_CODE 72       /* Reg 37: 0 9600, 1 2400, 2 4800, 3 1200 */
+
+/* Status flags (register 20) */
+#define BOVE_STATUS_EMPTY 0x0004    /* Empty pipe; also reported as leak */
+#define BOVE_STATUS_LOW_BATTERY 0x0020
+
+static inline uint16_t bove_get_u16(const uint8_t *d, int offset)
+{
+    return (uint16_t)((d[offset] << 8) | d[offset + 1]);
+}
+
+static inline uint32_t bove_get_u32(const uint8_t *d, int offset)
+{
+    return ((uint32_t)bove_get_u16(d, offset + 2) << 16) | bove_get_u16(d, offset);
+}
+
+/** @brief Value of one telemetry field from the response data */
+static inline uint32_t bove_field_get(const uint8_t *d, enum bove_field field)
+{
+#define BOVE_FIELD_CASE(id, key, offset, width)                                \
+    case BOVE_##id:                                                            \
+        return (width) == 4 ? bove_get_u32(d, offset) : bove_get_u16(d, offset);
+    switch (field) {
+        BOVE_FIELDS(BOVE_FIELD_CASE)
+    default:
+        return 0;
+    }
+#undef BOVE_FIELD_CASE
+}
+
+#endif /* REGISTER_MAP_H_ */
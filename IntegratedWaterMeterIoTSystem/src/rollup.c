@@ -0,0 +1,213 @@
+/**
+ * @file rollup.c
+ * @brief Cascading 15-minute and daily aggregates of the meter samples
+ */
+
+#include <string.h>
+
+#include "rollup.h"
+
+/* ============================================================================
+ * HELPERS
+ * ============================================================================ */
+
+static uint32_t quarter_start(uint32_t ts_s)
+{
+    return ts_s - ts_s % ROLLUP_QUARTER_SEC;
+}
+
+static uint32_t day_start(const struct rollup *r, uint32_t ts_s)
+{
+    int64_t local = (int64_t)ts_s + r->day_offset_s;
+
+    return (uint32_t)(local - local % ROLLUP_DAY_SEC - r->day_offset_s);
+}
+
+/* Volume since @p base; a totalizer that went back (meter swap) counts 0 */
+static uint32_t used_since(uint32_t total, uint32_t base)
+{
+    return (total >= base) ? total - base : 0;
+}
+
+/** @brief Fold a closed bucket into a coarser one */
+static void merge(struct rollup_record *into, const struct rollup_record *from)
+{
+    into->forward_total = from->forward_total;
+    into->reverse_total = from->reverse_total;
+    into->forward_used += from->forward_used;
+    into->reverse_used += from->reverse_used;
+    if (from->flow_max > into->flow_max) {
+        into->flow_max = from->flow_max;
+    }
+    if (from->pressure_min < into->pressure_min) {
+        into->pressure_min = from->pressure_min;
+    }
+    if (from->pressure_max > into->pressure_max) {
+        into->pressure_max = from->pressure_max;
+    }
+    into->samples = (into->samples + from->samples > UINT16_MAX) ?
+                    UINT16_MAX : into->samples + from->samples;
+    into->status |= from->status;
+}
+
+/**
+ * @brief Close the open 15-minute bucket and carry it into the day
+ */
+static int close_quarter(struct rollup *r, struct rollup_closed out[2])
+{
+    struct rollup_record *q = &r->quarter;
+    uint32_t day = day_start(r, q->start_s);
+    int n = 0;
+
+    q->forward_used = used_since(q->forward_total, r->forward_base);
+    q->reverse_used = used_since(q->reverse_total, r->reverse_base);
+    r->forward_base = q->forward_total;
+    r->reverse_base = q->reverse_total;
+    out[n++] = (struct rollup_closed){ ROLLUP_QUARTER, *q };
+
+    if (r->day.samples > 0 && r->day.start_s != day) {
+        out[n++] = (struct rollup_closed){ ROLLUP_DAILY, r->day };
+        r->day.samples = 0;
+    }
+    if (r->day.samples == 0) {
+        r->day = *q;
+        r->day.start_s = day;
+    } else {
+        merge(&r->day, q);
+    }
+
+    q->samples = 0;
+    return n;
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+uint32_t rollup_period_s(enum rollup_tier tier)
+{
+    switch (tier) {
+    case ROLLUP_QUARTER:
+        return ROLLUP_QUARTER_SEC;
+    case ROLLUP_DAILY:
+        return ROLLUP_DAY_SEC;
+    default:
+        return 0;
+    }
+}
+
+const char *rollup_tier_name(enum rollup_tier tier)
+{
+    static const char *const names[ROLLUP_TIER_COUNT] = { "raw", "15min", "daily" };
+
+    return (tier < ROLLUP_TIER_COUNT) ? names[tier] : "?";
+}
+
+void rollup_init(struct rollup *r, int32_t day_offset_s)
+{
+    memset(r, 0, sizeof(*r));
+    r->day_offset_s = day_offset_s;
+}
+
+int rollup_add(struct rollup *r, uint32_t ts_s, const uint32_t values[BOVE_FIELD_COUNT],
+               struct rollup_closed out[2])
+{
+    struct rollup_record *q = &r->quarter;
+    uint32_t start = quarter_start(ts_s);
+    int n = 0;
+
+    /* A later bucket, or the clock was set back: close the open one */
+    if (q->samples > 0 && start != q->start_s) {
+        n = close_quarter(r, out);
+    }
+
+    if (!r->have_base) {
+        r->forward_base = values[BOVE_FORWARD_TOTAL];
+        r->reverse_base = values[BOVE_REVERSE_TOTAL];
+        r->have_base = true;
+    }
+    if (q->samples == 0) {
+        *q = (struct rollup_record){
+            .start_s = start,
+            .pressure_min = UINT16_MAX,
+        };
+    }
+
+    struct rollup_record s;
+
+    rollup_from_sample(&s, ts_s, values, NULL);
+    merge(q, &s);
+    return n;
+}
+
+void rollup_restore(struct rollup *r, const struct rollup_record *quarter,
+                    uint32_t last_day_s)
+{
+    uint32_t day = day_start(r, quarter->start_s);
+
+    r->forward_base = quarter->forward_total;
+    r->reverse_base = quarter->reverse_total;
+    r->have_base = true;
+
+    if (last_day_s != 0 && day <= last_day_s) {
+        return;
+    }
+    if (r->day.samples > 0 && r->day.start_s == day) {
+        merge(&r->day, quarter);
+    } else {
+        r->day = *quarter;
+        r->day.start_s = day;
+    }
+}
+
+void rollup_from_sample(struct rollup_record *out, uint32_t ts_s,
+                        const uint32_t values[BOVE_FIELD_COUNT],
+                        const struct rollup_record *prev)
+{
+    *out = (struct rollup_record){
+        .start_s = ts_s,
+        .forward_total = values[BOVE_FORWARD_TOTAL],
+        .reverse_total = values[BOVE_REVERSE_TOTAL],
+        .flow_max = values[BOVE_FLOW_RATE],
+        .pressure_min = (uint16_t)values[BOVE_PRESSURE],
+        .pressure_max = (uint16_t)values[BOVE_PRESSURE],
+        .samples = 1,
+        .status = (uint16_t)values[BOVE_STATUS],
+    };
+    if (prev != NULL) {
+        out->forward_used = used_since(out->forward_total, prev->forward_total);
+        out->reverse_used = used_since(out->reverse_total, prev->reverse_total);
+    }
+}
+
+bool rollup_past_retention(uint32_t start_s, uint32_t now_s, uint32_t retention_s)
+{
+    return start_s <= now_s && now_s - start_s >= retention_s;
+}
+
+enum rollup_tier rollup_pick_tier(uint32_t resolution_s, uint32_t from_s,
+                                  const uint32_t oldest_s[ROLLUP_TIER_COUNT])
+{
+    int tier = ROLLUP_RAW;
+    int furthest = -1;
+
+    while (tier + 1 < ROLLUP_TIER_COUNT &&
+           rollup_period_s((enum rollup_tier)(tier + 1)) <= resolution_s) {
+        tier++;
+    }
+
+    /* Finer tiers are kept for less time: go coarser until one reaches back */
+    for (int t = tier; t < ROLLUP_TIER_COUNT; t++) {
+        if (oldest_s[t] != 0 && oldest_s[t] <= from_s) {
+            return (enum rollup_tier)t;
+        }
+    }
+
+    /* None does (or the coarse tiers are still empty): the one reaching furthest */
+    for (int t = 0; t < ROLLUP_TIER_COUNT; t++) {
+        if (oldest_s[t] != 0 && (furthest < 0 || oldest_s[t] < oldest_s[furthest])) {
+            furthest = t;
+        }
+    }
+    return (furthest < 0) ? (enum rollup_tier)tier : (enum rollup_tier)furthest;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file rollup.h
+ * @brief Cascading 15-minute and daily aggregates of the meter samples
+ *
+ * @details
+ * Each sample updates the open 15-minute bucket; when a sample falls into
+ * a later bucket the open one is closed and merged into the open day, and
+ * a day closes with the first 15-minute bucket of the next one. Nothing is
+ * read back: every bucket is built from the samples or buckets below it as
+ * they arrive.
+ *
+ * Consumption is attributed by the meter's totalizers: a bucket's volume
+ * is its last forward/reverse total minus the last total of the bucket
+ * before, so nothing is lost between buckets or across gaps (the volume of
+ * a gap lands in the next bucket).
+ *
+ * Pure C, no kernel calls: times are passed in (Unix seconds).
+ */
+
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "register_map.h"
+
+enum rollup_tier {
+    ROLLUP_RAW,
+    ROLLUP_QUARTER,             /* 15 minutes */
+    ROLLUP_DAILY,
+    ROLLUP_TIER_COUNT
+};
+
+#define ROLLUP_QUARTER_SEC 900
+#define ROLLUP_DAY_SEC 86400
+
+/* One aggregate; raw samples are returned in the same shape by queries */
+struct rollup_record {
+    uint32_t start_s;           /* Unix time of the bucket start */
+    uint32_t forward_total;     /* Totals at the end, m3 x 1000 */
+    uint32_t reverse_total;
+    uint32_t forward_used;      /* Volume in the bucket, m3 x 1000 (L) */
+    uint32_t reverse_used;
+    uint32_t flow_max;          /* L/h x 100 */
+    uint16_t pressure_min;      /* MPa x 1000 */
+    uint16_t pressure_max;
+    uint16_t samples;           /* 0 = empty */
+    uint16_t status;            /* Flags seen in the bucket (OR) */
+};
+
+struct rollup_closed {
+    enum rollup_tier tier;
+    struct rollup_record rec;
+};
+
+struct rollup {
+    int32_t day_offset_s;       /* Local day start relative to UTC midnight */
+    struct rollup_record quarter;
+    struct rollup_record day;
+
+    /* Totals at the end of the previous bucket */
+    uint32_t forward_base;
+    uint32_t reverse_base;
+    bool have_base;
+};
+
+/** @brief Period of a tier's buckets in seconds (raw: 0) */
+uint32_t rollup_period_s(enum rollup_tier tier);
+
+/** @brief Short name of a tier ("raw", "15min", "daily") */
+const char *rollup_tier_name(enum rollup_tier tier);
+
+/**
+ * @brief Start empty
+ *
+ * @param day_offset_s Added to UTC before cutting days, e.g. 7200 for UTC+2
+ */
+void rollup_init(struct rollup *r, int32_t day_offset_s);
+
+/**
+ * @brief Feed one sample
+ *
+ * @param out Buckets closed by it: a 15-minute one and possibly its day
+ * @return Number of entries in @p out, 0..2
+ */
+int rollup_add(struct rollup *r, uint32_t ts_s, const uint32_t values[BOVE_FIELD_COUNT],
+               struct rollup_closed out[2]);
+
+/**
+ * @brief Rebuild the state from stored 15-minute buckets after a reboot
+ *
+ * Call with the stored buckets in order. Buckets of days up to
+ * @p last_day_s (the newest stored day, 0 if none) only set the totals
+ * the next bucket counts from; later ones are merged into the open day.
+ */
+void rollup_restore(struct rollup *r, const struct rollup_record *quarter,
+                    uint32_t last_day_s);
+
+/** @brief A raw sample as a record; volume counted from @p prev if given */
+void rollup_from_sample(struct rollup_record *out, uint32_t ts_s,
+                        const uint32_t values[BOVE_FIELD_COUNT],
+                        const struct rollup_record *prev);
+
+/**
+ * @brief True once a record starting at @p start_s is past retention
+ *
+ * A record newer than @p now_s (the clock was set back) is kept.
+ */
+bool rollup_past_retention(uint32_t start_s, uint32_t now_s, uint32_t retention_s);
+
+/**
+ * @brief Tier for a range query
+ *
+ * The coarsest tier whose buckets are no longer than @p resolution_s; if
+ * that tier no longer reaches back to @p from_s, the next coarser one that
+ * does. If none does, the tier whose records reach back furthest.
+ *
+ * @param oldest_s Start of the oldest stored record per tier, 0 = empty
+ */
+enum rollup_tier rollup_pick_tier(uint32_t resolution_s, uint32_t from_s,
+                                  const uint32_t oldest_s[ROLLUP_TIER_COUNT]);
+
+#endif /* ROLLUP_H_ */
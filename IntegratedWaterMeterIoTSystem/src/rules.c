@@ -0,0 +1,646 @@
+/**
+ * @file rules.c
+ * @brief Edge alarm rules compiled to stack bytecode
+ *
+ * @details
+ * A recursive-descent compiler turns each rule expression into a compact
+ * postfix program over 32-bit signed integers. Evaluation is a single pass
+ * over at most RULES_CODE_LEN bytes with a fixed-size stack whose depth is
+ * proven at compile time, so rules_exec() needs no bounds checks and runs
+ * in a few microseconds per rule. Nesting is limited so that rule text
+ * from the cloud cannot exhaust the parser's stack.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rules.h"
+
+enum rule_op {
+    OP_PUSH8 = 1,   /* + int8 immediate */
+    OP_PUSH32,      /* + int32 immediate, little-endian */
+    OP_LOAD,        /* + field index */
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_BAND,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_LAND,
+    OP_LOR,
+    OP_NOT,
+    OP_NEG,
+};
+
+enum rule_field {
+    FIELD_FLOW_RATE,
+    FIELD_FORWARD_TOTAL,
+    FIELD_REVERSE_TOTAL,
+    FIELD_PRESSURE,
+    FIELD_TEMPERATURE,
+    FIELD_STATUS,
+};
+
+static const struct {
+    const char *name;
+    enum rule_field field;
+} field_names[] = {
+    { "flow_rate", FIELD_FLOW_RATE },
+    { "forward_total", FIELD_FORWARD_TOTAL },
+    { "reverse_total", FIELD_REVERSE_TOTAL },
+    { "pressure", FIELD_PRESSURE },
+    { "temperature", FIELD_TEMPERATURE },
+    { "status", FIELD_STATUS },
+};
+
+#define ARRAY_LEN(a) (sizeof(a) / sizeof((a)[0]))
+
+/* ============================================================================
+ * COMPILER
+ * ============================================================================ */
+
+struct compiler {
+    const char *p;
+    const char *end;
+    struct rule *rule;
+    int depth;
+    int nesting;
+    int err;
+    const char *msg;
+};
+
+static void fail(struct compiler *c, int err, const char *msg)
+{
+    if (c->err == 0) {
+        c->err = err;
+        c->msg = msg;
+    }
+}
+
+static void skip_ws(struct compiler *c)
+{
+    while (c->p < c->end && isspace((unsigned char)*c->p)) {
+        c->p++;
+    }
+}
+
+static bool accept(struct compiler *c, const char *tok)
+{
+    size_t len = strlen(tok);
+
+    skip_ws(c);
+    if ((size_t)(c->end - c->p) >= len && strncmp(c->p, tok, len) == 0) {
+        c->p += len;
+        return true;
+    }
+    return false;
+}
+
+/* Operators sharing a prefix with a longer one ("&" vs "&&", "<" vs "<=") */
+static bool accept_exact(struct compiler *c, const char *tok, char not_next)
+{
+    size_t len = strlen(tok);
+
+    skip_ws(c);
+    if ((size_t)(c->end - c->p) >= len && strncmp(c->p, tok, len) == 0 &&
+        (c->p + len >= c->end || c->p[len] != not_next)) {
+        c->p += len;
+        return true;
+    }
+    return false;
+}
+
+static size_t ident_len(const struct compiler *c)
+{
+    const char *q = c->p;
+
+    if (q >= c->end || !(isalpha((unsigned char)*q) || *q == '_')) {
+        return 0;
+    }
+    while (q < c->end && (isalnum((unsigned char)*q) || *q == '_')) {
+        q++;
+    }
+    return q - c->p;
+}
+
+static bool accept_keyword(struct compiler *c, const char *kw)
+{
+    skip_ws(c);
+    size_t len = ident_len(c);
+
+    if (len == strlen(kw) && strncmp(c->p, kw, len) == 0) {
+        c->p += len;
+        return true;
+    }
+    return false;
+}
+
+static bool parse_int(struct compiler *c, int32_t *out)
+{
+    const char *q;
+    int64_t v = 0;
+    int base = 10;
+
+    skip_ws(c);
+    q = c->p;
+    if (q + 1 < c->end && q[0] == '0' && (q[1] == 'x' || q[1] == 'X')) {
+        base = 16;
+        q += 2;
+    }
+    if (q >= c->end || !(base == 16 ? isxdigit((unsigned char)*q) : isdigit((unsigned char)*q))) {
+        return false;
+    }
+    while (q < c->end && isxdigit((unsigned char)*q)) {
+        int d = isdigit((unsigned char)*q) ? *q - '0' : (tolower((unsigned char)*q) - 'a' + 10);
+
+        if (d >= base) {
+            break;
+        }
+        v = v * base + d;
+        if (v > INT32_MAX && !(base == 16 && v <= UINT32_MAX)) {
+            fail(c, -EINVAL, "literal out of range");
+            return false;
+        }
+        q++;
+    }
+    c->p = q;
+    *out = (int32_t)(uint32_t)v;
+    return true;
+}
+
+static void emit(struct compiler *c, uint8_t byte)
+{
+    if (c->rule->code_len >= RULES_CODE_LEN) {
+        fail(c, -ENOMEM, "expression too long");
+        return;
+    }
+    c->rule->code[c->rule->code_len++] = byte;
+}
+
+static void emit_op(struct compiler *c, enum rule_op op, int stack_effect)
+{
+    emit(c, op);
+    c->depth += stack_effect;
+    if (c->depth > RULES_STACK_DEPTH) {
+        fail(c, -ENOMEM, "expression too deep");
+    }
+}
+
+static void emit_push(struct compiler *c, int32_t v)
+{
+    if (v >= INT8_MIN && v <= INT8_MAX) {
+        emit_op(c, OP_PUSH8, 1);
+        emit(c, (uint8_t)(int8_t)v);
+    } else {
+        emit_op(c, OP_PUSH32, 1);
+        for (int i = 0; i < 4; i++) {
+            emit(c, (uint8_t)((uint32_t)v >> (8 * i)));
+        }
+    }
+}
+
+static void parse_expr(struct compiler *c);
+
+static void parse_primary(struct compiler *c);
+
+/* Each level costs several parser frames on the caller's stack */
+static bool enter(struct compiler *c)
+{
+    if (++c->nesting > RULES_MAX_NESTING) {
+        fail(c, -ENOMEM, "nested too deep");
+        return false;
+    }
+    return true;
+}
+
+static void parse_primary(struct compiler *c)
+{
+    int32_t v;
+
+    if (accept(c, "(")) {
+        if (enter(c)) {
+            parse_expr(c);
+            if (!accept(c, ")")) {
+                fail(c, -EINVAL, "expected ')'");
+            }
+        }
+        c->nesting--;
+        return;
+    }
+    if (accept_exact(c, "!", '=')) {
+        if (enter(c)) {
+            parse_primary(c);
+            emit_op(c, OP_NOT, 0);
+        }
+        c->nesting--;
+        return;
+    }
+    if (accept(c, "-")) {
+        if (enter(c)) {
+            parse_primary(c);
+            emit_op(c, OP_NEG, 0);
+        }
+        c->nesting--;
+        return;
+    }
+    if (parse_int(c, &v)) {
+        emit_push(c, v);
+        return;
+    }
+
+    size_t len = ident_len(c);
+
+    for (size_t i = 0; len > 0 && i < ARRAY_LEN(field_names); i++) {
+        if (len == strlen(field_names[i].name) &&
+            strncmp(c->p, field_names[i].name, len) == 0) {
+            c->p += len;
+            emit_op(c, OP_LOAD, 1);
+            emit(c, field_names[i].field);
+            return;
+        }
+    }
+    fail(c, -EINVAL, len > 0 ? "unknown field" : "expected operand");
+}
+
+static void parse_mul(struct compiler *c)
+{
+    parse_primary(c);
+    while (c->err == 0) {
+        if (accept(c, "*")) {
+            parse_primary(c);
+            emit_op(c, OP_MUL, -1);
+        } else if (accept(c, "/")) {
+            parse_primary(c);
+            emit_op(c, OP_DIV, -1);
+        } else if (accept(c, "%")) {
+            parse_primary(c);
+            emit_op(c, OP_MOD, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void parse_add(struct compiler *c)
+{
+    parse_mul(c);
+    while (c->err == 0) {
+        if (accept(c, "+")) {
+            parse_mul(c);
+            emit_op(c, OP_ADD, -1);
+        } else if (accept(c, "-")) {
+            parse_mul(c);
+            emit_op(c, OP_SUB, -1);
+        } else {
+            break;
+        }
+    }
+}
+
+static void parse_band(struct compiler *c)
+{
+    parse_add(c);
+    while (c->err == 0 && accept_exact(c, "&", '&')) {
+        parse_add(c);
+        emit_op(c, OP_BAND, -1);
+    }
+}
+
+static void parse_cmp(struct compiler *c)
+{
+    static const struct {
+        const char *tok;
+        enum rule_op op;
+    } ops[] = {
+        { "<=", OP_LE }, { ">=", OP_GE }, { "==", OP_EQ }, { "!=", OP_NE },
+        { "<", OP_LT }, { ">", OP_GT },
+    };
+
+    parse_band(c);
+    for (size_t i = 0; c->err == 0 && i < ARRAY_LEN(ops); i++) {
+        if (accept(c, ops[i].tok)) {
+            parse_band(c);
+            emit_op(c, ops[i].op, -1);
+            break;
+        }
+    }
+}
+
+static void parse_land(struct compiler *c)
+{
+    parse_cmp(c);
+    while (c->err == 0 && accept(c, "&&")) {
+        parse_cmp(c);
+        emit_op(c, OP_LAND, -1);
+    }
+}
+
+static void parse_expr(struct compiler *c)
+{
+    parse_land(c);
+    while (c->err == 0 && accept(c, "||")) {
+        parse_land(c);
+        emit_op(c, OP_LOR, -1);
+    }
+}
+
+static bool is_cmp(uint8_t op)
+{
+    return op >= OP_LT && op <= OP_NE;
+}
+
+/* Index of the last opcode, skipping the immediates of the final push */
+static int last_op_index(const struct rule *r)
+{
+    int pc = 0;
+    int last = -1;
+
+    while (pc < r->code_len) {
+        last = pc;
+        switch (r->code[pc]) {
+        case OP_PUSH8:
+        case OP_LOAD:
+            pc += 2;
+            break;
+        case OP_PUSH32:
+            pc += 5;
+            break;
+        default:
+            pc += 1;
+            break;
+        }
+    }
+    return last;
+}
+
+static int compile_one(const char *start, const char *end, struct rule *r,
+                       char *err, size_t err_len)
+{
+    struct compiler c = { .p = start, .end = end, .rule = r };
+    size_t len;
+    int32_t v;
+
+    memset(r, 0, sizeof(*r));
+
+    skip_ws(&c);
+    len = ident_len(&c);
+    if (len == 0 || len >= RULES_NAME_LEN) {
+        fail(&c, -EINVAL, "bad rule name");
+        goto out;
+    }
+    memcpy(r->name, c.p, len);
+    c.p += len;
+    if (!accept(&c, ":")) {
+        fail(&c, -EINVAL, "expected ':'");
+        goto out;
+    }
+
+    parse_expr(&c);
+
+    while (c.err == 0) {
+        if (accept_keyword(&c, "for")) {
+            if (!parse_int(&c, &v) || v < 0) {
+                fail(&c, -EINVAL, "bad duration");
+            } else {
+                r->duration_ms = (uint32_t)v * 1000U;
+            }
+        } else if (accept_keyword(&c, "hyst")) {
+            if (!parse_int(&c, &v) || v < 0) {
+                fail(&c, -EINVAL, "bad hysteresis");
+            } else {
+                r->hysteresis = v;
+            }
+        } else {
+            break;
+        }
+    }
+
+    skip_ws(&c);
+    if (c.err == 0 && c.p != c.end) {
+        fail(&c, -EINVAL, "unexpected input");
+    }
+
+    if (c.err == 0) {
+        int last = last_op_index(r);
+
+        r->cmp_op = (last >= 0 && is_cmp(r->code[last])) ? r->code[last] : 0;
+        if (r->hysteresis != 0 && (r->cmp_op == 0 || r->cmp_op == OP_EQ ||
+                                   r->cmp_op == OP_NE)) {
+            fail(&c, -EINVAL, "hyst needs a top-level <, <=, > or >=");
+        }
+    }
+
+out:
+    if (c.err != 0 && err != NULL) {
+        snprintf(err, err_len, "%.*s: %s at offset %d",
+                 (int)((end - start) < 24 ? (end - start) : 24), start, c.msg, (int)(c.p - start));
+    }
+    return c.err;
+}
+
+int rules_compile(const char *text, struct rule_set *set, char *err, size_t err_len)
+{
+    static struct rule_set staged;
+    const char *p = text;
+
+    memset(&staged, 0, sizeof(staged));
+
+    while (*p != '\0') {
+        const char *end = strchr(p, ';');
+        const char *q;
+        int ret;
+
+        if (end == NULL) {
+            end = p + strlen(p);
+        }
+
+        /* Skip empty segments (trailing ';', blank lines) */
+        for (q = p; q < end && isspace((unsigned char)*q); q++) {
+        }
+        if (q < end) {
+            if (staged.count >= RULES_MAX) {
+                if (err != NULL) {
+                    snprintf(err, err_len, "more than %d rules", RULES_MAX);
+                }
+                return -ENOMEM;
+            }
+            ret = compile_one(q, end, &staged.rules[staged.count], err, err_len);
+            if (ret != 0) {
+                return ret;
+            }
+            staged.count++;
+        }
+
+        p = (*end == ';') ? end + 1 : end;
+    }
+
+    *set = staged;
+    return 0;
+}
+
+/* ============================================================================
+ * EVALUATION
+ * ============================================================================ */
+
+static int32_t load_field(const meter_data_t *d, uint8_t field)
+{
+    switch (field) {
+    case FIELD_FLOW_RATE:     return (int32_t)d->flow_rate;
+    case FIELD_FORWARD_TOTAL: return (int32_t)d->forward_total;
+    case FIELD_REVERSE_TOTAL: return (int32_t)d->reverse_total;
+    case FIELD_PRESSURE:      return d->pressure;
+    case FIELD_TEMPERATURE:   return d->temperature;
+    case FIELD_STATUS:        return d->status;
+    default:                  return 0;
+    }
+}
+
+static int32_t saturate(int64_t v)
+{
+    return (v > INT32_MAX) ? INT32_MAX : (v < INT32_MIN) ? INT32_MIN : (int32_t)v;
+}
+
+int32_t rules_exec(const struct rule *rule, const meter_data_t *data, int32_t bias)
+{
+    int32_t stack[RULES_STACK_DEPTH];
+    int sp = 0;
+    int pc = 0;
+
+    while (pc < rule->code_len) {
+        uint8_t op = rule->code[pc++];
+        int64_t a, b;
+
+        if (op == OP_PUSH8) {
+            stack[sp++] = (int8_t)rule->code[pc++];
+            continue;
+        }
+        if (op == OP_PUSH32) {
+            stack[sp++] = (int32_t)((uint32_t)rule->code[pc] |
+                                    ((uint32_t)rule->code[pc + 1] << 8) |
+                                    ((uint32_t)rule->code[pc + 2] << 16) |
+                                    ((uint32_t)rule->code[pc + 3] << 24));
+            pc += 4;
+            continue;
+        }
+        if (op == OP_LOAD) {
+            stack[sp++] = load_field(data, rule->code[pc++]);
+            continue;
+        }
+        if (op == OP_NOT) {
+            stack[sp - 1] = !stack[sp - 1];
+            continue;
+        }
+        if (op == OP_NEG) {
+            stack[sp - 1] = saturate(-(int64_t)stack[sp - 1]);
+            continue;
+        }
+
+        b = stack[--sp];
+        a = stack[sp - 1];
+
+        /* Hysteresis shifts only the rule's own top-level threshold */
+        if (pc == rule->code_len && is_cmp(op)) {
+            b += bias;
+        }
+
+        switch (op) {
+        case OP_ADD:  a = a + b; break;
+        case OP_SUB:  a = a - b; break;
+        case OP_MUL:  a = a * b; break;
+        case OP_DIV:  a = (b != 0) ? a / b : 0; break;
+        case OP_MOD:  a = (b != 0) ? a % b : 0; break;
+        case OP_BAND: a = a & b; break;
+        case OP_LT:   a = a < b; break;
+        case OP_LE:   a = a <= b; break;
+        case OP_GT:   a = a > b; break;
+        case OP_GE:   a = a >= b; break;
+        case OP_EQ:   a = a == b; break;
+        case OP_NE:   a = a != b; break;
+        case OP_LAND: a = a && b; break;
+        case OP_LOR:  a = a || b; break;
+        default:      a = 0; break;
+        }
+        stack[sp - 1] = saturate(a);
+    }
+
+    return (sp > 0) ? stack[0] : 0;
+}
+
+static int32_t clear_bias(const struct rule *r)
+{
+    switch (r->cmp_op) {
+    case OP_GT:
+    case OP_GE:
+        return -r->hysteresis;
+    case OP_LT:
+    case OP_LE:
+        return r->hysteresis;
+    default:
+        return 0;
+    }
+}
+
+void rules_evaluate(struct rule_set *set, const meter_data_t *data, int64_t now_ms,
+                    rules_transition_cb_t cb, void *user_data)
+{
+    for (int i = 0; i < set->count; i++) {
+        struct rule *r = &set->rules[i];
+        bool cond = rules_exec(r, data, r->active ? clear_bias(r) : 0) != 0;
+
+        if (!cond) {
+            r->pending = false;
+            if (r->active) {
+                r->active = false;
+                cb(r, false, user_data);
+            }
+            continue;
+        }
+
+        if (r->active) {
+            continue;
+        }
+        if (!r->pending) {
+            r->pending = true;
+            r->pending_since_ms = now_ms;
+        }
+        if (now_ms - r->pending_since_ms >= (int64_t)r->duration_ms) {
+            r->active = true;
+            r->pending = false;
+            cb(r, true, user_data);
+        }
+    }
+}
+
+void rules_inherit_state(struct rule_set *set, const struct rule_set *old,
+                         rules_transition_cb_t cb, void *user_data)
+{
+    for (int j = 0; j < old->count; j++) {
+        const struct rule *o = &old->rules[j];
+        bool kept = false;
+
+        for (int i = 0; i < set->count; i++) {
+            struct rule *r = &set->rules[i];
+
+            if (strcmp(r->name, o->name) == 0) {
+                r->active = o->active;
+                r->pending = o->pending;
+                r->pending_since_ms = o->pending_since_ms;
+                kept = true;
+                break;
+            }
+        }
+
+        /* A raised alarm whose rule was deleted must not stay raised */
+        if (!kept && o->active) {
+            cb(o, false, user_data);
+        }
+    }
+}
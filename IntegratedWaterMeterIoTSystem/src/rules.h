@@ -0,0 +1,102 @@
+/**
+ * @file rules.h
+ * @brief Edge alarm rules compiled to stack bytecode
+ *
+ * @details
+ * Rules arrive as the shared attribute "alarmRules", a ';'-separated list:
+ *
+ *   name: <expr> [for <seconds>] [hyst <value>]
+ *
+ * e.g.
+ *
+ *   highFlow: flow_rate > 500000 for 60 hyst 5000;
+ *   lowPressure: pressure < 150 for 30 hyst 10;
+ *   empty: status & 0x0004
+ *
+ * <expr> uses the meter_data_t fields flow_rate, forward_total,
+ * reverse_total, pressure, temperature and status in raw (scaled integer)
+ * units, integer literals, + - * / % &, comparisons, && || ! and
+ * parentheses, nested at most RULES_MAX_NESTING deep. Arithmetic
+ * saturates at the int32 limits. "for" delays raising until the condition held that long;
+ * "hyst" widens the clear threshold of a top-level comparison so the alarm
+ * does not chatter around the set point.
+ */
+
+#ifndef RULES_H_
+#define RULES_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "meter.h"
+
+#define RULES_MAX 8
+#define RULES_NAME_LEN 16
+#define RULES_CODE_LEN 64
+#define RULES_STACK_DEPTH 8
+#define RULES_MAX_NESTING 16     /* Parentheses, ! and unary - */
+
+struct rule {
+    char name[RULES_NAME_LEN];
+    uint8_t code[RULES_CODE_LEN];
+    uint8_t code_len;
+    uint8_t cmp_op;             /* Final comparison opcode, 0 if none */
+    int32_t hysteresis;
+    uint32_t duration_ms;
+
+    /* Runtime state */
+    bool active;
+    bool pending;
+    int64_t pending_since_ms;
+};
+
+struct rule_set {
+    struct rule rules[RULES_MAX];
+    uint8_t count;
+};
+
+/**
+ * @brief Called for every raise (active = true) or clear transition
+ */
+typedef void (*rules_transition_cb_t)(const struct rule *rule, bool active,
+                                      void *user_data);
+
+/**
+ * @brief Compile rule text into @p set
+ *
+ * @param text    ';'-separated rule list (see file description)
+ * @param set     Output; untouched on error
+ * @param err     Buffer for a human-readable error, may be NULL
+ * @param err_len Size of @p err
+ *
+ * @return 0 on success, -EINVAL on syntax error, -ENOMEM if a limit is hit
+ */
+int rules_compile(const char *text, struct rule_set *set, char *err, size_t err_len);
+
+/**
+ * @brief Evaluate one rule's bytecode against a sample
+ *
+ * @param bias Added to the right-hand side of the final comparison
+ *
+ * @return Non-zero if the condition holds
+ */
+int32_t rules_exec(const struct rule *rule, const meter_data_t *data, int32_t bias);
+
+/**
+ * @brief Run every rule against a sample and report state transitions
+ */
+void rules_evaluate(struct rule_set *set, const meter_data_t *data, int64_t now_ms,
+                    rules_transition_cb_t cb, void *user_data);
+
+/**
+ * @brief Carry runtime state of same-named rules from @p old to @p set
+ *
+ * Keeps alarms that are already raised from re-firing when the rule text is
+ * re-sent unchanged (e.g. after every reconnect). Active rules that no
+ * longer exist are reported to @p cb as cleared.
+ */
+void rules_inherit_state(struct rule_set *set, const struct rule_set *old,
+                         rules_transition_cb_t cb, void *user_data);
+
+#endif /* RULES_H_ */
@@ -0,0 +1,534 @@
+/**
+ * @file sim.c
+ * @brief Shared state of the native_sim world: PRNG, outages, run report
+ *
+ * @details
+ * Everything here runs on the virtual clock. The outage schedule is a fixed
+ * pattern (one primary broker outage of CONFIG_APP_SIM_OUTAGE_DURATION_MIN
+ * every CONFIG_APP_SIM_OUTAGE_INTERVAL_MIN, starting half an interval in) so
+ * runs are comparable between firmware changes. Poor-link periods follow
+ * the same kind of pattern, starting a quarter interval in.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/spinlock.h>
+#include <zephyr/sys/printk.h>
+#include <nsi_main.h>
+#include <stdlib.h>
+
+#include "sim.h"
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+#include "swing_door.h"
+#endif
+
+#if defined(CONFIG_APP_ARCHIVE)
+#include "archive.h"
+#endif
+
+#if defined(CONFIG_APP_PULSE)
+#include "pulse.h"
+#endif
+
+/* Publish-to-PUBACK latency histogram: 10 ms buckets up to 30 s */
+#define LATENCY_BUCKET_MS 10
+#define LATENCY_BUCKETS 3000
+
+/* Stored samples awaiting their history record; a segment is at most
+ * CONFIG_APP_HISTORY_MAX_GAP_SEC of 30 s reads
+ */
+#define TRACE_MAX 2048
+
+#define MS_PER_MIN (60 * 1000LL)
+#define MS_PER_HOUR (60 * MS_PER_MIN)
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+struct sim_stats {
+    uint32_t modbus_served;
+    uint32_t modbus_timeouts;
+    uint32_t modbus_corrupted;
+    uint32_t pulses_emitted;
+    uint32_t pulses_missed;
+
+    uint32_t telemetry_published;
+    uint32_t telemetry_messages;
+    uint32_t telemetry_acked;
+    uint32_t telemetry_lost;
+    uint32_t telemetry_resent;
+    uint32_t telemetry_stored;
+    uint32_t telemetry_backfilled;
+    uint32_t history_points;
+    uint32_t history_backfilled;
+    uint64_t bytes_backfilled;
+    uint32_t trace_scored;
+    uint32_t trace_overflow;
+    uint32_t max_error[BOVE_FIELD_COUNT];
+    uint32_t other_published;
+    uint32_t other_acked;
+    uint32_t other_lost;
+    uint64_t bytes_published;
+    uint64_t bytes_acked;
+
+    uint8_t batch_size;
+    uint8_t batch_size_max;
+    uint32_t batch_flush_ms;
+    uint32_t batch_increases;
+    uint32_t batch_decreases;
+
+    uint32_t connects;
+    uint32_t connect_failures;
+    uint32_t broker_switches;
+
+    uint32_t latency_min_ms;
+    uint32_t latency_max_ms;
+    uint64_t latency_sum_ms;
+    uint32_t latency_count;
+    uint32_t latency_hist[LATENCY_BUCKETS + 1];   /* Last bucket: overflow */
+};
+
+static struct k_spinlock lock;
+static struct sim_stats stats = {
+    .latency_min_ms = UINT32_MAX,
+};
+static uint32_t rng_state = CONFIG_APP_SIM_SEED ? CONFIG_APP_SIM_SEED : 0x2545F491;
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+/* Samples stored since the last history record, and that record */
+static struct telemetry_record trace[TRACE_MAX];
+static uint32_t trace_len;
+static struct telemetry_record last_point;
+static bool have_point;
+#endif
+
+/* ============================================================================
+ * RANDOMNESS AND SCHEDULE
+ * ============================================================================ */
+
+uint32_t sim_rand(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    uint32_t x = rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    k_spin_unlock(&lock, key);
+    return x;
+}
+
+bool sim_chance(uint32_t permille)
+{
+    return permille > 0 && (sim_rand() % 1000) < permille;
+}
+
+uint32_t sim_uniform(uint32_t span)
+{
+    return span ? sim_rand() % span : 0;
+}
+
+bool sim_network_down(void)
+{
+    const int64_t interval = CONFIG_APP_SIM_OUTAGE_INTERVAL_MIN * MS_PER_MIN;
+    const int64_t duration = CONFIG_APP_SIM_OUTAGE_DURATION_MIN * MS_PER_MIN;
+    int64_t t = k_uptime_get() - interval / 2;
+
+    if (interval <= 0 || duration <= 0 || t < 0) {
+        return false;
+    }
+    return (t % interval) < duration;
+}
+
+bool sim_link_poor(void)
+{
+    const int64_t interval = CONFIG_APP_SIM_POOR_LINK_INTERVAL_MIN * MS_PER_MIN;
+    const int64_t duration = CONFIG_APP_SIM_POOR_LINK_DURATION_MIN * MS_PER_MIN;
+    int64_t t = k_uptime_get() - interval / 4;
+
+    if (interval <= 0 || duration <= 0 || t < 0) {
+        return false;
+    }
+    return (t % interval) < duration;
+}
+
+/** @brief Outages that have started by @p now_ms */
+static uint32_t outages_started(int64_t now_ms)
+{
+    const int64_t interval = CONFIG_APP_SIM_OUTAGE_INTERVAL_MIN * MS_PER_MIN;
+    int64_t t = now_ms - interval / 2;
+
+    if (interval <= 0 || CONFIG_APP_SIM_OUTAGE_DURATION_MIN <= 0 || t < 0) {
+        return 0;
+    }
+    return (uint32_t)(t / interval) + 1;
+}
+
+/** @brief Poor-link periods that have started by @p now_ms */
+static uint32_t poor_periods_started(int64_t now_ms)
+{
+    const int64_t interval = CONFIG_APP_SIM_POOR_LINK_INTERVAL_MIN * MS_PER_MIN;
+    int64_t t = now_ms - interval / 4;
+
+    if (interval <= 0 || CONFIG_APP_SIM_POOR_LINK_DURATION_MIN <= 0 || t < 0) {
+        return 0;
+    }
+    return (uint32_t)(t / interval) + 1;
+}
+
+/* ============================================================================
+ * STATISTICS
+ * ============================================================================ */
+
+void sim_stat_modbus_served(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.modbus_served++;
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_modbus_fault(bool timeout)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (timeout) {
+        stats.modbus_timeouts++;
+    } else {
+        stats.modbus_corrupted++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_pulse(bool missed)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (missed) {
+        stats.pulses_missed++;
+    } else {
+        stats.pulses_emitted++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_published(uint32_t bytes, uint32_t samples)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (samples > 0) {
+        stats.telemetry_published += samples;
+        stats.telemetry_messages++;
+    } else {
+        stats.other_published++;
+    }
+    stats.bytes_published += bytes;
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_resent(uint32_t samples)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.telemetry_resent += samples;
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_acked(uint32_t latency_ms, uint32_t bytes, uint32_t samples)
+{
+    uint32_t bucket = MIN(latency_ms / LATENCY_BUCKET_MS, LATENCY_BUCKETS);
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    if (samples > 0) {
+        stats.telemetry_acked += samples;
+    } else {
+        stats.other_acked++;
+    }
+    stats.bytes_acked += bytes;
+    stats.latency_min_ms = MIN(stats.latency_min_ms, latency_ms);
+    stats.latency_max_ms = MAX(stats.latency_max_ms, latency_ms);
+    stats.latency_sum_ms += latency_ms;
+    stats.latency_count++;
+    stats.latency_hist[bucket]++;
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_lost(uint32_t samples)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    if (samples > 0) {
+        stats.telemetry_lost += samples;
+    } else {
+        stats.other_lost++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_stored(const struct telemetry_record *rec)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.telemetry_stored++;
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    if (trace_len < TRACE_MAX) {
+        trace[trace_len++] = *rec;
+    } else {
+        stats.trace_overflow++;
+    }
+#else
+    ARG_UNUSED(rec);
+#endif
+    k_spin_unlock(&lock, key);
+}
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+/**
+ * @brief Score the traced samples up to @p rec against the line from the
+ *        previous record to it, and drop them from the trace
+ */
+static void score_trace(const struct telemetry_record *rec)
+{
+    const struct telemetry_record *a = (have_point && last_point.ts_ms < rec->ts_ms) ?
+                                       &last_point : rec;
+    uint32_t kept = 0;
+
+    for (uint32_t i = 0; i < trace_len; i++) {
+        if (trace[i].ts_ms > rec->ts_ms) {
+            trace[kept++] = trace[i];
+            continue;
+        }
+        for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+            int64_t err = (int64_t)swing_door_value_at(a, rec, f, trace[i].ts_ms) -
+                          trace[i].values[f];
+
+            err = (err < 0) ? -err : err;
+            stats.max_error[f] = MAX(stats.max_error[f], (uint32_t)err);
+        }
+        stats.trace_scored++;
+    }
+    trace_len = kept;
+    last_point = *rec;
+    have_point = true;
+}
+#endif
+
+void sim_stat_history_point(const struct telemetry_record *rec, uint16_t samples)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.history_points++;
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    score_trace(rec);
+#else
+    ARG_UNUSED(rec);
+#endif
+    ARG_UNUSED(samples);
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_backfilled(uint32_t records, uint32_t samples, uint32_t bytes)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.history_backfilled += records;
+    stats.telemetry_backfilled += samples;
+    stats.bytes_backfilled += bytes;
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_batch(uint8_t size, uint32_t flush_ms, bool increase)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.batch_size = size;
+    stats.batch_size_max = MAX(stats.batch_size_max, size);
+    stats.batch_flush_ms = flush_ms;
+    if (increase) {
+        stats.batch_increases++;
+    } else {
+        stats.batch_decreases++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_connect(bool success)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.connects++;
+    if (!success) {
+        stats.connect_failures++;
+    }
+    k_spin_unlock(&lock, key);
+}
+
+void sim_stat_broker_switch(void)
+{
+    k_spinlock_key_t key = k_spin_lock(&lock);
+    stats.broker_switches++;
+    k_spin_unlock(&lock, key);
+}
+
+/* ============================================================================
+ * REPORT
+ * ============================================================================ */
+
+bool sim_finished(void)
+{
+    return k_uptime_get() >= CONFIG_APP_SIM_DURATION_HOURS * MS_PER_HOUR;
+}
+
+/**
+ * @brief Latency below which @p permille of the acked messages fall
+ *
+ * Resolved to the upper edge of a histogram bucket.
+ */
+static uint32_t latency_percentile(const struct sim_stats *s, uint32_t permille)
+{
+    uint64_t target = ((uint64_t)s->latency_count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (uint32_t i = 0; i <= LATENCY_BUCKETS; i++) {
+        seen += s->latency_hist[i];
+        if (seen >= target && seen > 0) {
+            return (i == LATENCY_BUCKETS) ? s->latency_max_ms
+                                          : MIN((i + 1) * LATENCY_BUCKET_MS,
+                                                s->latency_max_ms);
+        }
+    }
+    return 0;
+}
+
+/** @brief Print @p num / @p den as a percentage with two decimals */
+static void print_ratio(const char *label, uint64_t num, uint64_t den)
+{
+    uint64_t bp = den ? (num * 10000U) / den : 0;
+
+    printk("  %-26s %u.%02u %%\n", label, (uint32_t)(bp / 100), (uint32_t)(bp % 100));
+}
+
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+static void report_compression(const struct sim_stats *s)
+{
+#define FIELD_KEY(id, key, offset, width) [BOVE_##id] = key,
+    static const char *const keys[BOVE_FIELD_COUNT] = { BOVE_FIELDS(FIELD_KEY) };
+#undef FIELD_KEY
+    static const uint32_t tol[BOVE_FIELD_COUNT] = {
+        [BOVE_FLOW_RATE] = CONFIG_APP_HISTORY_TOL_FLOW,
+        [BOVE_FORWARD_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_REVERSE_TOTAL] = CONFIG_APP_HISTORY_TOL_TOTAL,
+        [BOVE_PRESSURE] = CONFIG_APP_HISTORY_TOL_PRESSURE,
+        [BOVE_TEMPERATURE] = CONFIG_APP_HISTORY_TOL_TEMPERATURE,
+    };
+    uint32_t ratio_x100 = s->history_points ?
+                          (uint32_t)((uint64_t)s->telemetry_stored * 100U / s->history_points) : 0;
+
+    printk("History compression\n");
+    printk("  Samples -> records         %u -> %u (%u.%02u : 1)\n", s->telemetry_stored,
+           s->history_points, ratio_x100 / 100, ratio_x100 % 100);
+    printk("  Samples scored             %u (%u untraced)\n", s->trace_scored,
+           s->trace_overflow);
+    printk("  Max error / tolerance     ");
+    for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+        printk(" %s %u/%u", keys[f], s->max_error[f], tol[f]);
+    }
+    printk("\n");
+}
+#endif
+
+#if defined(CONFIG_APP_ARCHIVE)
+static void report_archive(void)
+{
+    struct archive_stats a;
+
+    archive_get_stats(&a);
+    printk("Archive (stored / written / expired / dropped)\n");
+    for (int id = 0; id < ROLLUP_TIER_COUNT; id++) {
+        printk("  %-26s %u / %u / %u / %u\n", rollup_tier_name(id), a.records[id],
+               a.written[id], a.expired[id], a.dropped[id]);
+    }
+}
+#endif
+
+#if defined(CONFIG_APP_PULSE)
+static void report_pulse(const struct sim_stats *s)
+{
+    struct pulse_stats p;
+
+    pulse_get_stats(&p);
+    printk("Pulse input\n");
+    printk("  Pulses emitted (missed)    %u (%u)\n", s->pulses_emitted, s->pulses_missed);
+    printk("  Pulses counted (bounces)   %u (%u)\n", p.pulses, p.bounces);
+    printk("  Flow starts / stops        %u / %u\n", p.starts, p.stops);
+    printk("  Reads brought forward      %u\n", p.wakeups);
+    printk("  Checks (mismatches)        %u (%u)\n", p.checks, p.mismatches);
+    printk("  Largest drift              %s%u.%02u %%\n", p.max_drift_bp < 0 ? "-" : "",
+           (uint32_t)abs(p.max_drift_bp) / 100, (uint32_t)abs(p.max_drift_bp) % 100);
+}
+#endif
+
+void sim_report(void)
+{
+    static struct sim_stats s;
+    int64_t now = k_uptime_get();
+    k_spinlock_key_t key = k_spin_lock(&lock);
+
+    s = stats;
+    k_spin_unlock(&lock, key);
+
+    uint32_t hours_x100 = (uint32_t)(now * 100 / MS_PER_HOUR);
+    uint32_t modbus_total = s.modbus_served + s.modbus_timeouts + s.modbus_corrupted;
+    uint32_t delivered = s.telemetry_acked + s.telemetry_backfilled;
+    uint32_t produced = s.telemetry_published + s.telemetry_lost + s.telemetry_stored;
+    uint64_t per_hour_x100 = hours_x100 ? (uint64_t)delivered * 10000U / hours_x100 : 0;
+
+    printk("\n========================================\n");
+    printk("  SIMULATION REPORT (seed %u)\n", (uint32_t)CONFIG_APP_SIM_SEED);
+    printk("========================================\n");
+    printk("  Simulated time             %u.%02u h\n", hours_x100 / 100, hours_x100 % 100);
+    printk("  Meters on the bus          %u\n", CONFIG_APP_SIM_METERS);
+    printk("Modbus\n");
+    printk("  Requests                   %u\n", modbus_total);
+    printk("  Served                     %u\n", s.modbus_served);
+    printk("  Injected timeouts          %u\n", s.modbus_timeouts);
+    printk("  Injected CRC errors        %u\n", s.modbus_corrupted);
+#if defined(CONFIG_APP_PULSE)
+    report_pulse(&s);
+#endif
+    printk("Uplink\n");
+    printk("  Connect attempts           %u (%u failed)\n", s.connects, s.connect_failures);
+    printk("  Broker endpoints           %u\n", CONFIG_APP_SIM_BROKERS);
+    printk("  Primary broker outages     %u\n", outages_started(now));
+    printk("  Broker switches            %u\n", s.broker_switches);
+    printk("  Poor-link periods          %u\n", poor_periods_started(now));
+    printk("  Telemetry published        %u (%u messages)\n", s.telemetry_published,
+           s.telemetry_messages);
+    printk("  Telemetry acked            %u\n", s.telemetry_acked);
+    printk("  Telemetry re-sent          %u\n", s.telemetry_resent);
+    printk("  Telemetry dropped (full)   %u\n", s.telemetry_lost);
+    printk("  Telemetry unacked at end   %u\n", s.telemetry_published - s.telemetry_acked);
+    printk("  Telemetry stored offline   %u\n", s.telemetry_stored);
+    printk("  Telemetry backfilled       %u (%u records, %u bytes)\n",
+           s.telemetry_backfilled, s.history_backfilled, (uint32_t)s.bytes_backfilled);
+    printk("  Other messages (acked)     %u (%u)\n", s.other_published, s.other_acked);
+    printk("  Batch size now (max)       %u (%u), flush %u s\n", s.batch_size,
+           s.batch_size_max, s.batch_flush_ms / 1000);
+    printk("  Batch increases/decreases  %u / %u\n", s.batch_increases, s.batch_decreases);
+    print_ratio("Delivery ratio", delivered, produced);
+    print_ratio("Delivered per Modbus read", delivered, modbus_total);
+    printk("  Delivered samples/hour     %u.%02u\n",
+           (uint32_t)(per_hour_x100 / 100), (uint32_t)(per_hour_x100 % 100));
+    printk("  Bytes published (acked)    %u (%u)\n",
+           (uint32_t)s.bytes_published, (uint32_t)s.bytes_acked);
+#if defined(CONFIG_APP_HISTORY_COMPRESS)
+    report_compression(&s);
+#endif
+#if defined(CONFIG_APP_ARCHIVE)
+    report_archive();
+#endif
+    printk("Publish -> PUBACK latency (ms)\n");
+    if (s.latency_count > 0) {
+        printk("  min %u  avg %u  p50 %u  p95 %u  p99 %u  max %u\n",
+               s.latency_min_ms, (uint32_t)(s.latency_sum_ms / s.latency_count),
+               latency_percentile(&s, 500), latency_percentile(&s, 950),
+               latency_percentile(&s, 990), s.latency_max_ms);
+    } else {
+        printk("  no acknowledged messages\n");
+    }
+    printk("========================================\n");
+
+    nsi_exit(0);
+    CODE_UNREACHABLE;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file sim.h
+ * @brief Deterministic virtual world for the native_sim build
+ *
+ * @details
+ * The simulation replaces the physical meter (sim_meter.c, a BOVE slave on
+ * an emulated UART) and the network (sim_cloud.c, implementing cloud.h).
+ * native_sim runs without real-time slowdown, so every k_sleep() in the
+ * firmware advances the virtual clock instantly; all randomness comes from
+ * one seeded generator, so a given configuration always replays the same
+ * run.
+ */
+
+#ifndef SIM_H_
+#define SIM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "telemetry_batch.h"
+
+/** @brief Next value of the seeded generator (xorshift32) */
+uint32_t sim_rand(void);
+
+/** @brief True with probability @p permille / 1000 */
+bool sim_chance(uint32_t permille);
+
+/** @brief Uniform value in [0, span) */
+uint32_t sim_uniform(uint32_t span);
+
+/** @brief True while the scheduled outage of the primary broker is in effect */
+bool sim_network_down(void);
+
+/** @brief True during a scheduled poor-link period (weak RSSI, heavy loss) */
+bool sim_link_poor(void);
+
+/* ----------------------------------------------------------------------------
+ * Statistics
+ * ---------------------------------------------------------------------------- */
+
+/** @brief A Modbus request was answered with a valid frame */
+void sim_stat_modbus_served(void);
+
+/** @brief A Modbus request was deliberately left unanswered or corrupted */
+void sim_stat_modbus_fault(bool timeout);
+
+/** @brief The pulse meter passed one pulse volume; @p missed if not emitted */
+void sim_stat_pulse(bool missed);
+
+/*
+ * @p samples is the number of telemetry samples a message carries, 0 for
+ * anything other than telemetry.
+ */
+
+/** @brief A message left the device for the first time */
+void sim_stat_published(uint32_t bytes, uint32_t samples);
+
+/** @brief A message was sent again on a new session */
+void sim_stat_resent(uint32_t samples);
+
+/** @brief The broker acknowledged a message after @p latency_ms */
+void sim_stat_acked(uint32_t latency_ms, uint32_t bytes, uint32_t samples);
+
+/** @brief A message was dropped because the outbox was full */
+void sim_stat_lost(uint32_t samples);
+
+/** @brief A sample taken offline was stored for backfill (kept as a trace) */
+void sim_stat_stored(const struct telemetry_record *rec);
+
+/**
+ * @brief A history record standing for @p samples was written
+ *
+ * With compression, the traced samples up to it are reconstructed from the
+ * previous record and this one and the largest error per field is kept.
+ */
+void sim_stat_history_point(const struct telemetry_record *rec, uint16_t samples);
+
+/** @brief A backfill request was accepted */
+void sim_stat_backfilled(uint32_t records, uint32_t samples, uint32_t bytes);
+
+/** @brief The telemetry batch operating point moved up or down */
+void sim_stat_batch(uint8_t size, uint32_t flush_ms, bool increase);
+
+/** @brief The device went through a connect cycle */
+void sim_stat_connect(bool success);
+
+/** @brief A new session landed on a different broker endpoint */
+void sim_stat_broker_switch(void);
+
+/** @brief True once the configured simulated duration has elapsed */
+bool sim_finished(void);
+
+/** @brief Print the run statistics and terminate the process */
+void sim_report(void);
+
+#endif /* SIM_H_ */
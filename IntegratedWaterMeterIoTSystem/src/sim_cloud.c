@@ -0,0 +1,515 @@
+/**
+ * @file sim_cloud.c
+ * @brief Simulated WiFi and ThingsBoard link for the native_sim build
+ *
+ * @details
+ * Implements cloud.h without a network stack, with the same endpoint
+ * scoring (broker_select.c) and outbox (outbox.c) as cloud.c.
+ * CONFIG_APP_SIM_BROKERS endpoints are modelled: the primary at
+ * CONFIG_APP_SIM_NET_LATENCY_MS and subject to the scheduled outages, the
+ * fallbacks always reachable at CONFIG_APP_SIM_FALLBACK_LATENCY_MS.
+ * Connects take the time the real handshake would; publishes are
+ * acknowledged after latency and jitter, with packet loss modelled as TCP
+ * retransmission stalls (the message is delayed, not dropped). During the
+ * scheduled poor-link periods the RSSI drops and loss rises to
+ * CONFIG_APP_SIM_POOR_LINK_LOSS_PERMILLE; sent and retransmitted segments
+ * are counted for cloud_link_sample(). The
+ * attribute request is answered with CONFIG_APP_SIM_ALARM_RULES as the
+ * "alarmRules" shared attribute. Bulk uploads take a TCP handshake, the
+ * body at CONFIG_APP_SIM_UPLINK_KBPS and one round trip for the response,
+ * and fail if the endpoint goes down meanwhile.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "broker_select.h"
+#include "cloud.h"
+#include "metrics.h"
+#include "outbox.h"
+#include "raw_frame.h"
+#include "sim.h"
+
+LOG_MODULE_REGISTER(sim_cloud, LOG_LEVEL_INF);
+
+#define RTO_INITIAL_MS 1000
+#define RTO_MAX_MS 60000
+#define CONNACK_TIMEOUT_MS 5000
+#define TCP_MSS 1460
+
+#define RSSI_GOOD_DBM (-58)
+#define RSSI_POOR_DBM (-84)
+#define RSSI_SPREAD_DB 6
+
+#define ATTRIBUTES_RESPONSE "v1/devices/me/attributes/response/1"
+#define SIM_RAW_TOPIC "watermeter/sim/raw"
+
+/* ============================================================================
+ * GLOBAL VARIABLES
+ * ============================================================================ */
+
+/* A PUBACK on its way back from the broker */
+struct pending_ack {
+    uint16_t message_id;
+    uint16_t samples;           /* Telemetry samples carried, 0 for others */
+    uint32_t bytes;
+    int64_t sent_ms;
+    int64_t due_ms;
+};
+
+static bool connected;
+static cloud_rx_handler_t rx_handler;
+static cloud_session_handler_t session_handler;
+static cloud_delivery_handler_t delivery_handler;
+
+static struct broker_set brokers;
+static int last_broker = BROKER_NONE;
+OUTBOX_DEFINE(outbox, OUTBOX_SIZE);
+
+/* In send (and therefore ack) order */
+static struct pending_ack acks[OUTBOX_SIZE];
+static uint8_t acks_head;
+static uint8_t acks_count;
+static int64_t last_ack_ms;
+
+/* Pending attribute response */
+static bool attr_response_pending;
+static int64_t attr_response_at_ms;
+
+/* Endpoint of the bulk upload in progress */
+static int bulk_idx = BROKER_NONE;
+
+/* Cumulative, as the stack would count them */
+static uint32_t tcp_sent;
+static uint32_t tcp_rexmit;
+
+/* ============================================================================
+ * LINK MODEL
+ * ============================================================================ */
+
+/** @brief Scheduled outages take down the primary endpoint only */
+static bool broker_down(int idx)
+{
+    return idx == 0 && sim_network_down();
+}
+
+/**
+ * @brief Stall of one segment: retransmission timeouts until it gets through
+ */
+static uint32_t segment_stall_ms(void)
+{
+    uint32_t loss = sim_link_poor() ? CONFIG_APP_SIM_POOR_LINK_LOSS_PERMILLE :
+                                      CONFIG_APP_SIM_NET_LOSS_PERMILLE;
+    uint32_t rto = RTO_INITIAL_MS;
+    uint32_t ms = 0;
+
+    tcp_sent++;
+    while (sim_chance(loss)) {
+        tcp_sent++;
+        tcp_rexmit++;
+        ms += rto;
+        rto = MIN(rto * 2, RTO_MAX_MS);
+    }
+    return ms;
+}
+
+/**
+ * @brief One-way trip time to @p idx, including retransmission stalls on loss
+ */
+static uint32_t trip_ms(int idx)
+{
+    uint32_t ms = (idx == 0) ? CONFIG_APP_SIM_NET_LATENCY_MS :
+                               CONFIG_APP_SIM_FALLBACK_LATENCY_MS;
+
+    return ms + sim_uniform(CONFIG_APP_SIM_NET_JITTER_MS + 1) + segment_stall_ms();
+}
+
+/**
+ * @brief Deliver PUBACKs whose arrival time has passed
+ */
+static void deliver_acks(int64_t now)
+{
+    while (acks_count > 0 && acks[acks_head].due_ms <= now) {
+        struct pending_ack *a = &acks[acks_head];
+        const struct outbox_msg *m = outbox_ack(&outbox, a->message_id);
+
+        if (m != NULL) {
+            uint32_t rtt = (uint32_t)(a->due_ms - a->sent_ms);
+
+            broker_report_rtt(&brokers, rtt / 2);
+            metrics_mqtt_acked();
+            metrics_outbox_depth(outbox_count(&outbox));
+            sim_stat_acked(rtt, a->bytes, a->samples);
+            if (delivery_handler != NULL) {
+                delivery_handler(m->topic, CLOUD_ACKED, rtt);
+            }
+        }
+        acks_head = (acks_head + 1) % OUTBOX_SIZE;
+        acks_count--;
+    }
+}
+
+/**
+ * @brief End the session; unacknowledged messages stay in the outbox
+ *
+ * @param failure Count it against the endpoint (outage) or not (switch)
+ */
+static void end_session(bool failure)
+{
+    /* Whatever the broker acknowledged before the link went down still counts */
+    deliver_acks(k_uptime_get());
+    acks_count = 0;
+
+    if (failure) {
+        broker_report_drop(&brokers, brokers.active, k_uptime_get());
+        LOG_WRN("Simulated broker outage, MQTT session lost");
+    } else {
+        broker_set_active(&brokers, BROKER_NONE, k_uptime_get());
+    }
+
+    connected = false;
+    attr_response_pending = false;
+    metrics_mqtt_connection(false);
+    metrics_broker_active(BROKER_NONE);
+}
+
+/**
+ * @brief Samples in a telemetry message: one per "ts" key of a batch, else
+ *        one; one per frame of a raw batch
+ */
+static uint16_t telemetry_samples(const char *topic, const char *payload, size_t len)
+{
+    static const char key[] = "\"ts\":";
+    uint16_t n = 0;
+
+    if (strcmp(topic, SIM_RAW_TOPIC) == 0) {
+        return raw_batch_count((const uint8_t *)payload, len);
+    }
+    if (strcmp(topic, TELEMETRY_TOPIC) != 0) {
+        return 0;
+    }
+    for (size_t i = 0; i + sizeof(key) - 1 <= len; i++) {
+        if (memcmp(&payload[i], key, sizeof(key) - 1) == 0) {
+            n++;
+        }
+    }
+    return MAX(n, 1);
+}
+
+static void flush_outbox(void)
+{
+    struct outbox_msg *m;
+    int64_t now = k_uptime_get();
+
+    while (connected && (m = outbox_next_unsent(&outbox)) != NULL) {
+        struct pending_ack *a = &acks[(acks_head + acks_count) % OUTBOX_SIZE];
+        uint16_t samples = telemetry_samples(m->topic, m->payload, m->len);
+
+        /* TCP delivers in order: an ack never overtakes an earlier one */
+        a->message_id = outbox_mark_sent(&outbox, m, now);
+        a->samples = samples;
+        a->bytes = m->len;
+        a->sent_ms = now;
+        a->due_ms = MAX(now + 2 * trip_ms(brokers.active), last_ack_ms);
+        last_ack_ms = a->due_ms;
+        acks_count++;
+
+        metrics_mqtt_published();
+        if (m->attempts == 1) {
+            sim_stat_published(m->len, samples);
+        } else {
+            sim_stat_resent(samples);
+        }
+
+        if (strcmp(m->topic, ATTRIBUTES_REQUEST_TOPIC) == 0 &&
+            strlen(CONFIG_APP_SIM_ALARM_RULES) > 0) {
+            attr_response_pending = true;
+            attr_response_at_ms = a->due_ms;
+        }
+    }
+}
+
+/**
+ * @brief CONNECT to @p idx; takes the handshake time or the CONNACK timeout
+ */
+static int connect_endpoint(int idx)
+{
+    if (!broker_down(idx)) {
+        /* TCP handshake, then CONNECT/CONNACK */
+        k_sleep(K_MSEC(2 * trip_ms(idx) + 2 * trip_ms(idx)));
+        if (!broker_down(idx)) {
+            sim_stat_connect(true);
+            return 0;
+        }
+    }
+
+    k_sleep(K_MSEC(CONNACK_TIMEOUT_MS));
+    sim_stat_connect(false);
+    return -ETIMEDOUT;
+}
+
+static void session_started(int idx)
+{
+    connected = true;
+    last_ack_ms = k_uptime_get();
+    broker_set_active(&brokers, idx, k_uptime_get());
+    metrics_mqtt_connection(true);
+    metrics_broker_active(idx);
+
+    if (last_broker != BROKER_NONE && idx != last_broker) {
+        LOG_WRN("Broker switched: %d -> %d", last_broker, idx);
+        metrics_broker_switch();
+        sim_stat_broker_switch();
+    }
+    last_broker = idx;
+
+    if (outbox_session_reset(&outbox) > 0 && delivery_handler != NULL) {
+        delivery_handler(NULL, CLOUD_SESSION_LOST, 0);
+    }
+    if (session_handler != NULL) {
+        session_handler();
+    }
+    flush_outbox();
+}
+
+/* ============================================================================
+ * CLOUD API
+ * ============================================================================ */
+
+int cloud_link_sample(struct link_sample *s)
+{
+    int base = sim_link_poor() ? RSSI_POOR_DBM : RSSI_GOOD_DBM;
+
+    memset(s, 0, sizeof(*s));
+    s->rssi_valid = true;
+    s->rssi_dbm = base - RSSI_SPREAD_DB / 2 + (int)sim_uniform(RSSI_SPREAD_DB + 1);
+    s->tcp_valid = true;
+    s->tcp_sent = tcp_sent;
+    s->tcp_rexmit = tcp_rexmit;
+    return 0;
+}
+
+int wifi_connect(void)
+{
+    k_sleep(K_MSEC(1500 + sim_uniform(1000)));
+    return 0;
+}
+
+int broker_init(void)
+{
+    if (brokers.count == 0) {
+        broker_set_init(&brokers, CONFIG_APP_SIM_BROKERS);
+    }
+
+    k_sleep(K_MSEC(2 * trip_ms(0)));
+    return 0;
+}
+
+int thingsboard_connect(void)
+{
+    for (int attempt = 0; attempt < 2 * brokers.count; attempt++) {
+        int64_t now = k_uptime_get();
+        int idx = broker_select(&brokers, now);
+
+        if (idx == BROKER_NONE) {
+            break;
+        }
+        if (connect_endpoint(idx) == 0) {
+            broker_report_connect(&brokers, idx, true,
+                                  (uint32_t)(k_uptime_get() - now) / 2, k_uptime_get());
+            session_started(idx);
+            return 0;
+        }
+        broker_report_connect(&brokers, idx, false, 0, k_uptime_get());
+    }
+
+    return -ECONNREFUSED;
+}
+
+bool cloud_connected(void)
+{
+    if (connected && broker_down(brokers.active)) {
+        end_session(true);
+    }
+    return connected;
+}
+
+void cloud_set_rx_handler(cloud_rx_handler_t handler)
+{
+    rx_handler = handler;
+}
+
+void cloud_set_session_handler(cloud_session_handler_t handler)
+{
+    session_handler = handler;
+}
+
+void cloud_set_delivery_handler(cloud_delivery_handler_t handler)
+{
+    delivery_handler = handler;
+}
+
+int cloud_publish(const char *topic, const char *payload, size_t len)
+{
+    int rc = outbox_put(&outbox, topic, payload, len);
+
+    if (rc) {
+        metrics_mqtt_publish_failed();
+        sim_stat_lost(telemetry_samples(topic, payload, len));
+        return rc;
+    }
+    metrics_outbox_depth(outbox_count(&outbox));
+
+    if (cloud_connected()) {
+        flush_outbox();
+    }
+    return 0;
+}
+
+size_t cloud_queued(void)
+{
+    return outbox_count(&outbox);
+}
+
+/* The simulated bridge broker shares the link and outbox of the session */
+int cloud_publish_raw(const char *payload, size_t len)
+{
+    return cloud_publish(SIM_RAW_TOPIC, payload, len);
+}
+
+int cloud_subscribe(const char *const *topics, size_t count)
+{
+    ARG_UNUSED(topics);
+
+    if (count > CLOUD_MAX_SUBSCRIPTIONS) {
+        return -EINVAL;
+    }
+    return cloud_connected() ? 0 : -ENOTCONN;
+}
+
+/**
+ * @brief Probe a better-ranked endpoint and move the session if it wins
+ */
+static void probe_failback(void)
+{
+    int64_t now = k_uptime_get();
+    int cand = broker_probe_candidate(&brokers, now);
+
+    if (cand == BROKER_NONE) {
+        return;
+    }
+
+    bool up = !broker_down(cand);
+    uint32_t rtt = 2 * trip_ms(cand);
+
+    broker_report_connect(&brokers, cand, up, rtt, now);
+    if (!up || !broker_should_switch(&brokers, cand)) {
+        return;
+    }
+
+    end_session(false);
+    now = k_uptime_get();
+    if (connect_endpoint(cand) == 0) {
+        broker_report_connect(&brokers, cand, true,
+                              (uint32_t)(k_uptime_get() - now) / 2, k_uptime_get());
+        session_started(cand);
+    } else {
+        broker_report_connect(&brokers, cand, false, 0, k_uptime_get());
+        thingsboard_connect();
+    }
+}
+
+void mqtt_maintenance(void)
+{
+    if (!cloud_connected()) {
+        return;
+    }
+
+    int64_t now = k_uptime_get();
+    struct outbox_msg *m;
+
+    deliver_acks(now);
+
+    /* Stalled past the timeout: reported, still on its way */
+    while ((m = outbox_overdue(&outbox, now, CONFIG_APP_MQTT_ACK_TIMEOUT_MS)) != NULL) {
+        metrics_mqtt_ack_timeout();
+        if (delivery_handler != NULL) {
+            delivery_handler(m->topic, CLOUD_ACK_TIMEOUT, (uint32_t)(now - m->sent_ms));
+        }
+    }
+
+    if (attr_response_pending && attr_response_at_ms <= now) {
+        static char payload[sizeof(CONFIG_APP_SIM_ALARM_RULES) + 32];
+        int len = snprintf(payload, sizeof(payload), "{\"shared\":{\"alarmRules\":\"%s\"}}",
+                           CONFIG_APP_SIM_ALARM_RULES);
+
+        attr_response_pending = false;
+        if (rx_handler != NULL) {
+            rx_handler(ATTRIBUTES_RESPONSE, payload, len);
+        }
+    }
+
+    flush_outbox();
+    probe_failback();
+}
+
+int cloud_bulk_begin(void)
+{
+    if (!cloud_connected()) {
+        return -ENOTCONN;
+    }
+    if (bulk_idx != BROKER_NONE) {
+        return -EBUSY;
+    }
+
+    int idx = brokers.active;
+
+    k_sleep(K_MSEC(2 * trip_ms(idx)));
+    if (broker_down(idx)) {
+        return -ETIMEDOUT;
+    }
+    bulk_idx = idx;
+    return 0;
+}
+
+int cloud_bulk_write(const char *data, size_t len)
+{
+    ARG_UNUSED(data);
+
+    if (bulk_idx == BROKER_NONE) {
+        return -ENOTCONN;
+    }
+
+    /* kbit/s = bit/ms */
+    uint32_t ms = len * 8 / CONFIG_APP_SIM_UPLINK_KBPS + 1;
+
+    for (size_t seg = 0; seg < len; seg += TCP_MSS) {
+        ms += segment_stall_ms();
+    }
+    k_sleep(K_MSEC(ms));
+    if (broker_down(bulk_idx)) {
+        cloud_bulk_abort();
+        return -ECONNRESET;
+    }
+    return 0;
+}
+
+int cloud_bulk_end(void)
+{
+    if (bulk_idx == BROKER_NONE) {
+        return -ENOTCONN;
+    }
+
+    int idx = bulk_idx;
+
+    k_sleep(K_MSEC(2 * trip_ms(idx)));
+    cloud_bulk_abort();
+    return broker_down(idx) ? -ETIMEDOUT : 0;
+}
+
+void cloud_bulk_abort(void)
+{
+    bulk_idx = BROKER_NONE;
+}
@@ -0,0 +1,343 @@
+/**
+ * @file sim_meter.c
+ * @brief Simulated BOVE water meters behind an emulated UART
+ *
+ * @details
+ * Answers Read Holding Registers requests for slave IDs
+ * 1..CONFIG_APP_SIM_METERS exactly as the real meter lays out its 38
+ * registers, after a turnaround delay plus the wire time of the response
+ * at 2400 baud 8E1. Each meter follows a household day profile with noise;
+ * the forward total integrates the simulated flow between requests.
+ * Timeouts and corrupted frames are injected at the configured rates.
+ *
+ * With CONFIG_APP_PULSE, meter PULSE_METER_ID also drives the pulse input
+ * through the GPIO emulator, one pulse per CONFIG_APP_PULSE_ML_PER_PULSE
+ * of forward volume. Its flow then changes every FLOW_STEP_MS on its own
+ * instead of at each request, so flow starts and stops between polls.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/device.h>
+#include <zephyr/init.h>
+#include <zephyr/drivers/serial/uart_emul.h>
+#if defined(CONFIG_APP_PULSE)
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#endif
+#include <string.h>
+
+#include "modbus.h"
+#include "register_map.h"
+#include "sim.h"
+
+#define SIM_UART_NODE DT_CHOSEN(app_modbus_uart)
+
+#define REQUEST_LEN 8
+#define REGISTER_COUNT BOVE_READ_REG_COUNT
+#define RESPONSE_LEN BOVE_RESPONSE_LEN
+
+/* 11 bits per character at 2400 baud, rounded up */
+#define CHAR_TIME_US 4584
+#define TURNAROUND_MIN_MS 15
+#define TURNAROUND_SPAN_MS 30
+
+/* Meter wired to the pulse input, and how often its flow changes */
+#define PULSE_METER_ID 1
+#define FLOW_STEP_MS (60 * 1000)
+
+/* Mean household consumption per hour of day (L/h) */
+static const uint16_t day_profile_lph[24] = {
+    20, 10, 5, 5, 10, 40, 150, 300, 250, 150, 120, 110,
+    130, 120, 100, 100, 120, 180, 260, 240, 180, 120, 70, 40,
+};
+
+struct sim_meter {
+    uint64_t forward_ml;
+    uint64_t reverse_ml;
+    uint32_t flow_centi_lph;        /* 0.01 L/h, as register 1-2 */
+    int64_t last_update_ms;
+};
+
+static const struct device *uart_dev = DEVICE_DT_GET(SIM_UART_NODE);
+static struct sim_meter meters[CONFIG_APP_SIM_METERS];
+
+static uint8_t request[REQUEST_LEN];
+static size_t request_len;
+static uint8_t response[RESPONSE_LEN];
+
+static void send_response(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(response_work, send_response);
+
+#if defined(CONFIG_APP_PULSE)
+static const struct gpio_dt_spec pulse_out = GPIO_DT_SPEC_GET(DT_PATH(zephyr_user), pulse_gpios);
+static uint64_t next_pulse_ml;      /* Forward volume of the next pulse */
+static int64_t next_step_ms;
+
+static void pulse_step(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(pulse_work, pulse_step);
+#endif
+
+/* ============================================================================
+ * METER MODEL
+ * ============================================================================ */
+
+/** @brief Forward volume of @p m integrated up to @p now */
+static uint64_t volume_at(const struct sim_meter *m, int64_t now)
+{
+    return m->forward_ml + (uint64_t)m->flow_centi_lph * (now - m->last_update_ms) / 360000U;
+}
+
+#if defined(CONFIG_APP_DMA)
+/**
+ * @brief The DMA parent sees every other meter on the bus plus the leak
+ *
+ * Computed from the other meters' volumes at this instant, so the only
+ * difference between inflow and consumption is the configured leak.
+ */
+static void parent_update(uint8_t id, struct sim_meter *m)
+{
+    int64_t now = k_uptime_get();
+    uint64_t volume = (uint64_t)CONFIG_APP_SIM_DMA_LEAK_LPH * now / 3600U;
+    uint32_t flow = CONFIG_APP_SIM_DMA_LEAK_LPH * 100U;
+
+    for (int i = 0; i < CONFIG_APP_SIM_METERS; i++) {
+        if (i != id - 1) {
+            volume += volume_at(&meters[i], now);
+            flow += meters[i].flow_centi_lph;
+        }
+    }
+
+    m->forward_ml = volume;
+    m->flow_centi_lph = flow;
+    m->last_update_ms = now;
+}
+#endif
+
+/**
+ * @brief Advance one meter to the current virtual time
+ */
+static void meter_update(uint8_t id, struct sim_meter *m)
+{
+    int64_t now = k_uptime_get();
+    uint32_t hour = (uint32_t)((now / (3600 * 1000LL)) % 24);
+
+#if defined(CONFIG_APP_DMA)
+    if (id == CONFIG_APP_DMA_PARENT_ID) {
+        parent_update(id, m);
+        return;
+    }
+#endif
+
+    /* Integrate the previous flow over the elapsed interval */
+    m->forward_ml = volume_at(m, now);
+    m->last_update_ms = now;
+
+    /* New operating point: profile scaled per meter, +/-25% noise, idle spells */
+    uint32_t lph = day_profile_lph[hour] * (80U + id * 10U) / 100U;
+
+    lph = lph * (75U + sim_uniform(51)) / 100U;
+    if (sim_chance(150)) {
+        lph = 0;
+    }
+    m->flow_centi_lph = lph * 100U + sim_uniform(100);
+
+    /* Short backflow events when the supply pressure drops (not behind a
+     * DMA parent, where they would blur the leak check) */
+    if (!IS_ENABLED(CONFIG_APP_DMA) && sim_chance(2)) {
+        m->reverse_ml += 1 + sim_uniform(500);
+    }
+}
+
+#if defined(CONFIG_APP_PULSE)
+/* ============================================================================
+ * PULSE OUTPUT
+ * ============================================================================ */
+
+/**
+ * @brief Emit the pulses the meter's volume has passed, then sleep until
+ *        the next one or the next flow change
+ */
+static void pulse_step(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    struct sim_meter *m = &meters[PULSE_METER_ID - 1];
+    int64_t now = k_uptime_get();
+
+    if (now >= next_step_ms) {
+        meter_update(PULSE_METER_ID, m);
+        next_step_ms = now + FLOW_STEP_MS;
+    }
+
+    while (volume_at(m, now) >= next_pulse_ml) {
+        bool missed = sim_chance(CONFIG_APP_SIM_PULSE_MISS_PERMILLE);
+
+        if (!missed) {
+            /* The input interrupt runs inside the emulator call */
+            gpio_emul_input_set(pulse_out.port, pulse_out.pin, 1);
+            gpio_emul_input_set(pulse_out.port, pulse_out.pin, 0);
+        }
+        sim_stat_pulse(missed);
+        next_pulse_ml += CONFIG_APP_PULSE_ML_PER_PULSE;
+    }
+
+    int64_t wait = next_step_ms - now;
+
+    if (m->flow_centi_lph > 0) {
+        /* Rounded up: volume_at() truncates */
+        uint64_t to_pulse = ((next_pulse_ml - volume_at(m, now)) * 360000U +
+                             m->flow_centi_lph - 1) / m->flow_centi_lph;
+
+        wait = MIN(wait, (int64_t)to_pulse);
+    }
+    k_work_reschedule(&pulse_work, K_MSEC(MAX(wait, 1)));
+}
+#endif
+
+static void put_u16(uint8_t *d, int offset, uint16_t v)
+{
+    d[offset] = v >> 8;
+    d[offset + 1] = v & 0xFF;
+}
+
+/** @brief Low word first, matching read_u32() */
+static void put_u32(uint8_t *d, int offset, uint32_t v)
+{
+    put_u16(d, offset, v & 0xFFFF);
+    put_u16(d, offset + 2, v >> 16);
+}
+
+static void build_response(uint8_t id, const struct sim_meter *m)
+{
+    uint8_t *d = &response[3];
+    /* Pressure sags a little under heavy draw */
+    uint16_t pressure = 291 - MIN(m->flow_centi_lph / 1000U, 40U) + sim_uniform(5);
+
+    memset(response, 0, sizeof(response));
+    response[0] = id;
+    response[1] = BOVE_FC_READ_HOLDING;
+    response[2] = REGISTER_COUNT * 2;
+
+    put_u32(d, BOVE_OFF_FLOW_RATE, m->flow_centi_lph);
+    put_u32(d, BOVE_OFF_FORWARD_TOTAL, (uint32_t)(m->forward_ml / 1000));  // L
+    put_u32(d, BOVE_OFF_REVERSE_TOTAL, (uint32_t)(m->reverse_ml / 1000));
+    put_u16(d, BOVE_OFF_PRESSURE, pressure);
+    put_u16(d, BOVE_OFF_STATUS, 0x0000);
+    put_u16(d, BOVE_OFF_TEMPERATURE, 2715 + sim_uniform(20));
+    put_u16(d, BOVE_OFF_SERIAL, (0x12345678 + id) >> 16);
+    put_u16(d, BOVE_OFF_SERIAL + 2, (0x12345678 + id) & 0xFFFF);
+    put_u16(d, BOVE_OFF_MODBUS_ID, id);
+    put_u16(d, BOVE_OFF_BAUD_CODE, 1);                          // 2400
+
+    uint16_t crc = modbus_crc16(response, RESPONSE_LEN - 2);
+    response[RESPONSE_LEN - 2] = crc & 0xFF;
+    response[RESPONSE_LEN - 1] = crc >> 8;
+}
+
+/* ============================================================================
+ * UART SLAVE
+ * ============================================================================ */
+
+static void send_response(struct k_work *work)
+{
+    ARG_UNUSED(work);
+    uart_emul_put_rx_data(uart_dev, response, sizeof(response));
+}
+
+static void handle_request(void)
+{
+    uint8_t id = request[0];
+
+    if (id < 1 || id > CONFIG_APP_SIM_METERS || request[1] != BOVE_FC_READ_HOLDING) {
+        return;
+    }
+
+    struct sim_meter *m = &meters[id - 1];
+
+#if defined(CONFIG_APP_PULSE)
+    if (id == PULSE_METER_ID) {
+        /* Flow changes in pulse_step(); bring the total up to now */
+        int64_t now = k_uptime_get();
+
+        m->forward_ml = volume_at(m, now);
+        m->last_update_ms = now;
+    } else {
+        meter_update(id, m);
+    }
+#else
+    meter_update(id, m);
+#endif
+
+    if (sim_chance(CONFIG_APP_SIM_MODBUS_TIMEOUT_PERMILLE)) {
+        sim_stat_modbus_fault(true);
+        return;
+    }
+
+    build_response(id, m);
+
+    if (sim_chance(CONFIG_APP_SIM_MODBUS_CRC_PERMILLE)) {
+        /* Line noise: one flipped bit somewhere in the frame */
+        response[3 + sim_uniform(REGISTER_COUNT * 2)] ^= 1U << sim_uniform(8);
+        sim_stat_modbus_fault(false);
+    } else {
+        sim_stat_modbus_served();
+    }
+
+    uint32_t delay_ms = TURNAROUND_MIN_MS + sim_uniform(TURNAROUND_SPAN_MS) +
+                        (RESPONSE_LEN * CHAR_TIME_US) / 1000U;
+    k_work_reschedule(&response_work, K_MSEC(delay_ms));
+}
+
+/**
+ * @brief Collect the master's bytes and resynchronise on frame boundaries
+ */
+static void tx_data_ready(const struct device *dev, size_t size, void *user_data)
+{
+    ARG_UNUSED(user_data);
+
+    while (size-- > 0) {
+        uint8_t c;
+
+        if (uart_emul_get_tx_data(dev, &c, 1) != 1) {
+            break;
+        }
+        request[request_len++] = c;
+
+        if (request_len == REQUEST_LEN) {
+            uint16_t crc = request[6] | (request[7] << 8);
+
+            if (crc == modbus_crc16(request, 6)) {
+                handle_request();
+                request_len = 0;
+            } else {
+                /* Not aligned on a frame: drop the oldest byte */
+                memmove(request, request + 1, REQUEST_LEN - 1);
+                request_len--;
+            }
+        }
+    }
+}
+
+static int sim_meter_init(void)
+{
+    if (!device_is_ready(uart_dev)) {
+        return -ENODEV;
+    }
+
+    uart_emul_callback_tx_data_ready_set(uart_dev, tx_data_ready, NULL);
+
+    for (int i = 0; i < CONFIG_APP_SIM_METERS; i++) {
+        /* Start each meter with a different lifetime total */
+        meters[i].forward_ml = (uint64_t)(1000 + 250 * i) * 1000 * 1000;
+    }
+
+#if defined(CONFIG_APP_PULSE)
+    if (!gpio_is_ready_dt(&pulse_out)) {
+        return -ENODEV;
+    }
+    next_pulse_ml = meters[PULSE_METER_ID - 1].forward_ml + CONFIG_APP_PULSE_ML_PER_PULSE;
+    k_work_reschedule(&pulse_work, K_NO_WAIT);
+#endif
+    return 0;
+}
+
+SYS_INIT(sim_meter_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,194 @@
+/**
+ * @file swing_door.c
+ * @brief Swinging-door compression of samples on their way into history
+ */
+
+#include <string.h>
+
+#include "swing_door.h"
+
+/* Largest value each field can be stored with, from its register width */
+#define FIELD_MAX(id, key, offset, width) \
+    [BOVE_##id] = ((width) == 4) ? UINT32_MAX : UINT16_MAX,
+static const int64_t field_max[BOVE_FIELD_COUNT] = {
+    BOVE_FIELDS(FIELD_MAX)
+};
+#undef FIELD_MAX
+
+/* ============================================================================
+ * HELPERS
+ * ============================================================================ */
+
+/* Integer division rounding down / up; @p den is positive */
+static int64_t div_floor(int64_t num, int64_t den)
+{
+    int64_t q = num / den;
+
+    return (num % den != 0 && num < 0) ? q - 1 : q;
+}
+
+static int64_t div_ceil(int64_t num, int64_t den)
+{
+    int64_t q = num / den;
+
+    return (num % den != 0 && num > 0) ? q + 1 : q;
+}
+
+static int64_t last_ms(const struct swing_door *sd)
+{
+    return (sd->held_samples > 0) ? sd->held.ts_ms : sd->anchor.ts_ms;
+}
+
+/**
+ * @brief Narrow the corridors by @p rec and hold it, if a line still fits
+ *
+ * For each field the slopes from the upper and lower pivot bound the lines
+ * that pass within tolerance of every sample so far. The held point is the
+ * integer value at @p rec's time nearest the sample and inside the bounds.
+ *
+ * @return false (nothing changed) if the segment has to close first
+ */
+static bool extend(struct swing_door *sd, const struct telemetry_record *rec)
+{
+    int64_t dt = rec->ts_ms - sd->anchor.ts_ms;
+    int64_t up_num[BOVE_FIELD_COUNT], up_den[BOVE_FIELD_COUNT];
+    int64_t low_num[BOVE_FIELD_COUNT], low_den[BOVE_FIELD_COUNT];
+    uint32_t values[BOVE_FIELD_COUNT];
+
+    if (dt > sd->max_gap_ms) {
+        return false;
+    }
+
+    for (int f = 0; f < BOVE_FIELD_COUNT; f++) {
+        int64_t base = sd->anchor.values[f];
+        int64_t d = (int64_t)rec->values[f] - base;
+
+        up_num[f] = d - sd->tol[f];
+        up_den[f] = dt;
+        low_num[f] = d + sd->tol[f];
+        low_den[f] = dt;
+        if (sd->held_samples > 0) {
+            if (sd->up_num[f] * dt > up_num[f] * sd->up_den[f]) {
+                up_num[f] = sd->up_num[f];
+                up_den[f] = sd->up_den[f];
+            }
+            if (sd->low_num[f] * dt < low_num[f] * sd->low_den[f]) {
+                low_num[f] = sd->low_num[f];
+                low_den[f] = sd->low_den[f];
+            }
+        }
+
+        int64_t lo = div_ceil(up_num[f] * dt, up_den[f]);
+        int64_t hi = div_floor(low_num[f] * dt, low_den[f]);
+
+        if (lo < -base) {
+            lo = -base;
+        }
+        if (hi > field_max[f] - base) {
+            hi = field_max[f] - base;
+        }
+        if (lo > hi) {
+            return false;
+        }
+        if (d < lo) {
+            d = lo;
+        } else if (d > hi) {
+            d = hi;
+        }
+        values[f] = (uint32_t)(base + d);
+    }
+
+    memcpy(sd->up_num, up_num, sizeof(up_num));
+    memcpy(sd->up_den, up_den, sizeof(up_den));
+    memcpy(sd->low_num, low_num, sizeof(low_num));
+    memcpy(sd->low_den, low_den, sizeof(low_den));
+    sd->held.ts_ms = rec->ts_ms;
+    memcpy(sd->held.values, values, sizeof(values));
+    sd->held_samples++;
+    return true;
+}
+
+/* ============================================================================
+ * PUBLIC API
+ * ============================================================================ */
+
+void swing_door_init(struct swing_door *sd, const uint32_t tol[BOVE_FIELD_COUNT],
+                     uint32_t max_gap_ms)
+{
+    memset(sd, 0, sizeof(*sd));
+    memcpy(sd->tol, tol, sizeof(sd->tol));
+    sd->max_gap_ms = (max_gap_ms < SWING_DOOR_MAX_GAP_MS) ? max_gap_ms
+                                                          : SWING_DOOR_MAX_GAP_MS;
+}
+
+int swing_door_add(struct swing_door *sd, const struct telemetry_record *rec,
+                   struct swing_door_point out[SWING_DOOR_OUT_MAX])
+{
+    int n = 0;
+
+    sd->samples_in++;
+
+    /* Clock set back: the segment ends where it is */
+    if (sd->open && rec->ts_ms <= last_ms(sd)) {
+        if (sd->held_samples > 0) {
+            out[n++] = (struct swing_door_point){ sd->held, sd->held_samples };
+        }
+        sd->open = false;
+    }
+
+    if (sd->open && sd->held_samples > 0) {
+        if (extend(sd, rec)) {
+            return 0;
+        }
+        /* The door closed: the held sample is a turning point */
+        out[n++] = (struct swing_door_point){ sd->held, sd->held_samples };
+        sd->anchor = sd->held;
+        sd->held_samples = 0;
+    }
+
+    /* First sample after the anchor; fails only past the longest segment */
+    if (!sd->open || !extend(sd, rec)) {
+        out[n++] = (struct swing_door_point){ *rec, 1 };
+        sd->anchor = *rec;
+        sd->held_samples = 0;
+        sd->open = true;
+    }
+
+    sd->points_out += n;
+    return n;
+}
+
+bool swing_door_flush(struct swing_door *sd, struct swing_door_point *out)
+{
+    bool held = sd->open && sd->held_samples > 0;
+
+    if (held) {
+        *out = (struct swing_door_point){ sd->held, sd->held_samples };
+        sd->points_out++;
+    }
+    sd->open = false;
+    sd->held_samples = 0;
+    return held;
+}
+
+uint32_t swing_door_value_at(const struct telemetry_record *a,
+                             const struct telemetry_record *b,
+                             enum bove_field field, int64_t ts_ms)
+{
+    int64_t va = a->values[field];
+    int64_t vb = b->values[field];
+    int64_t span = b->ts_ms - a->ts_ms;
+
+    if (ts_ms <= a->ts_ms) {
+        return (uint32_t)va;
+    }
+    if (ts_ms >= b->ts_ms || span <= 0) {
+        return (uint32_t)vb;
+    }
+
+    /* Round half away from zero */
+    int64_t num = (vb - va) * (ts_ms - a->ts_ms);
+    int64_t q = (num >= 0) ? (num + span / 2) / span : -((-num + span / 2) / span);
+
+    return (uint32_t)(va + q);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file swing_door.h
+ * @brief Swinging-door compression of samples on their way into history
+ *
+ * @details
+ * Flow, pressure and the totals are mostly flat or ramp slowly, so most
+ * samples lie on the line between their neighbours. The compressor keeps
+ * only the turning points: a sample is archived once the next one could no
+ * longer be reached by a straight line from the last archived point that
+ * stays within the tolerance of every sample in between. Each field has
+ * its own corridor (absolute tolerance, raw register units) and all fields
+ * are archived together, so one history record stays one timestamp.
+ *
+ * Unlike the classic algorithm, which archives the sample as read and can
+ * be off by twice the tolerance, the archived point is moved onto the
+ * corridor (nearest integer inside it). Interpolating linearly between two
+ * archived points, rounded to the nearest unit, reproduces every sample in
+ * between within its tolerance. A tolerance of 0 keeps a field exact at
+ * every sample time, which is what the status word uses.
+ *
+ * Each archived point carries the number of samples it stands for (those
+ * after the previous point, itself included). A segment is closed after
+ * max_gap_ms, so flat periods still leave a point now and then.
+ *
+ * Pure C, no kernel calls.
+ */
+
+#ifndef SWING_DOOR_H_
+#define SWING_DOOR_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "register_map.h"
+#include "telemetry_batch.h"
+
+/* Points one sample can release: the held one and, after a clock step, itself */
+#define SWING_DOOR_OUT_MAX 2
+
+/* Longest segment; keeps the slope arithmetic within 64 bits */
+#define SWING_DOOR_MAX_GAP_MS (24U * 3600U * 1000U)
+
+struct swing_door_point {
+    struct telemetry_record rec;
+    uint16_t samples;           /* Samples this point stands for */
+};
+
+struct swing_door {
+    uint32_t tol[BOVE_FIELD_COUNT];
+    uint32_t max_gap_ms;
+
+    bool open;                          /* An anchor has been archived */
+    struct telemetry_record anchor;     /* Last archived point */
+    struct telemetry_record held;       /* Last sample, moved onto the corridor */
+    uint16_t held_samples;              /* Samples since the anchor, 0 = none */
+
+    /* Per field, relative to the anchor: steepest slope from the upper
+     * pivot (anchor + tol) and flattest from the lower one, as fractions */
+    int64_t up_num[BOVE_FIELD_COUNT];
+    int64_t up_den[BOVE_FIELD_COUNT];
+    int64_t low_num[BOVE_FIELD_COUNT];
+    int64_t low_den[BOVE_FIELD_COUNT];
+
+    uint32_t samples_in;
+    uint32_t points_out;
+};
+
+/**
+ * @brief Start with no segment open
+ *
+ * @param tol Absolute tolerance per field, indexed by enum bove_field
+ * @param max_gap_ms Longest segment, at most SWING_DOOR_MAX_GAP_MS
+ */
+void swing_door_init(struct swing_door *sd, const uint32_t tol[BOVE_FIELD_COUNT],
+                     uint32_t max_gap_ms);
+
+/**
+ * @brief Feed one sample
+ *
+ * A sample not newer than the previous one (the clock was set back) closes
+ * the segment and starts a new one.
+ *
+ * @param out Points to store, oldest first
+ * @return Number of points in @p out, 0..SWING_DOOR_OUT_MAX
+ */
+int swing_door_add(struct swing_door *sd, const struct telemetry_record *rec,
+                   struct swing_door_point out[SWING_DOOR_OUT_MAX]);
+
+/**
+ * @brief Close the segment: the held sample becomes a point
+ *
+ * The next sample starts a new segment.
+ *
+ * @return true if @p out holds a point to store
+ */
+bool swing_door_flush(struct swing_door *sd, struct swing_door_point *out);
+
+/**
+ * @brief Reconstructed value of @p field at @p ts_ms between two points
+ *
+ * Linear interpolation rounded to the nearest unit; outside [a, b] the
+ * nearer point's value.
+ */
+uint32_t swing_door_value_at(const struct telemetry_record *a,
+                             const struct telemetry_record *b,
+                             enum bove_field field, int64_t ts_ms);
+
+#endif /* SWING_DOOR_H_ */
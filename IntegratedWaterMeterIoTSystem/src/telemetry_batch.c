@@ -0,0 +1,177 @@
+/**
+ * @file telemetry_batch.c
+ * @brief Telemetry batches sized by PUBACK feedback (AIMD)
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "telemetry_batch.h"
+
+/* Weight of a new latency in the smoothed value: 1/8, as TCP's SRTT */
+#define ACK_EWMA_SHIFT 3
+
+/* ============================================================================
+ * FORMATTING
+ * ============================================================================ */
+
+int telemetry_record_format(const struct telemetry_record *rec, char *buf, size_t size)
+{
+    const uint32_t *v = rec->values;
+    uint32_t status = v[BOVE_STATUS];
+
+    int n = snprintf(buf, size,
+                     "{\"ts\":%lld,\"values\":{"
+                     "\"flowRate\":%u,"
+                     "\"forwardTotal\":%u,"
+                     "\"reverseTotal\":%u,"
+                     "\"pressure\":%u,"
+                     "\"temperature\":%u,"
+                     "\"status\":%u,"
+                     "\"leak\":%d,"
+                     "\"empty\":%d,"
+                     "\"lowBattery\":%d"
+                     "}}",
+                     (long long)rec->ts_ms,
+                     (unsigned int)v[BOVE_FLOW_RATE],
+                     (unsigned int)v[BOVE_FORWARD_TOTAL],
+                     (unsigned int)v[BOVE_REVERSE_TOTAL],
+                     (unsigned int)v[BOVE_PRESSURE],
+                     (unsigned int)v[BOVE_TEMPERATURE],
+                     (unsigned int)status,
+                     (status & BOVE_STATUS_EMPTY) ? 1 : 0,
+                     (status & BOVE_STATUS_EMPTY) ? 1 : 0,
+                     (status & BOVE_STATUS_LOW_BATTERY) ? 1 : 0);
+
+    return (n < 0 || (size_t)n >= size) ? -EMSGSIZE : n;
+}
+
+int telemetry_batch_format(const struct telemetry_batch *b, char *buf, size_t size)
+{
+    size_t len = 0;
+
+    /* Opening bracket, and room for the closing one and the terminator */
+    if (size < 3) {
+        return -EMSGSIZE;
+    }
+
+    for (uint8_t i = 0; i < b->count; i++) {
+        buf[len++] = (i == 0) ? '[' : ',';
+
+        int n = telemetry_record_format(&b->recs[i], &buf[len], size - len - 1);
+        if (n < 0) {
+            return n;
+        }
+        len += n;
+    }
+    if (b->count == 0) {
+        buf[len++] = '[';
+    }
+    buf[len++] = ']';
+    buf[len] = '\0';
+    return (int)len;
+}
+
+/* ============================================================================
+ * BATCHING
+ * ============================================================================ */
+
+void telemetry_batch_init(struct telemetry_batch *b, uint32_t period_ms,
+                          uint32_t max_flush_ms, uint32_t ack_target_ms,
+                          uint32_t holdoff_ms)
+{
+    memset(b, 0, sizeof(*b));
+    b->size = 1;
+    b->step_ms = period_ms;
+    b->max_flush_ms = max_flush_ms;
+    b->ack_target_ms = ack_target_ms;
+    b->holdoff_ms = holdoff_ms;
+}
+
+int telemetry_batch_add(struct telemetry_batch *b, const struct telemetry_record *rec,
+                        int64_t now_ms)
+{
+    int rc = 0;
+
+    if (b->count == TELEMETRY_BATCH_MAX) {
+        memmove(&b->recs[0], &b->recs[1], (TELEMETRY_BATCH_MAX - 1) * sizeof(b->recs[0]));
+        b->count--;
+        rc = -ENOBUFS;
+    }
+    if (b->count == 0) {
+        b->first_ms = now_ms;
+    }
+    b->recs[b->count++] = *rec;
+    return rc;
+}
+
+bool telemetry_batch_due(const struct telemetry_batch *b, int64_t now_ms)
+{
+    if (b->count == 0) {
+        return false;
+    }
+    if (b->count >= b->size) {
+        return true;
+    }
+
+    /* A changed status (empty pipe, battery) is not held back */
+    uint32_t first = b->recs[0].values[BOVE_STATUS];
+    uint32_t last = b->recs[b->count - 1].values[BOVE_STATUS];
+
+    return first != last || now_ms - b->first_ms >= b->flush_ms;
+}
+
+void telemetry_batch_clear(struct telemetry_batch *b)
+{
+    b->count = 0;
+}
+
+/* ============================================================================
+ * CONTROL
+ * ============================================================================ */
+
+bool telemetry_batch_on_ack(struct telemetry_batch *b, uint32_t latency_ms)
+{
+    if (!b->have_ack) {
+        b->ack_ms = latency_ms;
+        b->have_ack = true;
+    } else {
+        int64_t diff = (int64_t)latency_ms - (int64_t)b->ack_ms;
+
+        b->ack_ms = (uint32_t)((int64_t)b->ack_ms + diff / (1 << ACK_EWMA_SHIFT));
+    }
+
+    if (latency_ms > b->ack_target_ms) {
+        return false;
+    }
+    if (b->size >= TELEMETRY_BATCH_MAX && b->flush_ms >= b->max_flush_ms) {
+        return false;
+    }
+
+    if (b->size < TELEMETRY_BATCH_MAX) {
+        b->size++;
+    }
+    b->flush_ms += b->step_ms;
+    if (b->flush_ms > b->max_flush_ms) {
+        b->flush_ms = b->max_flush_ms;
+    }
+    b->increases++;
+    return true;
+}
+
+bool telemetry_batch_on_loss(struct telemetry_batch *b, int64_t now_ms)
+{
+    if (b->decreases > 0 && now_ms - b->last_decrease_ms < b->holdoff_ms) {
+        return false;
+    }
+
+    b->last_decrease_ms = now_ms;
+    if (b->size == 1 && b->flush_ms == 0) {
+        return false;
+    }
+    b->size = (b->size > 1) ? b->size / 2 : 1;
+    b->flush_ms /= 2;
+    b->decreases++;
+    return true;
+}
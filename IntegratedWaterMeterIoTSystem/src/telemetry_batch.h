@@ -0,0 +1,125 @@
+/**
+ * @file telemetry_batch.h
+ * @brief Telemetry batches sized by PUBACK feedback (AIMD)
+ *
+ * @details
+ * Samples are collected into one ThingsBoard telemetry array,
+ * [{"ts":..,"values":{..}},..], which is published once it holds the target
+ * number of samples or its oldest sample has waited the flush interval.
+ * Both follow the acknowledgements, the way TCP sizes its window:
+ *
+ * - a batch acknowledged within the latency target adds one sample to the
+ *   size and one sample period to the flush interval (additive increase)
+ * - a PUBACK timeout or a session lost with messages unacknowledged halves
+ *   both (multiplicative decrease), at most once per hold-off period so
+ *   the losses of one bad spell count once
+ * - a slower acknowledgement leaves the operating point as it is
+ *
+ * On a good link batches grow and the per-message cost (MQTT header,
+ * PUBACK round trip, radio wake-up) is shared by more samples; on a lossy
+ * one a stalled segment holds back less data and batches shrink back to
+ * single samples.
+ *
+ * Pure C, no kernel calls: times are passed in.
+ */
+
+#ifndef TELEMETRY_BATCH_H_
+#define TELEMETRY_BATCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "outbox.h"
+#include "register_map.h"
+
+/* Longest JSON of one record; a batch has to fit one outbox slot */
+#define TELEMETRY_RECORD_JSON_MAX 200
+#define TELEMETRY_BATCH_MAX (OUTBOX_PAYLOAD_LEN / TELEMETRY_RECORD_JSON_MAX)
+
+struct telemetry_record {
+    int64_t ts_ms;                      /* Unix time */
+    uint32_t values[BOVE_FIELD_COUNT];  /* Indexed by enum bove_field */
+};
+
+struct telemetry_batch {
+    struct telemetry_record recs[TELEMETRY_BATCH_MAX];
+    uint8_t count;
+    int64_t first_ms;           /* When the oldest record was added */
+
+    /* Operating point */
+    uint8_t size;               /* Samples per publish */
+    uint32_t flush_ms;          /* Longest a sample waits */
+    uint32_t ack_ms;            /* Smoothed PUBACK latency */
+    bool have_ack;              /* ack_ms holds at least one sample */
+
+    /* Limits */
+    uint32_t step_ms;           /* Flush increase: one sample period */
+    uint32_t max_flush_ms;
+    uint32_t ack_target_ms;
+    uint32_t holdoff_ms;
+    int64_t last_decrease_ms;
+
+    uint32_t increases;
+    uint32_t decreases;
+};
+
+/**
+ * @brief Start at single samples, published at once
+ *
+ * @param period_ms Sampling period, the additive flush step
+ * @param max_flush_ms Upper bound of the flush interval
+ * @param ack_target_ms Acknowledgements faster than this grow the batch
+ * @param holdoff_ms Further losses within this time after a decrease are
+ *        ignored (the PUBACK timeout is a good value)
+ */
+void telemetry_batch_init(struct telemetry_batch *b, uint32_t period_ms,
+                          uint32_t max_flush_ms, uint32_t ack_target_ms,
+                          uint32_t holdoff_ms);
+
+/**
+ * @brief Add a sample
+ *
+ * A full batch (publishing kept failing) drops its oldest sample.
+ *
+ * @return 0, or -ENOBUFS if a sample was dropped to make room
+ */
+int telemetry_batch_add(struct telemetry_batch *b, const struct telemetry_record *rec,
+                        int64_t now_ms);
+
+/** @brief True if the batch should be published now */
+bool telemetry_batch_due(const struct telemetry_batch *b, int64_t now_ms);
+
+/**
+ * @brief The batch as a ThingsBoard telemetry array
+ *
+ * @return Length without the terminator, -EMSGSIZE if @p size is too small
+ */
+int telemetry_batch_format(const struct telemetry_batch *b, char *buf, size_t size);
+
+/** @brief Forget the records (after they were queued or stored) */
+void telemetry_batch_clear(struct telemetry_batch *b);
+
+/**
+ * @brief A batch was acknowledged after @p latency_ms
+ *
+ * @return true if the operating point changed
+ */
+bool telemetry_batch_on_ack(struct telemetry_batch *b, uint32_t latency_ms);
+
+/**
+ * @brief A message timed out or a session was lost with messages in flight
+ *
+ * @return true if the operating point changed
+ */
+bool telemetry_batch_on_loss(struct telemetry_batch *b, int64_t now_ms);
+
+/**
+ * @brief One record as {"ts":..,"values":{..}}, the format of live
+ *        telemetry and backfill
+ *
+ * @return Length without the terminator, -EMSGSIZE if @p size is too small
+ */
+int telemetry_record_format(const struct telemetry_record *rec, char *buf, size_t size);
+
+#endif /* TELEMETRY_BATCH_H_ */
@@ -0,0 +1,64 @@
+/**
+ * @file timebase.c
+ * @brief Wall-clock time for timestamped telemetry
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#if defined(CONFIG_SNTP)
+#include <zephyr/net/sntp.h>
+#endif
+
+#include "timebase.h"
+
+LOG_MODULE_REGISTER(timebase, LOG_LEVEL_INF);
+
+#define SNTP_SERVER "pool.ntp.org"
+#define SNTP_TIMEOUT_MS 3000
+
+/* Simulated runs start at a fixed date so reports are reproducible */
+#define SIM_EPOCH_MS 1767225600000LL    /* 2026-01-01T00:00:00Z */
+
+static int64_t unix_offset_ms;
+static bool synced;
+
+int timebase_sync(void)
+{
+#if defined(CONFIG_SNTP)
+    struct sntp_time ts;
+    int64_t uptime = k_uptime_get();
+
+    int ret = sntp_simple(SNTP_SERVER, SNTP_TIMEOUT_MS, &ts);
+    if (ret < 0) {
+        LOG_WRN("SNTP query failed: %d", ret);
+        return ret;
+    }
+
+    /* Attribute the server time to the middle of the exchange */
+    uptime = (uptime + k_uptime_get()) / 2;
+
+    int64_t unix_ms = (int64_t)ts.seconds * 1000 + (((uint64_t)ts.fraction * 1000U) >> 32);
+
+    unix_offset_ms = unix_ms - uptime;
+    synced = true;
+    LOG_INF("Time synced (offset %lld ms)", (long long)unix_offset_ms);
+    return 0;
+#elif defined(CONFIG_APP_SIM)
+    unix_offset_ms = SIM_EPOCH_MS;
+    synced = true;
+    return 0;
+#else
+    return -ENOTSUP;
+#endif
+}
+
+bool timebase_synced(void)
+{
+    return synced;
+}
+
+int64_t timebase_to_unix_ms(int64_t uptime_ms)
+{
+    return synced ? uptime_ms + unix_offset_ms : 0;
+}
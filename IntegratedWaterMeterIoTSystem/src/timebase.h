@@ -0,0 +1,34 @@
+/**
+ * @file timebase.h
+ * @brief Wall-clock time for timestamped telemetry
+ *
+ * @details
+ * The device only keeps uptime. After an SNTP query the offset to Unix time
+ * is stored, so samples taken at a known uptime can be sent with their real
+ * timestamp ("ts" in the ThingsBoard telemetry format).
+ */
+
+#ifndef TIMEBASE_H_
+#define TIMEBASE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Query the time server and update the uptime-to-Unix offset
+ *
+ * @return 0 on success, negative errno from SNTP, -ENOTSUP without SNTP
+ */
+int timebase_sync(void);
+
+/** @brief True once a sync has succeeded */
+bool timebase_synced(void);
+
+/**
+ * @brief Convert an uptime (k_uptime_get()) to Unix time in ms
+ *
+ * @return Unix time in ms, or 0 if the clock was never synced
+ */
+int64_t timebase_to_unix_ms(int64_t uptime_ms);
+
+#endif /* TIMEBASE_H_ */